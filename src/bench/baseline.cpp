@@ -0,0 +1,267 @@
+/*
+ * External baseline for spm_project: zlib's Huffman-only deflate (Z_HUFFMAN_ONLY, no string matching, the
+ * closest off-the-shelf equivalent of a pure Huffman coder) against the seq, map and ff backends, on the
+ * same input. For every coder it reports the compression ratio and the compress and decompress throughput
+ * side by side, as the median of reps runs.
+ * zlib runs in this process, on the input already in memory. spm_project runs as a separate process in a
+ * scratch directory, as spm_bench does: compression is time_total_no_rw of its benchmark.csv row (reading
+ * the input and writing the archive excluded), decompression the time reported by `spm_project decode`,
+ * which includes mapping the archive and writing the output file, so it is on the conservative side.
+ * Every round trip is checked against the input.
+ *
+ * usage: spm_baseline <input_file> [--exec=seq,map,ff] [--threads=4] [--reps=3] [--level=6]
+ *                     [--binary=./build/spm_project] [--out=baseline] [-- extra spm_project options]
+ *
+ * Output: <out>.csv, one row per coder:
+ *   coder,n_threads,raw_size,comp_size,ratio,compress_us,decompress_us,compress_mbs,decompress_mbs
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#define ZLIB_CHUNK (1UL << 30)
+
+using namespace std;
+
+struct baseline_t {
+    string coder;
+    unsigned n_threads;
+    uint64_t comp_size;
+    double compress_us;     // medians
+    double decompress_us;
+};
+
+static vector<string> split(const string &s, char sep) {
+    vector<string> out;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+static double median(vector<double> v) {
+    sort(v.begin(), v.end());
+    auto n = v.size();
+    return n == 0 ? 0 : n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static double elapsed_us(chrono::steady_clock::time_point since) {
+    return (double) chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+}
+
+static string read_all(const string &filename) {
+    ifstream in(filename, ios::binary);
+    if (!in.is_open()) {
+        cerr << "Could not open file: " << filename << endl;
+        exit(1);
+    }
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+/* avail_in and avail_out are 32 bits: hand the buffers to zlib ZLIB_CHUNK bytes at a time */
+static void refill(z_stream &zs, uint64_t in_size, uint64_t out_size) {
+    zs.avail_in = (uInt) min<uint64_t>(in_size - zs.total_in, ZLIB_CHUNK);
+    zs.avail_out = (uInt) min<uint64_t>(out_size - zs.total_out, ZLIB_CHUNK);
+}
+
+/** zlib deflate with Z_HUFFMAN_ONLY and inflate, in memory. */
+static baseline_t run_zlib(const string &seq, int level, int reps) {
+    vector<double> times_compress, times_decompress;
+    string comp, decoded;
+    for (int r = 0; r < reps; r++) {
+        auto start = chrono::steady_clock::now();
+        z_stream zs{};
+        if (deflateInit2(&zs, level, Z_DEFLATED, 15, 8, Z_HUFFMAN_ONLY) != Z_OK) {
+            cerr << "deflateInit2 failed" << endl;
+            exit(1);
+        }
+        comp.resize(deflateBound(&zs, seq.size()));
+        zs.next_in = (Bytef *) seq.data();
+        zs.next_out = (Bytef *) &comp[0];
+        int ret;
+        do {
+            refill(zs, seq.size(), comp.size());
+            ret = deflate(&zs, zs.total_in + zs.avail_in == seq.size() ? Z_FINISH : Z_NO_FLUSH);
+        } while (ret == Z_OK);
+        if (ret != Z_STREAM_END) {
+            cerr << "deflate failed" << endl;
+            exit(1);
+        }
+        comp.resize(zs.total_out);
+        deflateEnd(&zs);
+        times_compress.push_back(elapsed_us(start));
+
+        start = chrono::steady_clock::now();
+        zs = z_stream{};
+        if (inflateInit2(&zs, 15) != Z_OK) {
+            cerr << "inflateInit2 failed" << endl;
+            exit(1);
+        }
+        decoded.resize(seq.size());
+        zs.next_in = (Bytef *) comp.data();
+        zs.next_out = (Bytef *) &decoded[0];
+        do {
+            refill(zs, comp.size(), decoded.size());
+            ret = inflate(&zs, Z_NO_FLUSH);
+        } while (ret == Z_OK);
+        inflateEnd(&zs);
+        times_decompress.push_back(elapsed_us(start));
+        if (ret != Z_STREAM_END || zs.total_out != seq.size() || decoded != seq) {
+            cerr << "zlib round trip failed" << endl;
+            exit(1);
+        }
+    }
+    return {"zlib-huff", 1, comp.size(), median(times_compress), median(times_decompress)};
+}
+
+/** Runs binary with args in workdir, its output captured in run.log; exits on failure. */
+static void run_process(const vector<string> &args, const string &workdir) {
+    auto pid = fork();
+    if (pid == 0) {
+        if (chdir(workdir.c_str()) != 0) _exit(127);
+        auto log = open("run.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        vector<char *> argv;
+        for (auto &a: args) argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(args[0].c_str(), argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cerr << "run failed: " << args[args.size() > 5 ? 5 : 1] << ", see " << workdir << "/run.log" << endl;
+        exit(1);
+    }
+}
+
+/** One backend of spm_project: compress, then decode the archive back and check it. */
+static baseline_t run_spm(const string &binary, const string &input, const string &seq, const string &exec,
+                          unsigned n_threads, const vector<string> &extra, int reps, const string &workdir) {
+    vector<double> times_compress, times_decompress;
+    uint64_t comp_size = 0;
+    auto csv = workdir + "/benchmark.csv";
+    for (int r = 0; r < reps; r++) {
+        unlink(csv.c_str());
+        vector<string> args = {binary, input, to_string(n_threads), "0", to_string(n_threads), exec};
+        args.insert(args.end(), extra.begin(), extra.end());
+        run_process(args, workdir);
+
+        ifstream in(csv);
+        string header, row;
+        if (!getline(in, header) || !getline(in, row)) {
+            cerr << "no benchmark row: " << exec << endl;
+            exit(1);
+        }
+        map<string, string> values;
+        auto names = split(header, ',');
+        auto fields = split(row, ',');
+        for (size_t i = 0; i < names.size() && i < fields.size(); i++) values[names[i]] = fields[i];
+        times_compress.push_back(strtod(values["time_total_no_rw"].c_str(), nullptr));
+        comp_size = strtoull(values["comp_size"].c_str(), nullptr, 10);
+
+        run_process({binary, "decode", "output.bin", "decoded.bin", to_string(n_threads)}, workdir);
+        // "<bytes> bytes decoded in <usec> usec (...)"
+        auto log = read_all(workdir + "/run.log");
+        auto at = log.find(" bytes decoded in ");
+        if (at == string::npos) {
+            cerr << "no decode time: " << exec << endl;
+            exit(1);
+        }
+        times_decompress.push_back(strtod(log.c_str() + at + 18, nullptr));
+        if (read_all(workdir + "/decoded.bin") != seq) {
+            cerr << exec << " round trip failed" << endl;
+            exit(1);
+        }
+    }
+    return {exec, n_threads, comp_size, median(times_compress), median(times_decompress)};
+}
+
+static double mbs(uint64_t bytes, double usec) {
+    return usec > 0 ? (double) bytes / usec : 0;    // bytes per usec = MB/s
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <input_file> [--exec=seq,map,ff] [--threads=4] [--reps=3] [--level=6]"
+             << " [--binary=./build/spm_project] [--out=baseline] [-- extra spm_project options]" << endl;
+        return 1;
+    }
+
+    map<string, string> options = {{"exec", "seq,map,ff"}, {"threads", "4"}, {"reps", "3"}, {"level", "6"},
+                                   {"binary", "./build/spm_project"}, {"out", "baseline"}};
+    vector<string> extra;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--") {
+            extra.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        if (arg.rfind("--", 0) != 0) continue;
+        auto eq = arg.find('=');
+        if (eq == string::npos) options[arg.substr(2)] = "1";
+        else options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+
+    char path[PATH_MAX];
+    if (!realpath(argv[1], path)) {
+        cerr << "Could not open file: " << argv[1] << endl;
+        return 1;
+    }
+    string input = path;
+    if (!realpath(options["binary"].c_str(), path)) {
+        cerr << "spm_project binary not found: " << options["binary"] << endl;
+        return 1;
+    }
+    string binary = path;
+    auto reps = max(1, stoi(options["reps"]));
+    auto n_threads = (unsigned) max(1, stoi(options["threads"]));
+    auto seq = read_all(input);
+
+    char tmpl[] = "/tmp/spm_baseline.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        cerr << "Could not create a scratch directory" << endl;
+        return 1;
+    }
+    string workdir = tmpl;
+
+    vector<baseline_t> results;
+    results.push_back(run_zlib(seq, stoi(options["level"]), reps));
+    for (auto &exec: split(options["exec"], ','))
+        results.push_back(run_spm(binary, input, seq, exec, exec == "seq" ? 1 : n_threads, extra, reps, workdir));
+
+    ofstream csv(options["out"] + ".csv");
+    csv << "coder,n_threads,raw_size,comp_size,ratio,compress_us,decompress_us,compress_mbs,decompress_mbs\n";
+    cout << setw(10) << "coder" << setw(9) << "threads" << setw(10) << "ratio" << setw(15) << "compress MB/s"
+         << setw(17) << "decompress MB/s" << endl;
+    for (auto &r: results) {
+        auto ratio = seq.empty() ? 0 : (double) r.comp_size / (double) seq.size();
+        cout << setw(10) << r.coder << setw(9) << r.n_threads << setw(10) << fixed << setprecision(4) << ratio
+             << setw(15) << setprecision(1) << mbs(seq.size(), r.compress_us)
+             << setw(17) << mbs(seq.size(), r.decompress_us) << endl;
+        csv << r.coder << "," << r.n_threads << "," << seq.size() << "," << r.comp_size << "," << ratio << ","
+            << r.compress_us << "," << r.decompress_us << "," << mbs(seq.size(), r.compress_us) << ","
+            << mbs(seq.size(), r.decompress_us) << "\n";
+    }
+
+    for (auto name: {"benchmark.csv", "output.bin", "decoded.bin", "run.log"}) unlink((workdir + "/" + name).c_str());
+    rmdir(workdir.c_str());
+
+    cout << "results: " << options["out"] << ".csv" << endl;
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Scaling-study driver for spm_project.
+ * Every configuration runs as a separate spm_project process in a scratch directory, so each run
+ * starts from a fresh heap and its benchmark.csv row and output.bin never mix with other runs.
+ * Each configuration gets `warmup` discarded runs followed by `reps` measured ones, optionally
+ * dropping the input from the page cache before every run. Per phase it reports median, mean,
+ * stddev and the 95% confidence interval of the mean. Against the sequential baseline it reports
+ * speedup, efficiency and the Karp-Flatt serial fraction.
+ *
+ * usage: spm_bench <input_file> [--exec=map,pf,ff] [--threads=1,2,4,8] [--reducers=0] [--reps=5]
+ *                  [--warmup=1] [--drop-caches] [--binary=./build/spm_project] [--out=bench]
+ *                  [-- extra spm_project options]
+ *
+ * Outputs:
+ *   <out>-runs.csv     every measured run, one row per run (raw data)
+ *   <out>.csv          one row per configuration and phase, with the statistics
+ *   <out>-scaling.dat  gnuplot blocks (one per exec type): threads, speedup, efficiency and
+ *                      serial fraction of the total time, median and CI of the total time
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// phases read from the benchmark.csv row; "load" is read + freqs, comparable across read modes
+static const vector<string> PHASES = {"time_read", "time_freqs", "time_reduce", "load", "time_tree_codes",
+                                      "time_encode", "time_write", "time_total_no_rw", "time_total_rw"};
+
+struct config_t {
+    string exec;
+    unsigned n_threads;     // mappers and encoders
+    unsigned n_reducers;
+};
+
+struct summary_t {
+    double median, mean, stddev, ci_lo, ci_hi;
+};
+
+static vector<string> split(const string &s, char sep) {
+    vector<string> out;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, sep)) out.push_back(item);
+    return out;
+}
+
+/** Two-sided 95% Student t quantile for df degrees of freedom. */
+static double t_quantile(size_t df) {
+    static const double table[] = {0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df == 0) return 0;
+    return df <= 30 ? table[df] : 1.96;
+}
+
+static summary_t summarize(vector<double> v) {
+    summary_t s{};
+    if (v.empty()) return s;
+    sort(v.begin(), v.end());
+    auto n = v.size();
+    s.median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    for (auto x: v) s.mean += x;
+    s.mean /= (double) n;
+    for (auto x: v) s.stddev += (x - s.mean) * (x - s.mean);
+    s.stddev = n > 1 ? sqrt(s.stddev / (double) (n - 1)) : 0;
+    auto half = t_quantile(n - 1) * s.stddev / sqrt((double) n);
+    s.ci_lo = s.mean - half;
+    s.ci_hi = s.mean + half;
+    return s;
+}
+
+/** Evicts the input from the page cache: fadvise always, the global drop_caches when running as root. */
+static void drop_caches(const string &input) {
+    sync();
+    int fd = open(input.c_str(), O_RDONLY);
+    if (fd >= 0) {
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        close(fd);
+    }
+    ofstream drop("/proc/sys/vm/drop_caches");
+    if (drop.is_open()) drop << "3" << endl;
+}
+
+/**
+ * Runs spm_project once in workdir and returns its benchmark.csv row, keyed by column name.
+ * Exits on failure: a broken configuration would make every statistic meaningless.
+ */
+static map<string, double> run_once(const string &binary, const string &input, const config_t &c,
+                                    const vector<string> &extra, const string &workdir) {
+    auto csv = workdir + "/benchmark.csv";
+    unlink(csv.c_str());
+
+    vector<string> args = {binary, input, to_string(c.n_threads), to_string(c.n_reducers),
+                           to_string(c.n_threads), c.exec};
+    args.insert(args.end(), extra.begin(), extra.end());
+
+    auto pid = fork();
+    if (pid == 0) {
+        if (chdir(workdir.c_str()) != 0) _exit(127);
+        auto log = open("run.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        vector<char *> argv;
+        for (auto &a: args) argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    ifstream in(csv);
+    string header, row;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !getline(in, header) || !getline(in, row)) {
+        cerr << "run failed: " << c.exec << " " << c.n_threads << " threads, see " << workdir << "/run.log" << endl;
+        exit(1);
+    }
+
+    map<string, double> values;
+    auto names = split(header, ',');
+    auto fields = split(row, ',');
+    for (size_t i = 0; i < names.size() && i < fields.size(); i++) values[names[i]] = strtod(fields[i].c_str(), nullptr);
+    values["load"] = values["time_read"] + values["time_freqs"];
+    return values;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <input_file> [--exec=map,pf,ff] [--threads=1,2,4,8] [--reducers=0]"
+             << " [--reps=5] [--warmup=1] [--drop-caches] [--binary=./build/spm_project] [--out=bench]"
+             << " [-- extra spm_project options]" << endl;
+        return 1;
+    }
+
+    map<string, string> options = {{"exec", "map,pf,ff"}, {"threads", "1,2,4,8"}, {"reducers", "0"}, {"reps", "5"},
+                                   {"warmup", "1"}, {"binary", "./build/spm_project"}, {"out", "bench"}};
+    vector<string> extra;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--") {
+            extra.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        if (arg.rfind("--", 0) != 0) continue;
+        auto eq = arg.find('=');
+        if (eq == string::npos) options[arg.substr(2)] = "1";
+        else options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+
+    char path[PATH_MAX];
+    if (!realpath(argv[1], path)) {
+        cerr << "Could not open file: " << argv[1] << endl;
+        return 1;
+    }
+    string input = path;
+    if (!realpath(options["binary"].c_str(), path)) {
+        cerr << "spm_project binary not found: " << options["binary"] << endl;
+        return 1;
+    }
+    string binary = path;
+    auto reps = max(1, stoi(options["reps"]));
+    auto warmup = max(0, stoi(options["warmup"]));
+    auto drop = options.count("drop-caches") > 0;
+    auto out = options["out"];
+
+    char tmpl[] = "/tmp/spm_bench.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        cerr << "Could not create a scratch directory" << endl;
+        return 1;
+    }
+    string workdir = tmpl;
+
+    // the sequential baseline comes first: every speedup is relative to it
+    vector<config_t> configs = {{"seq", 1, 0}};
+    for (auto &exec: split(options["exec"], ','))
+        for (auto &threads: split(options["threads"], ','))
+            for (auto &reducers: split(options["reducers"], ',')) {
+                // only the map backend has reducers
+                if (exec != "map" && reducers != split(options["reducers"], ',')[0]) continue;
+                configs.push_back({exec, (unsigned) stoul(threads), exec == "map" ? (unsigned) stoul(reducers) : 0});
+            }
+
+    ofstream runs_file(out + "-runs.csv");
+    runs_file << "exec,n_threads,n_reducers,rep";
+    for (auto &phase: PHASES) runs_file << "," << phase;
+    runs_file << "\n";
+
+    ofstream stats_file(out + ".csv");
+    stats_file << "exec,n_threads,n_reducers,phase,reps,median_us,mean_us,stddev_us,ci95_lo_us,ci95_hi_us,"
+                  "speedup,efficiency,serial_fraction\n";
+
+    map<string, double> baseline;                         // median of the sequential run, per phase
+    map<string, vector<pair<config_t, summary_t>>> scaling;   // total time, per exec type
+    map<string, vector<double>> scaling_speedup;
+
+    for (auto &c: configs) {
+        cout << c.exec << " threads=" << c.n_threads << " reducers=" << c.n_reducers << " " << flush;
+        for (int i = 0; i < warmup; i++) {
+            if (drop) drop_caches(input);
+            run_once(binary, input, c, extra, workdir);
+        }
+
+        map<string, vector<double>> samples;
+        for (int r = 0; r < reps; r++) {
+            if (drop) drop_caches(input);
+            auto values = run_once(binary, input, c, extra, workdir);
+            runs_file << c.exec << "," << c.n_threads << "," << c.n_reducers << "," << r;
+            for (auto &phase: PHASES) {
+                samples[phase].push_back(values[phase]);
+                runs_file << "," << values[phase];
+            }
+            runs_file << "\n";
+            cout << "." << flush;
+        }
+
+        for (auto &phase: PHASES) {
+            auto s = summarize(samples[phase]);
+            if (c.exec == "seq") baseline[phase] = s.median;
+
+            // speedup on medians; Karp-Flatt e = (1/S - 1/p) / (1 - 1/p) is undefined for p = 1
+            double p = c.n_threads;
+            double speedup = s.median > 0 ? baseline[phase] / s.median : 0;
+            double efficiency = speedup / p;
+            stats_file << c.exec << "," << c.n_threads << "," << c.n_reducers << "," << phase << "," << reps << ","
+                       << s.median << "," << s.mean << "," << s.stddev << "," << s.ci_lo << "," << s.ci_hi << ","
+                       << speedup << "," << efficiency << ",";
+            if (p > 1 && speedup > 0) stats_file << (1 / speedup - 1 / p) / (1 - 1 / p);
+            stats_file << "\n";
+
+            if (phase == "time_total_rw" && c.exec != "seq") {
+                auto key = c.exec + (c.n_reducers > 0 ? "-" + to_string(c.n_reducers) : "");
+                scaling[key].emplace_back(c, s);
+                scaling_speedup[key].push_back(speedup);
+            }
+        }
+        cout << " median total " << summarize(samples["time_total_rw"]).median << " us" << endl;
+    }
+
+    // one gnuplot data block per exec type, selected with `index "<name>"`
+    ofstream plot_file(out + "-scaling.dat");
+    for (auto &it: scaling) {
+        plot_file << "# " << it.first << "\n";
+        plot_file << "# threads speedup efficiency serial_fraction median_us ci95_lo_us ci95_hi_us\n";
+        for (size_t i = 0; i < it.second.size(); i++) {
+            auto &c = it.second[i].first;
+            auto &s = it.second[i].second;
+            double p = c.n_threads;
+            auto speedup = scaling_speedup[it.first][i];
+            plot_file << c.n_threads << " " << speedup << " " << speedup / p << " ";
+            // NaN is a missing point for gnuplot
+            if (p > 1 && speedup > 0) plot_file << (1 / speedup - 1 / p) / (1 - 1 / p);
+            else plot_file << "NaN";
+            plot_file << " " << s.median << " " << s.ci_lo << " " << s.ci_hi << "\n";
+        }
+        plot_file << "\n\n";
+    }
+
+    unlink((workdir + "/benchmark.csv").c_str());
+    unlink((workdir + "/output.bin").c_str());
+    unlink((workdir + "/run.log").c_str());
+    rmdir(workdir.c_str());
+
+    cout << "results: " << out << ".csv, " << out << "-runs.csv, " << out << "-scaling.dat" << endl;
+    return 0;
+}
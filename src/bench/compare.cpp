@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "compare.h"
+#include "../sequential/HuffmanSequential.h"
+#include "../thread/HuffmanThread.h"
+#include "../fastflow/HuffmanFarm.h"
+#include "../fastflow/HuffmanParFor.h"
+#include "../utils/huffman-commons.h"
+
+using namespace std;
+
+// reduce, the merge of the partial histograms, is part of freqs and not added to the total
+static const vector<string> PHASES = {"freqs", "reduce", "tree_codes", "encode", "total"};
+
+struct compare_config_t {
+    string exec;
+    unsigned n_threads;
+};
+
+static vector<string> split(const string &s, char sep) {
+    vector<string> out;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, sep))
+        if (!item.empty()) out.push_back(item);
+    return out;
+}
+
+/** One run of a backend on the shared input; a fresh backend every time, as a process would get. */
+static archive_t compress_with(const compare_config_t &c, string &input, const run_options_t &options,
+                               phase_times_t &times) {
+    if (c.exec == "seq") {
+        HuffmanSequential huffman(string(), options);
+        return huffman.compress(input, times);
+    }
+    if (c.exec == "map") {
+        HuffmanParallel huffman(c.n_threads, c.n_threads, string(), 0, options);
+        return huffman.compress(input, times);
+    }
+    if (c.exec == "ff") {
+        HuffmanMonode huffman(c.n_threads, c.n_threads, string(), options);
+        return huffman.compress(input, times);
+    }
+    if (c.exec == "pf") {
+        HuffmanFastFlow huffman(c.n_threads, 0, c.n_threads, string(), options.block_size, true, options);
+        return huffman.compress(input, times);
+    }
+    throw runtime_error("Invalid execution type for compare: " + c.exec + " (seq, map, ff or pf)");
+}
+
+static double median(vector<double> v) {
+    sort(v.begin(), v.end());
+    auto n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/**
+ * Compares the backends on one input, in one process.
+ * @param filename the input file.
+ * @param execs comma-separated backends among seq, map, ff and pf.
+ * @param threads comma-separated thread counts (mappers and encoders), for every backend but seq.
+ * @param reps measured runs per configuration, the median is reported.
+ * @param warmup discarded runs before them.
+ * @param options the knobs of every run.
+ * @return 0 if every archive is identical to the sequential one, 1 otherwise.
+ */
+int run_compare(const string &filename, const string &execs, const string &threads, unsigned long reps,
+                unsigned long warmup, const run_options_t &options) {
+    auto start = chrono::steady_clock::now();
+    auto input = read_file(filename);
+    auto time_read = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    reps = max(1UL, reps);
+
+    // the sequential reference comes first
+    vector<compare_config_t> configs = {{"seq", 1}};
+    for (auto &exec: split(execs, ','))
+        if (exec != "seq")
+            for (auto &n: split(threads, ',')) configs.push_back({exec, (unsigned) max(1UL, stoul(n))});
+
+    ofstream csv(COMPARE_BENCHMARK_FILE, ios::app);
+    if (csv.tellp() == 0) csv << COMPARE_BENCHMARK_HEADER;
+
+    cout << "Backend comparison, " << input.size() << " bytes loaded once in " << time_read << " usec, median of "
+         << reps << " runs after " << warmup << " warm-up" << endl;
+    cout << setw(6) << "exec" << setw(9) << "threads";
+    for (auto &phase: PHASES) cout << setw(15) << phase + " us";
+    cout << setw(10) << "speedup" << setw(11) << "identical" << endl;
+
+    vector<unsigned char> reference;    // heap memory: it outlives the arenas of every run
+    vector<double> baseline(PHASES.size(), 0);
+    auto all_identical = true;
+    for (auto &c: configs) {
+        vector<vector<double>> samples(PHASES.size());
+        auto identical = true;
+        for (unsigned long r = 0; r < warmup + reps; r++) {
+            phase_times_t times;
+            {
+                auto archive = compress_with(c, input, options, times);
+                bytes_t bytes;
+                serialize_archive(archive, bytes);
+                if (reference.empty()) {
+                    // the reference must itself decode back to the input
+                    if (verify_archive(archive, input, max(1U, thread::hardware_concurrency())) != 0)
+                        throw runtime_error("Sequential archive does not decode to the input");
+                    reference.assign(bytes.begin(), bytes.end());
+                }
+                identical &= equal(bytes.begin(), bytes.end(), reference.begin(), reference.end());
+            }
+            // the archive of the run is gone: its arena memory goes too, every run starts afresh
+            arena_release();
+            if (r < warmup) continue;
+            vector<long> values = {times.time_freqs, times.time_reduce, times.time_tree_codes, times.time_encode,
+                                   times.time_freqs + times.time_tree_codes + times.time_encode};
+            for (size_t p = 0; p < PHASES.size(); p++) samples[p].push_back((double) values[p]);
+        }
+        all_identical &= identical;
+
+        cout << setw(6) << c.exec << setw(9) << c.n_threads << fixed << setprecision(0);
+        for (size_t p = 0; p < PHASES.size(); p++) {
+            auto m = median(samples[p]);
+            if (c.exec == "seq") baseline[p] = m;
+            auto speedup = m > 0 ? baseline[p] / m : 0;
+            cout << setw(15) << m;
+            csv << c.exec << "," << c.n_threads << "," << reps << "," << PHASES[p] << "," << m << ","
+                << *min_element(samples[p].begin(), samples[p].end()) << ","
+                << *max_element(samples[p].begin(), samples[p].end()) << "," << speedup << ","
+                << (identical ? 1 : 0) << "\n";
+        }
+        auto total = median(samples.back());
+        cout << setw(10) << setprecision(2) << (total > 0 ? baseline.back() / total : 0)
+             << setw(11) << (identical ? "yes" : "NO") << endl;
+    }
+    if (!all_identical) cout << "\033[1;31mSome archives differ from the sequential one\033[0m" << endl;
+    return all_identical ? 0 : 1;
+}
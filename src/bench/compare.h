@@ -0,0 +1,27 @@
+#ifndef SPM_PROJECT_COMPARE_H
+#define SPM_PROJECT_COMPARE_H
+
+#include <string>
+
+#include "../utils/huffman-format.h"
+
+#define COMPARE_BENCHMARK_FILE "./compare.csv"
+#define COMPARE_BENCHMARK_HEADER "exec,n_threads,reps,phase,median_us,min_us,max_us,speedup,identical\n"
+#define COMPARE_REPS 5
+#define COMPARE_WARMUP 1
+
+using namespace std;
+
+/*
+ * In-process comparison of the backends: the input is read once, and every backend and thread count runs
+ * back to back on that same buffer (compress() of each backend: no file is read or written during the
+ * runs), warmup discarded runs then reps measured ones. seq runs first: every archive is checked to be
+ * byte-identical to its archive, which is decoded back and checked against the input once, and speedups
+ * are relative to its medians. pf runs with its grain set to the block size, so that its archives are
+ * comparable. Per configuration and phase (freqs, tree_codes, encode, total) the median, min and max are
+ * printed and appended to COMPARE_BENCHMARK_FILE.
+ */
+int run_compare(const string &filename, const string &execs, const string &threads, unsigned long reps,
+                unsigned long warmup, const run_options_t &options);
+
+#endif //SPM_PROJECT_COMPARE_H
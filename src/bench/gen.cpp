@@ -0,0 +1,388 @@
+/*
+ * Synthetic workload generator: deterministic, seeded datasets for the benchmarks.
+ * The file is generated in units of GEN_UNIT bytes (one region for `mixed`), each from its own
+ * generator seeded with (seed, unit index), so the output depends only on the seed and the size,
+ * never on the number of threads. Units are generated in parallel and pwritten in place.
+ *
+ * Kinds (every symbol is drawn i.i.d. from the model distribution, except bigram):
+ *   uniform   all 256 byte values, 8 bits/symbol
+ *   zipf      text alphabet of --alphabet symbols with Zipf(--zipf) rank frequencies
+ *   dna       ACGT with skewed probabilities, about 1.9 bits/symbol
+ *   runs      one dominant symbol (p = --dominant) and rare others: long single-symbol runs
+ *   bigram    order-1 Markov text, built-in English-like model or learned from --train=<file>
+ *   mixed     --region sized regions cycling bigram, uniform, dna, runs
+ *   all       every kind above, written to <output>-<kind>.bin (the workload matrix)
+ *
+ * Next to each dataset a <output>.json records its parameters, the model's order-0 entropy (what
+ * a Huffman coder sees), the entropy rate for bigram and the entropy measured on the output.
+ *
+ * usage: spm_gen <output> <size[K|M|G]> <kind> [--seed=1] [--threads=hw] [--alphabet=64] [--zipf=1.0]
+ *                [--dominant=0.99] [--region=1M] [--train=<file>]
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define GEN_UNIT (4UL << 20)
+
+typedef array<double, 256> dist_t;
+
+/** splitmix64: tiny, fast and bit-exact on every platform, unlike the std distributions. */
+struct rng_t {
+    uint64_t state;
+
+    explicit rng_t(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+/** Walker/Vose alias table: O(1) sampling from a discrete distribution. */
+struct alias_t {
+    vector<uint32_t> threshold;
+    vector<unsigned char> symbol, alias;
+
+    alias_t() = default;
+
+    explicit alias_t(const dist_t &dist) {
+        for (int c = 0; c < 256; c++) if (dist[c] > 0) symbol.push_back((unsigned char) c);
+        auto n = symbol.size();
+        double total = 0;
+        for (auto c: symbol) total += dist[c];
+
+        vector<double> scaled(n);
+        vector<size_t> small, large;
+        for (size_t i = 0; i < n; i++) {
+            scaled[i] = dist[symbol[i]] / total * (double) n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        threshold.assign(n, UINT32_MAX);
+        alias.assign(symbol.begin(), symbol.end());
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back(), l = large.back();
+            small.pop_back();
+            threshold[s] = (uint32_t) (scaled[s] * 4294967295.0);
+            alias[s] = symbol[l];
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+    }
+
+    unsigned char sample(rng_t &rng) const {
+        auto r = rng.next();
+        auto i = (size_t) (((r >> 32) * symbol.size()) >> 32);
+        return (uint32_t) r <= threshold[i] ? symbol[i] : alias[i];
+    }
+};
+
+static double entropy(const dist_t &dist) {
+    double total = 0, h = 0;
+    for (auto p: dist) total += p;
+    for (auto p: dist) if (p > 0) h -= p / total * log2(p / total);
+    return h;
+}
+
+static uint64_t parse_size(const string &s) {
+    auto v = stoull(s);
+    switch (s.empty() ? 0 : toupper(s.back())) {
+        case 'K': return v << 10;
+        case 'M': return v << 20;
+        case 'G': return v << 30;
+        default: return v;
+    }
+}
+
+/* ------------------------------------------------------------------ models */
+
+// printable symbols ordered roughly by frequency in English text
+static const string TEXT_SYMBOLS =
+        " etaoinshrdlcumwfgypbvkjxqzETAOINSHRDLCUMWFGYPBVKJXQZ.,;:'\"!?-()0123456789\n/[]{}<>_=+*&%$#@~^|`\\";
+
+// letter frequencies of English, per mille, a..z
+static const double ENGLISH[26] = {82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+                                   67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1};
+
+struct model_t {
+    dist_t dist{};                      // order-0 distribution (stationary one for bigram)
+    alias_t sampler;
+    array<alias_t, 256> transitions;    // bigram only: next symbol given the previous one
+    double rate = 0;                    // entropy rate, bits/symbol
+    bool markov = false;
+};
+
+static model_t iid_model(const dist_t &dist) {
+    model_t m;
+    m.dist = dist;
+    m.sampler = alias_t(dist);
+    m.rate = entropy(dist);
+    return m;
+}
+
+static model_t uniform_model() {
+    dist_t dist;
+    dist.fill(1);
+    return iid_model(dist);
+}
+
+static model_t zipf_model(unsigned alphabet, double s) {
+    dist_t dist{};
+    alphabet = max(1U, min<unsigned>(alphabet, TEXT_SYMBOLS.size()));
+    for (unsigned r = 0; r < alphabet; r++) dist[(unsigned char) TEXT_SYMBOLS[r]] = 1 / pow(r + 1, s);
+    return iid_model(dist);
+}
+
+static model_t dna_model() {
+    dist_t dist{};
+    dist['A'] = 0.35;
+    dist['T'] = 0.30;
+    dist['C'] = 0.20;
+    dist['G'] = 0.15;
+    return iid_model(dist);
+}
+
+static model_t runs_model(double dominant) {
+    dist_t dist{};
+    dominant = min(max(dominant, 0.0), 1.0);
+    for (auto c: TEXT_SYMBOLS) dist[(unsigned char) c] = (1 - dominant) / (double) (TEXT_SYMBOLS.size() - 1);
+    dist['a'] = dominant;
+    return iid_model(dist);
+}
+
+/** Builds the Markov model from a bigram count matrix; the stationary distribution by power iteration. */
+static model_t bigram_model(const vector<dist_t> &counts) {
+    model_t m;
+    m.markov = true;
+    vector<dist_t> p(256, dist_t{});
+    vector<bool> has_next(256, false);
+    for (int a = 0; a < 256; a++) {
+        double total = 0;
+        for (auto v: counts[a]) total += v;
+        if (total == 0) continue;
+        has_next[a] = true;
+        for (int b = 0; b < 256; b++) p[a][b] = counts[a][b] / total;
+        m.transitions[a] = alias_t(counts[a]);
+    }
+
+    dist_t pi{}, next{};
+    int live = 0;
+    for (int a = 0; a < 256; a++) live += has_next[a];
+    for (int a = 0; a < 256; a++) pi[a] = has_next[a] ? 1.0 / live : 0;
+    for (int it = 0; it < 1000; it++) {
+        next.fill(0);
+        for (int a = 0; a < 256; a++) if (pi[a] > 0) for (int b = 0; b < 256; b++) next[b] += pi[a] * p[a][b];
+        pi = next;
+    }
+
+    m.dist = pi;
+    m.sampler = alias_t(pi);
+    for (int a = 0; a < 256; a++) if (pi[a] > 0) m.rate += pi[a] * entropy(p[a]);
+    return m;
+}
+
+/** English-like letters and spaces: alternating vowels and consonants are preferred, no double spaces. */
+static model_t english_bigram_model() {
+    vector<dist_t> counts(256, dist_t{});
+    auto vowel = [](char c) { return strchr("aeiou", c) != nullptr; };
+    for (char a = 'a'; a <= 'z'; a++) {
+        for (char b = 'a'; b <= 'z'; b++)
+            counts[a][b] = ENGLISH[b - 'a'] * (vowel(a) != vowel(b) ? 3 : 1) * (a == b ? 0.3 : 1);
+        counts[a][' '] = 400;                   // about one word every 5 letters
+        counts[' '][a] = ENGLISH[a - 'a'];
+    }
+    counts['t'][' '] = 300;
+    counts['e'][' '] = 700;
+    counts['s'][' '] = 600;
+    return bigram_model(counts);
+}
+
+static model_t trained_bigram_model(const string &filename) {
+    ifstream in(filename, ios::binary);
+    if (!in.is_open()) throw runtime_error("Could not open file: " + filename);
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (text.size() < 2) throw runtime_error("Training file too small: " + filename);
+    vector<dist_t> counts(256, dist_t{});
+    for (size_t i = 1; i < text.size(); i++) counts[(unsigned char) text[i - 1]][(unsigned char) text[i]]++;
+    // the last symbol may have no successor: let it restart the text
+    counts[(unsigned char) text.back()][(unsigned char) text[0]]++;
+    return bigram_model(counts);
+}
+
+/* -------------------------------------------------------------- generation */
+
+static void generate(const model_t &m, rng_t &rng, unsigned char *out, size_t n) {
+    if (m.markov) {
+        auto prev = m.sampler.sample(rng);
+        for (size_t i = 0; i < n; i++) prev = out[i] = m.transitions[prev].sample(rng);
+    } else if (m.sampler.symbol.size() == 256 && m.rate > 7.999999) {
+        // uniform bytes: eight per draw
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            auto r = rng.next();
+            memcpy(out + i, &r, 8);
+        }
+        for (; i < n; i++) out[i] = (unsigned char) rng.next();
+    } else {
+        for (size_t i = 0; i < n; i++) out[i] = m.sampler.sample(rng);
+    }
+}
+
+struct dataset_t {
+    string kind;
+    vector<const model_t *> models;     // models[unit % size] generates a unit
+    vector<string> model_names;
+    uint64_t unit;
+};
+
+static int write_dataset(const string &filename, uint64_t size, const dataset_t &d, uint64_t seed,
+                         unsigned n_threads, const map<string, string> &params) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t) size) != 0) {
+        cerr << "Could not create file: " << filename << endl;
+        return 1;
+    }
+
+    auto n_units = (size + d.unit - 1) / d.unit;
+    atomic<uint64_t> next_unit{0};
+    atomic<bool> failed{false};
+    vector<array<uint64_t, 256>> partial_counts(n_threads, array<uint64_t, 256>{});
+
+    auto worker = [&](size_t tid) {
+        vector<unsigned char> buffer(d.unit);
+        for (auto u = next_unit++; u < n_units; u = next_unit++) {
+            auto offset = u * d.unit;
+            auto n = min<uint64_t>(d.unit, size - offset);
+            rng_t rng(seed * 0x100000001b3ULL ^ (u + 1) * 0x9e3779b97f4a7c15ULL);
+            generate(*d.models[u % d.models.size()], rng, buffer.data(), n);
+            for (size_t i = 0; i < n; i++) partial_counts[tid][buffer[i]]++;
+            for (size_t done = 0; done < n;) {
+                auto w = pwrite(fd, buffer.data() + done, n - done, (off_t) (offset + done));
+                if (w <= 0) {
+                    failed = true;
+                    return;
+                }
+                done += w;
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t i = 0; i < n_threads; i++) threads.emplace_back(worker, i);
+    for (auto &t: threads) t.join();
+    close(fd);
+    if (failed) {
+        cerr << "Write failed: " << filename << endl;
+        return 1;
+    }
+
+    // expected order-0 entropy: the models' distributions weighted by the bytes each one produced
+    dist_t mixture{}, measured{};
+    double rate = 0;
+    for (uint64_t u = 0; u < n_units; u++) {
+        auto &m = *d.models[u % d.models.size()];
+        auto bytes = (double) min<uint64_t>(d.unit, size - u * d.unit);
+        double total = 0;
+        for (auto p: m.dist) total += p;
+        for (int c = 0; c < 256; c++) mixture[c] += m.dist[c] / total * bytes;
+        rate += m.rate * bytes / (double) size;
+    }
+    for (auto &partial: partial_counts) for (int c = 0; c < 256; c++) measured[c] += (double) partial[c];
+
+    ofstream meta(filename + ".json");
+    meta << fixed << setprecision(6) << "{\"file\":\"" << filename << "\",\"kind\":\"" << d.kind << "\",\"size\":"
+         << size << ",\"seed\":" << seed;
+    for (auto &it: params) meta << ",\"" << it.first << "\":\"" << it.second << "\"";
+    meta << ",\"regions\":[";
+    for (size_t i = 0; i < d.model_names.size(); i++) meta << (i ? "," : "") << "\"" << d.model_names[i] << "\"";
+    meta << "],\"expected_entropy\":" << entropy(mixture) << ",\"entropy_rate\":" << rate
+         << ",\"measured_entropy\":" << entropy(measured) << "}\n";
+
+    cout << filename << ": " << d.kind << ", " << size << " bytes, seed " << seed << ", expected entropy "
+         << entropy(mixture) << " bits/symbol (measured " << entropy(measured) << ")" << endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "usage: " << argv[0] << " <output> <size[K|M|G]> <uniform|zipf|dna|runs|bigram|mixed|all>"
+             << " [--seed=1] [--threads=hw] [--alphabet=64] [--zipf=1.0] [--dominant=0.99] [--region=1M]"
+             << " [--train=<file>]" << endl;
+        return 1;
+    }
+
+    map<string, string> options = {{"seed", "1"}, {"alphabet", "64"}, {"zipf", "1.0"}, {"dominant", "0.99"},
+                                   {"region", "1M"}};
+    for (int i = 4; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) continue;
+        auto eq = arg.find('=');
+        if (eq == string::npos) options[arg.substr(2)] = "1";
+        else options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+
+    string output = argv[1];
+    auto size = parse_size(argv[2]);
+    string kind = argv[3];
+    auto seed = stoull(options["seed"]);
+    auto n_threads = options.count("threads") ? (unsigned) stoul(options["threads"]) : thread::hardware_concurrency();
+    n_threads = max(1U, n_threads);
+
+    auto uniform = uniform_model();
+    auto zipf = zipf_model(stoul(options["alphabet"]), stod(options["zipf"]));
+    auto dna = dna_model();
+    auto runs = runs_model(stod(options["dominant"]));
+    auto bigram = options.count("train") ? trained_bigram_model(options["train"]) : english_bigram_model();
+
+    map<string, dataset_t> datasets = {
+            {"uniform", {"uniform", {&uniform}, {"uniform"}, GEN_UNIT}},
+            {"zipf",    {"zipf", {&zipf}, {"zipf"}, GEN_UNIT}},
+            {"dna",     {"dna", {&dna}, {"dna"}, GEN_UNIT}},
+            {"runs",    {"runs", {&runs}, {"runs"}, GEN_UNIT}},
+            {"bigram",  {"bigram", {&bigram}, {"bigram"}, GEN_UNIT}},
+            {"mixed",   {"mixed", {&bigram, &uniform, &dna, &runs}, {"bigram", "uniform", "dna", "runs"},
+                         max<uint64_t>(1, parse_size(options["region"]))}},
+    };
+
+    map<string, string> params;
+    if (kind == "zipf" || kind == "all") {
+        params["alphabet"] = options["alphabet"];
+        params["zipf"] = options["zipf"];
+    }
+    if (kind == "runs" || kind == "mixed" || kind == "all") params["dominant"] = options["dominant"];
+    if (kind == "mixed" || kind == "all") params["region"] = options["region"];
+    if (options.count("train")) params["train"] = options["train"];
+
+    if (kind == "all") {
+        for (auto &it: datasets)
+            if (write_dataset(output + "-" + it.first + ".bin", size, it.second, seed, n_threads, params) != 0)
+                return 1;
+        return 0;
+    }
+    if (!datasets.count(kind)) {
+        cerr << "Unknown kind: " << kind << endl;
+        return 1;
+    }
+    return write_dataset(output, size, datasets[kind], seed, n_threads, params);
+}
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "kernels.h"
+#include "../utils/huffman-ans.h"
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-kernels.h"
+
+using namespace std;
+
+struct kernel_result_t {
+    long time_encode;       // median, usec
+    long time_decode;
+    uint64_t comp_bytes;
+};
+
+static long median(vector<long> v) {
+    sort(v.begin(), v.end());
+    auto n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static long elapsed_us(chrono::steady_clock::time_point since) {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+}
+
+/**
+ * Encodes every block of seq, then decodes them all, reps times, checking the round trip each time.
+ * @param encode called as encode(i, data, len, out) for block i, out is cleared before.
+ * @param decode called as decode(i, in, dst, len) with the bytes encode produced for block i.
+ */
+template<typename Encode, typename Decode>
+static kernel_result_t measure(const string &seq, unsigned long reps, Encode encode, Decode decode) {
+    auto n_blocks = block_count(seq.size());
+    vector<bytes_t> blocks(n_blocks);
+    string decoded(seq.size(), '\0');
+    vector<long> times_encode, times_decode;
+
+    for (unsigned long r = 0; r < reps; r++) {
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n_blocks; i++) {
+            auto len = min<uint64_t>(BLOCK_SIZE, seq.size() - i * BLOCK_SIZE);
+            blocks[i].clear();
+            encode(i, seq.data() + i * BLOCK_SIZE, len, blocks[i]);
+        }
+        times_encode.push_back(elapsed_us(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n_blocks; i++) {
+            auto len = min<uint64_t>(BLOCK_SIZE, seq.size() - i * BLOCK_SIZE);
+            decode(i, blocks[i], &decoded[i * BLOCK_SIZE], len);
+        }
+        times_decode.push_back(elapsed_us(start));
+
+        if (decoded != seq) throw runtime_error("Kernel round trip failed");
+    }
+
+    uint64_t comp_bytes = 0;
+    for (auto &block: blocks) comp_bytes += block.size();
+    return {median(times_encode), median(times_decode), comp_bytes};
+}
+
+static double mbs(uint64_t bytes, long usec) {
+    return usec > 0 ? (double) bytes / (double) usec : 0;   // bytes per usec = MB/s
+}
+
+static void report(ofstream &csv, const string &kernel, unsigned n_streams, uint64_t size, unsigned long reps,
+                   const kernel_result_t &result) {
+    auto ratio = size > 0 ? (double) result.comp_bytes / (double) size : 0;
+    cout << setw(10) << kernel << setw(9) << n_streams << setw(14) << fixed << setprecision(1)
+         << mbs(size, result.time_encode) << setw(14) << mbs(size, result.time_decode)
+         << setw(10) << setprecision(4) << ratio << endl;
+    csv << kernel << "," << n_streams << "," << size << "," << reps << "," << result.time_encode << ","
+        << result.time_decode << "," << mbs(size, result.time_encode) << "," << mbs(size, result.time_decode) << ","
+        << ratio << "\n";
+}
+
+/**
+ * Measures the single-thread throughput of the coding kernels on one input.
+ * @param filename the input file.
+ * @param reps measured runs per kernel, the median is reported.
+ * @return 0 on success.
+ */
+int run_kernels(const string &filename, unsigned long reps) {
+    auto seq = read_file(filename);
+    freq_table_t freqs{};
+    count_symbols(seq.data(), seq.size(), freqs);
+    auto tree = generate_huffman_tree(from_freq_table(freqs));
+    auto codes = generate_huffman_codes(tree);
+    auto table = make_code_table(codes);
+    auto decoder = make_decoder(tree);
+
+    ofstream csv(KERNEL_BENCHMARK_FILE, ios::app);
+    if (csv.tellp() == 0) csv << KERNEL_BENCHMARK_HEADER;
+
+    cout << "Kernel throughput, single thread, " << seq.size() << " bytes, median of " << reps << " runs" << endl;
+    cout << setw(10) << "kernel" << setw(9) << "streams" << setw(14) << "encode MB/s" << setw(14) << "decode MB/s"
+         << setw(10) << "ratio" << endl;
+
+    vector<vector<uint64_t>> stream_bits(block_count(seq.size()));
+    for (unsigned n_streams: {1u, 2u, 4u, 8u}) {
+        auto result = measure(seq, reps,
+                              [&](size_t i, const char *data, size_t len, bytes_t &out) {
+                                  encode_streams(data, len, table, n_streams, out, stream_bits[i]);
+                              },
+                              [&](size_t i, const bytes_t &in, char *dst, size_t len) {
+                                  decode_streams(in.data(), stream_bits[i], decoder, dst, len);
+                              });
+        report(csv, "huffman", n_streams, seq.size(), reps, result);
+    }
+
+    // the single-stream coder again, with the two-symbol tables (built once, outside the timings)
+    // and with the kernel specialized for the code lengths, if there is one
+    vector<uint64_t> n_bits(block_count(seq.size()));
+    auto single_stream = [&](const code_table_t &encode_table, const decoder_t &block_decoder) {
+        return measure(seq, reps,
+                       [&](size_t i, const char *data, size_t len, bytes_t &out) {
+                           n_bits[i] = encode_block(data, len, encode_table, out);
+                       },
+                       [&](size_t i, const bytes_t &in, char *dst, size_t len) {
+                           decode_block(in.data(), n_bits[i], block_decoder, dst, len);
+                       });
+    };
+    auto pair_table = make_code_table(codes, true);
+    auto pair_decoder = make_decoder(tree, true);
+    pair_table.kernel = pair_decoder.kernel = KERNEL_GENERIC;
+    report(csv, "pairs", 1, seq.size(), reps, single_stream(pair_table, pair_decoder));
+    if (table.kernel != KERNEL_GENERIC || decoder.kernel != KERNEL_GENERIC)
+        report(csv, kernel_name(table.kernel), 1, seq.size(), reps, single_stream(table, decoder));
+
+    // the tANS coder on the same blocks
+    auto ans_table = make_ans_table(freqs);
+    report(csv, "ans", 1, seq.size(), reps,
+           measure(seq, reps,
+                   [&](size_t i, const char *data, size_t len, bytes_t &out) {
+                       n_bits[i] = ans_encode(data, len, ans_table, out);
+                   },
+                   [&](size_t i, const bytes_t &in, char *dst, size_t len) {
+                       ans_decode(in.data(), n_bits[i], ans_table, dst, len);
+                   }));
+
+    free_codes(codes);
+    free_tree(tree);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef SPM_PROJECT_KERNELS_H
+#define SPM_PROJECT_KERNELS_H
+
+#include <string>
+
+#define KERNEL_BENCHMARK_FILE "./kernels.csv"
+#define KERNEL_BENCHMARK_HEADER "kernel,n_streams,size,reps,time_encode,time_decode,encode_mbs,decode_mbs,ratio\n"
+#define KERNEL_REPS 5
+
+using namespace std;
+
+/*
+ * Single-thread throughput of the block coding kernels, outside of any backend: the input is cut in
+ * BLOCK_SIZE blocks, every block is encoded and decoded on the calling thread and checked against the
+ * original. Times are the median of reps runs, in usec; rows are appended to KERNEL_BENCHMARK_FILE.
+ * Kernels measured:
+ *   huffman   packed-code encoder and table-driven decoder, 1, 2, 4 and 8 interleaved sub-streams
+ *   pairs     the single-stream coder with the two-symbol encode and decode tables
+ *   <kernel>  the single-stream coder with the kernel specialized for the code lengths (huffman-kernels.h),
+ *             when the input has one
+ */
+int run_kernels(const string &filename, unsigned long reps);
+
+#endif //SPM_PROJECT_KERNELS_H
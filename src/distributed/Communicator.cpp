@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Communicator.h"
+#include "../server/protocol.h"
+
+using namespace std;
+
+#define TAG_HELLO 'H'
+#define TAG_REDUCE 'R'
+#define CONNECT_RETRIES 600         // 100 ms apart: a minute for rank 0 to come up
+
+/* ------------------------------------------------------------------- TCP */
+
+static sockaddr_in resolve(const string &host, unsigned port) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr)
+        throw runtime_error("Could not resolve " + host);
+    auto addr = *reinterpret_cast<sockaddr_in *>(res->ai_addr);
+    addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    return addr;
+}
+
+static void no_delay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * Opens a listening socket; port 0 picks a free port, written back to port.
+ */
+int TcpCommunicator::listen_on(const string &host, unsigned &port) {
+    auto addr = resolve(host, port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 128) < 0)
+        throw runtime_error("Could not listen on " + host + ":" + to_string(port));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *) &addr, &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+TcpCommunicator::TcpCommunicator(size_t rank, size_t n_ranks, const string &host, unsigned port, int listen_fd)
+        : Communicator(rank, n_ranks) {
+    if (rank == 0) {
+        this->listen_fd = listen_fd >= 0 ? listen_fd : listen_on(host, port);
+        peers.assign(n_ranks, -1);
+        // ranks connect in any order and introduce themselves
+        for (size_t i = 1; i < n_ranks; i++) {
+            int fd = accept(this->listen_fd, nullptr, nullptr);
+            uint8_t tag;
+            vector<unsigned char> hello;
+            uint64_t peer = 0;
+            if (fd < 0 || !recv_message(fd, tag, hello) || tag != TAG_HELLO || hello.size() != sizeof(peer))
+                throw runtime_error("Bad hello from a distributed rank");
+            memcpy(&peer, hello.data(), sizeof(peer));
+            if (peer == 0 || peer >= n_ranks || peers[peer] >= 0)
+                throw runtime_error("Unexpected rank " + to_string(peer));
+            no_delay(fd);
+            peers[peer] = fd;
+        }
+        return;
+    }
+
+    auto addr = resolve(host, port);
+    for (int attempt = 0; root_fd < 0; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0) {
+            root_fd = fd;
+            break;
+        }
+        close(fd);
+        if (attempt == CONNECT_RETRIES)
+            throw runtime_error("Could not connect to rank 0 at " + host + ":" + to_string(port));
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    no_delay(root_fd);
+    uint64_t me = rank;
+    if (!send_message(root_fd, TAG_HELLO, &me, sizeof(me)))
+        throw runtime_error("Lost connection to rank 0");
+}
+
+TcpCommunicator::~TcpCommunicator() {
+    for (auto fd: peers) if (fd >= 0) close(fd);
+    if (listen_fd >= 0) close(listen_fd);
+    if (root_fd >= 0) close(root_fd);
+}
+
+void TcpCommunicator::all_reduce(vector<uint64_t> &values) {
+    auto bytes = values.size() * sizeof(uint64_t);
+    uint8_t tag;
+
+    if (rank_id != 0) {
+        vector<unsigned char> buffer;
+        if (!send_message(root_fd, TAG_REDUCE, values.data(), bytes) || !recv_message(root_fd, tag, buffer) ||
+            buffer.size() != bytes)
+            throw runtime_error("all_reduce: lost connection to rank 0");
+        memcpy(values.data(), buffer.data(), bytes);
+        return;
+    }
+
+    for (size_t r = 1; r < n_ranks; r++) {
+        vector<unsigned char> buffer;
+        if (!recv_message(peers[r], tag, buffer) || tag != TAG_REDUCE || buffer.size() != bytes)
+            throw runtime_error("all_reduce: bad contribution from rank " + to_string(r));
+        auto contribution = reinterpret_cast<const uint64_t *>(buffer.data());
+        for (size_t i = 0; i < values.size(); i++) values[i] += contribution[i];
+    }
+    for (size_t r = 1; r < n_ranks; r++)
+        if (!send_message(peers[r], TAG_REDUCE, values.data(), bytes))
+            throw runtime_error("all_reduce: lost connection to rank " + to_string(r));
+}
+
+/* ---------------------------------------------------------- shared memory */
+
+void *ShmCommunicator::create_region(size_t n_ranks, size_t capacity, size_t &region_size) {
+    region_size = sizeof(region_t) + n_ranks * (capacity + 1) * sizeof(uint64_t);
+    auto p = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw runtime_error("Could not map the shared region");
+    auto region = static_cast<region_t *>(p);
+    new(&region->arrived) atomic<uint64_t>(0);
+    new(&region->generation) atomic<uint64_t>(0);
+    region->capacity = capacity;
+    return p;
+}
+
+void ShmCommunicator::destroy_region(void *region, size_t region_size) {
+    munmap(region, region_size);
+}
+
+ShmCommunicator::ShmCommunicator(size_t rank, size_t n_ranks, void *region, size_t region_size)
+        : Communicator(rank, n_ranks), region(static_cast<region_t *>(region)), region_size(region_size) {}
+
+uint64_t *ShmCommunicator::slot(size_t rank) const {
+    return region->lengths() + n_ranks + rank * region->capacity;
+}
+
+/** Generation-counting barrier on the shared counters; spins, then yields. */
+void ShmCommunicator::wait_all() {
+    auto generation = region->generation.load(memory_order_acquire);
+    if (region->arrived.fetch_add(1, memory_order_acq_rel) + 1 == n_ranks) {
+        region->arrived.store(0, memory_order_relaxed);
+        region->generation.fetch_add(1, memory_order_release);
+        return;
+    }
+    for (unsigned spins = 0; region->generation.load(memory_order_acquire) == generation; spins++)
+        if (spins > 1000) sched_yield();
+}
+
+void ShmCommunicator::all_reduce(vector<uint64_t> &values) {
+    if (values.size() > region->capacity)
+        throw runtime_error("all_reduce: " + to_string(values.size()) + " values exceed the shared region");
+    region->lengths()[rank_id] = values.size();
+    memcpy(slot(rank_id), values.data(), values.size() * sizeof(uint64_t));
+    wait_all();
+
+    for (size_t r = 0; r < n_ranks; r++) {
+        if (region->lengths()[r] != values.size())
+            throw runtime_error("all_reduce: ranks disagree on the vector size");
+        if (r == rank_id) continue;
+        auto contribution = slot(r);
+        for (size_t i = 0; i < values.size(); i++) values[i] += contribution[i];
+    }
+    // nobody may overwrite a slot before every rank has read it
+    wait_all();
+}
@@ -0,0 +1,93 @@
+#ifndef SPM_PROJECT_COMMUNICATOR_H
+#define SPM_PROJECT_COMMUNICATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Collective operations between the processes of a distributed run.
+ * The only primitive is an element-wise sum of a u64 vector across all ranks: it is the histogram
+ * all-reduce, and with every rank filling only its own slots it is also an all-gather (sizes,
+ * block index). Rank 0 is the coordinator.
+ */
+class Communicator {
+protected:
+    size_t rank_id;
+    size_t n_ranks;
+
+public:
+    Communicator(size_t rank, size_t n_ranks) : rank_id(rank), n_ranks(n_ranks) {}
+    virtual ~Communicator() = default;
+
+    size_t rank() const { return rank_id; }
+    size_t size() const { return n_ranks; }
+
+    /** Replaces values, on every rank, with the element-wise sum of the values of all ranks. */
+    virtual void all_reduce(vector<uint64_t> &values) = 0;
+
+    void barrier() {
+        vector<uint64_t> none;
+        all_reduce(none);
+    }
+};
+
+/**
+ * All-reduce over TCP, star shaped: ranks send their vector to rank 0, which sums and sends back
+ * the result. Works across nodes (ranks must share the byte order) and over loopback.
+ */
+class TcpCommunicator : public Communicator {
+private:
+    int listen_fd = -1;
+    vector<int> peers;      // rank 0: the socket of every other rank, by rank
+    int root_fd = -1;       // other ranks: the socket to rank 0
+
+public:
+    /**
+     * Rank 0 listens on host:port (or takes over listen_fd if it is >= 0) and waits for every
+     * other rank; the others connect to it, retrying until it is up.
+     */
+    TcpCommunicator(size_t rank, size_t n_ranks, const string &host, unsigned port, int listen_fd = -1);
+    ~TcpCommunicator() override;
+
+    void all_reduce(vector<uint64_t> &values) override;
+
+    static int listen_on(const string &host, unsigned &port);
+};
+
+/**
+ * All-reduce through a shared anonymous mapping, for ranks forked on the same node.
+ * The region (one slot of `capacity` values per rank and a barrier) must be created with
+ * create_region() before forking. Ranks write their slot, meet at the barrier, each one sums
+ * all slots, and meet again before the slots can be reused.
+ */
+class ShmCommunicator : public Communicator {
+private:
+    struct region_t {
+        atomic<uint64_t> arrived;
+        atomic<uint64_t> generation;
+        uint64_t capacity;
+
+        // followed by n_ranks lengths, then n_ranks slots of capacity values
+        uint64_t *lengths() { return reinterpret_cast<uint64_t *>(this + 1); }
+    };
+
+    region_t *region;
+    size_t region_size;
+
+    void wait_all();
+    uint64_t *slot(size_t rank) const;
+
+public:
+    ShmCommunicator(size_t rank, size_t n_ranks, void *region, size_t region_size);
+
+    void all_reduce(vector<uint64_t> &values) override;
+
+    static void *create_region(size_t n_ranks, size_t capacity, size_t &region_size);
+    static void destroy_region(void *region, size_t region_size);
+};
+
+#endif //SPM_PROJECT_COMMUNICATOR_H
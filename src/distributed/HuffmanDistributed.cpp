@@ -0,0 +1,313 @@
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "HuffmanDistributed.h"
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-io.h"
+#include "../utils/utimer.cpp"
+
+using namespace std;
+
+HuffmanDistributed::HuffmanDistributed(Communicator &comm, size_t n_threads, string filename, string transport,
+                                       const run_options_t &options) : comm(comm) {
+    this->n_threads = max<size_t>(1, n_threads);
+    this->filename = std::move(filename);
+    this->transport = std::move(transport);
+    this->options = options;
+}
+
+HuffmanDistributed::~HuffmanDistributed() {
+    if (tree) free_tree(tree);
+    free_codes(codes);
+    if (output_fd >= 0) close(output_fd);
+}
+
+/** checkpoints the writer records for a Huffman block of raw_len bytes */
+static uint64_t checkpoint_count(uint64_t raw_len, uint64_t interval) {
+    return interval > 0 && raw_len > 0 ? (raw_len - 1) / interval : 0;
+}
+
+/**
+ * Largest vector any all-reduce of a run will carry (the block index one), so that the shared
+ * region of the shm transport can be sized before forking.
+ */
+size_t HuffmanDistributed::reduce_capacity(uint64_t raw_size, size_t n_ranks, const run_options_t &options) {
+    auto n_blocks = block_count(raw_size, options.block_size);
+    size_t n_checkpoints = 0;
+    for (size_t i = 0; i < n_blocks; i++)
+        n_checkpoints += checkpoint_count(min(options.block_size, raw_size - i * options.block_size),
+                                          options.checkpoint_interval);
+    auto n_stream_slots = options.n_streams > 1 ? options.n_streams * n_blocks : 0;
+    return max<size_t>(256, n_ranks + 3 * n_blocks + n_checkpoints + n_stream_slots);
+}
+
+/* map phase: local mappers pread and count slices of this rank's range */
+freq_table_t HuffmanDistributed::read_and_count() {
+    // ranges start on block boundaries, O_DIRECT only when those are aligned too
+    auto direct = options.direct_io && options.block_size % DIRECT_ALIGN == 0;
+    auto file = open_input(filename, direct);
+    raw_size = file.size;
+
+    auto n_blocks = block_count(raw_size, options.block_size);
+    first_block = comm.rank() * n_blocks / comm.size();
+    last_block = (comm.rank() + 1) * n_blocks / comm.size();
+    range_begin = min(raw_size, first_block * options.block_size);
+    range_end = min(raw_size, last_block * options.block_size);
+    seq.resize(range_end - range_begin);
+
+    vector<freq_table_t> partial_counts(n_threads, freq_table_t{});
+    vector<thread> mappers;
+    for (size_t t = 0; t < n_threads; t++)
+        mappers.emplace_back([&, t]() {
+            auto start = read_split(seq.size(), t, n_threads);
+            auto end = read_split(seq.size(), t + 1, n_threads);
+            read_count_range(file, range_begin + start, range_begin + end, &seq[start], partial_counts[t]);
+        });
+    for (auto &t: mappers) t.join();
+    close_input(file);
+
+    freq_table_t counts{};
+    for (auto &partial: partial_counts) for (int c = 0; c < 256; c++) counts[c] += partial[c];
+    return counts;
+}
+
+void HuffmanDistributed::encode() {
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, raw_size));
+    use_coder(archive, table, options.coder);
+    auto policy = resolve_store_policy(archive, table, options.store_mode);
+
+    // range_begin is a block boundary, so local block i is global block first_block + i
+    init_archive(local, seq.size(), archive.freqs, options.block_size, options.checkpoint_interval, options.n_streams);
+    local.coder = archive.coder;
+    auto n_blocks = local.blocks.size();
+    vector<thread> encoders;
+    for (size_t t = 0; t < n_threads; t++)
+        encoders.emplace_back([&, t]() {
+            for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                encode_archive_block(local, i, seq.data(), table, policy);
+        });
+    for (auto &t: encoders) t.join();
+}
+
+/*
+ * Gathers payload sizes and block metadata in a single all-reduce; the layout of the vector is
+ *   [0, n_ranks)                  payload bytes of every rank
+ *   [n_ranks, + 4 * n_blocks)     kind, raw_len, n_bits, crc of every block
+ *   [cp_base, stream_base)        checkpoints of every block, checkpoint_count() slots each
+ *   [stream_base, end)            sub-stream bits of every block, n_streams slots each (multi-stream only)
+ * Every rank fills only its own slots, so the sum is a gather.
+ */
+void HuffmanDistributed::write_output() {
+    auto n_ranks = comm.size();
+    auto n_blocks = archive.blocks.size();
+    vector<uint64_t> checkpoint_base(n_blocks + 1, 0);
+    for (size_t i = 0; i < n_blocks; i++)
+        checkpoint_base[i + 1] = checkpoint_base[i] + checkpoint_count(archive.blocks[i].raw_len,
+                                                                       options.checkpoint_interval);
+
+    auto meta_base = n_ranks;
+    auto cp_base = meta_base + 4 * n_blocks;
+    auto stream_base = cp_base + checkpoint_base[n_blocks];
+    auto n_streams = options.n_streams > 1 ? options.n_streams : 0;
+    vector<uint64_t> index(stream_base + n_streams * n_blocks, 0);
+    for (size_t i = 0; i < local.blocks.size(); i++) {
+        auto &block = local.blocks[i];
+        auto g = first_block + i;
+        index[comm.rank()] += block.data.size();
+        index[meta_base + 4 * g] = block.kind;
+        index[meta_base + 4 * g + 1] = block.raw_len;
+        index[meta_base + 4 * g + 2] = block.n_bits;
+        index[meta_base + 4 * g + 3] = block.crc;
+        for (size_t k = 0; k < block.checkpoints.size(); k++) index[cp_base + checkpoint_base[g] + k] = block.checkpoints[k];
+        for (size_t s = 0; s < block.stream_bits.size(); s++) index[stream_base + n_streams * g + s] = block.stream_bits[s];
+    }
+    comm.all_reduce(index);
+
+    uint64_t offset = ARCHIVE_HEADER_SIZE, payload = 0;
+    for (size_t r = 0; r < n_ranks; r++) {
+        if (r < comm.rank()) offset += index[r];
+        payload += index[r];
+    }
+
+    for (auto &block: local.blocks) {
+        for (size_t done = 0; done < block.data.size();) {
+            auto n = pwrite(output_fd, block.data.data() + done, block.data.size() - done, (off_t) (offset + done));
+            if (n <= 0) throw runtime_error("Could not write " + string(OUTPUT_FILE));
+            done += n;
+        }
+        offset += block.data.size();
+    }
+
+    if (comm.rank() == 0) {
+        for (size_t g = 0; g < n_blocks; g++) {
+            auto &block = archive.blocks[g];
+            block.kind = (uint8_t) index[meta_base + 4 * g];
+            block.raw_len = index[meta_base + 4 * g + 1];
+            block.n_bits = index[meta_base + 4 * g + 2];
+            block.crc = (uint32_t) index[meta_base + 4 * g + 3];
+            if (block.kind == BLOCK_HUFFMAN)
+                block.checkpoints.assign(index.begin() + (long) (cp_base + checkpoint_base[g]),
+                                         index.begin() + (long) (cp_base + checkpoint_base[g + 1]));
+            if (block.kind == BLOCK_HUFFMAN && n_streams > 0)
+                block.stream_bits.assign(index.begin() + (long) (stream_base + n_streams * g),
+                                         index.begin() + (long) (stream_base + n_streams * (g + 1)));
+        }
+        bytes_t buffer;
+        serialize_header(archive, buffer);
+        auto trailer_offset = ARCHIVE_HEADER_SIZE + payload;
+        auto header_size = buffer.size();
+        serialize_trailer(archive, trailer_offset, buffer);
+        if (pwrite(output_fd, buffer.data(), header_size, 0) != (ssize_t) header_size ||
+            pwrite(output_fd, buffer.data() + header_size, buffer.size() - header_size, (off_t) trailer_offset) !=
+            (ssize_t) (buffer.size() - header_size))
+            throw runtime_error("Could not write " + string(OUTPUT_FILE));
+    }
+    close(output_fd);
+    output_fd = -1;
+
+    // the archive is complete only when every rank has written its blocks
+    comm.barrier();
+}
+
+void HuffmanDistributed::run() {
+    alloc_stats_reset();
+
+    // the coordinator truncates the output before the first collective: nobody writes before the second one
+    if (comm.rank() == 0) output_fd = open(OUTPUT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    long time_read, time_freqs, time_tree_codes, time_encoding, time_writing;
+    freq_table_t counts;
+    {
+        utimer timer("read+freqs time", &time_read);
+        counts = read_and_count();
+    }
+
+    /** histogram all-reduce **/
+    {
+        utimer timer("all-reduce time", &time_freqs);
+        vector<uint64_t> global(counts.begin(), counts.end());
+        comm.all_reduce(global);
+        copy(global.begin(), global.end(), counts.begin());
+    }
+
+    /** huffman tree generation, identical on every rank **/
+    {
+        utimer timer("tree codes time", &time_tree_codes);
+        init_archive(archive, raw_size, counts, options.block_size, options.checkpoint_interval, options.n_streams);
+        for (size_t i = 0; i < archive.blocks.size(); i++)
+            archive.blocks[i].raw_len = min(options.block_size, raw_size - i * options.block_size);
+        tree = generate_huffman_tree(from_freq_table(counts));
+        codes = generate_huffman_codes(tree);
+    }
+
+    {
+        utimer timer("encoding time", &time_encoding);
+        encode();
+    }
+
+    {
+        utimer timer("writing time", &time_writing);
+        if (comm.rank() != 0) output_fd = open(OUTPUT_FILE, O_WRONLY | O_CREAT, 0644);
+        if (output_fd < 0) throw runtime_error("Could not open file: " + string(OUTPUT_FILE));
+        write_output();
+    }
+
+    if (comm.rank() != 0) return;
+
+    if (options.verify) {
+        // rank 0 holds no block data: the written file is verified, against its checksums and the input
+        auto seq = read_file(filename);
+        uint64_t n_blocks, n_failed;
+        long time_verify;
+        {
+            utimer timer("verify time", &time_verify);
+            n_failed = verify_file(OUTPUT_FILE, n_threads, &seq, n_blocks);
+        }
+        report_verification(n_failed, time_verify);
+    }
+    unsigned n_huffman, n_stored;
+    count_blocks(archive, n_huffman, n_stored);
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, comm.size(), 0, n_threads,
+                    TYPE_DISTRIBUTED + transport + (options.coder == CODER_ANS ? TYPE_ANS_SUFFIX : ""), n_huffman,
+                    n_stored, raw_size);
+}
+
+/**
+ * Forks n_procs ranks on this node, talking over loopback TCP or a shared mapping.
+ * @return 0 if every rank succeeded.
+ */
+int run_distributed_local(const string &filename, size_t n_procs, size_t n_threads, const string &transport,
+                          const run_options_t &options) {
+    struct stat st{};
+    if (stat(filename.c_str(), &st) != 0) throw runtime_error("Could not open file: " + filename);
+
+    void *region = nullptr;
+    size_t region_size = 0;
+    int listen_fd = -1;
+    unsigned port = 0;
+    if (transport == "shm")
+        region = ShmCommunicator::create_region(n_procs, HuffmanDistributed::reduce_capacity(st.st_size, n_procs, options),
+                                                region_size);
+    else listen_fd = TcpCommunicator::listen_on("127.0.0.1", port);
+
+    cout.flush();
+    vector<pid_t> ranks;
+    for (size_t r = 0; r < n_procs; r++) {
+        auto pid = fork();
+        if (pid != 0) {
+            ranks.push_back(pid);
+            continue;
+        }
+        int status = 0;
+        try {
+            unique_ptr<Communicator> comm;
+            if (region) comm = make_unique<ShmCommunicator>(r, n_procs, region, region_size);
+            else {
+                if (r != 0) close(listen_fd);
+                comm = make_unique<TcpCommunicator>(r, n_procs, "127.0.0.1", port, r == 0 ? listen_fd : -1);
+            }
+            HuffmanDistributed(*comm, n_threads, filename, transport, options).run();
+        } catch (const exception &e) {
+            cerr << "rank " << r << ": " << e.what() << endl;
+            status = 1;
+        }
+        cout.flush();
+        _exit(status);
+    }
+    if (listen_fd >= 0) close(listen_fd);
+
+    // a failed rank would leave the others waiting in a collective forever
+    int failed = 0;
+    for (size_t done = 0; done < ranks.size(); done++) {
+        int status = 0;
+        auto pid = wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (!failed) for (auto rank: ranks) if (rank != pid) kill(rank, SIGTERM);
+            failed = 1;
+        }
+    }
+    if (region) ShmCommunicator::destroy_region(region, region_size);
+    return failed;
+}
+
+/**
+ * Runs one rank of a multi-node compression; coordinator is rank 0's host:port.
+ */
+int run_distributed_worker(const string &filename, size_t rank, size_t n_procs, const string &coordinator,
+                           size_t n_threads, const run_options_t &options) {
+    auto colon = coordinator.rfind(':');
+    if (colon == string::npos) throw runtime_error("Coordinator must be host:port, got " + coordinator);
+    TcpCommunicator comm(rank, n_procs, coordinator.substr(0, colon), stoul(coordinator.substr(colon + 1)));
+    HuffmanDistributed(comm, n_threads, filename, "tcp", options).run();
+    return 0;
+}
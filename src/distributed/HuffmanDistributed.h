@@ -0,0 +1,61 @@
+#ifndef SPM_PROJECT_HUFFMANDISTRIBUTED_H
+#define SPM_PROJECT_HUFFMANDISTRIBUTED_H
+
+#include <string>
+#include <unordered_map>
+#include "Communicator.h"
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+
+#define TYPE_DISTRIBUTED "dist-"
+
+using namespace std;
+
+/**
+ * One rank of a multi-process compression, the map/reduce of HuffmanParallel spread over processes:
+ *  1. map: the rank preads its range of blocks and counts it (fused, n_threads local mappers);
+ *  2. reduce: histograms are all-reduced, every rank builds the same tree from the global counts;
+ *  3. the rank encodes its blocks (n_threads local encoders);
+ *  4. block metadata and payload sizes are all-gathered: every rank knows its output offset and
+ *     pwrites its blocks there, rank 0 (the coordinator) writes header and block index.
+ * The input and output paths must be visible to every rank (e.g. a shared filesystem).
+ */
+class HuffmanDistributed {
+private:
+    Communicator &comm;
+    size_t n_threads;
+    string filename;
+    string transport;
+    run_options_t options;
+
+    uint64_t raw_size = 0;
+    size_t first_block = 0, last_block = 0;   // blocks [first_block, last_block) belong to this rank
+    uint64_t range_begin = 0, range_end = 0;
+    string seq;                               // this rank's range of the input only
+
+    Node* tree = nullptr;
+    unordered_map<char, code_t*> codes;
+    archive_t archive;      // the whole archive: header fields and block index, no block data
+    archive_t local;        // the blocks of this rank, encoded
+    int output_fd = -1;
+
+    freq_table_t read_and_count();
+    void encode();
+    void write_output();
+
+public:
+    HuffmanDistributed(Communicator &comm, size_t n_threads, string filename, string transport,
+                       const run_options_t &options = run_options_t());
+    ~HuffmanDistributed();
+    void run();
+
+    static size_t reduce_capacity(uint64_t raw_size, size_t n_ranks, const run_options_t &options);
+};
+
+int run_distributed_local(const string &filename, size_t n_procs, size_t n_threads, const string &transport,
+                          const run_options_t &options);
+
+int run_distributed_worker(const string &filename, size_t rank, size_t n_procs, const string &coordinator,
+                           size_t n_threads, const run_options_t &options);
+
+#endif //SPM_PROJECT_HUFFMANDISTRIBUTED_H
@@ -5,151 +5,238 @@
 #include <unordered_map>
 #include <queue>
 #include <chrono>
+#include <memory>
+#include <stdexcept>
 
 #include <ff/ff.hpp>
 #include <ff/parallel_for.hpp>
 
 #include "HuffmanFarm.h"
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-io.h"
+#include "../utils/huffman-kernels.h"
 #include "../utils/utimer.cpp"
 
 using namespace std;
 using namespace ff;
 
+/** What the farm encodes: the input and the code table are referenced, never copied. */
+struct FarmJob {
+    const char *data;
+    const code_table_t *table;
+    archive_t *archive;
+    int policy;
+};
+
 struct Task{
-    int task_id;
-    int n_encoders;
-    string* seq;
-    chunk_t* chunk;
-    unordered_map<char, code_t* >* codes;
-
-    Task(int task_id, string* seq, int n_encoders, chunk_t *chunk, unordered_map<char, code_t* >* codes){
-        this->task_id = task_id;
-        this->seq = seq;
-        this->codes = codes;
-        this->chunk = chunk;
-        this->n_encoders = n_encoders;
-    }
+    size_t block;
 };
 
+/*
+ * Emits one task per archive block, on demand: the farm runs with a feedback channel, every worker sends
+ * its task back when the block is encoded and the emitter reuses it for the next block. Tasks come from a
+ * bounded pool of FARM_TASKS_PER_WORKER per worker, allocated once, so a slow worker holds at most a few
+ * blocks while the others keep draining the rest.
+ */
 class Emitter : public ff_monode_t<Task>{
     private:
-        int n_encoders;
-        string seq;
-        unordered_map<char, code_t*> codes;
-        encoded_t partial_res;
+        const FarmJob *job;
+        vector<Task> pool;
+        size_t next = 0;
+        size_t blocks_done = 0;
 
     public:
-        Emitter(
-            int n_encoders,
-            unordered_map<char, code_t* > codes, const string &seq): n_encoders(n_encoders){
-            this -> seq = seq;
-            this->codes = std::move(codes);
+        Emitter(const FarmJob *job, size_t n_encoders) : job(job) {
+            pool.resize(min(job->archive->blocks.size(), n_encoders * FARM_TASKS_PER_WORKER));
         }
-        Task *svc(Task*) override{
-            for (int i = 0; i < n_encoders; i++){
-                Task *t = new Task(i, &seq, n_encoders, nullptr, &codes);
+        Task *svc(Task *t) override{
+            auto n_blocks = job->archive->blocks.size();
+            if (t == nullptr) {
+                // start: fill the pool
+                for (auto &task : pool) {
+                    task.block = next++;
+                    ff_send_out(&task);
+                }
+                return n_blocks == 0 ? EOS : GO_ON;
+            }
+            // a block came back: recycle its task for the next one
+            blocks_done++;
+            if (next < n_blocks) {
+                t->block = next++;
                 ff_send_out(t);
             }
-            return EOS;
+            return blocks_done == n_blocks ? EOS : GO_ON;
         }
+        size_t completed() const { return blocks_done; }
     };
 
-class Collector : public ff_node_t<Task>{
+class Encoder : public ff_node_t<Task>{
     private:
-        encoded_t* partial_res;
-        public:
-            Task* svc(Task* t) override{
-                partial_res->at(t->task_id) = t->chunk;
-                delete t;
-                return GO_ON;
-            }
-            explicit Collector(encoded_t* partial_res){
-                // get pointer to result vector
-                this->partial_res = partial_res;
-            }
-};
+        const FarmJob *job;
+        bool pin;
 
-Task* Worker(Task* t, ff::ff_node* nn){
-    auto n_encoders = t->n_encoders;
-    auto tid   = t->task_id;
-    auto size  = t->seq->length();
-    auto start = tid * (size /n_encoders);
-    auto stop  = (tid == n_encoders - 1) ? size : (tid+ 1) * (size / n_encoders);
-    
-    // allocating memory for chunk -> make memory allocation parallel time.
-    t->chunk = new chunk_t();
-    t->chunk->reserve(stop - start);
-
-    for (auto i = start; i < stop; i++){
-        auto seq = t->seq->at(i);
-        t->chunk->push_back(t->codes->at(seq));
-    }
-    return t;
-}
+    public:
+        Encoder(const FarmJob *job, bool pin) : job(job), pin(pin) {}
+        int svc_init() override{
+            // one worker per core, in worker order (FastFlow's own mapping is off: NO_DEFAULT_MAPPING)
+            if (pin) ff_mapThreadToCpu((int)(get_my_id() % ff_numCores()));
+            return 0;
+        }
+        Task *svc(Task *t) override{
+            // packing the blocks here -> make memory allocation parallel time.
+            encode_archive_block(*job->archive, t->block, job->data, *job->table, job->policy);
+            return t;
+        }
+};
 
 
-HuffmanMonode::HuffmanMonode(size_t n_mappers, size_t n_encoders, string filename){
+HuffmanMonode::HuffmanMonode(size_t n_mappers, size_t n_encoders, string filename, const run_options_t &options){
     this->n_mappers = n_mappers;
+    this->options = options;
     this->n_encoders = n_encoders;
     this->filename = std::move(filename);
-    this->seq = read_file(this->filename);
     this->tree = nullptr;
 }
 
 HuffmanMonode::~HuffmanMonode(){
     if(tree) free_tree(this->tree);
-    free_encoding(*this->encoded);
     free_codes(this->codes);
 }
 
 unordered_map<char, unsigned int> HuffmanMonode::generate_frequency(){
-    auto res = unordered_map<char, unsigned int>();
+    auto res = freq_table_t{};
+    auto size = (long)seq.size();
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{});
+
+    // one iteration per mapper range, counted by the shared kernel: no hashing per byte
+    auto map_f = [&](const long t){
+        auto start = t * size / (long)n_mappers;
+        auto end = (t + 1) * size / (long)n_mappers;
+        count_symbols(seq.data() + start, end - start, partial_counts[t]);
+    };
 
-    auto map_f = [&](const long i, unordered_map<char, unsigned> &tempsum){
-        tempsum[seq[i]]++;
+    // the partials are reduced by column slices on the same workers, not one after the other by this thread
+    auto n_slices = reduce_slices(n_mappers);
+    auto red_f = [&](const long s){
+        reduce_counts(partial_counts, s, n_slices, res);
     };
 
-    auto red_f = [&](unordered_map<char, unsigned> &a, const unordered_map<char, unsigned> &b){
-        for (auto &it : b)
-            a[it.first] += it.second;
+    auto pf = ParallelFor((long)n_mappers);
+    pf.parallel_for(0, (long)n_mappers, 1, 0, map_f, (long)n_mappers);
+    {
+        utimer timer("Histogram reduction", &time_reduce);
+        pf.parallel_for(0, (long)n_slices, 1, 0, red_f, (long)n_slices);
+    }
+
+    return from_freq_table(res);
+}
+
+/*
+ * Fused read and count, as in generate_frequency(): every mapper preads its read_split() range of the
+ * file into seq and counts it chunk by chunk, then the partials are reduced by column slices.
+ */
+unordered_map<char, unsigned int> HuffmanMonode::read_and_count(){
+    auto file = open_input(filename, options.direct_io);
+    auto res = freq_table_t{};
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{});
+    seq.resize(file.size);
+
+    auto map_f = [&](const long t){
+        auto start = read_split(file.size, t, n_mappers);
+        auto end = read_split(file.size, t + 1, n_mappers);
+        read_count_range(file, start, end, &seq[start], partial_counts[t]);
     };
 
-    auto pf = ParallelForReduce<unordered_map<char, unsigned>>((long)n_mappers);
-    pf.parallel_reduce(res, unordered_map<char, unsigned>(), 0, (long)seq.size(), 1, map_f, red_f, n_mappers);
-    
-    return res;
+    auto n_slices = reduce_slices(n_mappers);
+    auto red_f = [&](const long s){
+        reduce_counts(partial_counts, s, n_slices, res);
+    };
+
+    auto pf = ParallelFor((long)n_mappers);
+    pf.parallel_for(0, (long)n_mappers, 1, 0, map_f, (long)n_mappers);
+    close_input(file);
+    {
+        utimer timer("Histogram reduction", &time_reduce);
+        pf.parallel_for(0, (long)n_slices, 1, 0, red_f, (long)n_slices);
+    }
+
+    return from_freq_table(res);
 }
 
 
-encoded_t* HuffmanMonode::encode(){
-    auto results = new encoded_t(n_encoders);
-    auto emitter = Emitter((int)n_encoders, codes, seq);
-    auto collector = Collector(results);
+archive_t HuffmanMonode::encode(){
+    auto results = archive_t();
+    init_archive(results, seq.length(), to_freq_table(freq_map), options.block_size, options.checkpoint_interval,
+                 options.n_streams);
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, seq.length()));
+    use_coder(results, table, options.coder);
+    auto policy = resolve_store_policy(results, table, options.store_mode);
 
-    // create FF farm with n_encoders workers
-    ff_Farm<Task> farm(Worker, (long)n_encoders);
-    farm.add_emitter(emitter);
-    farm.add_collector(collector);
-    farm.run_and_wait_end();
+    FarmJob job{seq.data(), &table, &results, policy};
+    auto emitter = Emitter(&job, n_encoders);
 
+    // FF farm with n_encoders workers, on-demand scheduling and the tasks fed back to the emitter
+    vector<unique_ptr<ff_node>> workers;
+    for (size_t i = 0; i < n_encoders; i++) workers.push_back(make_unique<Encoder>(&job, options.pin_threads));
+    ff_Farm<Task> farm(std::move(workers));
+    farm.add_emitter(emitter);
+    farm.remove_collector();
+    farm.set_scheduling_ondemand();
+    farm.wrap_around();
+    if (farm.run_and_wait_end() < 0)
+        throw runtime_error("Could not run the encoder farm");
+
+    if (emitter.completed() != results.blocks.size())
+        throw runtime_error("Encoder farm did not complete every block");
     return results;
 }
 
 
-void HuffmanMonode::run()
+void HuffmanMonode::estimate()
 {
-    /** frequency map generation **/
-    long time_read;
-    {
-        utimer timer("Reading file", &time_read);
-        this -> seq = read_file(this->filename);
+    long time_read, time_freqs = 0;
+    unordered_map<char, unsigned int> freqs;
+    if (options.read_mode == READ_FUSED) {
+        utimer timer("Reading file and frequency map generation", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("Reading file", &time_read);
+            this -> seq = read_file(this->filename);
+        }
+        utimer timer("Frequency map generation", &time_freqs);
+        freqs = generate_frequency();
     }
 
+    print_estimate(estimate_compression(seq, freqs, options, n_encoders), time_read, time_freqs);
+}
+
+/* the in-memory phases of run(), on an input already loaded (compress_phases) */
+archive_t HuffmanMonode::compress(string &input, phase_times_t &times)
+{
+    return compress_phases(seq, input, times,
+                           [&]() { freq_map = generate_frequency(); return time_reduce; },
+                           [&]() { tree = generate_huffman_tree(freq_map); codes = generate_huffman_codes(tree); },
+                           [&]() { return encode(); });
+}
+
+void HuffmanMonode::run()
+{
+    alloc_stats_reset();
 
-    long time_freqs;
+    /** frequency map generation **/
+    // fused: the whole stage is accounted as read time, time_freqs stays 0
+    long time_read, time_freqs = 0;
     unordered_map<char, unsigned int> freqs;
-    {
+    if (options.read_mode == READ_FUSED) {
+        utimer timer("Reading file and frequency map generation", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("Reading file", &time_read);
+            this -> seq = read_file(this->filename);
+        }
         utimer timer("Frequency map generation", &time_freqs);
         freqs = generate_frequency();
     }
@@ -159,6 +246,7 @@ void HuffmanMonode::run()
     long time_tree_codes;
     {
         utimer timer("Huffman tree generation", &time_tree_codes);
+        this->freq_map = freqs;
         this->tree = generate_huffman_tree(freqs);
         this->codes = generate_huffman_codes(tree);
     }
@@ -168,20 +256,22 @@ void HuffmanMonode::run()
     long time_encoding;
     {
         utimer timer("Encoding", &time_encoding);
-        this->encoded = encode();
+        this->archive = encode();
     }
 
     /** writing **/
     long time_writing;
     {
         utimer timer("Writing", &time_writing);
-        write_to_file(*encoded, OUTPUT_FILE);
+        write_archive(archive, OUTPUT_FILE);
     }
 
-    //check file and print result in green if correct, red otherwise.
-    #ifdef CHKFILE
-        check_file(OUTPUT_FILE, seq, this->tree);
-    #endif
+    //decode the archive back in parallel and print the result in green if correct, red otherwise.
+    if (options.verify)
+        check_archive(archive, seq, n_encoders);
 
-    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, 0, n_encoders, TYPE_FASTFLOW_FARM);
+    unsigned n_huffman, n_stored;
+    count_blocks(archive, n_huffman, n_stored);
+    auto type = string(TYPE_FASTFLOW_FARM) + (options.coder == CODER_ANS ? TYPE_ANS_SUFFIX : "");
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, 0, n_encoders, type, n_huffman, n_stored, seq.length(), time_reduce);
 }
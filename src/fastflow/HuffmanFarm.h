@@ -11,6 +11,9 @@
 #include <vector>
 #include <ff/ff.hpp>
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+
+#define FARM_TASKS_PER_WORKER 4     // block tasks in flight per encoder, the size of the task pool
 
 using namespace std;
 using namespace ff;
@@ -21,18 +24,23 @@ private:
     size_t n_mappers;
     size_t n_encoders;
     string filename;
+    run_options_t options;
     string seq;
     Node* tree;
     unordered_map<char, unsigned> freq_map;
     unordered_map<char, code_t*> codes;
-    encoded_t *encoded;
-    encoded_t *encode();
+    archive_t archive;
+    long time_reduce = 0;   // merge of the partial histograms, part of the freqs phase
+    archive_t encode();
     unordered_map<char, unsigned> generate_frequency();
+    unordered_map<char, unsigned> read_and_count();
 
 public:
-    HuffmanMonode(size_t n_mappers, size_t n_encoders, string filename);
+    HuffmanMonode(size_t n_mappers, size_t n_encoders, string filename, const run_options_t &options = run_options_t());
     ~HuffmanMonode();
     void run();
+    void estimate();
+    archive_t compress(string &input, phase_times_t &times);
 };
 
 
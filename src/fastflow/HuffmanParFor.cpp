@@ -9,17 +9,23 @@
 
 #include "HuffmanParFor.h"
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-io.h"
+#include "../utils/huffman-kernels.h"
 #include "../utils/utimer.cpp"
 
 using namespace ff;
 
 
-HuffmanFastFlow::HuffmanFastFlow(size_t n_mappers, size_t n_reducers, size_t n_encoders, string filename) {
+HuffmanFastFlow::HuffmanFastFlow(size_t n_mappers, size_t n_reducers, size_t n_encoders, string filename,
+                                 size_t grain, bool dynamic, const run_options_t &options) {
     this->n_mappers = n_mappers;
+    this->options = options;
     this->n_reducers = n_reducers;
     this->n_encoders = n_encoders;
+    this->grain = grain > 0 ? grain : PF_GRAIN;
+    this->dynamic = dynamic;
     this->filename = std::move(filename);
-    this -> seq = read_file(this->filename);
 }
 
 HuffmanFastFlow::~HuffmanFastFlow() {
@@ -27,47 +33,132 @@ HuffmanFastFlow::~HuffmanFastFlow() {
     free_codes(codes);
 }
 
-vector<vector<bool>*> HuffmanFastFlow::encode() {
-    auto buffer = vector<vector<bool>*>(seq.length());
-    auto body = [&](const long i){
-        auto code = codes[seq[i]];
-        buffer[i] = code;
+size_t HuffmanFastFlow::n_blocks() const {
+    return (seq.length() + grain - 1) / grain;
+}
+
+/*
+ * Both loops iterate over blocks of `grain` bytes rather than over single bytes: one iteration
+ * is a cache-sized piece of work, so the scheduler overhead is paid once per block.
+ * Dynamic scheduling hands out one block per task (chunk = 1); static scheduling gives each
+ * worker a contiguous range of blocks (chunk = 0).
+ * The grain is also the block size of the archive written by this backend.
+ */
+
+archive_t HuffmanFastFlow::encode() {
+    auto results = archive_t();
+    init_archive(results, seq.length(), to_freq_table(freq_map), grain, options.checkpoint_interval,
+                 options.n_streams);
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, seq.length()));
+    use_coder(results, table, options.coder);
+    auto policy = resolve_store_policy(results, table, options.store_mode);
+
+    // each block owns its buffer, no shared seq.length()-sized vector
+    auto body = [&](const long b){
+        encode_archive_block(results, b, seq.data(), table, policy);
     };
 
     auto pf = ParallelFor((long)n_encoders);
-    pf.parallel_for(0, (long)seq.size(), 1, body);
+    pf.parallel_for(0, (long)n_blocks(), 1, dynamic ? 1 : 0, body, (long)n_encoders);
+
+    return results;
+}
+
+/* the per-worker partial tables, summed by column slices on the workers of pf: see reduce_counts() */
+static freq_table_t reduce_frequency(ParallelFor &pf, const vector<freq_table_t> &partial_counts, long &time_reduce) {
+    auto res = freq_table_t{};
+    auto n_slices = reduce_slices(partial_counts.size());
+    auto red_f = [&](const long s){
+        reduce_counts(partial_counts, s, n_slices, res);
+    };
 
-    return buffer;
+    utimer timer("Histogram reduction", &time_reduce);
+    pf.parallel_for(0, (long)n_slices, 1, 0, red_f, (long)n_slices);
+    return res;
 }
 
 unordered_map<char, unsigned int> HuffmanFastFlow::generate_frequency() {
-    auto res = unordered_map<char, unsigned int>();
+    // partial results are plain 256-bin arrays, one per worker
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{});
 
-    auto map_f = [&](const long i, unordered_map<char, unsigned> &tempsum){
-        tempsum[seq[i]]++;
+    auto map_f = [&](const long b, const int thid){
+        auto start = b * grain;
+        auto end = min(seq.length(), start + grain);
+        count_symbols(seq.data() + start, end - start, partial_counts[thid]);
     };
 
-    auto red_f = [&](unordered_map<char, unsigned> &a, const unordered_map<char, unsigned> &b){
-        for(auto &it: b) a[it.first] += it.second;
+    auto pf = ParallelFor((long)n_mappers);
+    pf.parallel_for_thid(0, (long)n_blocks(), 1, dynamic ? 1 : 0, map_f, (long)n_mappers);
+    return from_freq_table(reduce_frequency(pf, partial_counts, time_reduce));
+}
+
+/*
+ * Fused read and count: one iteration preads READ_CHUNK bytes into seq and counts them into the
+ * worker's partial table. Chunks rather than grain-sized blocks, so every pread is large and
+ * aligned for O_DIRECT whatever the grain.
+ */
+unordered_map<char, unsigned int> HuffmanFastFlow::read_and_count() {
+    auto file = open_input(filename, options.direct_io);
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{});
+    seq.resize(file.size);
+    auto n_chunks = (long)((file.size + READ_CHUNK - 1) / READ_CHUNK);
+
+    auto map_f = [&](const long i, const int thid){
+        auto start = (uint64_t)i * READ_CHUNK;
+        read_count_range(file, start, min<uint64_t>(file.size, start + READ_CHUNK), &seq[start],
+                         partial_counts[thid]);
     };
 
-    auto pf = ParallelForReduce<unordered_map<char, unsigned>>(n_mappers);
-    pf.parallel_reduce(res, unordered_map<char, unsigned>(), 0, (long)seq.size(), 1, map_f, red_f);
-    return res;
+    auto pf = ParallelFor((long)n_mappers);
+    pf.parallel_for_thid(0, n_chunks, 1, dynamic ? 1 : 0, map_f, (long)n_mappers);
+    close_input(file);
+    return from_freq_table(reduce_frequency(pf, partial_counts, time_reduce));
 }
 
-void HuffmanFastFlow::run() {
-    /** frequency map generation **/
-    long time_read;
-    {
-        utimer timer("Reading file", &time_read);
-        this -> seq = read_file(this->filename);
+void HuffmanFastFlow::estimate() {
+    long time_read, time_freqs = 0;
+    unordered_map<char, unsigned int> freqs;
+    if (options.read_mode == READ_FUSED) {
+        utimer timer("Reading file and frequency generation", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("Reading file", &time_read);
+            this -> seq = read_file(this->filename);
+        }
+        utimer timer("Frequency generation", &time_freqs);
+        freqs = generate_frequency();
     }
 
+    // the archive of this backend is cut in grain-sized blocks
+    auto block_options = options;
+    block_options.block_size = grain;
+    print_estimate(estimate_compression(seq, freqs, block_options, n_encoders), time_read, time_freqs);
+}
 
-    long time_freqs;
+/* the in-memory phases of run(), on an input already loaded (compress_phases) */
+archive_t HuffmanFastFlow::compress(string &input, phase_times_t &times) {
+    return compress_phases(seq, input, times,
+                           [&]() { freq_map = generate_frequency(); return time_reduce; },
+                           [&]() { tree = generate_huffman_tree(freq_map); codes = generate_huffman_codes(tree); },
+                           [&]() { return encode(); });
+}
+
+void HuffmanFastFlow::run() {
+    alloc_stats_reset();
+
+    /** frequency map generation **/
+    // fused: the whole stage is accounted as read time, time_freqs stays 0
+    long time_read, time_freqs = 0;
     unordered_map<char, unsigned int> freqs;
-    {
+    if (options.read_mode == READ_FUSED) {
+        utimer timer("Reading file and frequency generation", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("Reading file", &time_read);
+            this -> seq = read_file(this->filename);
+        }
         utimer timer("Frequency generation", &time_freqs);
         freqs = generate_frequency();
     }
@@ -77,30 +168,33 @@ void HuffmanFastFlow::run() {
     long time_tree_codes;
     {
         utimer timer("Tree and codes generation", &time_tree_codes);
+        this -> freq_map = freqs;
         this -> tree = generate_huffman_tree(freqs);
         this -> codes = generate_huffman_codes(tree);
     }
 
 
     long time_encoding;
-    vector<vector<bool>*> encoded;
     {
         utimer timer("Encoding", &time_encoding);
-        encoded = encode();
+        this -> archive = encode();
     }
 
     long time_writing;
     {
         utimer timer("Writing file", &time_writing);
-        write_to_file(encoded, OUTPUT_FILE);
+        write_archive(archive, OUTPUT_FILE);
     }
 
 
-    //check file and print result in green if correct, red otherwise.
-    #ifdef CHKFILE
-        check_file(OUTPUT_FILE, seq, this->tree);
-    #endif
+    //decode the archive back in parallel and print the result in green if correct, red otherwise.
+    if (options.verify)
+        check_archive(archive, seq, n_encoders);
 
-    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, n_reducers, n_encoders, TYPE_FASTFLOW_PF);
+    unsigned n_huffman, n_stored;
+    count_blocks(archive, n_huffman, n_stored);
+    auto type = string(TYPE_FASTFLOW_PF) + (dynamic ? "-dynamic-" : "-static-") + to_string(grain);
+    if (options.coder == CODER_ANS) type += TYPE_ANS_SUFFIX;
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, n_reducers, n_encoders, type, n_huffman, n_stored, seq.length(), time_reduce);
 }
 
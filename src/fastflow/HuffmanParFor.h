@@ -10,6 +10,9 @@
 #include <unordered_map>
 #include <vector>
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+
+#define PF_GRAIN (64 * 1024)
 
 using namespace std;
 
@@ -20,20 +23,31 @@ private:
     size_t n_reducers;
     size_t n_encoders;
     string filename;
+    run_options_t options;
 
     string seq;
 
-    Node* tree;
+    size_t grain;       // block size in bytes, the unit of work of both loops
+    bool dynamic;       // dynamic (one block per task) or static (contiguous partitions) scheduling
+
+    Node* tree = nullptr;
     unordered_map<char, unsigned> freq_map;
     unordered_map<char, vector<bool>*> codes;
+    archive_t archive;
+    long time_reduce = 0;   // merge of the partial histograms, part of the freqs (or fused read) phase
 
-    vector<vector<bool>*> encode();
+    size_t n_blocks() const;
+    archive_t encode();
     unordered_map<char, unsigned> generate_frequency();
+    unordered_map<char, unsigned> read_and_count();
 
 public:
-    HuffmanFastFlow(size_t n_mappers, size_t n_reducers,size_t n_encoders, string filename);
+    HuffmanFastFlow(size_t n_mappers, size_t n_reducers, size_t n_encoders, string filename,
+                    size_t grain = PF_GRAIN, bool dynamic = true, const run_options_t &options = run_options_t());
     ~HuffmanFastFlow();
     void run();
+    void estimate();
+    archive_t compress(string &input, phase_times_t &times);
 
 };
 
@@ -1,19 +1,385 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <algorithm>
+#include <fstream>
+#include <cctype>
+#include <thread>
 #include "thread/HuffmanThread.h"
+#include "thread/HuffmanWords.h"
 #include "sequential/HuffmanSequential.h"
 #include "fastflow/HuffmanFarm.h"
+#include "fastflow/HuffmanParFor.h"
+#include "server/HuffmanServer.h"
+#include "distributed/HuffmanDistributed.h"
+#include "utils/huffman-io.h"
+#include "utils/huffman-query.h"
+#include "utils/huffman-stream.h"
+#include "bench/kernels.h"
+#include "bench/compare.h"
+#include "utils/utimer.cpp"
 
 using namespace std;
+
+/**
+ * Collects the optional trailing flags: "--key=value" or bare "--flag" (stored with value "1").
+ */
+static unordered_map<string, string> parse_options(int argc, char** argv, int first) {
+    unordered_map<string, string> options;
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) continue;
+        auto eq = arg.find('=');
+        if (eq == string::npos) options[arg.substr(2)] = "1";
+        else options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    return options;
+}
+
+/**
+ * Fills the knobs shared by every backend from the parsed flags.
+ * @return false (after printing why) if a flag has an invalid value.
+ */
+static bool make_run_options(unordered_map<string, string> &options, run_options_t &run_options) {
+    if (options.count("stored")) {
+        auto mode = options["stored"];
+        if (mode == "block") run_options.store_mode = STORE_BLOCK;
+        else if (mode == "global") run_options.store_mode = STORE_GLOBAL;
+        else if (mode == "off") run_options.store_mode = STORE_OFF;
+        else {
+            cout << "Invalid --stored mode: " << mode << endl;
+            return false;
+        }
+    }
+    if (options.count("block-size")) run_options.block_size = max(1UL, stoul(options["block-size"]));
+    if (options.count("read")) {
+        auto mode = options["read"];
+        if (mode == "fused") run_options.read_mode = READ_FUSED;
+        else if (mode == "serial") run_options.read_mode = READ_SERIAL;
+        else {
+            cout << "Invalid --read mode: " << mode << endl;
+            return false;
+        }
+    }
+    run_options.direct_io = options.count("direct") > 0;
+    run_options.verify = options.count("verify") > 0;
+    run_options.pin_threads = options.count("pin") > 0;
+    if (options.count("checkpoint")) run_options.checkpoint_interval = stoull(options["checkpoint"]);
+    if (options.count("pairs")) {
+        auto mode = options["pairs"];
+        if (mode == "auto") run_options.pair_mode = PAIRS_AUTO;
+        else if (mode == "on") run_options.pair_mode = PAIRS_ON;
+        else if (mode == "off") run_options.pair_mode = PAIRS_OFF;
+        else {
+            cout << "Invalid --pairs mode: " << mode << endl;
+            return false;
+        }
+    }
+    if (options.count("coder")) {
+        auto coder = options["coder"];
+        if (coder == "huffman") run_options.coder = CODER_HUFFMAN;
+        else if (coder == "ans") run_options.coder = CODER_ANS;
+        else {
+            cout << "Invalid --coder: " << coder << endl;
+            return false;
+        }
+    }
+    if (options.count("streams")) {
+        run_options.n_streams = stoul(options["streams"]);
+        if (run_options.n_streams < 1 || run_options.n_streams > MAX_STREAMS) {
+            cout << "Invalid --streams: " << options["streams"] << " (1.." << MAX_STREAMS << ")" << endl;
+            return false;
+        }
+        if (run_options.n_streams > 1 && run_options.checkpoint_interval > 0) {
+            cout << "--streams and --checkpoint cannot be combined" << endl;
+            return false;
+        }
+    }
+    if (run_options.coder == CODER_ANS && (run_options.n_streams > 1 || run_options.checkpoint_interval > 0)) {
+        cout << "--coder=ans supports neither --streams nor --checkpoint" << endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char** argv) {
+    // daemon mode: serve <socket> n_mappers n_encoders [map|ff]
+    if (argc > 1 && string(argv[1]) == "serve") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " serve <socket> n_mappers n_encoders [map|ff]" << endl;
+            return 1;
+        }
+        auto engine = argc > 5 ? string(argv[5]) : "map";
+        HuffmanServer server(argv[2], stoi(argv[3]), stoi(argv[4]), engine == "ff");
+        server.serve();
+        return 0;
+    }
+
+    // distributed: dist <input> n_procs n_threads [--transport=tcp|shm] forks the ranks on this node,
+    // dist-worker <input> rank n_procs <host:port> n_threads runs one rank of a multi-node job
+    if (argc > 1 && (string(argv[1]) == "dist" || string(argv[1]) == "dist-worker")) {
+        auto worker = string(argv[1]) == "dist-worker";
+        if (argc < (worker ? 7 : 5)) {
+            cout << "Usage: " << argv[0] << " dist <input_file> n_procs n_threads [--transport=tcp|shm] [options]" << endl;
+            cout << "       " << argv[0] << " dist-worker <input_file> rank n_procs <host:port> n_threads [options]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, worker ? 7 : 5);
+        run_options_t run_options;
+        if (!make_run_options(options, run_options)) return 1;
+        if (worker)
+            return run_distributed_worker(argv[2], stoul(argv[3]), stoul(argv[4]), argv[5], stoul(argv[6]), run_options);
+        auto transport = options.count("transport") ? options["transport"] : "tcp";
+        if (transport != "tcp" && transport != "shm") {
+            cout << "Invalid --transport: " << transport << endl;
+            return 1;
+        }
+        cout << "Running Huffman Distributed (" << argv[3] << " processes, " << transport << ")..." << endl;
+        return run_distributed_local(argv[2], stoul(argv[3]), stoul(argv[4]), transport, run_options);
+    }
+
+    // random access: extract <archive> <offset> <length> [output_file]
+    if (argc > 1 && string(argv[1]) == "extract") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " extract <archive> <offset> <length> [output_file]" << endl;
+            return 1;
+        }
+        string bytes;
+        long time_extract;
+        uint64_t decoded;
+        {
+            utimer timer("extract", &time_extract);
+            decoded = extract_file(argv[2], stoull(argv[3]), stoull(argv[4]), bytes);
+        }
+        if (argc > 5) {
+            ofstream out(argv[5], ios::binary);
+            out.write(bytes.data(), (long) bytes.size());
+        } else {
+            cout.write(bytes.data(), (long) bytes.size());
+            cout.flush();
+        }
+        cerr << bytes.size() << " bytes extracted, " << decoded << " symbols decoded in " << time_extract << " usec" << endl;
+        return 0;
+    }
+
+    // whole-archive decode: decode <archive> <output_file|-> n_threads [--speculative | --stream[=ahead]]
+    if (argc > 1 && string(argv[1]) == "decode") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " decode <archive> <output_file|-> n_threads [--speculative | --stream[=blocks]]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 5);
+        auto speculative = options.count("speculative") > 0;
+        auto &log = string(argv[3]) == "-" ? cerr : cout;   // "-": the sequence goes to stdout
+        sync_stats_t stats;
+        uint64_t size;
+        long time_decode;
+        {
+            utimer timer("decode", &time_decode);
+            if (options.count("stream")) {
+                auto ahead = options["stream"] == "1" ? STREAM_AHEAD_BLOCKS : max(1UL, stoul(options["stream"]));
+                size = stream_file(argv[2], argv[3], ahead);
+            } else
+                size = decode_file(argv[2], argv[3], stoul(argv[4]), speculative, stats);
+        }
+        log << size << " bytes decoded in " << time_decode << " usec ("
+            << (time_decode > 0 ? (double) size / (double) time_decode : 0) << " MB/s)" << endl;
+        if (speculative) {
+            auto synced = stats.n_segments - stats.n_failed;
+            log << "speculative: " << stats.n_blocks << " blocks split, " << stats.n_segments << " guessed starts, "
+                << stats.n_failed << " redone serially" << endl;
+            log << "  sync distance: " << (synced > 0 ? (double) stats.sync_bits / (double) synced : 0)
+                << " bits on average, " << stats.max_sync_bits << " max" << endl;
+            log << "  wasted work:   " << stats.wasted_symbols << " of " << stats.decoded_symbols << " symbols ("
+                << (stats.decoded_symbols > 0 ? 100.0 * (double) stats.wasted_symbols / (double) stats.decoded_symbols : 0)
+                << "%)" << endl;
+        }
+        return 0;
+    }
+
+    // incremental compression of a growing input: append <archive> <input_file> n_threads [--divergence=D]
+    if (argc > 1 && string(argv[1]) == "append") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " append <archive> <input_file> n_threads [--divergence="
+                 << APPEND_MAX_DIVERGENCE << "] [options]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 5);
+        run_options_t run_options;
+        if (!make_run_options(options, run_options)) return 1;
+        auto max_divergence = options.count("divergence") ? stod(options["divergence"]) : APPEND_MAX_DIVERGENCE;
+        append_result_t result;
+        long time_append;
+        {
+            utimer timer("append", &time_append);
+            append_file(argv[2], argv[3], stoul(argv[4]), max_divergence, run_options, result);
+        }
+        cout << result.new_bytes << " new bytes, " << result.n_blocks << " blocks appended in " << time_append
+             << " usec" << endl;
+        if (result.new_bytes > 0)
+            cout << "table divergence " << result.divergence << ", " << (result.new_table ? "new table" : "table reused")
+                 << ", " << result.n_tables << " tables in the archive" << endl;
+        return 0;
+    }
+
+    // one-pass compression of a stream, for pipelines: compress <input_file|-> <archive|-> n_threads [--divergence=D]
+    if (argc > 1 && string(argv[1]) == "compress") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " compress <input_file|-> <archive|-> n_threads [--divergence="
+                 << APPEND_MAX_DIVERGENCE << "] [options]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 5);
+        run_options_t run_options;
+        if (!make_run_options(options, run_options)) return 1;
+        auto max_divergence = options.count("divergence") ? stod(options["divergence"]) : APPEND_MAX_DIVERGENCE;
+        pipe_result_t result;
+        long time_compress;
+        {
+            utimer timer("compress", &time_compress);
+            compress_pipe(argv[2], argv[3], stoul(argv[4]), max_divergence, run_options, result);
+        }
+        // the archive may be on stdout: everything else goes to stderr
+        cerr << result.raw_size << " bytes compressed to " << result.comp_size << " in " << time_compress << " usec ("
+             << (time_compress > 0 ? (double) result.raw_size / (double) time_compress : 0) << " MB/s)" << endl;
+        cerr << result.n_blocks << " blocks in " << result.n_segments << " segments, " << result.n_tables << " tables"
+             << (result.streamed ? ", streamed archive" : "") << endl;
+        return 0;
+    }
+
+    // compressed-domain queries: count <archive> n_threads [--scan], search <archive> <pattern> n_threads
+    if (argc > 1 && string(argv[1]) == "count") {
+        if (argc < 4) {
+            cout << "Usage: " << argv[0] << " count <archive> n_threads [--scan]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 4);
+        bool from_trailer;
+        freq_table_t counts;
+        long time_count;
+        {
+            utimer timer("count", &time_count);
+            counts = count_file(argv[2], stoul(argv[3]), options.count("scan") > 0, from_trailer);
+        }
+        uint64_t total = 0;
+        for (int c = 0; c < 256; c++) {
+            if (counts[c] == 0) continue;
+            total += counts[c];
+            cout << c << "\t" << (isprint(c) ? string(1, (char) c) : "") << "\t" << counts[c] << endl;
+        }
+        cerr << total << " symbols counted in " << time_count << " usec ("
+             << (from_trailer ? "from the trailer" : "scanned") << ")" << endl;
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "search") {
+        if (argc < 5) {
+            cout << "Usage: " << argv[0] << " search <archive> <pattern> n_threads [--offsets=" << SEARCH_MAX_OFFSETS
+                 << "]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 5);
+        search_result_t result;
+        long time_search;
+        {
+            utimer timer("search", &time_search);
+            result = search_file(argv[2], argv[3], stoul(argv[4]),
+                                 options.count("offsets") ? stoul(options["offsets"]) : SEARCH_MAX_OFFSETS);
+        }
+        cout << result.n_matches << " matches" << endl;
+        for (auto offset: result.offsets) cout << offset << endl;
+        cerr << "searched in " << time_search << " usec: " << result.n_scanned << " blocks scanned compressed, "
+             << result.n_skipped << " skipped, "
+             << result.n_stored << " stored, " << result.n_decoded << " decoded" << endl;
+        return 0;
+    }
+
+    // integrity check: verify <archive> n_threads [--input=<original>]
+    if (argc > 1 && string(argv[1]) == "verify") {
+        if (argc < 4) {
+            cout << "Usage: " << argv[0] << " verify <archive> n_threads [--input=<original_file>]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 4);
+        string seq;
+        if (options.count("input")) seq = read_file(options["input"]);
+        uint64_t n_blocks, n_failed;
+        long time_verify;
+        {
+            utimer timer("verify", &time_verify);
+            n_failed = verify_file(argv[2], stoul(argv[3]), options.count("input") ? &seq : nullptr, n_blocks);
+        }
+        cout << n_blocks << " blocks checked" << endl;
+        return report_verification(n_failed, time_verify) ? 0 : 2;
+    }
+
+    // single-thread kernel throughput: kernels <input> [--reps=N]
+    if (argc > 1 && string(argv[1]) == "kernels") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " kernels <input_file> [--reps=5]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 3);
+        return run_kernels(argv[2], options.count("reps") ? max(1UL, stoul(options["reps"])) : KERNEL_REPS);
+    }
+
+    // in-process backend comparison: compare <input> [--exec=seq,map,ff,pf] [--threads=1,2,4] [--reps=5] [--warmup=1]
+    if (argc > 1 && string(argv[1]) == "compare") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " compare <input_file> [--exec=map,ff,pf] [--threads=1,2,4] [--reps="
+                 << COMPARE_REPS << "] [--warmup=" << COMPARE_WARMUP << "] [options]" << endl;
+            return 1;
+        }
+        auto options = parse_options(argc, argv, 3);
+        run_options_t run_options;
+        if (!make_run_options(options, run_options)) return 1;
+        return run_compare(argv[2], options.count("exec") ? options["exec"] : "map,ff,pf",
+                           options.count("threads") ? options["threads"] : to_string(thread::hardware_concurrency()),
+                           options.count("reps") ? stoul(options["reps"]) : COMPARE_REPS,
+                           options.count("warmup") ? stoul(options["warmup"]) : COMPARE_WARMUP, run_options);
+    }
+
     // take filename, nmappers, nreducers, nthreads from command line
+    if (argc < 6) {
+        cout << "Usage: " << argv[0] << " <input_file> n_mappers n_reducers n_encoders <seq|map|ff|pf|words|ans|ff-ans> [options]" << endl;
+        cout << "  --estimate: only count symbols and report entropy, archive size and ratio" << endl;
+        cout << "  --stored=<block|global|off>: fall back to raw stored blocks when coding does not pay off" << endl;
+        cout << "  --block-size=<bytes>: archive block size (pf uses its grain)" << endl;
+        cout << "  --read=<fused|serial>: map, pf and ff read and count the file in one parallel pread stage (default fused)" << endl;
+        cout << "  --direct: open the input with O_DIRECT for the fused read" << endl;
+        cout << "  --checkpoint=<symbols>: add a seek checkpoint every <symbols> inside each block (0 = block starts only)" << endl;
+        cout << "  --streams=<1..8>: split every Huffman block into interleaved sub-streams (default 1)" << endl;
+        cout << "  --pairs=<auto|on|off>: two-symbol encode table (auto: inputs of at least 1 MiB)" << endl;
+        cout << "  --coder=<huffman|ans>: entropy coder of the blocks; ans and ff-ans are map and ff with --coder=ans" << endl;
+        cout << "  --verify: decode the archive back in memory, in parallel, and compare it to the input" << endl;
+        cout << "  words: word-level codes (n_reducers shards the token counts); no --streams or --checkpoint" << endl;
+        cout << "Random access: " << argv[0] << " extract <archive> <offset> <length> [output_file]" << endl;
+        cout << "Decoding: " << argv[0] << " decode <archive> <output_file|-> n_threads [--speculative | --stream[=blocks]]" << endl;
+        cout << "Pipes: " << argv[0] << " compress <input_file|-> <archive|-> n_threads [--divergence=D] [options]" << endl;
+        cout << "Appending: " << argv[0] << " append <archive> <input_file> n_threads [--divergence=D] [options]" << endl;
+        cout << "Queries: " << argv[0] << " count <archive> n_threads [--scan] | search <archive> <pattern> n_threads [--offsets=N]" << endl;
+        cout << "Verifying: " << argv[0] << " verify <archive> n_threads [--input=<original_file>]" << endl;
+        cout << "Backend comparison: " << argv[0] << " compare <input_file> [--exec=map,ff,pf] [--threads=1,2,4] [--reps=5] [--warmup=1] [options]" << endl;
+        cout << "Kernel throughput: " << argv[0] << " kernels <input_file> [--reps=5]" << endl;
+        cout << "  pf options: --grain=<bytes> --sched=<static|dynamic>" << endl;
+        cout << "  ff options: --pin (pin every encoder to a core)" << endl;
+        return 1;
+    }
 
     string filename = argv[1];
     auto n_mappers = stoi(argv[2]);
     auto n_reducers = stoi(argv[3]);
     auto n_threads = stoi(argv[4]);
-    auto exec_type = string(argv[5]); //seq gmr ff
+    auto exec_type = string(argv[5]); //seq gmr ff pf
+    auto options = parse_options(argc, argv, 6);
+    // tANS exec types: the map and farm backends with the tANS coder
+    if (exec_type == "ans" || exec_type == "ff-ans") {
+        exec_type = exec_type == "ans" ? "map" : "ff";
+        options["coder"] = "ans";
+    }
+    auto estimate = options.count("estimate") > 0;
+
+    run_options_t run_options;
+    if (!make_run_options(options, run_options)) return 1;
 
 
     cout << "---------------------------------------------------------------" << endl;
@@ -24,18 +390,40 @@ int main(int argc, char** argv) {
 
     if (exec_type == "seq") {
         cout << "Running Huffman Sequential..." << endl;
-        HuffmanSequential huffman_sequential(filename);
-        huffman_sequential.run();
+        HuffmanSequential huffman_sequential(filename, run_options);
+        if (estimate) huffman_sequential.estimate();
+        else huffman_sequential.run();
     }
     else if (exec_type == "ff") {
         cout << "Running Huffman FastFlow..." << endl;
-        HuffmanMonode huffman_fastflow(n_mappers, n_threads, filename);
-        huffman_fastflow.run();
+        HuffmanMonode huffman_fastflow(n_mappers, n_threads, filename, run_options);
+        if (estimate) huffman_fastflow.estimate();
+        else huffman_fastflow.run();
+    }
+    else if (exec_type == "pf") {
+        auto grain = options.count("grain") ? stoul(options["grain"]) : PF_GRAIN;
+        auto dynamic = !options.count("sched") || options["sched"] != "static";
+        cout << "Running Huffman FastFlow ParallelFor (" << (dynamic ? "dynamic" : "static")
+             << ", grain " << grain << ")..." << endl;
+        HuffmanFastFlow huffman_parfor(n_mappers, n_reducers, n_threads, filename, grain, dynamic, run_options);
+        if (estimate) huffman_parfor.estimate();
+        else huffman_parfor.run();
     }
     else if (exec_type == "map") {
         cout << "Running Huffman Map-Parallel..." << endl;
-        HuffmanParallel huffman_parallel(n_mappers, n_threads, filename, n_reducers);
-        huffman_parallel.run();
+        HuffmanParallel huffman_parallel(n_mappers, n_threads, filename, n_reducers, run_options);
+        if (estimate) huffman_parallel.estimate();
+        else huffman_parallel.run();
+    }
+    else if (exec_type == "words") {
+        if (run_options.n_streams > 1 || run_options.checkpoint_interval > 0 || run_options.coder != CODER_HUFFMAN) {
+            cout << "words supports neither --streams, --checkpoint nor --coder" << endl;
+            return 1;
+        }
+        cout << "Running Huffman Words..." << endl;
+        HuffmanWords huffman_words(n_mappers, n_threads, filename, n_reducers, run_options);
+        if (estimate) huffman_words.estimate();
+        else huffman_words.run();
     } else {
         cout << "Invalid execution type" << endl;
         return 1;
@@ -1,15 +1,16 @@
 #include <fstream>
 #include "HuffmanSequential.h"
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-kernels.h"
 #include "../utils/utimer.cpp"
 
 using namespace std;
 
-HuffmanSequential::HuffmanSequential(const string &filename) {
+HuffmanSequential::HuffmanSequential(const string &filename, const run_options_t &options) {
 
     this->filename = filename;
-    this->seq = read_file(filename);
-    this->input = vector<char>(seq.begin(), seq.end());
+    this->options = options;
     this->codes = unordered_map<char, vector<bool>*>();
 }
 
@@ -19,21 +20,29 @@ HuffmanSequential::~HuffmanSequential() {
 }
 
 unordered_map<char, unsigned int> HuffmanSequential::generate_frequency() {
-    this->freq_map = unordered_map<char, unsigned>();
-    for (auto &c: seq) (freq_map)[c]++;
+    // count into flat arrays, the map is only built from the (at most 256) non-zero bins.
+    freq_table_t counts{};
+    count_symbols(seq.data(), seq.size(), counts);
+    this->freq_map = from_freq_table(counts);
     return freq_map;
 }
 
-vector<vector<bool>*> HuffmanSequential::encode() {
-    auto encoded = vector<vector<bool>*>();
-    encoded.reserve(seq.size());
-    for (char i: seq) {
-        encoded.push_back(codes[i]);
+archive_t HuffmanSequential::encode() {
+    auto archive = archive_t();
+    init_archive(archive, seq.size(), to_freq_table(freq_map), options.block_size, options.checkpoint_interval,
+                 options.n_streams);
+
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, seq.size()));
+    use_coder(archive, table, options.coder);
+    auto policy = resolve_store_policy(archive, table, options.store_mode);
+    for (size_t i = 0; i < archive.blocks.size(); i++) {
+        encode_archive_block(archive, i, seq.data(), table, policy);
     }
-    return encoded;
+    return archive;
 }
 
 void HuffmanSequential::run() {
+    alloc_stats_reset();
 
  /** frequency map generation **/
     long time_read, time_freqs, time_tree_codes, time_encoding, time_writing;
@@ -57,20 +66,45 @@ void HuffmanSequential::run() {
     /** encoding **/
     {
         utimer timer("", &time_encoding);
-        this->encoded_seq = encode();
+        this->archive = encode();
     }
 
     /** writing **/
     {
         utimer timer("", &time_writing);
-        write_to_file(this->encoded_seq, OUTPUT_FILE);
+        write_archive(this->archive, OUTPUT_FILE);
     }
 
-    // check file and print result in green if correct, red otherwise.
-    #ifdef CHKFILE
-        check_file(OUTPUT_FILE, seq, this->tree);
-    #endif
+    // decode the archive back and print the result in green if correct, red otherwise.
+    if (options.verify)
+        check_archive(this->archive, seq, 1);
+
+    unsigned n_huffman, n_stored;
+    count_blocks(this->archive, n_huffman, n_stored);
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, 1, 1, 1,
+                    options.coder == CODER_ANS ? "sequential-ans" : "sequential", n_huffman, n_stored, seq.size());
+
+}
+
+/* the in-memory phases of run(), on an input already loaded (compress_phases) */
+archive_t HuffmanSequential::compress(string &input, phase_times_t &times) {
+    return compress_phases(seq, input, times,
+                           [&]() { freq_map = generate_frequency(); return 0L; },
+                           [&]() { tree = generate_huffman_tree(freq_map); codes = generate_huffman_codes(tree); },
+                           [&]() { return encode(); });
+}
 
-    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, 1, 1, 1, "sequential");
+void HuffmanSequential::estimate() {
+    long time_read, time_freqs;
+    {
+        utimer timer("", &time_read);
+        this->seq = read_file(this->filename);
+    }
+
+    {
+        utimer timer("", &time_freqs);
+        this->freq_map = generate_frequency();
+    }
 
+    print_estimate(estimate_compression(seq, this->freq_map, options), time_read, time_freqs);
 }
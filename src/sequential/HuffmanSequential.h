@@ -9,27 +9,30 @@
 #include <chrono>
 #include <memory>
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
 
 using namespace std;
 
 class HuffmanSequential {
 private:
     string filename;
+    run_options_t options;
     string seq;
-    vector<char> input;
 
     unordered_map<char, unsigned> freq_map;
     unordered_map<char, vector<bool>*> codes;
-    vector<vector<bool> *> encoded_seq;
+    archive_t archive;
 
     Node* tree = nullptr;
-    vector<vector<bool>*> encode();
+    archive_t encode();
     unordered_map<char, unsigned> generate_frequency();
 
 public:
-    HuffmanSequential(const string& filename);
+    HuffmanSequential(const string& filename, const run_options_t &options = run_options_t());
     ~HuffmanSequential();
     void run();
+    void estimate();
+    archive_t compress(string &input, phase_times_t &times);
 
 };
 
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <ff/ff.hpp>
+
+#include "HuffmanServer.h"
+#include "protocol.h"
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-kernels.h"
+#include "../utils/utimer.cpp"
+
+using namespace std;
+using namespace ff;
+
+/** Encoding job the frozen farm works on; rewritten before every thaw. */
+struct FarmJob {
+    const char *data = nullptr;
+    size_t size = 0;
+    const code_table_t *table = nullptr;
+    archive_t *archive = nullptr;
+};
+
+struct BlockTask {
+    size_t block;
+};
+
+class JobEmitter : public ff_monode_t<BlockTask> {
+private:
+    FarmJob *job;
+    vector<BlockTask> tasks;    // reused across jobs, nothing is allocated per block
+
+public:
+    explicit JobEmitter(FarmJob *job) : job(job) {}
+
+    BlockTask *svc(BlockTask *) override {
+        auto n_blocks = job->archive->blocks.size();
+        if (tasks.size() < n_blocks) tasks.resize(n_blocks);
+        for (size_t i = 0; i < n_blocks; i++) {
+            tasks[i].block = i;
+            ff_send_out(&tasks[i]);
+        }
+        return EOS;
+    }
+};
+
+class BlockEncoder : public ff_node_t<BlockTask> {
+private:
+    FarmJob *job;
+
+public:
+    explicit BlockEncoder(FarmJob *job) : job(job) {}
+
+    BlockTask *svc(BlockTask *t) override {
+        encode_archive_block(*job->archive, t->block, job->data, *job->table, STORE_BLOCK);
+        return GO_ON;
+    }
+};
+
+/** Farm kept frozen between requests (run_then_freeze / wait_freezing). */
+struct WarmFarm {
+    FarmJob job;
+    JobEmitter emitter;
+    ff_Farm<BlockTask> farm;
+
+    static vector<unique_ptr<ff_node>> make_workers(FarmJob *job, size_t n) {
+        vector<unique_ptr<ff_node>> workers;
+        for (size_t i = 0; i < n; i++) workers.push_back(make_unique<BlockEncoder>(job));
+        return workers;
+    }
+
+    explicit WarmFarm(size_t n_encoders) : emitter(&job), farm(make_workers(&job, n_encoders)) {
+        farm.add_emitter(emitter);
+        farm.remove_collector();
+    }
+
+    void run(const char *data, size_t size, const code_table_t &table, archive_t &archive) {
+        job.data = data;
+        job.size = size;
+        job.table = &table;
+        job.archive = &archive;
+        if (farm.run_then_freeze() < 0) throw runtime_error("Could not start the encoder farm");
+        farm.wait_freezing();
+    }
+
+    ~WarmFarm() {
+        farm.wait();
+    }
+};
+
+
+HuffmanServer::HuffmanServer(string socket_path, size_t n_mappers, size_t n_encoders, bool use_farm)
+        : socket_path(std::move(socket_path)), n_mappers(max<size_t>(n_mappers, 1)),
+          n_encoders(max<size_t>(n_encoders, 1)), use_farm(use_farm), pool(max(n_mappers, n_encoders)) {
+    this->partial_freqs = vector<freq_table_t>(this->n_mappers);
+    this->latencies.reserve(STATS_WINDOW);
+    if (use_farm) this->farm = make_unique<WarmFarm>(this->n_encoders);
+}
+
+HuffmanServer::~HuffmanServer() {
+    stop();
+    for (auto &t: connections) t.join();
+    if (listen_fd >= 0) close(listen_fd);
+    unlink(socket_path.c_str());
+}
+
+/**
+ * Computes the histogram of a payload. Small payloads are counted on the calling thread:
+ * waking the pool costs more than counting a few KB.
+ */
+freq_table_t HuffmanServer::generate_frequency(const char *data, size_t size) {
+    freq_table_t result{};
+    if (size < SMALL_INPUT) {
+        count_symbols(data, size, result);
+        return result;
+    }
+
+    pool.parallel_for(n_mappers, [&](size_t tid) {
+        auto start = tid * (size / n_mappers);
+        auto end = (tid == n_mappers - 1) ? size : (tid + 1) * (size / n_mappers);
+        auto &partial = partial_freqs[tid];
+        partial.fill(0);
+        count_symbols(data + start, end - start, partial);
+    });
+    for (auto &partial: partial_freqs)
+        for (int c = 0; c < 256; c++) result[c] += partial[c];
+    return result;
+}
+
+void HuffmanServer::compress(const vector<unsigned char> &input, vector<unsigned char> &output) {
+    auto data = reinterpret_cast<const char *>(input.data());
+    auto size = input.size();
+
+    // blocks keep their buffers between requests, only the count changes.
+    init_archive(archive, size, generate_frequency(data, size));
+
+    auto tree = generate_huffman_tree(from_freq_table(archive.freqs));
+    auto codes = generate_huffman_codes(tree);
+    auto table = make_code_table(codes, use_pair_tables(PAIRS_AUTO, size));
+    free_codes(codes);
+    free_tree(tree);
+
+    auto n_blocks = archive.blocks.size();
+    if (n_blocks == 1) {
+        encode_archive_block(archive, 0, data, table, STORE_BLOCK);
+    } else if (use_farm) {
+        farm->run(data, size, table, archive);
+    } else {
+        pool.parallel_for(n_blocks, [&](size_t i) {
+            encode_archive_block(archive, i, data, table, STORE_BLOCK);
+        });
+    }
+
+    serialized.clear();
+    serialize_archive(archive, serialized);
+    output.assign(serialized.begin(), serialized.end());
+}
+
+void HuffmanServer::decompress(const vector<unsigned char> &input, vector<unsigned char> &output) {
+    auto index = parse_archive(input.data(), input.size());
+    output.resize(index.raw_size);
+    if (index.raw_size == 0) return;
+
+    auto tree = generate_huffman_tree(from_freq_table(index.freqs));
+    auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+    auto decode_one = [&](size_t i) {
+        auto &entry = index.entries[i];
+        decode_entry(input.data(), entry, decoder, reinterpret_cast<char *>(output.data()) + entry.raw_offset);
+    };
+    try {
+        if (index.entries.size() == 1) decode_one(0);
+        else pool.parallel_for(index.entries.size(), decode_one);
+    } catch (...) {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+}
+
+/**
+ * Frees the arena memory of the request just served (engine_mutex held). The arenas are only released
+ * wholesale (allocator.h), so the scratch blocks kept between requests are dropped first; connection
+ * buffers come from the heap and survive. With the other allocators the scratch is kept warm.
+ */
+void HuffmanServer::release_scratch() {
+#ifdef SPM_ALLOCATOR_ARENA
+    archive = archive_t();
+    serialized = bytes_t();
+    arena_release();
+#endif
+}
+
+void HuffmanServer::record(long us, size_t in, size_t out) {
+    unique_lock<mutex> lock(stats_mutex);
+    if (latencies.size() < STATS_WINDOW) latencies.push_back(us);
+    else latencies[n_requests % STATS_WINDOW] = us;
+    n_requests++;
+    bytes_in += in;
+    bytes_out += out;
+    busy_us += us;
+}
+
+/**
+ * Latency percentiles (over the last STATS_WINDOW requests) and throughput, as a JSON object.
+ */
+string HuffmanServer::stats() {
+    unique_lock<mutex> lock(stats_mutex);
+    auto sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) -> long {
+        if (sorted.empty()) return 0;
+        return sorted[min(sorted.size() - 1, (size_t) (p * (double) sorted.size()))];
+    };
+    auto uptime = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    auto allocs = alloc_stats();
+
+    ostringstream out;
+    out << "{\"requests\":" << n_requests
+        << ",\"compress\":" << n_compress
+        << ",\"decompress\":" << n_decompress
+        << ",\"errors\":" << n_errors
+        << ",\"bytes_in\":" << bytes_in
+        << ",\"bytes_out\":" << bytes_out
+        << ",\"p50_us\":" << percentile(0.50)
+        << ",\"p99_us\":" << percentile(0.99)
+        << ",\"max_us\":" << (sorted.empty() ? 0 : sorted.back())
+        << ",\"uptime_s\":" << uptime
+        << ",\"requests_per_s\":" << (uptime > 0 ? (double) n_requests / uptime : 0)
+        << ",\"throughput_mb_s\":" << (busy_us > 0 ? (double) bytes_in / (double) busy_us : 0)
+        << ",\"allocs\":" << (allocs.heap_counted ? to_string(allocs.allocs) : "null")
+        << ",\"peak_bytes\":" << (allocs.heap_counted ? to_string(allocs.peak_bytes) : "null")
+        << ",\"allocator\":\"" << allocator_name() << "\""
+        << ",\"engine\":\"" << (use_farm ? "ff" : "map") << "\""
+        << ",\"n_mappers\":" << n_mappers
+        << ",\"n_encoders\":" << n_encoders << "}";
+    return out.str();
+}
+
+void HuffmanServer::handle_connection(int fd) {
+    vector<unsigned char> request, response;     // not arena memory: they outlive the request
+    uint8_t op;
+
+    while (recv_message(fd, op, request)) {
+        if (op == OP_STATS) {
+            auto s = stats();
+            if (!send_message(fd, STATUS_OK, s.data(), s.size())) break;
+            continue;
+        }
+        if (op == OP_SHUTDOWN) {
+            send_message(fd, STATUS_OK, nullptr, 0);
+            stop();
+            break;
+        }
+
+        long elapsed = 0;
+        string error;
+        {
+            unique_lock<mutex> lock(engine_mutex);
+            utimer timer("request", &elapsed);
+            try {
+                if (op == OP_COMPRESS) compress(request, response);
+                else if (op == OP_DECOMPRESS) decompress(request, response);
+                else error = "Unknown operation";
+            } catch (const exception &e) {
+                error = e.what();
+            }
+            release_scratch();
+        }
+
+        if (!error.empty()) {
+            {
+                unique_lock<mutex> lock(stats_mutex);
+                n_errors++;
+            }
+            if (!send_message(fd, STATUS_ERROR, error.data(), error.size())) break;
+            continue;
+        }
+
+        {
+            unique_lock<mutex> lock(stats_mutex);
+            if (op == OP_COMPRESS) n_compress++;
+            else n_decompress++;
+        }
+        record(elapsed, request.size(), response.size());
+        if (!send_message(fd, STATUS_OK, response.data(), response.size())) break;
+    }
+
+    unique_lock<mutex> lock(conn_mutex);
+    connection_fds.erase(find(connection_fds.begin(), connection_fds.end(), fd));
+    finished.push_back(this_thread::get_id());
+    close(fd);
+}
+
+/* joins the handlers that are done with their connection, with conn_mutex held: a long-running server
+ * keeps one thread per open connection, not one per connection ever accepted */
+void HuffmanServer::reap_connections() {
+    for (auto id: finished) {
+        auto it = find_if(connections.begin(), connections.end(), [&](const thread &t) { return t.get_id() == id; });
+        if (it == connections.end()) continue;
+        it->join();     // it only has to return: conn_mutex is not needed anymore
+        connections.erase(it);
+    }
+    finished.clear();
+}
+
+void HuffmanServer::stop() {
+    if (!running.exchange(false)) return;
+    // wake up accept() and every connection blocked in recv()
+    if (listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+    unique_lock<mutex> lock(conn_mutex);
+    for (auto fd: connection_fds) shutdown(fd, SHUT_RDWR);
+}
+
+void HuffmanServer::serve() {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        throw runtime_error("Socket path too long: " + socket_path);
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) throw runtime_error("Could not create socket");
+    unlink(socket_path.c_str());
+    if (::bind(listen_fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0)
+        throw runtime_error("Could not listen on " + socket_path);
+
+    started = chrono::steady_clock::now();
+    running = true;
+    cout << "Listening on " << socket_path << " (" << (use_farm ? "ff" : "map") << " engine, "
+         << n_mappers << " mappers, " << n_encoders << " encoders)" << endl;
+
+    while (running) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        unique_lock<mutex> lock(conn_mutex);
+        if (!running) {
+            close(fd);
+            break;
+        }
+        reap_connections();
+        connection_fds.push_back(fd);
+        connections.emplace_back(&HuffmanServer::handle_connection, this, fd);
+    }
+    stop();
+    cout << "Server stats: " << stats() << endl;
+}
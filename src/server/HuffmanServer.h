@@ -0,0 +1,78 @@
+#ifndef SPM_PROJECT_HUFFMANSERVER_H
+#define SPM_PROJECT_HUFFMANSERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../thread/ThreadPool.h"
+#include "../utils/huffman-format.h"
+
+using namespace std;
+
+#define STATS_WINDOW 100000
+#define SMALL_INPUT (64 * 1024)
+
+struct WarmFarm;
+
+/**
+ * Long-running compression daemon listening on a Unix domain socket.
+ * Thread pool, FastFlow farm and scratch buffers are created once and reused by every request,
+ * so small payloads pay neither thread spawns nor farm construction.
+ * Requests are served one at a time on the warm workers; connections are handled concurrently.
+ */
+class HuffmanServer {
+private:
+    string socket_path;
+    size_t n_mappers;
+    size_t n_encoders;
+    bool use_farm;
+    int listen_fd = -1;
+    atomic<bool> running{false};
+
+    ThreadPool pool;
+    unique_ptr<WarmFarm> farm;
+
+    // the warm workers and scratch buffers below are shared: one job at a time.
+    mutex engine_mutex;
+    vector<freq_table_t> partial_freqs;
+    archive_t archive;
+    bytes_t serialized;
+
+    mutex conn_mutex;
+    vector<thread> connections;
+    vector<int> connection_fds;
+    vector<thread::id> finished;    // handlers of closed connections, joined by the accept loop
+
+    mutex stats_mutex;
+    vector<long> latencies;     // ring buffer of the last STATS_WINDOW request latencies (usec)
+    size_t n_requests = 0;
+    size_t n_compress = 0;
+    size_t n_decompress = 0;
+    size_t n_errors = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    long busy_us = 0;
+    chrono::steady_clock::time_point started;
+
+    void handle_connection(int fd);
+    void reap_connections();
+    void compress(const vector<unsigned char> &input, vector<unsigned char> &output);
+    void decompress(const vector<unsigned char> &input, vector<unsigned char> &output);
+    void release_scratch();
+    freq_table_t generate_frequency(const char *data, size_t size);
+    void record(long us, size_t in, size_t out);
+    string stats();
+    void stop();
+
+public:
+    HuffmanServer(string socket_path, size_t n_mappers, size_t n_encoders, bool use_farm);
+    ~HuffmanServer();
+    void serve();
+};
+
+#endif //SPM_PROJECT_HUFFMANSERVER_H
@@ -0,0 +1,144 @@
+/*
+ * Load generator for the compression server.
+ * Opens n_connections connections, each sending compress requests for random slices of the
+ * input file and decompressing every response to check the round trip.
+ *
+ * usage: spm_client <socket> <input_file> [n_requests] [n_connections] [payload_size] [shutdown]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+using namespace std;
+
+static int connect_to(const string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        cerr << "Could not connect to " << path << endl;
+        exit(1);
+    }
+    return fd;
+}
+
+static long percentile(vector<long> &v, double p) {
+    if (v.empty()) return 0;
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, (size_t) (p * (double) v.size()))];
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <socket> <input_file> [n_requests] [n_connections] [payload_size] [shutdown]"
+             << endl;
+        return 1;
+    }
+    string socket_path = argv[1];
+    size_t n_requests = argc > 3 ? stoul(argv[3]) : 1000;
+    size_t n_connections = argc > 4 ? stoul(argv[4]) : 1;
+    size_t payload_size = argc > 5 ? stoul(argv[5]) : 4096;
+    bool shutdown_after = argc > 6 && string(argv[6]) == "shutdown";
+
+    ifstream in(argv[2], ios::binary);
+    if (!in.is_open()) {
+        cerr << "Could not open file: " << argv[2] << endl;
+        return 1;
+    }
+    string input((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (input.empty()) {
+        cerr << "Empty input file" << endl;
+        return 1;
+    }
+    payload_size = min(payload_size, input.size());
+
+    mutex res_mutex;
+    vector<long> compress_lat, decompress_lat;
+    size_t failures = 0;
+    uint64_t bytes_raw = 0, bytes_compressed = 0;
+
+    auto client = [&](size_t cid) {
+        int fd = connect_to(socket_path);
+        mt19937_64 rng(cid);
+        vector<unsigned char> request, compressed, decompressed;
+        vector<long> c_lat, d_lat;
+        size_t fails = 0;
+        uint64_t raw = 0, comp = 0;
+        uint8_t status;
+
+        for (size_t r = cid; r < n_requests; r += n_connections) {
+            auto offset = rng() % (input.size() - payload_size + 1);
+            request.assign(input.begin() + (long) offset, input.begin() + (long) (offset + payload_size));
+
+            auto t0 = chrono::steady_clock::now();
+            if (!send_message(fd, OP_COMPRESS, request.data(), request.size()) ||
+                !recv_message(fd, status, compressed))
+                break;
+            auto t1 = chrono::steady_clock::now();
+            if (status != STATUS_OK) {
+                fails++;
+                continue;
+            }
+            if (!send_message(fd, OP_DECOMPRESS, compressed.data(), compressed.size()) ||
+                !recv_message(fd, status, decompressed))
+                break;
+            auto t2 = chrono::steady_clock::now();
+
+            c_lat.push_back(chrono::duration_cast<chrono::microseconds>(t1 - t0).count());
+            d_lat.push_back(chrono::duration_cast<chrono::microseconds>(t2 - t1).count());
+            if (status != STATUS_OK || decompressed != request) fails++;
+            raw += request.size();
+            comp += compressed.size();
+        }
+        close(fd);
+
+        unique_lock<mutex> lock(res_mutex);
+        compress_lat.insert(compress_lat.end(), c_lat.begin(), c_lat.end());
+        decompress_lat.insert(decompress_lat.end(), d_lat.begin(), d_lat.end());
+        failures += fails;
+        bytes_raw += raw;
+        bytes_compressed += comp;
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t i = 0; i < n_connections; i++) threads.emplace_back(client, i);
+    for (auto &t: threads) t.join();
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    auto n_done = compress_lat.size();
+    cout << "requests: " << n_done << " x (compress + decompress), " << n_connections << " connections, "
+         << payload_size << " bytes each" << endl;
+    cout << "compress   p50 " << percentile(compress_lat, 0.50) << " us, p99 " << percentile(compress_lat, 0.99)
+         << " us" << endl;
+    cout << "decompress p50 " << percentile(decompress_lat, 0.50) << " us, p99 " << percentile(decompress_lat, 0.99)
+         << " us" << endl;
+    cout << "throughput " << (double) n_done / elapsed << " round trips/s, "
+         << (double) bytes_raw / elapsed / 1e6 << " MB/s" << endl;
+    if (bytes_raw > 0) cout << "ratio " << (double) bytes_compressed / (double) bytes_raw << endl;
+    cout << "failures " << failures << endl;
+
+    int fd = connect_to(socket_path);
+    vector<unsigned char> response;
+    uint8_t status;
+    if (send_message(fd, OP_STATS, nullptr, 0) && recv_message(fd, status, response))
+        cout << "server: " << string(response.begin(), response.end()) << endl;
+    if (shutdown_after && send_message(fd, OP_SHUTDOWN, nullptr, 0)) recv_message(fd, status, response);
+    close(fd);
+
+    return failures == 0 ? 0 : 1;
+}
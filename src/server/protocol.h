@@ -0,0 +1,70 @@
+#ifndef SPM_PROJECT_PROTOCOL_H
+#define SPM_PROJECT_PROTOCOL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Wire format shared by the compression server and its clients.
+ * Every message is: u8 tag | u64 payload length (little endian) | payload.
+ * Requests carry an OP_* tag, responses a STATUS_* tag. Errors carry a text message.
+ */
+
+#define OP_COMPRESS 'C'
+#define OP_DECOMPRESS 'D'
+#define OP_STATS 'S'
+#define OP_SHUTDOWN 'Q'
+
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+
+#define MAX_MESSAGE_SIZE (1ULL << 34)
+
+inline bool send_all(int fd, const void *data, size_t len) {
+    auto p = static_cast<const char *>(data);
+    while (len > 0) {
+        auto n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void *data, size_t len) {
+    auto p = static_cast<char *>(data);
+    while (len > 0) {
+        auto n = ::recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline bool send_message(int fd, uint8_t tag, const void *payload, uint64_t len) {
+    unsigned char header[9];
+    header[0] = tag;
+    for (int i = 0; i < 8; i++) header[1 + i] = (unsigned char) (len >> (8 * i));
+    return send_all(fd, header, sizeof(header)) && (len == 0 || send_all(fd, payload, len));
+}
+
+/** Receives one message; payload is resized in place so its capacity is reused across calls. */
+template <typename Buffer>
+inline bool recv_message(int fd, uint8_t &tag, Buffer &payload) {
+    unsigned char header[9];
+    if (!recv_all(fd, header, sizeof(header))) return false;
+    tag = header[0];
+    uint64_t len = 0;
+    for (int i = 0; i < 8; i++) len |= (uint64_t) header[1 + i] << (8 * i);
+    if (len > MAX_MESSAGE_SIZE) return false;
+    payload.resize(len);
+    return len == 0 || recv_all(fd, payload.data(), len);
+}
+
+#endif //SPM_PROJECT_PROTOCOL_H
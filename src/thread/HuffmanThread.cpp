@@ -1,4 +1,5 @@
 #include <utility>
+#include <chrono>
 #include <iostream>
 #include <thread>
 #include <fstream>
@@ -10,27 +11,62 @@
 #include "HuffmanThread.h"
 #include "../utils/utimer.cpp"
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-io.h"
+#include "../utils/huffman-kernels.h"
 
-HuffmanParallel::HuffmanParallel(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers=0) {
+HuffmanParallel::HuffmanParallel(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers,
+                                 const run_options_t &options) {
     this->n_mappers = n_mappers;
+    this->options = options;
     this->n_encoders = n_encoders;
     this->n_reducers = n_reducers;
     this->filename = std::move(filename);
-    this->seq = read_file(this->filename);
     this->tree = nullptr;
 }
 
 HuffmanParallel::~HuffmanParallel() {
     if(tree) free_tree(this->tree);
-    free_encoding(*this->encoded);
     free_codes(this->codes);
 }
 
-/* sequential reduce version */
+/*
+ * Barrier between the map and the reduce of the histograms: the mappers wait for each other, then reduce
+ * the partial tables by columns (reduce_counts). Mappers past the last slice leave without waiting, so at most
+ * reduce_slices() threads are woken up. The last mapper to arrive starts the reduce clock.
+ */
+class ReduceBarrier {
+    mutex lock;
+    condition_variable all_counted;
+    size_t n_waiting;
+    chrono::system_clock::time_point reduce_start;
+
+public:
+    explicit ReduceBarrier(size_t n_mappers) : n_waiting(n_mappers) {}
+
+    /** Marks a mapper as done counting; with reduce set, waits for the others before returning. */
+    void arrive(bool reduce) {
+        unique_lock<mutex> guard(lock);
+        if (--n_waiting == 0) {
+            reduce_start = chrono::system_clock::now();
+            all_counted.notify_all();
+        } else if (reduce)
+            all_counted.wait(guard, [&] { return n_waiting == 0; });
+    }
+
+    /** usec since the reduce started, once every mapper is joined. */
+    long reduce_time() const {
+        return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now() - reduce_start).count();
+    }
+};
+
+/* map and column reduce, on the same threads */
 unordered_map<char, unsigned int> HuffmanParallel::generate_frequency() {
 
-    unordered_map<char, unsigned> partial_freqs[n_mappers]; // partial result array for each thread, using map fusion concept.
-    unordered_map<char, unsigned> result;                   // result to be returned
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{}); // partial result for each thread, using map fusion concept.
+    freq_table_t counts{};                                          // result, reduced by column slices
+    auto n_slices = reduce_slices(n_mappers);
+    ReduceBarrier barrier(n_mappers);
     vector<thread> thread_mappers(n_mappers);
 
     auto map_executor = [&](size_t tid) {
@@ -45,17 +81,56 @@ unordered_map<char, unsigned int> HuffmanParallel::generate_frequency() {
         // mapping phase.
         // note: instead of returning the tuple (char, 1) we return a map with the partial frequencies.
         // this will reduce the amount of data to be transferred to the reducers. (map fusion)
-        for (size_t i = start; i < end; i++) partial_freqs[tid][seq[i]]++;
+        // counting goes through a flat array: no hashing per byte.
+        count_symbols(seq.data() + start, end - start, partial_counts[tid]);
+
+        // reduce phase: the first n_slices mappers each sum their slice of the bins over all the partials.
+        barrier.arrive(tid < n_slices);
+        if (tid < n_slices) reduce_counts(partial_counts, tid, n_slices, counts);
     };
 
     // start the threads
     for (size_t i = 0; i < n_mappers; i++) thread_mappers[i] = thread(map_executor, i);
     for (auto &t: thread_mappers) t.join();
-    for (auto &partial_freq: partial_freqs) for (auto &it: partial_freq) result[it.first] += it.second;
+    time_reduce = barrier.reduce_time();
 
-    return result;
+    return from_freq_table(counts);
+}
+
+
+/**
+ * Fused read and map phase: every mapper preads its own range of the file into seq and counts it
+ * chunk by chunk, so reading is parallel and the bytes are counted while still in cache.
+ * The gmr version keeps the two phases, since its reducers would sit idle during the read anyway.
+ */
+unordered_map<char, unsigned> HuffmanParallel::read_and_count() {
+    auto file = open_input(filename, options.direct_io);
+    vector<freq_table_t> partial_counts(n_mappers, freq_table_t{});
+    freq_table_t counts{};
+    auto n_slices = reduce_slices(n_mappers);
+    ReduceBarrier barrier(n_mappers);
+    vector<thread> thread_mappers(n_mappers);
+    seq.resize(file.size);
+
+    auto read_executor = [&](size_t tid) {
+        auto start = read_split(file.size, tid, n_mappers);
+        auto end = read_split(file.size, tid + 1, n_mappers);
+        read_count_range(file, start, end, &seq[start], partial_counts[tid]);
+        barrier.arrive(tid < n_slices);
+        if (tid < n_slices) reduce_counts(partial_counts, tid, n_slices, counts);
+    };
+
+    for (size_t i = 0; i < n_mappers; i++) thread_mappers[i] = thread(read_executor, i);
+    for (auto &t: thread_mappers) t.join();
+    time_reduce = barrier.reduce_time();
+    close_input(file);
+
+    return from_freq_table(counts);
 }
 
+bool HuffmanParallel::fused_read() const {
+    return options.read_mode == READ_FUSED && n_reducers == 0;
+}
 
 /** 
  * Parallel reduce version, just for demonstration purposes only; justification may be found on the report
@@ -85,15 +160,14 @@ unordered_map<char, unsigned> HuffmanParallel::generate_frequency_gmr(){
         // mapping phase.
         // note: instead of returning the tuple (char, 1) we return a map with the partial frequencies.
         // this will reduce the amount of data to be transferred to the reducers.
-        for (size_t i = start; i < end; i++)
-        {
-            partial_freqs[tid][seq[i]]++;
-        }
+        freq_table_t counts{};
+        count_symbols(seq.data() + start, end - start, counts);
+        partial_freqs[tid] = from_freq_table(counts);
 
         // push the partial frequencies to the reducers queues.
         for (auto &it : partial_freqs[tid])
         {
-            auto red_id = it.first % n_reducers;
+            auto red_id = (unsigned char)it.first % n_reducers;
             unique_lock<mutex> lock(red_mutexes[red_id]);  // we need to lock the queues
             red_queues[red_id].emplace(it.first, it.second);
             red_conds[red_id].notify_one();
@@ -116,7 +190,7 @@ unordered_map<char, unsigned> HuffmanParallel::generate_frequency_gmr(){
                 pair = red_queues[nred].front();
                 red_queues[nred].pop();     
             }
-            if (pair.first == '\0') break;
+            if (pair.second == 0) break;   // end marker: real entries always have a count
             partial_res[pair.first] += pair.second; 
         }
 
@@ -136,6 +210,8 @@ unordered_map<char, unsigned> HuffmanParallel::generate_frequency_gmr(){
     for (auto &t : thread_mappers)
         t.join();
 
+    // the reducers drain their queues while the mappers run: the reduce time is what is left after them
+    utimer timer("reduce time", &time_reduce);
     // push nullptr to reducers
     for (size_t i = 0; i < n_reducers; i++)
     {
@@ -151,24 +227,26 @@ unordered_map<char, unsigned> HuffmanParallel::generate_frequency_gmr(){
 }
 
 
-encoded_t* HuffmanParallel::encode() {
+archive_t HuffmanParallel::encode() {
     vector<thread> thread_encoder(n_encoders);
-    auto size = seq.length();
-    auto results = new encoded_t (n_encoders);
-    
-    // executor body: it will compute chunk size and add the chunk to the vector of chunks
-    // no lock needed since splits are independent.
+    auto results = archive_t();
+    init_archive(results, seq.length(), to_freq_table(freq_map), options.block_size, options.checkpoint_interval,
+                 options.n_streams);
+    auto n_blocks = results.blocks.size();
+
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, seq.length()));
+    use_coder(results, table, options.coder);
+    auto policy = resolve_store_policy(results, table, options.store_mode);
+
+    // executor body: every encoder packs a contiguous range of blocks of the archive
+    // no lock needed since blocks are independent.
     auto encode_executor = [&](size_t tid) {
-        // split the sequence in chunks
-        auto start = tid * (size / n_encoders);
-        auto end = (tid + 1) * (size / n_encoders);
-        if (tid == n_encoders - 1) end = size;
-
-        // encode the chunk -> this will make memory allocation parallel
-        results->at(tid) = new chunk_t();
-        results->at(tid)->reserve(end - start);
+        auto start = tid * n_blocks / n_encoders;
+        auto end = (tid + 1) * n_blocks / n_encoders;
+
+        // encode the blocks -> this will make memory allocation parallel
         for (size_t i = start; i < end; i++) {
-            results->at(tid)->push_back(codes[seq[i]]);
+            encode_archive_block(results, i, seq.data(), table, policy);
         }
     };
 
@@ -178,18 +256,51 @@ encoded_t* HuffmanParallel::encode() {
     return results;
 }
 
+void HuffmanParallel::estimate() {
+    long time_read, time_freqs = 0;
+    unordered_map<char, unsigned> freqs;
+    if (fused_read()) {
+        utimer timer("read+freqs time", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("read time", &time_read);
+            this->seq = read_file(this->filename);
+        }
+        utimer timer("freqs time", &time_freqs);
+        if (n_reducers>0) freqs = generate_frequency_gmr();
+        else freqs = generate_frequency();
+    }
+
+    print_estimate(estimate_compression(seq, freqs, options, n_encoders), time_read, time_freqs);
+}
+
+/* the in-memory phases of run(), on an input already loaded (compress_phases) */
+archive_t HuffmanParallel::compress(string &input, phase_times_t &times) {
+    return compress_phases(seq, input, times,
+                           [&]() {
+                               freq_map = n_reducers > 0 ? generate_frequency_gmr() : generate_frequency();
+                               return time_reduce;
+                           },
+                           [&]() { tree = generate_huffman_tree(freq_map); codes = generate_huffman_codes(tree); },
+                           [&]() { return encode(); });
+}
+
 void HuffmanParallel::run() {
+    alloc_stats_reset();
 
     /** frequency map generation **/
-    long time_read;
-    {
-        utimer timer("read time", &time_read);
-        this->seq = read_file(this->filename);
-    }
-
-    long time_freqs;
+    // fused: the whole stage is accounted as read time, time_freqs stays 0
+    long time_read, time_freqs = 0;
     unordered_map<char, unsigned> freqs;
-    {
+    if (fused_read()) {
+        utimer timer("read+freqs time", &time_read);
+        freqs = read_and_count();
+    } else {
+        {
+            utimer timer("read time", &time_read);
+            this->seq = read_file(this->filename);
+        }
         utimer timer("freqs time", &time_freqs);
         if (n_reducers>0) freqs = generate_frequency_gmr();
         else freqs = generate_frequency();
@@ -199,6 +310,7 @@ void HuffmanParallel::run() {
     long time_tree_codes;
     {
         utimer timer("tree codes time", &time_tree_codes);
+        this->freq_map = freqs;
         this->tree = generate_huffman_tree(freqs);
         this->codes = generate_huffman_codes(tree);
     }
@@ -208,21 +320,22 @@ void HuffmanParallel::run() {
     long time_encoding;
     {
         utimer timer("encoding time", &time_encoding);
-        this->encoded = encode();
+        this->archive = encode();
     }
     /** writing **/
     long time_writing;
     {
         utimer timer("writing time", &time_writing);
-        write_to_file(*encoded, OUTPUT_FILE);
+        write_archive(archive, OUTPUT_FILE);
     }
 
-    //check file and print result in green if correct, red otherwise.
-    #ifdef CHKFILE
-    check_file(OUTPUT_FILE, seq, this->tree);
-    #endif  
+    //decode the archive back in parallel and print the result in green if correct, red otherwise.
+    if (options.verify) check_archive(archive, seq, n_encoders);
+    unsigned n_huffman, n_stored;
+    count_blocks(archive, n_huffman, n_stored);
     auto type = n_reducers > 0 ? TYPE_GMR + to_string(n_reducers): TYPE_MAP;
-    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, n_reducers, n_encoders, type);
+    if (options.coder == CODER_ANS) type += TYPE_ANS_SUFFIX;
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, n_reducers, n_encoders, type, n_huffman, n_stored, seq.length(), time_reduce);
 }
 
 
@@ -8,6 +8,7 @@
 #include <string>
 #include <memory>
 #include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
 
 using namespace std;
 
@@ -17,21 +18,28 @@ class HuffmanParallel {
         size_t n_reducers;
         size_t n_encoders;
         string filename;
+        run_options_t options;
         string seq;
 
         Node* tree{};
         unordered_map<char, unsigned> freq_map;
         unordered_map<char, code_t*> codes;
-        encoded_t* encoded;
-        encoded_t* encode();
+        archive_t archive;
+        long time_reduce = 0;   // merge of the partial histograms, part of the freqs (or fused read) phase
+        archive_t encode();
         unordered_map<char, unsigned> generate_frequency();
         unordered_map<char, unsigned> generate_frequency_gmr();
+        unordered_map<char, unsigned> read_and_count();
+        bool fused_read() const;
 
     public:
         // for the sequential reducer version
-        HuffmanParallel(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers);
+        HuffmanParallel(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers = 0,
+                        const run_options_t &options = run_options_t());
         ~HuffmanParallel();
         void run();
+        void estimate();
+        archive_t compress(string &input, phase_times_t &times);
 
 };
 
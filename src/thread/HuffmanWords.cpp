@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include "HuffmanWords.h"
+#include "../utils/utimer.cpp"
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-kernels.h"
+#include "../utils/huffman-words.h"
+#include "../utils/crc32c.h"
+
+HuffmanWords::HuffmanWords(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers,
+                           const run_options_t &options) {
+    this->n_mappers = max<size_t>(1, n_mappers);
+    this->n_encoders = max<size_t>(1, n_encoders);
+    // one shard per reducer; without reducers the mappers merge the shards themselves
+    this->n_reducers = n_reducers > 0 ? n_reducers : this->n_mappers;
+    this->filename = std::move(filename);
+    this->options = options;
+}
+
+size_t HuffmanWords::shard_of(string_view token) const {
+    return hash<string_view>{}(token) % n_reducers;
+}
+
+/* symbols by increasing count, ties by token so the code does not depend on the number of threads */
+static bool by_count(const word_symbol_t &a, const word_symbol_t &b) {
+    return a.count != b.count ? a.count < b.count : a.token < b.token;
+}
+
+/**
+ * Token counting: every mapper tokenizes a token-aligned range into one local table per shard,
+ * then every reducer merges its shard from all the mappers. Tokens are views into seq.
+ */
+void HuffmanWords::generate_frequency() {
+    vector<vector<token_map_t>> partial(n_mappers, vector<token_map_t>(n_reducers));
+    vector<thread> thread_mappers(n_mappers);
+    vector<thread> thread_reducers(n_reducers);
+    auto data = seq.data();
+    auto size = seq.size();
+
+    auto map_executor = [&](size_t tid) {
+        auto start = token_boundary(data, size, tid * size / n_mappers);
+        auto end = token_boundary(data, size, (tid + 1) * size / n_mappers);
+        auto &local = partial[tid];
+        for (auto p = start; p < end;) {
+            auto q = token_end(data, p, end);
+            string_view token(data + p, q - p);
+            local[shard_of(token)][token]++;
+            p = q;
+        }
+    };
+
+    // merge in place into the largest table of the shard, the others are freed as they are consumed
+    auto reduce_executor = [&](size_t r) {
+        size_t largest = 0;
+        for (size_t m = 1; m < n_mappers; m++)
+            if (partial[m][r].size() > partial[largest][r].size()) largest = m;
+        auto &result = shards[r];
+        result = std::move(partial[largest][r]);
+        for (size_t m = 0; m < n_mappers; m++) {
+            if (m == largest) continue;
+            for (auto &it: partial[m][r]) result[it.first] += it.second;
+            token_map_t().swap(partial[m][r]);
+        }
+    };
+
+    shards.assign(n_reducers, token_map_t());
+    for (size_t i = 0; i < n_mappers; i++) thread_mappers[i] = thread(map_executor, i);
+    for (auto &t: thread_mappers) t.join();
+    for (size_t i = 0; i < n_reducers; i++) thread_reducers[i] = thread(reduce_executor, i);
+    for (auto &t: thread_reducers) t.join();
+}
+
+/**
+ * Code lengths: every reducer sorts its shard by count, the sorted runs are merged pairwise in parallel
+ * (log2(n_reducers) rounds), and the lengths are computed in place on the merged order.
+ */
+void HuffmanWords::generate_lengths() {
+    vector<vector<word_symbol_t>> runs(n_reducers);
+    vector<thread> threads(n_reducers);
+
+    auto sort_executor = [&](size_t r) {
+        auto &run = runs[r];
+        run.reserve(shards[r].size());
+        for (auto &it: shards[r]) run.push_back({it.first, it.second, 0, &it.second});
+        sort(run.begin(), run.end(), by_count);
+    };
+    for (size_t i = 0; i < n_reducers; i++) threads[i] = thread(sort_executor, i);
+    for (auto &t: threads) t.join();
+
+    while (runs.size() > 1) {
+        vector<vector<word_symbol_t>> merged((runs.size() + 1) / 2);
+        vector<thread> mergers;
+        for (size_t k = 0; k + 1 < runs.size(); k += 2)
+            mergers.emplace_back([&, k]() {
+                auto &out = merged[k / 2];
+                out.resize(runs[k].size() + runs[k + 1].size());
+                merge(runs[k].begin(), runs[k].end(), runs[k + 1].begin(), runs[k + 1].end(), out.begin(), by_count);
+                vector<word_symbol_t>().swap(runs[k]);
+                vector<word_symbol_t>().swap(runs[k + 1]);
+            });
+        if (runs.size() % 2) merged.back() = std::move(runs.back());
+        for (auto &t: mergers) t.join();
+        runs = std::move(merged);
+    }
+    symbols = runs.empty() ? vector<word_symbol_t>() : std::move(runs[0]);
+    code_lengths(symbols);
+}
+
+/**
+ * Canonical order (by length, then token): the symbols are bucketed by length and the buckets sorted in
+ * parallel. Every shard entry then gets its symbol index, and the dictionary is serialized.
+ */
+void HuffmanWords::generate_codes() {
+    unsigned max_len = 0;
+    for (auto &s: symbols) max_len = max<unsigned>(max_len, s.len);
+    vector<vector<word_symbol_t>> buckets(max_len + 1);
+    for (auto &s: symbols) buckets[s.len].push_back(s);
+
+    // the longest codes are the most numerous: take the buckets from the last one
+    atomic<long> next_len((long) max_len);
+    vector<thread> threads(n_reducers);
+    auto sort_executor = [&]() {
+        for (long len; (len = next_len--) > 0;)
+            sort(buckets[len].begin(), buckets[len].end(),
+                 [](const word_symbol_t &a, const word_symbol_t &b) { return a.token < b.token; });
+    };
+    for (auto &t: threads) t = thread(sort_executor);
+    for (auto &t: threads) t.join();
+
+    symbols.clear();
+    for (auto &bucket: buckets) symbols.insert(symbols.end(), bucket.begin(), bucket.end());
+    for (size_t i = 0; i < symbols.size(); i++) *symbols[i].slot = i;
+    canonical_codes(symbols, codes);
+    archive.dictionary.clear();
+    if (!symbols.empty()) serialize_dictionary(symbols, archive.dictionary);
+}
+
+/* appends the codes of ids, n_bits in total, LSB first; codes can be up to 64 bits long */
+static void pack_words(const vector<uint64_t> &ids, const vector<packed_code_t> &codes, uint64_t n_bits,
+                       bytes_t &out) {
+    out.resize((n_bits + 7) / 8);
+    auto dst = out.data();
+    uint64_t acc = 0;
+    unsigned fill = 0;
+    for (auto id: ids) {
+        auto &code = codes[id];
+        acc |= code.bits << fill;
+        if (fill + code.len < 64) {
+            fill += code.len;
+            continue;
+        }
+        for (int k = 0; k < 8; k++) *dst++ = (unsigned char) (acc >> (8 * k));
+        acc = fill > 0 ? code.bits >> (64 - fill) : 0;
+        fill = fill + code.len - 64;
+    }
+    for (unsigned k = 0; k < fill; k += 8) *dst++ = (unsigned char) (acc >> k);
+}
+
+/* encoded size of the whole input with the word codes, dictionary excluded */
+uint64_t HuffmanWords::word_bits() const {
+    uint64_t n_bits = 0;
+    for (size_t i = 0; i < symbols.size(); i++) n_bits += symbols[i].count * codes[i].len;
+    return n_bits;
+}
+
+/**
+ * Byte-level codes for the fallback: the mappers count the bytes of their range, the tree is built from
+ * the sum as in the byte-level backends.
+ * @return the encoded size of the whole input with these codes, in bits.
+ */
+uint64_t HuffmanWords::generate_byte_codes() {
+    vector<freq_table_t> partials(n_mappers, freq_table_t{});
+    vector<thread> thread_mappers(n_mappers);
+    auto data = seq.data();
+    auto size = seq.size();
+    for (size_t i = 0; i < n_mappers; i++)
+        thread_mappers[i] = thread([&, i]() {
+            auto start = i * size / n_mappers, end = (i + 1) * size / n_mappers;
+            count_symbols(data + start, end - start, partials[i]);
+        });
+    for (auto &t: thread_mappers) t.join();
+
+    byte_freqs.fill(0);
+    for (auto &partial: partials)
+        for (int c = 0; c < 256; c++) byte_freqs[c] += partial[c];
+    auto tree = generate_huffman_tree(from_freq_table(byte_freqs));
+    auto byte_codes = generate_huffman_codes(tree);
+    byte_table = make_code_table(byte_codes, use_pair_tables(options.pair_mode, size));
+    free_codes(byte_codes);
+    free_tree(tree);
+    return histogram_bits(byte_freqs, byte_table);
+}
+
+/**
+ * Whether the word codes plus the dictionary are smaller than the byte-level codes (or the raw bytes,
+ * when those would be stored); inputs with few repeated tokens carry a dictionary as large as the savings.
+ */
+bool HuffmanWords::use_words() {
+    auto word_bytes = (word_bits() + 7) / 8 + archive.dictionary.size();
+    auto byte_bytes = min<uint64_t>((generate_byte_codes() + 7) / 8, seq.size());
+    return word_bytes < byte_bytes;
+}
+
+/**
+ * The byte-level fallback: fixed-size blocks coded with the byte codes, every encoder a contiguous range.
+ */
+archive_t HuffmanWords::encode_bytes() {
+    auto results = archive_t();
+    init_archive(results, seq.size(), byte_freqs, options.block_size, options.checkpoint_interval,
+                 options.n_streams);
+    use_coder(results, byte_table, options.coder);
+    auto policy = resolve_store_policy(results, byte_table, options.store_mode);
+    auto n_blocks = results.blocks.size();
+
+    vector<thread> thread_encoder(n_encoders);
+    for (size_t i = 0; i < n_encoders; i++)
+        thread_encoder[i] = thread([&, i]() {
+            for (auto b = i * n_blocks / n_encoders; b < (i + 1) * n_blocks / n_encoders; b++)
+                encode_archive_block(results, b, seq.data(), byte_table, policy);
+        });
+    for (auto &t: thread_encoder) t.join();
+    return results;
+}
+
+/**
+ * Encodes token-aligned blocks of about block_size bytes, every encoder a contiguous range of them.
+ * Incompressible blocks are stored as with the byte-level coder.
+ */
+archive_t HuffmanWords::encode() {
+    auto results = archive_t();
+    auto data = seq.data();
+    auto size = seq.size();
+    init_archive(results, size, freq_table_t{}, options.block_size);
+    results.dictionary = archive.dictionary;
+
+    vector<uint64_t> bounds{0};
+    while (bounds.back() < size) bounds.push_back(token_boundary(data, size, bounds.back() + options.block_size));
+    auto n_blocks = bounds.size() - 1;
+    results.blocks.assign(n_blocks, block_t());
+
+    // the dictionary is part of the cost of coding the whole input
+    auto policy = options.store_mode;
+    if (policy == STORE_GLOBAL)
+        policy = worth_encoding(word_bits() + 8 * results.dictionary.size(), size) ? STORE_OFF : STORE_ALL;
+
+    vector<thread> thread_encoder(n_encoders);
+    auto encode_executor = [&](size_t tid) {
+        vector<uint64_t> ids;
+        for (auto i = tid * n_blocks / n_encoders; i < (tid + 1) * n_blocks / n_encoders; i++) {
+            auto start = bounds[i], end = bounds[i + 1];
+            auto &block = results.blocks[i];
+            block.raw_len = end - start;
+            block.crc = crc32c(data + start, block.raw_len);
+
+            uint64_t n_bits = 0;
+            ids.clear();
+            if (policy != STORE_ALL)
+                for (auto p = start; p < end;) {
+                    auto q = token_end(data, p, end);
+                    string_view token(data + p, q - p);
+                    auto id = shards[shard_of(token)].find(token)->second;
+                    ids.push_back(id);
+                    n_bits += codes[id].len;
+                    p = q;
+                }
+            if (policy == STORE_ALL || (policy == STORE_BLOCK && !worth_encoding(n_bits, block.raw_len))) {
+                block.kind = BLOCK_STORED;
+                block.data.assign(data + start, data + end);
+                continue;
+            }
+            block.kind = BLOCK_HUFFMAN;
+            block.n_bits = n_bits;
+            pack_words(ids, codes, n_bits, block.data);
+        }
+    };
+
+    for (size_t i = 0; i < n_encoders; i++) thread_encoder[i] = thread(encode_executor, i);
+    for (auto &t: thread_encoder) t.join();
+    return results;
+}
+
+void HuffmanWords::estimate() {
+    long time_read, time_freqs;
+    {
+        utimer timer("read time", &time_read);
+        this->seq = read_file(this->filename);
+    }
+    {
+        utimer timer("freqs time", &time_freqs);
+        generate_frequency();
+    }
+    generate_lengths();
+    generate_codes();
+
+    uint64_t n_tokens = 0, huffman_bits = 0;
+    for (size_t i = 0; i < symbols.size(); i++) {
+        n_tokens += symbols[i].count;
+        huffman_bits += symbols[i].count * codes[i].len;
+    }
+    double entropy = 0;
+    for (auto &s: symbols) {
+        auto p = (double) s.count / (double) n_tokens;
+        entropy -= p * log2(p);
+    }
+    auto word_bytes = (huffman_bits + 7) / 8 + archive.dictionary.size();
+    auto byte_bytes = min<uint64_t>((generate_byte_codes() + 7) / 8, seq.size());
+    auto output_bytes = min(word_bytes, byte_bytes);
+    cout << "Estimate (word-level, nothing encoded or written):" << endl;
+    cout << "  input size:     " << seq.size() << " bytes, " << n_tokens << " tokens, " << symbols.size()
+         << " distinct" << endl;
+    cout << "  entropy:        " << entropy << " bits/token" << endl;
+    cout << "  huffman:        " << (n_tokens > 0 ? (double) huffman_bits / (double) n_tokens : 0)
+         << " bits/token, " << huffman_bits << " bits" << endl;
+    cout << "  dictionary:     " << archive.dictionary.size() << " bytes" << endl;
+    cout << "  byte-level:     " << byte_bytes << " bytes" << (word_bytes < byte_bytes ? "" : " (used instead)")
+         << endl;
+    cout << "  expected ratio: " << (seq.empty() ? 0 : (double) output_bytes / (double) seq.size()) << endl;
+    cout << "  time read:      " << time_read << " usec, time freqs: " << time_freqs << " usec" << endl;
+}
+
+void HuffmanWords::run() {
+    alloc_stats_reset();
+
+    long time_read;
+    {
+        utimer timer("read time", &time_read);
+        this->seq = read_file(this->filename);
+    }
+
+    /** tokenize and count **/
+    long time_freqs;
+    {
+        utimer timer("freqs time", &time_freqs);
+        generate_frequency();
+    }
+
+    /** code lengths, canonical codes and dictionary **/
+    long time_tree_codes;
+    {
+        utimer timer("tree codes time", &time_tree_codes);
+        generate_lengths();
+        generate_codes();
+    }
+    cout << symbols.size() << " distinct tokens, dictionary " << archive.dictionary.size() << " bytes" << endl;
+
+    long time_encoding;
+    {
+        utimer timer("encoding time", &time_encoding);
+        if (use_words()) {
+            this->archive = encode();
+        } else {
+            cout << "word codes and dictionary exceed the byte-level codes, encoding bytes" << endl;
+            this->archive = encode_bytes();
+        }
+    }
+
+    long time_writing;
+    {
+        utimer timer("writing time", &time_writing);
+        write_archive(archive, OUTPUT_FILE);
+    }
+
+    if (options.verify) check_archive(archive, seq, n_encoders);
+    unsigned n_huffman, n_stored;
+    count_blocks(archive, n_huffman, n_stored);
+    write_benchmark(time_read, time_freqs, time_tree_codes, time_encoding, time_writing, n_mappers, n_reducers,
+                    n_encoders, TYPE_WORDS, n_huffman, n_stored, seq.size());
+}
@@ -0,0 +1,58 @@
+#ifndef SPM_PROJECT_HUFFMANWORDS_H
+#define SPM_PROJECT_HUFFMANWORDS_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../utils/huffman-commons.h"
+#include "../utils/huffman-format.h"
+#include "../utils/huffman-words.h"
+
+using namespace std;
+
+/** Occurrences of the tokens of one shard; once codes are assigned, the symbol index of every token. */
+typedef unordered_map<string_view, uint64_t> token_map_t;
+
+/**
+ * Word-level Huffman on threads, with the mapper/reducer structure of HuffmanParallel:
+ * mappers tokenize their range into one table per shard, reducers merge a shard each from all the
+ * mappers and sort it by count, the sorted shards are merged pairwise in parallel and the code lengths
+ * computed in place from the merged order (huffman-words.h). Encoders pack token-aligned blocks, or
+ * byte-level blocks when the word codes plus the dictionary would not beat them.
+ */
+class HuffmanWords {
+    private:
+        size_t n_mappers;
+        size_t n_reducers;
+        size_t n_encoders;
+        string filename;
+        run_options_t options;
+        string seq;
+
+        vector<token_map_t> shards;         // token -> count, then token -> symbol index
+        vector<word_symbol_t> symbols;      // in canonical order once the codes are assigned
+        vector<packed_code_t> codes;
+        archive_t archive;
+        freq_table_t byte_freqs{};          // byte-level fallback
+        code_table_t byte_table;
+
+        size_t shard_of(string_view token) const;
+        void generate_frequency();
+        void generate_lengths();
+        void generate_codes();
+        uint64_t word_bits() const;
+        uint64_t generate_byte_codes();
+        bool use_words();
+        archive_t encode();
+        archive_t encode_bytes();
+
+    public:
+        HuffmanWords(size_t n_mappers, size_t n_encoders, string filename, size_t n_reducers = 0,
+                     const run_options_t &options = run_options_t());
+        void run();
+        void estimate();
+
+};
+
+#endif //SPM_PROJECT_HUFFMANWORDS_H
@@ -0,0 +1,63 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t n_workers) {
+    if (n_workers == 0) n_workers = 1;
+    workers.reserve(n_workers);
+    for (size_t i = 0; i < n_workers; i++) workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        unique_lock<mutex> lock(mtx);
+        stopping = true;
+    }
+    job_cond.notify_all();
+    for (auto &t: workers) t.join();
+}
+
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    while (true) {
+        const function<void(size_t)> *job;
+        size_t total;
+        {
+            unique_lock<mutex> lock(mtx);
+            job_cond.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            job = body;
+            total = n_tasks;
+        }
+
+        // grab tasks until the job is drained; a throwing task drains it at once
+        exception_ptr thrown;
+        try {
+            for (size_t i = next_task.fetch_add(1); i < total; i = next_task.fetch_add(1)) (*job)(i);
+        } catch (...) {
+            thrown = current_exception();
+            next_task = total;
+        }
+
+        unique_lock<mutex> lock(mtx);
+        if (thrown && !error) error = thrown;
+        if (--active == 0) done_cond.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(size_t tasks, const function<void(size_t)> &f) {
+    if (tasks == 0) return;
+    unique_lock<mutex> lock(mtx);
+    body = &f;
+    n_tasks = tasks;
+    next_task = 0;
+    active = workers.size();
+    generation++;
+    job_cond.notify_all();
+    done_cond.wait(lock, [&]() { return active == 0; });
+    body = nullptr;
+    if (error) {
+        auto thrown = error;
+        error = nullptr;
+        rethrow_exception(thrown);
+    }
+}
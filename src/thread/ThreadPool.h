@@ -0,0 +1,53 @@
+#ifndef SPM_PROJECT_THREADPOOL_H
+#define SPM_PROJECT_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Fixed-size pool of persistent workers.
+ * Threads are spawned once and parked on a condition variable between jobs, so repeated
+ * map phases (e.g. one per server request) do not pay thread creation every time.
+ * Only one job runs at a time: parallel_for blocks until every task of the job is done.
+ * A task that throws ends its job early; the exception reaches the caller of parallel_for.
+ */
+class ThreadPool {
+private:
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable job_cond;
+    condition_variable done_cond;
+
+    const function<void(size_t)> *body = nullptr;
+    size_t n_tasks = 0;
+    atomic<size_t> next_task{0};
+    size_t active = 0;          // workers still running the current job
+    unsigned long generation = 0;
+    bool stopping = false;
+    exception_ptr error;        // first exception thrown by a task of the current job
+
+    void worker_loop();
+
+public:
+    explicit ThreadPool(size_t n_workers);
+    ~ThreadPool();
+
+    size_t size() const { return workers.size(); }
+
+    /**
+     * Runs body(0) ... body(n_tasks - 1) on the pool and waits for all of them.
+     * Tasks are handed out dynamically, so n_tasks may be larger than the pool size.
+     * If a task throws, the tasks not started yet are skipped and the first exception is
+     * rethrown here once every worker is done with the job.
+     */
+    void parallel_for(size_t n_tasks, const function<void(size_t)> &body);
+};
+
+#endif //SPM_PROJECT_THREADPOOL_H
@@ -0,0 +1,251 @@
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "allocator.h"
+
+using namespace std;
+
+/* ---------------------------------------------------------------- arenas */
+
+struct arena_t {
+    char *cur = nullptr;
+    char *end = nullptr;
+    unsigned long generation = 0;
+};
+
+static thread_local arena_t local_arena;
+
+static mutex regions_mutex;
+static vector<pair<void *, size_t>> regions;        // every mapping, of every thread
+static atomic<unsigned long> arena_generation{1};   // bumped by arena_release()
+
+static atomic<uint64_t> arena_allocs{0};
+static atomic<uint64_t> arena_bytes{0};
+static atomic<uint64_t> arena_mapped{0};
+static atomic<uint64_t> arena_huge{0};
+
+/**
+ * Maps a new region for an arena. With SPM_HUGEPAGES, explicit huge pages are tried first and
+ * transparent huge pages are requested on the fallback mapping.
+ */
+static char *map_region(size_t &size)
+{
+    void *p = MAP_FAILED;
+#if defined(SPM_HUGEPAGES) && defined(MAP_HUGETLB)
+    auto huge_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    p = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+    {
+        size = huge_size;
+        arena_huge += size;
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw bad_alloc();
+#if defined(SPM_HUGEPAGES) && defined(MADV_HUGEPAGE)
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+    arena_mapped += size;
+
+    unique_lock<mutex> lock(regions_mutex);
+    regions.emplace_back(p, size);
+    return static_cast<char *>(p);
+}
+
+/**
+ * Bump allocation from the calling thread's arena.
+ * @param size the number of bytes.
+ * @param align the required alignment (power of two).
+ * @return memory valid until the next arena_release().
+ */
+void *arena_allocate(size_t size, size_t align)
+{
+    auto &arena = local_arena;
+    auto generation = arena_generation.load(memory_order_acquire);
+    if (arena.generation != generation)
+    {
+        // regions were released since this thread last allocated
+        arena.cur = arena.end = nullptr;
+        arena.generation = generation;
+    }
+
+    arena_allocs.fetch_add(1, memory_order_relaxed);
+    arena_bytes.fetch_add(size, memory_order_relaxed);
+
+    // big buffers get a region of their own, so the current one is not wasted.
+    if (size > ARENA_REGION_SIZE / 4)
+    {
+        auto region_size = size;
+        return map_region(region_size);
+    }
+
+    auto p = (char *)(((uintptr_t)arena.cur + align - 1) & ~(uintptr_t)(align - 1));
+    if (arena.cur == nullptr || p + size > arena.end)
+    {
+        size_t region_size = ARENA_REGION_SIZE;
+        arena.cur = map_region(region_size);
+        arena.end = arena.cur + region_size;
+        p = arena.cur;
+    }
+    arena.cur = p + size;
+    return p;
+}
+
+/**
+ * Unmaps the regions of every arena. Nothing allocated through arena_allocator may be used
+ * afterwards; threads notice the release on their next allocation.
+ */
+void arena_release()
+{
+    unique_lock<mutex> lock(regions_mutex);
+    for (auto &region : regions)
+        munmap(region.first, region.second);
+    regions.clear();
+    arena_generation.fetch_add(1, memory_order_release);
+    arena_mapped = 0;
+    arena_huge = 0;
+}
+
+/* ------------------------------------------------------------ heap stats */
+
+static atomic<uint64_t> n_allocs{0};
+static atomic<uint64_t> n_frees{0};
+static atomic<uint64_t> live_bytes{0};
+static atomic<uint64_t> peak_bytes{0};
+
+#ifdef SPM_ALLOC_STATS
+
+static inline size_t usable_size(void *p)
+{
+#ifdef __APPLE__
+    return malloc_size(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+static inline void count_alloc(void *p)
+{
+    n_allocs.fetch_add(1, memory_order_relaxed);
+    auto size = usable_size(p);
+    auto live = live_bytes.fetch_add(size, memory_order_relaxed) + size;
+    auto peak = peak_bytes.load(memory_order_relaxed);
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, memory_order_relaxed));
+}
+
+static inline void count_free(void *p)
+{
+    n_frees.fetch_add(1, memory_order_relaxed);
+    live_bytes.fetch_sub(usable_size(p), memory_order_relaxed);
+}
+
+static inline void *counted_alloc(size_t size, size_t align)
+{
+    void *p = nullptr;
+    if (align <= alignof(max_align_t))
+        p = malloc(size ? size : 1);
+    else if (posix_memalign(&p, align, size ? size : 1) != 0)
+        p = nullptr;
+    if (p)
+        count_alloc(p);
+    return p;
+}
+
+static inline void counted_free(void *p)
+{
+    if (!p)
+        return;
+    count_free(p);
+    free(p);
+}
+
+void *operator new(size_t size)
+{
+    auto p = counted_alloc(size, 0);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+    return counted_alloc(size, 0);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+    return counted_alloc(size, 0);
+}
+
+void *operator new(size_t size, align_val_t align)
+{
+    auto p = counted_alloc(size, (size_t)align);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size, align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void operator delete(void *p) noexcept { counted_free(p); }
+void operator delete[](void *p) noexcept { counted_free(p); }
+void operator delete(void *p, size_t) noexcept { counted_free(p); }
+void operator delete[](void *p, size_t) noexcept { counted_free(p); }
+void operator delete(void *p, align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, align_val_t) noexcept { counted_free(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { counted_free(p); }
+
+#endif
+
+/** Starts a new measurement: counters go to zero, the peak restarts from what is live now. */
+void alloc_stats_reset()
+{
+    n_allocs = 0;
+    n_frees = 0;
+    peak_bytes = live_bytes.load();
+    arena_allocs = 0;
+    arena_bytes = 0;
+}
+
+alloc_stats_t alloc_stats()
+{
+    return {n_allocs.load(), n_frees.load(), peak_bytes.load(), arena_allocs.load(),
+            arena_bytes.load(), arena_mapped.load(), arena_huge.load(),
+#ifdef SPM_ALLOC_STATS
+            true};
+#else
+            false};
+#endif
+}
+
+const char *allocator_name()
+{
+#if defined(SPM_ALLOCATOR_ARENA)
+    return "arena";
+#elif defined(SPM_ALLOCATOR_JEMALLOC)
+    return "jemalloc";
+#else
+    return "system";
+#endif
+}
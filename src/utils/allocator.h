@@ -0,0 +1,85 @@
+#ifndef SPM_PROJECT_ALLOCATOR_H
+#define SPM_PROJECT_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Allocator layer, selected at configure time with -DSPM_ALLOCATOR=system|jemalloc|arena.
+ *
+ *  - system / jemalloc: spm_allocator<T> is std::allocator<T>; jemalloc is simply linked in
+ *    place of the libc malloc.
+ *  - arena: spm_allocator<T> hands out memory from a per-thread bump arena backed by mmap
+ *    (optionally huge pages, -DSPM_HUGEPAGES=ON). Deallocation is a no-op: the hot-path buffers
+ *    (block and output buffers) live until arena_release() unmaps everything at once.
+ *    One-shot runs leave that to process exit; the long-lived loops call it whenever none of
+ *    their arena memory is live: the server after every request, compare after every run and
+ *    the pipe compressor after every segment.
+ *
+ * With SPM_ALLOC_STATS the global operator new/delete are replaced by counting wrappers, so every
+ * run can report how many allocations it made and its peak heap usage.
+ */
+
+#define ARENA_REGION_SIZE (64UL << 20)
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+using namespace std;
+
+struct alloc_stats_t {
+    uint64_t allocs;        // operator new calls
+    uint64_t frees;         // operator delete calls
+    uint64_t peak_bytes;    // peak heap bytes live (operator new) since the last reset
+    uint64_t arena_allocs;  // allocations served by the arenas
+    uint64_t arena_bytes;   // bytes handed out by the arenas
+    uint64_t arena_mapped;  // bytes mapped for the arenas
+    uint64_t arena_huge;    // bytes mapped with MAP_HUGETLB
+    bool heap_counted;      // false without SPM_ALLOC_STATS: allocs, frees and peak_bytes are not tracked
+};
+
+void *arena_allocate(size_t size, size_t align);
+
+void arena_release();
+
+void alloc_stats_reset();
+
+alloc_stats_t alloc_stats();
+
+const char *allocator_name();
+
+/** STL allocator drawing from the calling thread's arena. */
+template <typename T>
+struct arena_allocator {
+    typedef T value_type;
+
+    arena_allocator() noexcept = default;
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena_allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) noexcept {}
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &) const noexcept { return false; }
+};
+
+#ifdef SPM_ALLOCATOR_ARENA
+template <typename T>
+using spm_allocator = arena_allocator<T>;
+#else
+template <typename T>
+using spm_allocator = std::allocator<T>;
+#endif
+
+/** Vector for the hot-path buffers (encoded blocks, output bytes). */
+template <typename T>
+using spm_vector = vector<T, spm_allocator<T>>;
+
+#endif //SPM_PROJECT_ALLOCATOR_H
@@ -0,0 +1,66 @@
+#include <array>
+#include <cstring>
+
+#include "crc32c.h"
+
+using namespace std;
+
+#define CRC32C_POLY 0x82f63b78U     // reversed Castagnoli polynomial
+
+/* table[k][b]: the CRC of byte b followed by k zero bytes */
+static array<array<uint32_t, 256>, 8> make_tables() {
+    array<array<uint32_t, 256>, 8> table{};
+    for (uint32_t b = 0; b < 256; b++) {
+        auto crc = b;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++)
+        for (int k = 1; k < 8; k++) table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+    return table;
+}
+
+static uint32_t crc32c_table(const unsigned char *p, size_t n, uint32_t crc) {
+    static const auto table = make_tables();
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        v ^= crc;
+        crc = table[7][v & 0xff] ^ table[6][(v >> 8) & 0xff] ^ table[5][(v >> 16) & 0xff] ^
+              table[4][(v >> 24) & 0xff] ^ table[3][(v >> 32) & 0xff] ^ table[2][(v >> 40) & 0xff] ^
+              table[1][(v >> 48) & 0xff] ^ table[0][v >> 56];
+    }
+    for (; n > 0; p++, n--) crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const unsigned char *p, size_t n, uint32_t crc) {
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+    }
+    for (; n > 0; p++, n--) c = __builtin_ia32_crc32qi((uint32_t) c, *p);
+    return (uint32_t) c;
+}
+#endif
+
+/**
+ * CRC32C of n bytes.
+ * @param crc the CRC of the bytes before, to checksum a sequence in pieces.
+ */
+uint32_t crc32c(const void *data, size_t n, uint32_t crc) {
+    auto p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42) return ~crc32c_sse42(p, n, crc);
+#endif
+    return ~crc32c_table(p, n, crc);
+}
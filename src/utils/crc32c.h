@@ -0,0 +1,15 @@
+#ifndef SPM_PROJECT_CRC32C_H
+#define SPM_PROJECT_CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * CRC32C (Castagnoli), the checksum of every archive block. On x86-64 CPUs with SSE4.2 it runs on the
+ * crc32 instruction, 8 bytes at a time; elsewhere on a slicing-by-8 table.
+ * The CPU is checked at run time, so the binary needs no -msse4.2.
+ */
+
+uint32_t crc32c(const void *data, size_t n, uint32_t crc = 0);
+
+#endif //SPM_PROJECT_CRC32C_H
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "huffman-ans.h"
+#include "huffman-kernels.h"
+
+using namespace std;
+
+static unsigned floor_log2(uint32_t v) {
+    return 31 - __builtin_clz(v);
+}
+
+/*
+ * counts scaled to sum to 1 << table_log, every symbol that occurs keeping at least 1. The slots left over
+ * by rounding down go, one at a time, where they save the most bits (f log2((n + 1) / n)); slots missing
+ * because of the forced 1s are taken where they cost the least.
+ */
+static void normalize(const freq_table_t &freqs, unsigned table_log, array<uint32_t, 256> &norm) {
+    uint64_t total = 0;
+    for (auto f: freqs) total += f;
+    norm.fill(0);
+    if (total == 0) return;
+
+    auto size = 1L << table_log;
+    long sum = 0;
+    for (int c = 0; c < 256; c++)
+        if (freqs[c] > 0) {
+            norm[c] = max<uint32_t>(1, (uint32_t) ((double) freqs[c] * (double) size / (double) total));
+            sum += norm[c];
+        }
+    for (; sum < size; sum++) {
+        int best = -1;
+        double best_gain = -1;
+        for (int c = 0; c < 256; c++)
+            if (freqs[c] > 0) {
+                auto gain = (double) freqs[c] * log2((norm[c] + 1.0) / norm[c]);
+                if (gain > best_gain) best_gain = gain, best = c;
+            }
+        norm[best]++;
+    }
+    for (; sum > size; sum--) {
+        int best = -1;
+        double best_loss = 0;
+        for (int c = 0; c < 256; c++)
+            if (norm[c] > 1) {
+                auto loss = (double) freqs[c] * log2((double) norm[c] / (norm[c] - 1.0));
+                if (best < 0 || loss < best_loss) best_loss = loss, best = c;
+            }
+        if (best < 0) throw runtime_error("Alphabet too large for the tANS table");
+        norm[best]--;
+    }
+}
+
+/**
+ * Builds the tANS tables of a histogram.
+ * @param freqs the symbol counts, as stored in the archive trailer.
+ * @param table_log log2 of the number of states.
+ */
+ans_table_t make_ans_table(const freq_table_t &freqs, unsigned table_log) {
+    ans_table_t table;
+    table.table_log = table_log;
+    normalize(freqs, table_log, table.norm);
+    uint32_t size = 1U << table_log;
+    for (int c = 1; c < 256; c++) table.cumul[c] = table.cumul[c - 1] + table.norm[c - 1];
+    for (int c = 0; c < 256; c++)
+        if (table.norm[c] > 0) {
+            table.max_bits[c] = (uint8_t) (table_log - floor_log2(table.norm[c]));
+            table.threshold[c] = table.norm[c] << table.max_bits[c];
+        }
+
+    // spread the symbols over the states; the step is odd, so it visits every state once
+    vector<uint8_t> spread(size);
+    uint32_t step = (size >> 1) + (size >> 3) + 3, pos = 0;
+    for (int c = 0; c < 256; c++)
+        for (uint32_t k = 0; k < table.norm[c]; k++) {
+            spread[pos] = (uint8_t) c;
+            pos = (pos + step) & (size - 1);
+        }
+
+    // the k-th state of symbol c, in state order, is reached from y = norm[c] + k
+    table.encode.assign(size, 0);
+    table.decode.assign(size, 0);
+    array<uint32_t, 256> next = table.norm;
+    for (uint32_t x = 0; x < size; x++) {
+        auto c = spread[x];
+        auto y = next[c]++;
+        table.encode[table.cumul[c] + y - table.norm[c]] = (uint16_t) (size + x);
+        auto bits = table_log - floor_log2(y);
+        table.decode[x] = c | bits << 8 | ((y << bits) - size) << 16;
+    }
+    return table;
+}
+
+/**
+ * Size in bits of the tANS coding of the whole input, from its histogram (to within a bit per block).
+ */
+uint64_t ans_histogram_bits(const freq_table_t &freqs, const ans_table_t &table) {
+    double bits = 0;
+    for (int c = 0; c < 256; c++)
+        if (freqs[c] > 0) bits += (double) freqs[c] * (table.table_log - log2((double) table.norm[c]));
+    return (uint64_t) ceil(bits) + table.table_log;
+}
+
+/**
+ * Runs the coder over a block, last symbol first, without writing anything yet.
+ * @param scratch receives the bits of every symbol (value | count << 16, in symbol order) and, last,
+ * the final state.
+ * @return the size of the coded block in bits.
+ */
+uint64_t ans_encode_symbols(const char *data, size_t n, const ans_table_t &table, vector<uint32_t> &scratch) {
+    scratch.resize(n + 1);
+    uint32_t x = 1U << table.table_log;
+    uint64_t n_bits = table.table_log;
+    for (size_t i = n; i-- > 0;) {
+        auto c = (unsigned char) data[i];
+        if (table.norm[c] == 0) throw runtime_error("Symbol missing from the tANS table");
+        unsigned bits = table.max_bits[c] - (x < table.threshold[c]);
+        scratch[i] = (x & ((1U << bits) - 1)) | bits << 16;
+        n_bits += bits;
+        x = table.encode[table.cumul[c] + (x >> bits) - table.norm[c]];
+    }
+    scratch[n] = x - (1U << table.table_log);
+    return n_bits;
+}
+
+/**
+ * Appends a block prepared by ans_encode_symbols, in decoding order.
+ */
+void ans_pack(const vector<uint32_t> &scratch, size_t n, uint64_t n_bits, const ans_table_t &table, bytes_t &out) {
+    auto base = out.size();
+    out.resize(base + (n_bits + 7) / 8);
+    auto dst = out.data() + base;
+    uint64_t acc = scratch[n];
+    unsigned fill = table.table_log;
+    for (size_t i = 0; i < n; i++) {
+        acc |= (uint64_t) (scratch[i] & 0xffff) << fill;
+        fill += scratch[i] >> 16;
+        if (fill >= 32) {
+            for (int k = 0; k < 4; k++) *dst++ = (unsigned char) (acc >> (8 * k));
+            acc >>= 32;
+            fill -= 32;
+        }
+    }
+    for (unsigned k = 0; k < fill; k += 8) *dst++ = (unsigned char) (acc >> k);
+}
+
+/**
+ * Encodes a block with tANS, appending the bits to out.
+ * @return the number of bits written.
+ */
+uint64_t ans_encode(const char *data, size_t n, const ans_table_t &table, bytes_t &out) {
+    vector<uint32_t> scratch;
+    auto n_bits = ans_encode_symbols(data, n, table, scratch);
+    ans_pack(scratch, n, n_bits, table, out);
+    return n_bits;
+}
+
+/**
+ * Decodes n_out symbols of a tANS block.
+ * @param data the encoded bytes.
+ * @param n_bits the number of meaningful bits.
+ * @param table the tables rebuilt from the archive histogram.
+ * @param out destination buffer, at least n_out bytes.
+ * @param n_out the number of symbols to decode.
+ * @return the bits consumed.
+ */
+uint64_t ans_decode(const unsigned char *data, uint64_t n_bits, const ans_table_t &table, char *out, size_t n_out) {
+    auto n_bytes = (n_bits + 7) / 8;
+    auto decode = table.decode.data();
+    uint64_t mask = (1ULL << table.table_log) - 1;
+    if (n_bits < table.table_log) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+    auto x = peek_bits(data, n_bytes, 0) & mask;
+    uint64_t pos = table.table_log;
+    for (size_t i = 0; i < n_out; i++) {
+        auto entry = decode[x];
+        auto bits = (entry >> 8) & 0xff;
+        out[i] = (char) (entry & 0xff);
+        x = (entry >> 16) + (peek_bits(data, n_bytes, pos) & ((1ULL << bits) - 1));
+        pos += bits;
+    }
+    if (pos > n_bits) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+    return pos;
+}
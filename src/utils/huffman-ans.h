@@ -0,0 +1,50 @@
+#ifndef SPM_PROJECT_HUFFMAN_ANS_H
+#define SPM_PROJECT_HUFFMAN_ANS_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "huffman-format.h"
+
+/*
+ * Table-based asymmetric numeral system (tANS, as in FSE), the alternative entropy coder of the archives
+ * with ARCHIVE_FLAG_ANS. Huffman spends a whole number of bits per symbol; tANS spends fractional ones,
+ * which matters on skewed histograms, and decodes with one branchless lookup per symbol.
+ *
+ * The counts are normalized to sum to L = 2^ANS_TABLE_LOG and the symbols spread over the L states.
+ * Both tables are rebuilt from the frequency table of the trailer, so the archive carries nothing else.
+ * tANS is last in, first out: a block is encoded from its last symbol to its first, and the bits are
+ * laid out in decoding order, LSB first:
+ *   final state (ANS_TABLE_LOG bits) | bits of symbol 0 | bits of symbol 1 | ...
+ * The decoder reads the state, then alternates a lookup (symbol, bit count, next base) and a read.
+ */
+
+#define ANS_TABLE_LOG 13
+
+using namespace std;
+
+/** Normalized counts and coding tables of one histogram. */
+struct ans_table_t {
+    unsigned table_log = ANS_TABLE_LOG;
+    array<uint32_t, 256> norm{};        // normalized counts, summing to 1 << table_log (0 if absent)
+    array<uint32_t, 256> cumul{};       // sum of the norms of the symbols before
+    array<uint32_t, 256> threshold{};   // states at or above shift out max_bits, the others one bit less
+    array<uint8_t, 256> max_bits{};
+    vector<uint16_t> encode;            // cumul[s] + y - norm[s] -> next state, y in [norm[s], 2 norm[s])
+    vector<uint32_t> decode;            // state - L -> symbol | bits << 8 | next base << 16
+};
+
+ans_table_t make_ans_table(const freq_table_t &freqs, unsigned table_log = ANS_TABLE_LOG);
+
+uint64_t ans_histogram_bits(const freq_table_t &freqs, const ans_table_t &table);
+
+uint64_t ans_encode_symbols(const char *data, size_t n, const ans_table_t &table, vector<uint32_t> &scratch);
+
+void ans_pack(const vector<uint32_t> &scratch, size_t n, uint64_t n_bits, const ans_table_t &table, bytes_t &out);
+
+uint64_t ans_encode(const char *data, size_t n, const ans_table_t &table, bytes_t &out);
+
+uint64_t ans_decode(const unsigned char *data, uint64_t n_bits, const ans_table_t &table, char *out, size_t n_out);
+
+#endif //SPM_PROJECT_HUFFMAN_ANS_H
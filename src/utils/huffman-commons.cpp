@@ -2,57 +2,40 @@
 // Created by Luca Miglior on 22/07/23.
 //
 
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <queue>
+#include <algorithm>
+#include <stdexcept>
 
 #include "../utils/huffman-commons.h"
 
 using namespace std;
 
-/**
- * Decodes a sequence of bits using a Huffman tree.
- * Clearly not built for efficiency, but for simplicity.
- * @param encoded the sequence of bits to decode.
- * @param root the root of the Huffman tree.
- * @return string the decoded sequence.
- */
-string decode(const vector<bool> &encoded, const Node *root)
-{
-    std::string decoded = "";
-    auto node = root;
-    for (auto b : encoded)
-    {
-        if (b)
-            node = node->right;
-        else
-            node = node->left;
-
-        if (node->c != '\0')
-        {
-            // append the character to the decoded string and reset the node to the root.
-            decoded.push_back(node->c);
-            node = root;
-        }
-    }
-    return decoded;
-}
-
 /**
  * Generates a Huffman tree from a frequency map.
+ * Leaves are pushed in symbol order, so the same frequencies always give the same tree:
+ * this is what lets a decoder rebuild the codes from the frequency table stored in an archive.
  * @param freqs the frequency map.
- * @return Node* the root of the Huffman tree.
+ * @return Node* the root of the Huffman tree, nullptr if the map is empty.
  */
 Node *generate_huffman_tree(const unordered_map<char, unsigned> &freqs)
 {
+    if (freqs.empty())
+        return nullptr;
 
     // instantiating a priority queue to store the nodes, ordered by frequency.
     auto q = priority_queue<Node *, vector<Node *>, Compare>();
 
-    for (auto &it : freqs)
+    auto symbols = vector<pair<char, unsigned>>(freqs.begin(), freqs.end());
+    sort(symbols.begin(), symbols.end(), [](const pair<char, unsigned> &a, const pair<char, unsigned> &b) {
+        return (unsigned char)a.first < (unsigned char)b.first;
+    });
+    for (auto &it : symbols)
         q.push(new Node(it.first, it.second, nullptr, nullptr));
 
     while (q.size() != 1)
@@ -81,6 +64,15 @@ unordered_map<char, vector<bool> *> generate_huffman_codes(Node *root)
     auto codes = unordered_map<char, vector<bool> *>();
     auto q = queue<pair<Node *, vector<bool>>>();
 
+    if (root == nullptr)
+        return codes;
+    // a tree made of a single leaf still needs one bit per symbol.
+    if (is_leaf(root))
+    {
+        codes[root->c] = new vector<bool>(1, false);
+        return codes;
+    }
+
     q.emplace(root, vector<bool>());
 
     // traversing the tree iteratively, using a queue.
@@ -91,7 +83,7 @@ unordered_map<char, vector<bool> *> generate_huffman_codes(Node *root)
         auto code = elem.second;
         q.pop();
 
-        if (node->c != '\0')
+        if (is_leaf(node))
             (codes)[node->c] = new vector<bool>(code);
 
         if (node->left != nullptr)
@@ -113,180 +105,24 @@ unordered_map<char, vector<bool> *> generate_huffman_codes(Node *root)
 }
 
 /**
- * Reads the file and returns the sequence of characters.
+ * Reads the whole file and returns the sequence of characters.
  * @param filename the name of the file to read.
  * @return the sequence of characters.
  */
 std::string read_file(const std::string &filename)
 {
-    std::ifstream in(filename);
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
     std::string seq;
 
     if (!in.is_open())
         throw std::runtime_error("Could not open file: " + filename);
-    getline(in, seq);
+    seq.resize(in.tellg());
+    in.seekg(0);
+    in.read(&seq[0], (std::streamsize)seq.size());
     in.close();
     return seq;
 }
 
-/**
- * Reads the encoded file and returns a vector of bits.
- * @param filename the name of the file to read.
- * @return a vector of bits. The last n bits are discarded, where n is the header.
- */
-std::vector<bool> *read_encoded_file(const std::string &filename)
-{
-
-    std::ifstream in(filename, std::ios::binary);
-    auto encoded = new std::vector<bool>();
-
-    if (!in.is_open())
-        throw std::runtime_error("Could not open file: " + filename);
-
-    // first byte is the header, which contains the number of bits to discard from the last byte.
-    char header;
-    in.get(header);
-
-    char c;
-    while (in.get(c))
-    {
-        std::bitset<8> bits(c);
-        for (int i = 0; i < 8; i++)
-            encoded->push_back(bits[i]);
-    }
-
-    // discard the last n bits, where n is the header.
-    encoded->erase(encoded->end() - int(header), encoded->end());
-    in.close();
-    return encoded;
-}
-
-/**
- * Checks if the decoded sequence is equal to the original sequence.
- * @param filename the name of the file to read.
- * @param seq the original sequence.
- * @param root the root of the Huffman tree.
- * @return true if the decoded sequence is equal to the original sequence, false otherwise.
- */
-bool check_file(const string &filename, const string &seq, const Node *root)
-{
-    // read the file and decode it to string
-    auto encoded = read_encoded_file(filename);
-    auto decoded = decode(*encoded, root);
-
-
-    if (seq == decoded)
-        cout << "\033[1;32m> File is correct!\033[0m" << endl;
-    else
-        cout << "\033[1;31mWrong!\033[0m" << endl;
-
-    auto val = (seq == decoded);
-    delete encoded;
-    return val;
-}
-
-
-/**
- * Writes the encoded sequence to a file, grouping bits into bytes to write an effective compression.
- * First byte is the header, which contains the number of bits to discard from the last byte, if the number of bits
- * is not a multiple of 8.
- *
- * @param encoded the encoded sequence (vector of vectors of bools).
- * @param filename the name of the file to write to.
- */
-void write_to_file(std::vector<std::vector<bool> *> &encoded, const std::string &filename)
-{
-    std::ofstream out(filename, std::ios::binary);
-    if (!out.is_open())
-        throw std::runtime_error("Could not open file: " + filename);
-
-    // convert the sequence of bits to bytes and write them to the file.
-    // now we have a vector of vectors of bools, so we need to iterate over the vector of vectors.
-
-    std::vector<unsigned char> bytes;
-    int bitsWritten = 0;
-    int totalWritten = 0;
-    unsigned char byte = 0;
-
-    for (const auto &vec : encoded)
-    {
-        for (auto bit : *vec)
-        {
-            byte |= (bit << bitsWritten);
-            bitsWritten++;
-            totalWritten++; // needed for final padding and header
-            if (bitsWritten == 8)
-            {
-                bytes.push_back(byte);
-                byte = 0;
-                bitsWritten = 0;
-            }
-        }
-    }
-
-    // Handle padding
-    if (bitsWritten > 0)
-        bytes.push_back(byte);
-    unsigned char header = 8 - (totalWritten % 8);
-    if (header == 8)
-        header = 0;
-
-    // writing a header which contains the number of bits to discard from the last byte.
-    out << char(header);
-    out.write(reinterpret_cast<const char *>(bytes.data()), (long)bytes.size());
-    out.close();
-}
-
-
-
-// same function but working on the nested version of the encoding (the one generated from the parallel code)
-void write_to_file(encoded_t &encoded, const std::string &filename)
-{
-    std::ofstream out(filename, std::ios::binary);
-    if (!out.is_open())
-        throw std::runtime_error("Could not open file: " + filename);
-
-    // convert the sequence of bits to bytes and write them to the file.
-    // now we have a vector of vectors of bools, so we need to iterate over the vector of vectors.
-
-    std::vector<unsigned char> bytes;
-    int bitsWritten = 0;
-    int totalWritten = 0;
-    unsigned char byte = 0;
-
-    for (const auto &chunk : encoded)
-    {
-        for (const auto &vec : *chunk)
-        {
-            for (auto bit : *vec)
-            {
-                byte |= (bit << bitsWritten);
-                bitsWritten++;
-                totalWritten++;
-                if (bitsWritten == 8)
-                {
-                    bytes.push_back(byte);
-                    byte = 0;
-                    bitsWritten = 0;
-                }
-            }
-        }
-    }
-
-    // Handle padding
-    if (bitsWritten > 0)
-        bytes.push_back(byte);
-    unsigned char header = 8 - (totalWritten % 8);
-    if (header == 8)
-        header = 0;
-
-    // writing a header which contains the number of bits to discard from the last byte.
-    out << char(header);
-    out.write(reinterpret_cast<const char *>(bytes.data()), (long)bytes.size());
-    out.close();
-}
-
-
 /**
  * Frees the memory allocated for the Huffman tree.
  * @param root the root of the Huffman tree.
@@ -320,13 +156,28 @@ void free_codes(unordered_map<char, vector<bool> *> &codes)
     }
 }
 
-void free_encoding(encoded_t &encoding)
+/**
+ * Moves an existing benchmark file aside when its header is not BENCHMARK_HEADER (it was written by a
+ * version with other columns), to the first free benchmark.csv.N, so rows are never appended under the
+ * wrong columns. The next row starts a new file.
+ */
+static void rotate_benchmark_file()
 {
-    for (auto &chunk : encoding){
-        delete chunk;
+    ifstream existing(BENCHMARK_FILE);
+    string header;
+    if (!existing.is_open() || !getline(existing, header) || header + "\n" == BENCHMARK_HEADER)
+        return;
+    existing.close();
+    string rotated;
+    for (unsigned n = 1;; n++)
+    {
+        rotated = string(BENCHMARK_FILE) + "." + to_string(n);
+        if (!ifstream(rotated).is_open())
+            break;
     }
-
-    delete &encoding;
+    if (rename(BENCHMARK_FILE, rotated.c_str()) != 0)
+        throw runtime_error("Could not rotate " + string(BENCHMARK_FILE) + " with an old header");
+    cerr << BENCHMARK_FILE << " had other columns, moved to " << rotated << endl;
 }
 
 void write_benchmark(
@@ -338,15 +189,29 @@ void write_benchmark(
     unsigned const n_mappers, 
     unsigned const n_reducers, 
     unsigned const n_encoders,
-    const string &type
+    const string &type,
+    unsigned const n_huffman_blocks,
+    unsigned const n_stored_blocks,
+    const uint64_t raw_size,
+    const long time_reduce
     )
 {
     // sum freqs, tree_codes, encoding
     auto total_elapsed_no_rw = time_freqs + time_tree_codes + time_encoding;
     auto total_elapsed_rw = total_elapsed_no_rw + time_writing + time_read;
+    auto allocs = alloc_stats();
+
+    // ratio of the archive just written, so coders can be compared on the same input
+    ifstream output(OUTPUT_FILE, ios::binary | ios::ate);
+    uint64_t comp_size = output.is_open() ? (uint64_t) output.tellg() : 0;
+    auto ratio = raw_size > 0 ? (double) comp_size / (double) raw_size : 0;
 
+    rotate_benchmark_file();
     ofstream benchmark_file;
     benchmark_file.open(BENCHMARK_FILE, ios::out | ios::app);
+    // a new file starts with the header, so the columns can be looked up by name
+    if (benchmark_file.tellp() == 0)
+        benchmark_file << BENCHMARK_HEADER;
     auto bench_string = 
         to_string(n_mappers) + ","
         + to_string(n_reducers) + "," 
@@ -357,7 +222,18 @@ void write_benchmark(
         + to_string(time_read) + "," 
         + to_string(time_writing) + "," 
         + to_string(total_elapsed_no_rw) + "," 
-        + to_string(total_elapsed_rw) + "," + type + "\n";
+        + to_string(total_elapsed_rw) + "," + type + ","
+        + (allocs.heap_counted ? to_string(allocs.allocs) : "") + ","
+        + (allocs.heap_counted ? to_string(allocs.peak_bytes) : "") + ","
+        + to_string(allocs.arena_allocs) + ","
+        + to_string(allocs.arena_mapped) + ","
+        + allocator_name() + ","
+        + to_string(n_huffman_blocks) + ","
+        + to_string(n_stored_blocks) + ","
+        + to_string(raw_size) + ","
+        + to_string(comp_size) + ","
+        + to_string(ratio) + ","
+        + to_string(time_reduce) + "\n";
     benchmark_file << bench_string;
     benchmark_file.close();
 }
@@ -1,13 +1,15 @@
 #ifndef SPM_PROJECT_HUFFMAN_COMMONS_H
 #define SPM_PROJECT_HUFFMAN_COMMONS_H
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <queue>
 #include <memory>
-#include <bitset>
+
+#include "allocator.h"
 
 #define OUTPUT_FILE "./output.bin"
 #define BENCHMARK_FILE "./benchmark.csv"
@@ -16,18 +18,26 @@
 #define TYPE_GMR "map-"
 #define TYPE_FASTFLOW_PF "ff-pf"
 #define TYPE_FASTFLOW_FARM "ff-farm"
-#define BENCHMARK_HEADER "time_read,time_freqs,time_tree_codes,time_encode,time_write,n_mappers,n_reducers,n_encoders\n"
+#define TYPE_WORDS "words"
+#define TYPE_ANS_SUFFIX "-ans"      // appended to the type of runs with the tANS coder
+// columns of every row written by write_benchmark, in order (times in usec);
+// time_reduce is the merge of the partial histograms, already counted in time_freqs (time_read when fused)
+#define BENCHMARK_HEADER "n_mappers,n_reducers,n_encoders,time_freqs,time_tree_codes,time_encode,time_read,time_write," \
+                         "time_total_no_rw,time_total_rw,type,allocs,peak_bytes,arena_allocs,arena_mapped,allocator," \
+                         "n_huffman_blocks,n_stored_blocks,raw_size,comp_size,ratio,time_reduce\n"
 
 using namespace std;
+/** Times of the in-memory phases of a run (usec), for runs on an input already loaded. */
+struct phase_times_t {
+    long time_freqs = 0;
+    long time_reduce = 0;       // part of time_freqs
+    long time_tree_codes = 0;
+    long time_encode = 0;
+};
+
 /** Single Huffman code. */
 typedef vector<bool> code_t;
 
-/** Chunk of encoded sequence */
-typedef vector<code_t*> chunk_t;
-
-/** Full encoded sequence. (Vector of chunks) */
-typedef vector<chunk_t*> encoded_t;
-
 /** Node of the Huffman tree. */
 struct Node {
     char c;
@@ -42,6 +52,11 @@ struct Node {
     }
 };
 
+/** A node is a leaf iff it has no children ('\0' is a legal symbol in binary inputs). */
+inline bool is_leaf(const Node *node) {
+    return node->left == nullptr && node->right == nullptr;
+}
+
 /** Comparator for the priority queue. */
 struct Compare {
     bool operator()(Node *left, Node *right) {
@@ -50,36 +65,17 @@ struct Compare {
 };
 
 
-std::string decode(const vector<bool> &encoded, const Node *root);
-
 std::string read_file(const std::string &filename);
 
-std::vector<bool> *read_encoded_file(const std::string &filename);
-
 Node *generate_huffman_tree(const unordered_map<char, unsigned> &freqs);
 
 unordered_map<char, vector<bool>*> generate_huffman_codes(Node *root);
 
-bool check_file(const string &filename, const string &seq, const Node *root);
-
-void free_tree(Node *root);
-
-void print_codes(std::unordered_map<char, code_t> &codes);
-
-void print_encoded_sequence(code_t &encoded);
-
-// legacy version that uses a vector of codes instead of a vector of chunks
-void write_to_file(std::vector<code_t*> &encoded, const std::string &filename);
-
-void write_to_file(encoded_t &encoded, const std::string &filename);
-
 void free_tree(Node *root);
 
 void free_codes(unordered_map<char, code_t*> &codes);
 
-void free_encoding(encoded_t &encoded);
-
-void write_benchmark(const long time_read, const long time_freqs, const long time_tree_codes, const long time_encode, const long time_write, const unsigned n_mappers, const unsigned n_reducers, const unsigned n_encoders, const string &type);
+void write_benchmark(const long time_read, const long time_freqs, const long time_tree_codes, const long time_encode, const long time_write, const unsigned n_mappers, const unsigned n_reducers, const unsigned n_encoders, const string &type, const unsigned n_huffman_blocks = 0, const unsigned n_stored_blocks = 0, const uint64_t raw_size = 0, const long time_reduce = 0);
 
 
 #endif //SPM_PROJECT_HUFFMAN_COMMONS_H
@@ -0,0 +1,1371 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#include "huffman-format.h"
+#include "huffman-kernels.h"
+#include "huffman-words.h"
+#include "huffman-ans.h"
+#include "crc32c.h"
+
+using namespace std;
+
+/* little endian helpers used by the (de)serializer */
+
+static void put_u64(bytes_t &out, uint64_t v, int n_bytes = 8)
+{
+    for (int i = 0; i < n_bytes; i++)
+        out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static void put_varint(bytes_t &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+static uint64_t get_u64(const unsigned char *data, size_t size, size_t &pos, int n_bytes = 8)
+{
+    if (pos + n_bytes > size)
+        throw runtime_error("Corrupted archive: unexpected end of data");
+    uint64_t v = 0;
+    for (int i = 0; i < n_bytes; i++)
+        v |= (uint64_t)data[pos + i] << (8 * i);
+    pos += n_bytes;
+    return v;
+}
+
+static uint64_t get_varint(const unsigned char *data, size_t size, size_t &pos)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (pos >= size)
+            throw runtime_error("Corrupted archive: unexpected end of data");
+        auto b = data[pos++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    throw runtime_error("Corrupted archive: bad varint");
+}
+
+freq_table_t to_freq_table(const unordered_map<char, unsigned> &freqs)
+{
+    freq_table_t table{};
+    for (auto &it : freqs)
+        table[(unsigned char)it.first] = it.second;
+    return table;
+}
+
+unordered_map<char, unsigned> from_freq_table(const freq_table_t &table)
+{
+    unordered_map<char, unsigned> freqs;
+    for (int c = 0; c < 256; c++)
+        if (table[c] > 0)
+            freqs[(char)c] = (unsigned)table[c];
+    return freqs;
+}
+
+/**
+ * Whether the two-symbol tables are worth building for n_symbols symbols.
+ * @param pair_mode PAIRS_AUTO, PAIRS_OFF or PAIRS_ON.
+ */
+bool use_pair_tables(int pair_mode, uint64_t n_symbols)
+{
+    return pair_mode == PAIRS_ON || (pair_mode == PAIRS_AUTO && n_symbols >= PAIR_MIN_INPUT);
+}
+
+/**
+ * Packs the vector<bool> codes into words, so that encoding is a table lookup plus a shift.
+ * @param codes the codes generated from the Huffman tree.
+ * @param pairs also build the two-symbol table (see use_pair_tables).
+ * @return the packed code of every byte value (len 0 for symbols not in the alphabet).
+ */
+code_table_t make_code_table(const unordered_map<char, code_t*> &codes, bool pairs)
+{
+    code_table_t table{};
+    for (auto &it : codes)
+    {
+        auto &code = *it.second;
+        if (code.size() > 64)
+            throw runtime_error("Huffman code longer than 64 bits");
+        uint64_t bits = 0;
+        for (size_t i = 0; i < code.size(); i++)
+            bits |= (uint64_t)code[i] << i;
+        table[(unsigned char)it.first] = {bits, (uint8_t)code.size()};
+    }
+    unsigned min_len = 64, max_len = 0;
+    for (auto &code : table.codes)
+        if (code.len > 0)
+        {
+            min_len = min<unsigned>(min_len, code.len);
+            max_len = max<unsigned>(max_len, code.len);
+        }
+    table.kernel = select_kernel(min_len, max_len);
+    if (!pairs)
+        return table;
+
+    // only the symbols that occur, so the build is |alphabet|^2 and not 64K
+    vector<unsigned> alphabet;
+    for (unsigned c = 0; c < 256; c++)
+        if (table[c].len > 0)
+            alphabet.push_back(c);
+    table.pairs.assign(1UL << 16, 0);
+    for (auto a : alphabet)
+        for (auto b : alphabet)
+        {
+            auto len = table[a].len + table[b].len;
+            if (len <= PAIR_MAX_BITS)
+                table.pairs[a | b << 8] = (uint32_t)(table[a].bits | table[b].bits << table[a].len) | len << 24;
+        }
+    return table;
+}
+
+/**
+ * Exact size in bits of the encoding of a range, without encoding it.
+ */
+uint64_t encoded_bits(const char *data, size_t n, const code_table_t &table)
+{
+    uint64_t bits = 0;
+    for (size_t i = 0; i < n; i++)
+        bits += table[(unsigned char)data[i]].len;
+    return bits;
+}
+
+/**
+ * Exact size in bits of the whole input, from its histogram.
+ */
+uint64_t histogram_bits(const freq_table_t &freqs, const code_table_t &table)
+{
+    uint64_t bits = 0;
+    for (int c = 0; c < 256; c++)
+        bits += freqs[c] * table[c].len;
+    return bits;
+}
+
+/**
+ * Whether Huffman-coding raw_len bytes into n_bits saves enough to beat a stored copy.
+ */
+bool worth_encoding(uint64_t n_bits, uint64_t raw_len)
+{
+    return (n_bits + 7) / 8 + raw_len / STORE_MIN_GAIN < raw_len;
+}
+
+/*
+ * packs n symbols whose encoded size (n_bits) is already known, with the specialized kernel of the table if
+ * it has one, else two at a time when the table has pairs.
+ * With interval > 0 the bit offset of symbols interval, 2 * interval, ... is appended to checkpoints.
+ */
+static void pack_symbols(const char *data, size_t n, const code_table_t &table, uint64_t n_bits, bytes_t &out,
+                         uint64_t interval = 0, vector<uint64_t> *checkpoints = nullptr)
+{
+    auto base = out.size();
+    out.resize(base + (n_bits + 7) / 8 + 8);    // slack for the 32 bit stores below
+    auto dst = out.data() + base;
+
+    uint64_t acc = 0;
+    unsigned fill = 0;
+
+    auto put = [&](uint64_t bits, unsigned len) {
+        acc |= bits << fill;
+        fill += len;
+        if (fill >= 32)
+        {
+            for (int k = 0; k < 4; k++)
+                dst[k] = (unsigned char)(acc >> (8 * k));
+            dst += 4;
+            acc >>= 32;
+            fill -= 32;
+        }
+    };
+    auto put_symbol = [&](unsigned char c) {
+        auto &code = table[c];
+        if (code.len <= 32)
+            put(code.bits, code.len);
+        else
+        {
+            // long codes are split so that acc never overflows
+            put(code.bits & 0xffffffffULL, 32);
+            put(code.bits >> 32, code.len - 32);
+        }
+    };
+
+    auto begin = dst;
+    auto segment = interval > 0 ? interval : n;
+    for (size_t first = 0; first < n; first += segment)
+    {
+        if (first > 0)
+            checkpoints->push_back((uint64_t)(dst - begin) * 8 + fill);
+
+        auto last = min<size_t>(n, first + segment);
+        auto i = first;
+        if (table.kernel != KERNEL_GENERIC)
+        {
+            pack_kernel(table.kernel, data + first, last - first, table, dst, acc, fill);
+            continue;
+        }
+        if (!table.pairs.empty())
+            for (; i + 1 < last; i += 2)
+            {
+                auto pair = table.pairs[(unsigned char)data[i] | (unsigned char)data[i + 1] << 8];
+                if (pair != 0)
+                    put(pair & 0xffffff, pair >> 24);
+                else
+                {
+                    put_symbol((unsigned char)data[i]);
+                    put_symbol((unsigned char)data[i + 1]);
+                }
+            }
+        for (; i < last; i++)
+            put_symbol((unsigned char)data[i]);
+    }
+    while (fill > 0)
+    {
+        *dst++ = (unsigned char)acc;
+        acc >>= 8;
+        fill = fill > 8 ? fill - 8 : 0;
+    }
+
+    out.resize(base + (n_bits + 7) / 8);
+}
+
+/**
+ * Encodes a range of symbols, appending the bits to out (LSB first).
+ * The last byte is zero padded; the number of meaningful bits is returned.
+ * @param data the symbols to encode.
+ * @param n the number of symbols.
+ * @param table the packed codes.
+ * @param out buffer the encoded bytes are appended to.
+ * @return the number of bits written.
+ */
+uint64_t encode_block(const char *data, size_t n, const code_table_t &table, bytes_t &out)
+{
+    auto n_bits = encoded_bits(data, n, table);
+    pack_symbols(data, n, table, n_bits, out);
+    return n_bits;
+}
+
+/*
+ * bits of every sub-stream when symbol i goes to sub-stream i % n_streams.
+ */
+static uint64_t count_stream_bits(const char *data, size_t n, const code_table_t &table, unsigned n_streams,
+                                  vector<uint64_t> &stream_bits)
+{
+    stream_bits.assign(n_streams, 0);
+    unsigned s = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        stream_bits[s] += table[(unsigned char)data[i]].len;
+        s = s + 1 == n_streams ? 0 : s + 1;
+    }
+    uint64_t n_bits = 0;
+    for (auto bits : stream_bits)
+        n_bits += bits;
+    return n_bits;
+}
+
+/*
+ * S copies of the pack_symbols accumulator, advanced in lockstep: the S shift/or chains are
+ * independent, so the core overlaps them. Sub-stream s starts at dst + the bytes of the ones before it.
+ */
+template <unsigned S>
+static void pack_interleaved(const char *data, size_t n, const code_table_t &table, const uint64_t *stream_bits,
+                             unsigned char *dst)
+{
+    unsigned char *cursor[S];
+    uint64_t acc[S] = {};
+    unsigned fill[S] = {};
+    for (unsigned s = 0; s < S; s++)
+    {
+        cursor[s] = dst;
+        dst += (stream_bits[s] + 7) / 8;
+    }
+
+    auto put = [&](unsigned s, uint64_t bits, unsigned len) {
+        acc[s] |= bits << fill[s];
+        fill[s] += len;
+        if (fill[s] >= 32)
+        {
+            // 32 meaningful bits: the store never reaches into the next sub-stream
+            for (int k = 0; k < 4; k++)
+                cursor[s][k] = (unsigned char)(acc[s] >> (8 * k));
+            cursor[s] += 4;
+            acc[s] >>= 32;
+            fill[s] -= 32;
+        }
+    };
+    auto put_symbol = [&](unsigned s, unsigned char c) {
+        auto &code = table[c];
+        if (code.len <= 32)
+            put(s, code.bits, code.len);
+        else
+        {
+            put(s, code.bits & 0xffffffffULL, 32);
+            put(s, code.bits >> 32, code.len - 32);
+        }
+    };
+
+    auto n_groups = n / S;
+    for (size_t g = 0; g < n_groups; g++)
+    {
+        auto src = data + g * S;
+        for (unsigned s = 0; s < S; s++)
+            put_symbol(s, (unsigned char)src[s]);
+    }
+    for (unsigned s = 0; s < n % S; s++)
+        put_symbol(s, (unsigned char)data[n_groups * S + s]);
+
+    for (unsigned s = 0; s < S; s++)
+        for (; fill[s] > 0; fill[s] = fill[s] > 8 ? fill[s] - 8 : 0)
+        {
+            *cursor[s]++ = (unsigned char)acc[s];
+            acc[s] >>= 8;
+        }
+}
+
+/**
+ * Encodes a range of symbols as n_streams interleaved sub-streams (the layout of a multi-stream block),
+ * appending them to out one after the other, each one zero padded to a byte boundary.
+ * @param data the symbols to encode.
+ * @param n the number of symbols.
+ * @param table the packed codes.
+ * @param n_streams the number of sub-streams, 1..MAX_STREAMS.
+ * @param out buffer the encoded bytes are appended to.
+ * @param stream_bits filled with the number of bits of every sub-stream.
+ * @return the total number of bits written.
+ */
+uint64_t encode_streams(const char *data, size_t n, const code_table_t &table, unsigned n_streams, bytes_t &out,
+                        vector<uint64_t> &stream_bits)
+{
+    auto n_bits = count_stream_bits(data, n, table, n_streams, stream_bits);
+    uint64_t n_bytes = 0;
+    for (auto bits : stream_bits)
+        n_bytes += (bits + 7) / 8;
+    auto base = out.size();
+    out.resize(base + n_bytes);
+    auto dst = out.data() + base;
+    switch (n_streams)
+    {
+    case 1: pack_interleaved<1>(data, n, table, stream_bits.data(), dst); break;
+    case 2: pack_interleaved<2>(data, n, table, stream_bits.data(), dst); break;
+    case 3: pack_interleaved<3>(data, n, table, stream_bits.data(), dst); break;
+    case 4: pack_interleaved<4>(data, n, table, stream_bits.data(), dst); break;
+    case 5: pack_interleaved<5>(data, n, table, stream_bits.data(), dst); break;
+    case 6: pack_interleaved<6>(data, n, table, stream_bits.data(), dst); break;
+    case 7: pack_interleaved<7>(data, n, table, stream_bits.data(), dst); break;
+    case 8: pack_interleaved<8>(data, n, table, stream_bits.data(), dst); break;
+    default: throw runtime_error("Unsupported number of streams " + to_string(n_streams));
+    }
+    return n_bits;
+}
+
+/**
+ * Builds the lookup table of the decoder: every index whose low bits are a code of at most
+ * DECODE_TABLE_BITS bits maps to that code's symbol and length.
+ * @param root the root of the Huffman tree, owned by the caller and used for the longer codes.
+ * @param pairs also build the two-symbol table (see use_pair_tables).
+ */
+decoder_t make_decoder(const Node *root, bool pairs)
+{
+    decoder_t decoder;
+    decoder.root = root;
+    decoder.table.assign(1UL << DECODE_TABLE_BITS, 0);
+    if (root == nullptr || is_leaf(root))
+        return decoder;
+
+    unsigned min_len = 64, max_len = 0;
+    auto stack = vector<tuple<const Node *, uint64_t, unsigned>>{{root, 0, 0}};
+    while (!stack.empty())
+    {
+        auto [node, bits, len] = stack.back();
+        stack.pop_back();
+        if (len > DECODE_TABLE_BITS)
+        {
+            max_len = 64;   // some code is longer than the table
+            continue;
+        }
+        if (is_leaf(node))
+        {
+            min_len = min(min_len, len);
+            max_len = max(max_len, len);
+            auto entry = (uint16_t)((unsigned char)node->c | len << 8);
+            for (uint64_t high = 0; high < 1UL << (DECODE_TABLE_BITS - len); high++)
+                decoder.table[bits | high << len] = entry;
+            continue;
+        }
+        // bit i of a packed code is the i-th step from the root, 1 going right
+        stack.emplace_back(node->left, bits, len + 1);
+        stack.emplace_back(node->right, bits | 1ULL << len, len + 1);
+    }
+    decoder.kernel = select_kernel(min_len, max_len);
+    if (!pairs)
+        return decoder;
+
+    // a second code fits if the bits left after the first one determine it
+    decoder.pairs.assign(1UL << PAIR_TABLE_BITS, 0);
+    auto mask = (1UL << DECODE_TABLE_BITS) - 1;
+    for (uint64_t bits = 0; bits < decoder.pairs.size(); bits++)
+    {
+        auto first = decoder.table[bits & mask];
+        auto first_len = first >> 8;
+        if (first == 0 || first_len >= PAIR_TABLE_BITS)
+            continue;
+        auto second = decoder.table[(bits >> first_len) & mask];
+        auto len = first_len + (second >> 8);
+        if (second != 0 && len <= PAIR_TABLE_BITS)
+            decoder.pairs[bits] = (first & 0xff) | (second & 0xff) << 8 | len << 16;
+    }
+    return decoder;
+}
+
+/**
+ * Builds the decoder of a parsed archive: from the tree of its frequencies, or from its dictionary for
+ * word archives (the tree is then empty).
+ */
+decoder_t make_decoder(const archive_index_t &index, const Node *root, bool pairs)
+{
+    auto decoder = make_decoder(root, pairs);
+    if (index.coder == CODER_ANS)
+        decoder.ans = make_shared<ans_table_t>(make_ans_table(index.freqs));
+    if (!index.dictionary.empty())
+        decoder.words = make_shared<word_decoder_t>(parse_dictionary(index.dictionary.data(),
+                                                                     index.dictionary.size()));
+    // every table switch gets its own decoder, which owns its tree
+    for (auto &table : index.tables)
+    {
+        auto tree = shared_ptr<Node>(generate_huffman_tree(from_freq_table(table.freqs)), free_tree);
+        auto sub = make_decoder(tree.get(), pairs);
+        sub.tree = tree;
+        if (index.coder == CODER_ANS)
+            sub.ans = make_shared<ans_table_t>(make_ans_table(table.freqs));
+        decoder.tables.push_back(std::move(sub));
+    }
+    return decoder;
+}
+
+/**
+ * The decoder of the table a block was coded with: the archive's own, or that of a table switch.
+ */
+const decoder_t &entry_decoder(const decoder_t &decoder, const block_entry_t &entry)
+{
+    return entry.table == 0 ? decoder : decoder.tables.at(entry.table - 1);
+}
+
+/**
+ * Decodes a single-stream block: with the specialized kernel of the decoder if it has one, else one table
+ * lookup per symbol (or per pair with the two-symbol table).
+ * @param data the encoded bytes.
+ * @param n_bits the number of meaningful bits.
+ * @param decoder the decoder built from the archive's Huffman tree.
+ * @param out destination buffer, at least n_out bytes.
+ * @param n_out the number of symbols to decode.
+ * @param first_bit where to start, the beginning of the block or a checkpoint.
+ */
+void decode_block(const unsigned char *data, uint64_t n_bits, const decoder_t &decoder, char *out, size_t n_out,
+                  uint64_t first_bit)
+{
+    if (n_out == 0)
+        return;
+    if (is_leaf(decoder.root))
+    {
+        memset(out, decoder.root->c, n_out);
+        return;
+    }
+
+    auto n_bytes = (n_bits + 7) / 8;
+    auto pos = first_bit;
+    size_t i = 0;
+    if (decoder.kernel != KERNEL_GENERIC)
+    {
+        decode_kernel(decoder.kernel, data, n_bytes, decoder, out, n_out, pos);
+        i = n_out;
+    }
+    else if (!decoder.pairs.empty())
+        while (i + 1 < n_out)
+        {
+            auto pair = decoder.pairs[peek_bits(data, n_bytes, pos) & ((1UL << PAIR_TABLE_BITS) - 1)];
+            if (pair != 0)
+            {
+                out[i] = (char)(pair & 0xff);
+                out[i + 1] = (char)(pair >> 8 & 0xff);
+                pos += pair >> 16;
+                i += 2;
+            }
+            else
+                out[i++] = decode_symbol(decoder, data, n_bytes, pos);
+        }
+    for (; i < n_out; i++)
+        out[i] = decode_symbol(decoder, data, n_bytes, pos);
+    if (pos > n_bits)
+        throw runtime_error("Corrupted archive: block decoded to the wrong size");
+}
+
+/* S cursors advanced in lockstep, the decoding counterpart of pack_interleaved */
+template <unsigned S>
+static void decode_interleaved(const unsigned char *data, const uint64_t *stream_bits, const decoder_t &decoder,
+                               char *out, size_t n_out)
+{
+    const unsigned char *base[S];
+    uint64_t n_bytes[S], pos[S] = {};
+    uint64_t total = 0;
+    for (unsigned s = 0; s < S; s++)
+        total += (stream_bits[s] + 7) / 8;
+    // a cursor may peek into the sub-streams after its own, never past the block
+    for (unsigned s = 0; s < S; s++)
+    {
+        base[s] = data;
+        n_bytes[s] = total;
+        data += (stream_bits[s] + 7) / 8;
+        total -= (stream_bits[s] + 7) / 8;
+    }
+
+    auto n_groups = n_out / S;
+    for (size_t g = 0; g < n_groups; g++)
+    {
+        auto dst = out + g * S;
+        for (unsigned s = 0; s < S; s++)
+            dst[s] = decode_symbol(decoder, base[s], n_bytes[s], pos[s]);
+    }
+    for (unsigned s = 0; s < n_out % S; s++)
+        out[n_groups * S + s] = decode_symbol(decoder, base[s], n_bytes[s], pos[s]);
+
+    for (unsigned s = 0; s < S; s++)
+        if (pos[s] > stream_bits[s])
+            throw runtime_error("Corrupted archive: block decoded to the wrong size");
+}
+
+/**
+ * Decodes the first n_out symbols of a multi-stream block.
+ * @param data the encoded bytes, sub-streams one after the other.
+ * @param stream_bits the number of bits of every sub-stream.
+ * @param decoder the decoder built from the archive's Huffman tree.
+ * @param out destination buffer, at least n_out bytes.
+ * @param n_out the number of symbols to decode, at most the block's raw_len.
+ */
+void decode_streams(const unsigned char *data, const vector<uint64_t> &stream_bits, const decoder_t &decoder,
+                    char *out, size_t n_out)
+{
+    if (n_out == 0)
+        return;
+    if (is_leaf(decoder.root))
+    {
+        memset(out, decoder.root->c, n_out);
+        return;
+    }
+    switch (stream_bits.size())
+    {
+    case 1: decode_interleaved<1>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 2: decode_interleaved<2>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 3: decode_interleaved<3>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 4: decode_interleaved<4>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 5: decode_interleaved<5>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 6: decode_interleaved<6>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 7: decode_interleaved<7>(data, stream_bits.data(), decoder, out, n_out); break;
+    case 8: decode_interleaved<8>(data, stream_bits.data(), decoder, out, n_out); break;
+    default: throw runtime_error("Unsupported number of streams " + to_string(stream_bits.size()));
+    }
+}
+
+/** Number of blocks needed to cover raw_size bytes. */
+size_t block_count(uint64_t raw_size, uint64_t block_size)
+{
+    return (raw_size + block_size - 1) / block_size;
+}
+
+/**
+ * Prepares an archive to be filled block by block (possibly by several threads at once).
+ */
+void init_archive(archive_t &archive, uint64_t raw_size, const freq_table_t &freqs, uint64_t block_size,
+                  uint64_t checkpoint_interval, unsigned n_streams)
+{
+    if (n_streams < 1 || n_streams > MAX_STREAMS)
+        throw runtime_error("Unsupported number of streams " + to_string(n_streams));
+    if (n_streams > 1 && checkpoint_interval > 0)
+        throw runtime_error("Checkpoints and multiple streams cannot be combined");
+    archive.raw_size = raw_size;
+    archive.block_size = block_size;
+    archive.checkpoint_interval = checkpoint_interval;
+    archive.n_streams = n_streams;
+    archive.freqs = freqs;
+    archive.blocks.resize(block_count(raw_size, block_size));
+}
+
+/**
+ * Selects the entropy coder of an archive: with CODER_ANS the tANS tables of its histogram are attached to
+ * the code table, and encode_archive_block uses them instead of the Huffman codes.
+ */
+void use_coder(archive_t &archive, code_table_t &table, int coder)
+{
+    if (coder == CODER_ANS && (archive.checkpoint_interval > 0 || archive.n_streams > 1))
+        throw runtime_error("tANS blocks have no checkpoints or sub-streams");
+    archive.coder = coder;
+    table.ans = coder == CODER_ANS ? make_shared<ans_table_t>(make_ans_table(archive.freqs)) : nullptr;
+}
+
+/**
+ * Turns the store mode chosen by the user into the policy applied to every block.
+ * STORE_GLOBAL is resolved here, once, from the histogram: either every block is stored
+ * (STORE_ALL) or every block is encoded (STORE_OFF) without looking at the blocks.
+ */
+int resolve_store_policy(const archive_t &archive, const code_table_t &table, int store_mode)
+{
+    if (store_mode != STORE_GLOBAL)
+        return store_mode;
+    auto n_bits = table.ans ? ans_histogram_bits(archive.freqs, *table.ans) : histogram_bits(archive.freqs, table);
+    return worth_encoding(n_bits, archive.raw_size) ? STORE_OFF : STORE_ALL;
+}
+
+/**
+ * Fills block i of the archive: Huffman-coded, or a raw copy when the policy says so.
+ * With STORE_BLOCK the encoded size is computed first, so incompressible blocks skip the encoding.
+ * @param archive the archive, initialised with init_archive.
+ * @param i the block index.
+ * @param data the whole input.
+ * @param table the packed codes.
+ * @param policy the value returned by resolve_store_policy.
+ */
+void encode_archive_block(archive_t &archive, size_t i, const char *data, const code_table_t &table, int policy)
+{
+    auto start = i * archive.block_size;
+    auto len = min(archive.block_size, archive.raw_size - start);
+    auto &block = archive.blocks[i];
+    block.data.clear();
+    block.checkpoints.clear();
+    block.stream_bits.clear();
+    block.raw_len = len;
+    block.crc = archive.checksums ? crc32c(data + start, len) : 0;
+
+    // tANS: the symbols are coded first, last to first, and packed only if the block is kept
+    static thread_local vector<uint32_t> ans_scratch;
+    uint64_t n_bits = 0;
+    if (policy != STORE_ALL && table.ans)
+        n_bits = ans_encode_symbols(data + start, len, *table.ans, ans_scratch);
+    else if (policy != STORE_ALL)
+        n_bits = archive.n_streams > 1 ? count_stream_bits(data + start, len, table, archive.n_streams,
+                                                           block.stream_bits)
+                                       : encoded_bits(data + start, len, table);
+    if (policy == STORE_ALL || (policy == STORE_BLOCK && !worth_encoding(n_bits, len)))
+    {
+        block.kind = BLOCK_STORED;
+        block.n_bits = 0;
+        block.stream_bits.clear();
+        block.data.assign(data + start, data + start + len);
+        return;
+    }
+    block.kind = BLOCK_HUFFMAN;
+    block.n_bits = n_bits;
+    if (table.ans)
+        ans_pack(ans_scratch, len, n_bits, *table.ans, block.data);
+    else if (archive.n_streams > 1)
+        encode_streams(data + start, len, table, archive.n_streams, block.data, block.stream_bits);
+    else
+        pack_symbols(data + start, len, table, n_bits, block.data, archive.checkpoint_interval, &block.checkpoints);
+}
+
+void count_blocks(const archive_t &archive, unsigned &n_huffman, unsigned &n_stored)
+{
+    n_huffman = n_stored = 0;
+    for (auto &block : archive.blocks)
+        (block.kind == BLOCK_STORED ? n_stored : n_huffman)++;
+}
+
+/* bytes a block takes in the payload: every sub-stream is padded to a byte boundary */
+static uint64_t payload_size(const block_entry_t &entry)
+{
+    if (entry.kind == BLOCK_STORED)
+        return entry.raw_len;
+    if (entry.stream_bits.empty())
+        return (entry.n_bits + 7) / 8;
+    uint64_t n_bytes = 0;
+    for (auto bits : entry.stream_bits)
+        n_bytes += (bits + 7) / 8;
+    return n_bytes;
+}
+
+/* frequency table: only the symbols that occur, as (symbol, count) pairs */
+static void put_freqs(bytes_t &out, const freq_table_t &freqs)
+{
+    unsigned n_symbols = 0;
+    for (auto f : freqs)
+        n_symbols += f > 0;
+    put_u64(out, n_symbols, 2);
+    for (int c = 0; c < 256; c++)
+        if (freqs[c] > 0)
+        {
+            out.push_back((unsigned char)c);
+            put_varint(out, freqs[c]);
+        }
+}
+
+static void get_freqs(const unsigned char *data, size_t size, size_t &pos, freq_table_t &freqs)
+{
+    auto n_symbols = get_u64(data, size, pos, 2);
+    for (unsigned i = 0; i < n_symbols; i++)
+    {
+        auto c = get_u64(data, size, pos, 1);
+        freqs[c] = get_varint(data, size, pos);
+    }
+}
+
+/**
+ * Appends the archive header (magic, version, flags, raw size).
+ */
+void serialize_header(const archive_t &archive, bytes_t &out)
+{
+    out.insert(out.end(), ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+    out.push_back(ARCHIVE_VERSION);
+    out.push_back((archive.checkpoint_interval > 0 ? ARCHIVE_FLAG_CHECKPOINTS : 0) |
+                  (archive.n_streams > 1 ? ARCHIVE_FLAG_STREAMS : 0) |
+                  (!archive.dictionary.empty() ? ARCHIVE_FLAG_WORDS : 0) |
+                  (archive.coder == CODER_ANS ? ARCHIVE_FLAG_ANS : 0) |
+                  (!archive.tables.empty() && !archive.streamed ? ARCHIVE_FLAG_TABLES : 0) |
+                  (archive.checksums ? ARCHIVE_FLAG_CHECKSUMS : 0) |
+                  (archive.streamed ? ARCHIVE_FLAG_STREAMED : 0));
+    put_u64(out, 0, 2); // reserved
+    put_u64(out, archive.streamed ? 0 : archive.raw_size);
+}
+
+/**
+ * Appends trailer and footer. Only the block metadata is used, not the block data, so the index of an
+ * archive whose payload was written elsewhere (e.g. by other processes) can be produced too.
+ * @param archive the archive.
+ * @param trailer_offset where the trailer starts, i.e. header plus payload size.
+ * @param out buffer the trailer is appended to.
+ */
+void serialize_trailer(const archive_t &archive, uint64_t trailer_offset, bytes_t &out)
+{
+    put_freqs(out, archive.freqs);
+    if (archive.checkpoint_interval > 0)
+        put_varint(out, archive.checkpoint_interval);
+    if (archive.n_streams > 1)
+        put_varint(out, archive.n_streams);
+    if (!archive.dictionary.empty())
+    {
+        put_varint(out, archive.dictionary.size());
+        out.insert(out.end(), archive.dictionary.begin(), archive.dictionary.end());
+    }
+    if (archive.streamed)
+        put_varint(out, archive.raw_size);
+    if (!archive.tables.empty() || archive.streamed)
+    {
+        put_varint(out, archive.tables.size());
+        for (auto &table : archive.tables)
+        {
+            put_varint(out, table.first_block);
+            put_freqs(out, table.freqs);
+        }
+    }
+
+    put_u64(out, archive.blocks.size(), 4);
+    for (auto &block : archive.blocks)
+    {
+        out.push_back(block.kind);
+        put_varint(out, block.raw_len);
+        put_varint(out, block.n_bits);
+        if (archive.checksums)
+            put_u64(out, block.crc, 4);
+        // checkpoints are increasing, deltas keep them to a couple of bytes each
+        uint64_t prev = 0;
+        for (auto bit : block.checkpoints)
+        {
+            put_varint(out, bit - prev);
+            prev = bit;
+        }
+        for (auto bits : block.stream_bits)
+            put_varint(out, bits);
+    }
+
+    put_u64(out, trailer_offset);
+    out.insert(out.end(), ARCHIVE_FOOTER_MAGIC, ARCHIVE_FOOTER_MAGIC + 4);
+}
+
+/**
+ * Serializes an archive (header, blocks, trailer and footer) appending it to out.
+ */
+void serialize_archive(const archive_t &archive, bytes_t &out)
+{
+    auto base = out.size();
+    serialize_header(archive, out);
+    for (auto &block : archive.blocks)
+        out.insert(out.end(), block.data.begin(), block.data.end());
+    serialize_trailer(archive, out.size() - base, out);
+}
+
+/**
+ * Writes an archive to a file, block by block: the payload is never copied into one buffer.
+ * @param archive the archive.
+ * @param filename the name of the file to write to.
+ */
+void write_archive(const archive_t &archive, const string &filename)
+{
+    ofstream out(filename, ios::binary);
+    if (!out.is_open())
+        throw runtime_error("Could not open file: " + filename);
+
+    bytes_t buffer;
+    serialize_header(archive, buffer);
+    out.write(reinterpret_cast<const char *>(buffer.data()), (long)buffer.size());
+
+    uint64_t offset = buffer.size();
+    for (auto &block : archive.blocks)
+    {
+        out.write(reinterpret_cast<const char *>(block.data.data()), (long)block.data.size());
+        offset += block.data.size();
+    }
+
+    buffer.clear();
+    serialize_trailer(archive, offset, buffer);
+    out.write(reinterpret_cast<const char *>(buffer.data()), (long)buffer.size());
+    out.close();
+}
+
+/**
+ * Reads header, trailer and footer of a serialized archive.
+ * @param data the archive bytes.
+ * @param size the archive size.
+ * @return the index, with block offsets relative to data.
+ */
+archive_index_t parse_archive(const unsigned char *data, size_t size)
+{
+    if (size < ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE || memcmp(data, ARCHIVE_MAGIC, 4) != 0)
+        throw runtime_error("Not an archive: bad magic");
+    if (data[4] != ARCHIVE_VERSION)
+        throw runtime_error("Unsupported archive version " + to_string(data[4]));
+    if (memcmp(data + size - 4, ARCHIVE_FOOTER_MAGIC, 4) != 0)
+        throw runtime_error("Corrupted archive: bad footer");
+    auto flags = data[5];
+    if ((flags & ~(ARCHIVE_FLAG_CHECKPOINTS | ARCHIVE_FLAG_STREAMS | ARCHIVE_FLAG_WORDS | ARCHIVE_FLAG_ANS |
+                   ARCHIVE_FLAG_TABLES | ARCHIVE_FLAG_CHECKSUMS | ARCHIVE_FLAG_STREAMED)) ||
+        (flags & ARCHIVE_FLAG_STREAMED && flags & (ARCHIVE_FLAG_TABLES | ARCHIVE_FLAG_WORDS)) ||
+        (flags & ARCHIVE_FLAG_CHECKPOINTS && flags & ARCHIVE_FLAG_STREAMS) ||
+        (flags & ARCHIVE_FLAG_WORDS &&
+         flags & (ARCHIVE_FLAG_CHECKPOINTS | ARCHIVE_FLAG_STREAMS | ARCHIVE_FLAG_ANS | ARCHIVE_FLAG_TABLES)) ||
+        (flags & ARCHIVE_FLAG_ANS && flags & (ARCHIVE_FLAG_CHECKPOINTS | ARCHIVE_FLAG_STREAMS)))
+        throw runtime_error("Unsupported archive flags " + to_string(flags));
+
+    archive_index_t index;
+    index.coder = flags & ARCHIVE_FLAG_ANS ? CODER_ANS : CODER_HUFFMAN;
+    index.checksums = flags & ARCHIVE_FLAG_CHECKSUMS;
+    index.streamed = flags & ARCHIVE_FLAG_STREAMED;
+    size_t pos = 8;
+    index.raw_size = get_u64(data, size, pos);
+
+    pos = size - ARCHIVE_FOOTER_SIZE;
+    auto trailer_offset = get_u64(data, size, pos);
+    if (trailer_offset < ARCHIVE_HEADER_SIZE || trailer_offset > size - ARCHIVE_FOOTER_SIZE)
+        throw runtime_error("Corrupted archive: bad trailer offset");
+
+    auto end = size - ARCHIVE_FOOTER_SIZE;
+    pos = trailer_offset;
+    index.trailer_offset = trailer_offset;
+    get_freqs(data, end, pos, index.freqs);
+    if (flags & ARCHIVE_FLAG_CHECKPOINTS)
+    {
+        index.checkpoint_interval = get_varint(data, end, pos);
+        if (index.checkpoint_interval == 0)
+            throw runtime_error("Corrupted archive: zero checkpoint interval");
+    }
+    if (flags & ARCHIVE_FLAG_STREAMS)
+    {
+        index.n_streams = (unsigned)get_varint(data, end, pos);
+        if (index.n_streams < 2 || index.n_streams > MAX_STREAMS)
+            throw runtime_error("Unsupported number of streams " + to_string(index.n_streams));
+    }
+    if (flags & ARCHIVE_FLAG_WORDS)
+    {
+        auto n_bytes = get_varint(data, end, pos);
+        if (n_bytes == 0 || n_bytes > end - pos)
+            throw runtime_error("Corrupted archive: bad dictionary size");
+        index.dictionary.assign(data + pos, data + pos + n_bytes);
+        pos += n_bytes;
+    }
+    if (index.streamed)
+        index.raw_size = get_varint(data, end, pos);
+    if (flags & (ARCHIVE_FLAG_TABLES | ARCHIVE_FLAG_STREAMED))
+    {
+        auto n_tables = get_varint(data, end, pos);
+        if ((n_tables == 0 && !index.streamed) || n_tables > end - pos)
+            throw runtime_error("Corrupted archive: bad number of table switches");
+        index.tables.resize(n_tables);
+        for (auto &table : index.tables)
+        {
+            table.first_block = get_varint(data, end, pos);
+            get_freqs(data, end, pos, table.freqs);
+        }
+    }
+
+    auto n_blocks = get_u64(data, end, pos, 4);
+    for (size_t k = 0; k < index.tables.size(); k++)
+        if (index.tables[k].first_block >= n_blocks ||
+            (k > 0 ? index.tables[k].first_block <= index.tables[k - 1].first_block : index.tables[k].first_block == 0))
+            throw runtime_error("Corrupted archive: bad table switch");
+    uint64_t raw_offset = 0, comp_offset = ARCHIVE_HEADER_SIZE;
+    index.entries.reserve(n_blocks);
+    for (uint64_t i = 0; i < n_blocks; i++)
+    {
+        block_entry_t entry{};
+        entry.kind = (uint8_t)get_u64(data, end, pos, 1);
+        if (entry.kind != BLOCK_HUFFMAN && entry.kind != BLOCK_STORED)
+            throw runtime_error("Corrupted archive: unknown block kind");
+        entry.raw_len = get_varint(data, end, pos);
+        entry.n_bits = get_varint(data, end, pos);
+        if (index.checksums)
+        {
+            entry.has_crc = true;
+            entry.crc = (uint32_t)get_u64(data, end, pos, 4);
+        }
+        if (index.checkpoint_interval > 0 && entry.kind == BLOCK_HUFFMAN && entry.raw_len > 0)
+        {
+            uint64_t bit = 0;
+            for (uint64_t k = 0; k < (entry.raw_len - 1) / index.checkpoint_interval; k++)
+            {
+                bit += get_varint(data, end, pos);
+                if (bit > entry.n_bits)
+                    throw runtime_error("Corrupted archive: checkpoint past the end of its block");
+                entry.checkpoints.push_back(bit);
+            }
+        }
+        if (index.n_streams > 1 && entry.kind == BLOCK_HUFFMAN)
+        {
+            uint64_t n_bits = 0;
+            for (unsigned s = 0; s < index.n_streams; s++)
+            {
+                entry.stream_bits.push_back(get_varint(data, end, pos));
+                n_bits += entry.stream_bits.back();
+            }
+            if (n_bits != entry.n_bits)
+                throw runtime_error("Corrupted archive: sub-streams do not add up to the block");
+        }
+        while (entry.table < index.tables.size() && index.tables[entry.table].first_block <= i)
+            entry.table++;
+        entry.raw_offset = raw_offset;
+        entry.comp_offset = comp_offset;
+        raw_offset += entry.raw_len;
+        comp_offset += payload_size(entry);
+        index.entries.push_back(entry);
+    }
+    if (raw_offset != index.raw_size || comp_offset != trailer_offset)
+        throw runtime_error("Corrupted archive: index does not match the payload");
+
+    // a table counts the bytes it was built from: all of its blocks, or fewer when appends kept it for more,
+    // and at least one byte if it codes any (a tree needs a leaf). Word archives code with their dictionary.
+    if (index.dictionary.empty())
+    {
+        vector<uint64_t> covered(index.tables.size() + 1, 0);
+        vector<bool> coded(index.tables.size() + 1, false);
+        for (auto &entry : index.entries)
+        {
+            covered[entry.table] += entry.raw_len;
+            coded[entry.table] = coded[entry.table] || (entry.kind == BLOCK_HUFFMAN && entry.raw_len > 0);
+        }
+        for (size_t t = 0; t < covered.size(); t++)
+        {
+            uint64_t total = 0;
+            for (auto f : t == 0 ? index.freqs : index.tables[t - 1].freqs)
+                total += f;
+            if (total > covered[t] || (coded[t] && total == 0))
+                throw runtime_error("Corrupted archive: frequency table does not match its blocks");
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Decodes one block of a serialized archive. Stored blocks are a plain copy.
+ * The CRC of the block, when the archive has one, is checked on the decoded bytes.
+ * @param archive the archive bytes.
+ * @param entry the block, as returned by parse_archive.
+ * @param archive_decoder the decoder built by make_decoder from the archive index.
+ * @param out destination, at least entry.raw_len bytes.
+ */
+void decode_entry(const unsigned char *archive, const block_entry_t &entry, const decoder_t &archive_decoder,
+                  char *out)
+{
+    auto &decoder = entry_decoder(archive_decoder, entry);
+    if (entry.kind == BLOCK_STORED)
+        memcpy(out, archive + entry.comp_offset, entry.raw_len);
+    else if (decoder.ans)
+    {
+        if (ans_decode(archive + entry.comp_offset, entry.n_bits, *decoder.ans, out, entry.raw_len) != entry.n_bits)
+            throw runtime_error("Corrupted archive: block decoded to the wrong size");
+    }
+    else if (decoder.words)
+    {
+        if (decode_words(archive + entry.comp_offset, entry.n_bits, *decoder.words, out, entry.raw_len) !=
+            entry.n_bits)
+            throw runtime_error("Corrupted archive: block decoded to the wrong size");
+    }
+    else if (!entry.stream_bits.empty())
+        decode_streams(archive + entry.comp_offset, entry.stream_bits, decoder, out, entry.raw_len);
+    else
+        decode_block(archive + entry.comp_offset, entry.n_bits, decoder, out, entry.raw_len);
+    if (entry.has_crc && crc32c(out, entry.raw_len) != entry.crc)
+        throw runtime_error("Corrupted archive: block checksum mismatch");
+}
+
+/**
+ * Decodes the byte range [offset, offset + length) of a serialized archive, and nothing else:
+ * only the blocks covering the range are read, each one from the last checkpoint before the range.
+ * @param archive the archive bytes (possibly a mapping: untouched blocks are never paged in).
+ * @param index the index returned by parse_archive.
+ * @param archive_decoder the decoder built by make_decoder from the archive index.
+ * @param offset first byte of the range, in the uncompressed sequence.
+ * @param length the number of bytes, clamped to the end of the sequence.
+ * @param out destination, at least length bytes.
+ * @return the number of symbols decoded (>= the bytes returned when starting from a checkpoint).
+ */
+uint64_t extract_range(const unsigned char *archive, const archive_index_t &index, const decoder_t &archive_decoder,
+                       uint64_t offset, uint64_t length, char *out)
+{
+    if (offset >= index.raw_size)
+        return 0;
+    auto end = offset + min(length, index.raw_size - offset);
+
+    // first block ending after offset
+    auto it = upper_bound(index.entries.begin(), index.entries.end(), offset,
+                          [](uint64_t off, const block_entry_t &e) { return off < e.raw_offset + e.raw_len; });
+
+    uint64_t decoded = 0;
+    string scratch;
+    for (; it != index.entries.end() && it->raw_offset < end; ++it)
+    {
+        auto &entry = *it;
+        auto from = max(offset, entry.raw_offset) - entry.raw_offset;
+        auto to = min(end, entry.raw_offset + entry.raw_len) - entry.raw_offset;
+        auto dst = out + (entry.raw_offset + from - offset);
+        auto &decoder = entry_decoder(archive_decoder, entry);
+
+        if (entry.kind == BLOCK_STORED)
+        {
+            memcpy(dst, archive + entry.comp_offset + from, to - from);
+            continue;
+        }
+        if (!entry.stream_bits.empty() || decoder.words || decoder.ans)
+        {
+            // sub-streams, word and tANS blocks have no checkpoints: decode the block up to `to`
+            scratch.resize(to);
+            if (decoder.ans)
+                ans_decode(archive + entry.comp_offset, entry.n_bits, *decoder.ans, &scratch[0], to);
+            else if (decoder.words)
+                decode_words(archive + entry.comp_offset, entry.n_bits, *decoder.words, &scratch[0], to);
+            else
+                decode_streams(archive + entry.comp_offset, entry.stream_bits, decoder, &scratch[0], to);
+            memcpy(dst, scratch.data() + from, to - from);
+            decoded += to;
+            continue;
+        }
+
+        // restart from the closest checkpoint at or before `from`
+        uint64_t k = index.checkpoint_interval > 0 ? min<uint64_t>(from / index.checkpoint_interval,
+                                                                   entry.checkpoints.size()) : 0;
+        auto first_symbol = k * index.checkpoint_interval;
+        auto first_bit = k > 0 ? entry.checkpoints[k - 1] : 0;
+        scratch.resize(to - first_symbol);
+        decode_block(archive + entry.comp_offset, entry.n_bits, decoder, &scratch[0], scratch.size(), first_bit);
+        memcpy(dst, scratch.data() + (from - first_symbol), to - from);
+        decoded += scratch.size();
+    }
+    return decoded;
+}
+
+/**
+ * Decodes the blocks of an archive still in memory and compares every one with its range of the original
+ * sequence. Blocks are split among n_threads threads, each decoding into its own scratch block, as a reader
+ * would: the decoders are rebuilt from the frequencies of the archive.
+ * @param archive the encoded archive.
+ * @param seq the original sequence.
+ * @param n_threads the number of decoding threads.
+ * @return the number of blocks that do not decode to their range (or fail to decode).
+ */
+uint64_t verify_archive(const archive_t &archive, const string &seq, size_t n_threads)
+{
+    if (seq.size() != archive.raw_size)
+        return max<uint64_t>(1, archive.blocks.size());
+
+    archive_index_t index;
+    index.raw_size = archive.raw_size;
+    index.checkpoint_interval = archive.checkpoint_interval;
+    index.n_streams = archive.n_streams;
+    index.coder = archive.coder;
+    index.checksums = archive.checksums;
+    index.freqs = archive.freqs;
+    index.dictionary = archive.dictionary;
+    index.tables = archive.tables;
+    uint64_t raw_offset = 0;
+    index.entries.reserve(archive.blocks.size());
+    for (size_t i = 0; i < archive.blocks.size(); i++)
+    {
+        auto &block = archive.blocks[i];
+        block_entry_t entry{};
+        entry.kind = block.kind;
+        entry.raw_len = block.raw_len;
+        entry.raw_offset = raw_offset;
+        entry.comp_offset = 0;      // every block is decoded from its own buffer
+        entry.n_bits = block.n_bits;
+        entry.has_crc = archive.checksums;
+        entry.crc = block.crc;
+        entry.checkpoints = block.checkpoints;
+        entry.stream_bits = block.stream_bits;
+        while (entry.table < index.tables.size() && index.tables[entry.table].first_block <= i)
+            entry.table++;
+        raw_offset += block.raw_len;
+        index.entries.push_back(std::move(entry));
+    }
+    if (raw_offset != archive.raw_size)
+        return max<uint64_t>(1, archive.blocks.size());
+
+    auto tree = generate_huffman_tree(from_freq_table(index.freqs));
+    auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+    n_threads = max<size_t>(1, min(n_threads, index.entries.size()));
+    vector<uint64_t> failed(n_threads, 0);
+    vector<thread> threads;
+    auto n_blocks = index.entries.size();
+    for (size_t t = 0; t < n_threads; t++)
+        threads.emplace_back([&, t]() {
+            string scratch;
+            for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+            {
+                auto &entry = index.entries[i];
+                scratch.resize(entry.raw_len);
+                try
+                {
+                    decode_entry(archive.blocks[i].data.data(), entry, decoder, &scratch[0]);
+                    if (memcmp(scratch.data(), seq.data() + entry.raw_offset, entry.raw_len) != 0)
+                        failed[t]++;
+                }
+                catch (const exception &)
+                {
+                    failed[t]++;
+                }
+            }
+        });
+    for (auto &t : threads)
+        t.join();
+    free_tree(tree);
+
+    uint64_t n_failed = 0;
+    for (auto n : failed)
+        n_failed += n;
+    return n_failed;
+}
+
+/**
+ * Prints the outcome of a verification.
+ * @param n_failed the number of blocks that did not decode to the original.
+ * @param time_verify the time taken, in microseconds.
+ * @return true if every block was correct.
+ */
+bool report_verification(uint64_t n_failed, long time_verify)
+{
+    if (n_failed == 0)
+        cout << "\033[1;32m> File is correct!\033[0m (verified in " << time_verify << " usec)" << endl;
+    else
+        cout << "\033[1;31mWrong! " << n_failed << " corrupted block(s)\033[0m" << endl;
+    return n_failed == 0;
+}
+
+/**
+ * Checks that an archive decodes back to the original sequence, before it is written anywhere:
+ * see verify_archive.
+ * @param archive the encoded archive.
+ * @param seq the original sequence.
+ * @param n_threads the number of decoding threads.
+ * @return true if the decoded sequence is equal to the original sequence, false otherwise.
+ */
+bool check_archive(const archive_t &archive, const string &seq, size_t n_threads)
+{
+    auto start = chrono::steady_clock::now();
+    auto n_failed = verify_archive(archive, seq, n_threads);
+    auto time_verify = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    return report_verification(n_failed, (long)time_verify);
+}
+
+/**
+ * The compress() of every backend: runs its in-memory phases on an input already loaded, without reading
+ * or writing files, and times them. The input is borrowed, not copied: it is swapped into the backend's
+ * sequence for the call and swapped back before returning, also when a phase throws.
+ * @param seq the sequence the backend works on.
+ * @param input the sequence to compress.
+ * @param times filled with the time of every phase.
+ * @param count computes the frequencies of seq; returns the time of the merge of the partial histograms.
+ * @param build_codes builds the tree and the codes from the frequencies.
+ * @param encode encodes seq.
+ * @return the archive.
+ */
+archive_t compress_phases(string &seq, string &input, phase_times_t &times, const function<long()> &count,
+                          const function<void()> &build_codes, const function<archive_t()> &encode)
+{
+    auto elapsed = [](chrono::steady_clock::time_point start) {
+        return (long)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    };
+    seq.swap(input);
+    archive_t archive;
+    try
+    {
+        auto start = chrono::steady_clock::now();
+        times.time_reduce = count();
+        times.time_freqs = elapsed(start);
+        start = chrono::steady_clock::now();
+        build_codes();
+        times.time_tree_codes = elapsed(start);
+        start = chrono::steady_clock::now();
+        archive = encode();
+        times.time_encode = elapsed(start);
+    }
+    catch (...)
+    {
+        seq.swap(input);
+        throw;
+    }
+    seq.swap(input);
+    return archive;
+}
+
+/* bytes block i of an estimated archive takes in the payload, as payload_size() counts its entry */
+static uint64_t estimated_payload(const block_t &block)
+{
+    if (block.kind == BLOCK_STORED)
+        return block.raw_len;
+    if (block.stream_bits.empty())
+        return (block.n_bits + 7) / 8;
+    uint64_t n_bytes = 0;
+    for (auto bits : block.stream_bits)
+        n_bytes += (bits + 7) / 8;
+    return n_bytes;
+}
+
+/*
+ * Fills the metadata of block i as encode_archive_block would, without packing anything: the size in bits
+ * with the coder of the archive, the stored-or-coded decision of the policy, the sub-stream sizes and the
+ * checkpoint offsets. Huffman sizes are exact; tANS sizes come from the histogram of the block, so they
+ * can be off by the few bits of the final state.
+ */
+static void estimate_block(archive_t &archive, size_t i, const char *data, const code_table_t &table, int policy)
+{
+    auto start = i * archive.block_size;
+    auto len = min(archive.block_size, archive.raw_size - start);
+    auto &block = archive.blocks[i];
+    block.raw_len = len;
+    data += start;
+
+    uint64_t n_bits = 0;
+    if (policy != STORE_ALL && table.ans)
+    {
+        freq_table_t counts{};
+        count_symbols(data, len, counts);
+        n_bits = ans_histogram_bits(counts, *table.ans);
+    }
+    else if (policy != STORE_ALL)
+        n_bits = archive.n_streams > 1 ? count_stream_bits(data, len, table, archive.n_streams, block.stream_bits)
+                                       : encoded_bits(data, len, table);
+    if (policy == STORE_ALL || (policy == STORE_BLOCK && !worth_encoding(n_bits, len)))
+    {
+        block.kind = BLOCK_STORED;
+        block.stream_bits.clear();
+        return;
+    }
+    block.kind = BLOCK_HUFFMAN;
+    block.n_bits = n_bits;
+    // the offset of every checkpoint_interval-th symbol, as pack_symbols records them
+    uint64_t offset = 0;
+    for (uint64_t k = 1; archive.checkpoint_interval > 0 && k * archive.checkpoint_interval < len; k++)
+    {
+        offset += encoded_bits(data + (k - 1) * archive.checkpoint_interval, archive.checkpoint_interval, table);
+        block.checkpoints.push_back(offset);
+    }
+}
+
+/**
+ * Predicts the archive a run with these options would write, without writing it.
+ * The blocks are laid out as the backends lay them out and every block is sized and stored or coded with
+ * the policy of the run (store mode, coder, streams, checkpoints); the trailer is then serialized from
+ * that metadata, so header, index and footer are counted exactly.
+ * Huffman code lengths are the leaf depths of the tree, so the code table is built from the histogram and
+ * nothing is packed.
+ * @param seq the input.
+ * @param freqs its frequency map.
+ * @param options the options of the run; block_size is the block size of the backend.
+ * @param n_threads threads sizing the blocks.
+ * @return the estimate; output_bytes is the size of the whole archive.
+ */
+estimate_t estimate_compression(const string &seq, const unordered_map<char, unsigned> &freqs,
+                                const run_options_t &options, size_t n_threads)
+{
+    estimate_t estimate{};
+    estimate.coder = options.coder;
+    for (auto &it : freqs)
+        estimate.n_symbols += it.second;
+    estimate.alphabet = freqs.size();
+
+    for (auto &it : freqs)
+    {
+        auto p = (double)it.second / (double)estimate.n_symbols;
+        estimate.entropy -= p * log2(p);
+    }
+
+    archive_t archive;
+    init_archive(archive, seq.size(), to_freq_table(freqs), options.block_size, options.checkpoint_interval,
+                 options.n_streams);
+    auto tree = generate_huffman_tree(freqs);
+    auto codes = generate_huffman_codes(tree);
+    auto table = make_code_table(codes);
+    free_codes(codes);
+    free_tree(tree);
+    use_coder(archive, table, options.coder);
+    auto policy = resolve_store_policy(archive, table, options.store_mode);
+    estimate.coded_bits = table.ans ? ans_histogram_bits(archive.freqs, *table.ans)
+                                    : histogram_bits(archive.freqs, table);
+
+    auto n_blocks = archive.blocks.size();
+    n_threads = max<size_t>(1, min(n_threads, n_blocks));
+    vector<thread> threads;
+    for (size_t t = 0; t < n_threads; t++)
+        threads.emplace_back([&, t]() {
+            for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                estimate_block(archive, i, seq.data(), table, policy);
+        });
+    for (auto &t : threads)
+        t.join();
+
+    estimate.n_blocks = n_blocks;
+    for (auto &block : archive.blocks)
+    {
+        estimate.n_stored += block.kind == BLOCK_STORED;
+        estimate.payload_bytes += estimated_payload(block);
+    }
+    bytes_t overhead;
+    serialize_header(archive, overhead);
+    serialize_trailer(archive, overhead.size() + estimate.payload_bytes, overhead);
+    estimate.overhead_bytes = overhead.size();
+    estimate.output_bytes = estimate.payload_bytes + estimate.overhead_bytes;
+    estimate.ratio = estimate.n_symbols > 0 ? (double)estimate.output_bytes / (double)estimate.n_symbols : 0;
+    return estimate;
+}
+
+void print_estimate(const estimate_t &estimate, const long time_read, const long time_freqs)
+{
+    auto avg_len = estimate.n_symbols > 0 ? (double)estimate.coded_bits / (double)estimate.n_symbols : 0;
+    cout << "Estimate (code lengths only, nothing encoded or written):" << endl;
+    cout << "  input size:     " << estimate.n_symbols << " bytes, " << estimate.alphabet << " distinct symbols" << endl;
+    cout << "  entropy:        " << estimate.entropy << " bits/symbol" << endl;
+    cout << (estimate.coder == CODER_ANS ? "  tANS:           " : "  huffman:        ") << avg_len << " bits/symbol, "
+         << estimate.coded_bits << " bits" << endl;
+    cout << "  blocks:         " << estimate.n_blocks << ", " << estimate.n_stored << " would be stored" << endl;
+    cout << "  output size:    " << estimate.output_bytes << " bytes (payload " << estimate.payload_bytes
+         << ", header and index " << estimate.overhead_bytes << ")" << endl;
+    cout << "  expected ratio: " << estimate.ratio << endl;
+    cout << "  time read:      " << time_read << " usec, time freqs: " << time_freqs << " usec" << endl;
+}
@@ -0,0 +1,307 @@
+#ifndef SPM_PROJECT_HUFFMAN_FORMAT_H
+#define SPM_PROJECT_HUFFMAN_FORMAT_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "allocator.h"
+#include "huffman-commons.h"
+
+/*
+ * Self-describing archive layout (all integers little endian):
+ *
+ *   header   "SPMH" | u8 version | u8 flags | u16 reserved | u64 raw_size
+ *   payload  block 0 | block 1 | ...            (each block starts on a byte boundary)
+ *            a Huffman block holds ceil(n_bits / 8) bytes, a stored block its raw_len raw bytes
+ *   trailer  frequency table | [varint checkpoint_interval] | [varint n_streams] | [dictionary] |
+ *            [varint raw_size] | [table switches] | u32 n_blocks | block entries
+ *   footer   u64 trailer_offset | "SPMF"
+ *
+ * A block entry is u8 kind | varint raw_len | varint n_bits | [u32 crc], followed, with ARCHIVE_FLAG_CHECKPOINTS
+ * and for Huffman blocks only, by (raw_len - 1) / checkpoint_interval varint deltas: the bit offset
+ * of symbol k * checkpoint_interval of the block, for k = 1, 2, ...
+ * With ARCHIVE_FLAG_STREAMS a Huffman block is split into n_streams interleaved sub-streams: sub-stream s
+ * holds symbols s, s + n_streams, s + 2 * n_streams, ... with its own bit cursor, starts on a byte boundary
+ * and is followed by the next one. Its entry is followed by n_streams varints, the bits of every
+ * sub-stream (n_bits is their sum). Independent cursors let one core keep several encode/decode chains
+ * in flight; checkpoints and sub-streams are not combined.
+ * With ARCHIVE_FLAG_WORDS the symbols are tokens rather than bytes: the frequency table is empty and the
+ * dictionary (varint size | bytes, see huffman-words.h) describes the canonical code. Blocks split on
+ * token boundaries and there are no checkpoints or sub-streams.
+ * With ARCHIVE_FLAG_ANS the coded blocks are tANS bitstreams (huffman-ans.h) instead of Huffman codes; the
+ * decoder tables are rebuilt from the frequency table, and there are no checkpoints or sub-streams either.
+ * With ARCHIVE_FLAG_TABLES the archive was grown by appends (huffman-io.h) and not every block uses the
+ * first frequency table: the switches (varint n_switches, then varint first_block | frequency table for
+ * each, first_block increasing) give the table every block from first_block on is coded with.
+ * With ARCHIVE_FLAG_STREAMED the archive was written to a pipe, in one pass (huffman-io.h): the header was
+ * out before the size and the tables were known, so its raw_size is 0 and the trailer holds the raw size and
+ * the table switches, whose count may be 0; ARCHIVE_FLAG_TABLES is never set with it.
+ * With ARCHIVE_FLAG_CHECKSUMS (set by every writer) each entry carries the CRC32C of the raw bytes of its
+ * block (crc32c.h); decode_entry checks it, so whole blocks are verified as they are decoded.
+ *
+ * The frequency table is what the decoder needs to rebuild the Huffman tree, so an archive
+ * can be decoded without the original input. Keeping the index at the end lets writers stream
+ * blocks out before they know how many there will be.
+ * Block starts and checkpoints form a sparse (uncompressed offset -> bit offset) index: reading a
+ * byte range decodes from the closest preceding checkpoint and touches only the blocks it covers.
+ */
+
+#define ARCHIVE_MAGIC "SPMH"
+#define ARCHIVE_FOOTER_MAGIC "SPMF"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_FOOTER_SIZE 12
+#define ARCHIVE_FLAG_CHECKPOINTS 1
+#define ARCHIVE_FLAG_STREAMS 2
+#define ARCHIVE_FLAG_WORDS 4
+#define ARCHIVE_FLAG_ANS 8
+#define ARCHIVE_FLAG_TABLES 16
+#define ARCHIVE_FLAG_CHECKSUMS 32
+#define ARCHIVE_FLAG_STREAMED 64
+#define MAX_STREAMS 8
+#define BLOCK_SIZE (256 * 1024)
+
+#define BLOCK_HUFFMAN 0     // entropy coded, with the coder of the archive
+#define BLOCK_STORED 1
+
+// entropy coder of the blocks
+#define CODER_HUFFMAN 0
+#define CODER_ANS 1         // tANS over the same histogram (huffman-ans.h)
+
+// when to fall back to stored (raw) blocks
+#define STORE_OFF 0         // always Huffman-code
+#define STORE_BLOCK 1       // decide per block, from the exact encoded size of the block
+#define STORE_GLOBAL 2      // decide once, from the histogram of the whole input
+#define STORE_ALL 3         // policy resolved by STORE_GLOBAL: every block is stored
+
+// how the input is loaded
+#define READ_SERIAL 0       // read the whole file on one thread, then count it
+#define READ_FUSED 1        // mappers pread their own ranges and count them as they arrive (huffman-io.h)
+
+// codes up to this length are decoded with one table lookup, longer ones walk the tree
+#define DECODE_TABLE_BITS 11
+
+// two-symbol tables: pairs whose codes add up to PAIR_MAX_BITS are encoded with one lookup in a 64K-entry
+// table, and decoded two at a time from a PAIR_TABLE_BITS table; below PAIR_MIN_INPUT symbols the table
+// builds do not pay for themselves
+#define PAIR_MAX_BITS 24
+#define PAIR_TABLE_BITS 12
+#define PAIR_MIN_INPUT (1UL << 20)
+
+#define PAIRS_AUTO 0        // pair tables for inputs of at least PAIR_MIN_INPUT symbols
+#define PAIRS_OFF 1
+#define PAIRS_ON 2
+
+// Huffman-coding a block must save more than raw_len / STORE_MIN_GAIN bytes, or it is stored
+#define STORE_MIN_GAIN 64
+
+using namespace std;
+
+typedef spm_vector<unsigned char> bytes_t;
+
+/** Occurrences of each byte value. */
+typedef array<uint64_t, 256> freq_table_t;
+
+/** Huffman code packed in a machine word: bit i is the i-th bit written to the stream. */
+struct packed_code_t {
+    uint64_t bits;
+    uint8_t len;
+};
+
+struct ans_table_t;
+
+/** Packed code of every byte value, plus the optional two-symbol table. */
+struct code_table_t {
+    array<packed_code_t, 256> codes{};
+    vector<uint32_t> pairs;     // byte pair (first | second << 8) -> bits | length << 24, 0 if too long; may be empty
+    int kernel = 0;             // specialized encode kernel for these code lengths (huffman-kernels.h)
+    shared_ptr<const ans_table_t> ans;  // set when the blocks are tANS coded instead (use_coder)
+
+    packed_code_t &operator[](size_t c) { return codes[c]; }
+    const packed_code_t &operator[](size_t c) const { return codes[c]; }
+};
+
+/** Frequency table that takes over from block first_block on, in archives grown by appends. */
+struct table_switch_t {
+    uint64_t first_block;
+    freq_table_t freqs;
+};
+
+/** One compressed block, owned by the writer. */
+struct block_t {
+    uint8_t kind = BLOCK_HUFFMAN;
+    uint64_t raw_len = 0;
+    uint64_t n_bits = 0;
+    uint32_t crc = 0;               // CRC32C of the raw bytes of the block
+    bytes_t data;
+    vector<uint64_t> checkpoints;   // bit offset of every checkpoint_interval-th symbol, Huffman blocks only
+    vector<uint64_t> stream_bits;   // bits of every sub-stream, Huffman blocks of multi-stream archives only
+};
+
+/** Archive being assembled in memory. */
+struct archive_t {
+    uint64_t raw_size = 0;
+    uint64_t block_size = BLOCK_SIZE;   // writer side only, readers use the per-block raw_len
+    uint64_t checkpoint_interval = 0;   // symbols between checkpoints inside a block, 0 for none
+    unsigned n_streams = 1;             // interleaved sub-streams per Huffman block
+    int coder = CODER_HUFFMAN;
+    bool checksums = true;              // store the CRC of every block
+    bool streamed = false;              // raw size and table switches in the trailer only (non-seekable output)
+    freq_table_t freqs{};
+    bytes_t dictionary;                 // word archives only: the serialized token dictionary
+    vector<table_switch_t> tables;      // appended and piped archives only: the tables after freqs
+    vector<block_t> blocks;
+};
+
+/** Knobs shared by every backend, set from the command line flags. */
+struct run_options_t {
+    int store_mode = STORE_BLOCK;
+    uint64_t block_size = BLOCK_SIZE;
+    int read_mode = READ_FUSED;     // parallel backends only, seq always reads serially
+    bool direct_io = false;         // O_DIRECT for the fused reader
+    uint64_t checkpoint_interval = 0;
+    unsigned n_streams = 1;         // interleaved sub-streams per Huffman block (1..MAX_STREAMS)
+    int pair_mode = PAIRS_AUTO;
+    int coder = CODER_HUFFMAN;
+    bool verify = false;            // decode the archive back in memory, in parallel, and compare it to the input
+    bool pin_threads = false;       // ff: pin every encoder of the farm to a core
+};
+
+/** Outcome of a dry run: the archive compressing the input would produce, sized block by block. */
+struct estimate_t {
+    uint64_t n_symbols;
+    unsigned alphabet;
+    double entropy;         // Shannon entropy, bits per symbol
+    int coder;
+    uint64_t coded_bits;    // size of the whole input coded in one piece with that coder
+    unsigned n_blocks;
+    unsigned n_stored;      // blocks the store policy of the run would keep raw
+    uint64_t payload_bytes; // coded and stored blocks
+    uint64_t overhead_bytes;// header, trailer and footer
+    uint64_t output_bytes;  // size of the archive that would be written
+    double ratio;           // output_bytes / n_symbols
+};
+
+/** Location of one block inside a serialized archive. */
+struct block_entry_t {
+    uint8_t kind;
+    uint64_t raw_offset;
+    uint64_t raw_len;
+    uint64_t comp_offset;   // from the beginning of the archive
+    uint64_t n_bits;
+    bool has_crc;
+    uint32_t crc;
+    vector<uint64_t> checkpoints;
+    vector<uint64_t> stream_bits;   // empty for single-stream and stored blocks
+    unsigned table = 0;             // 0 for the frequency table of the archive, k for its k-th switch
+};
+
+/** Parsed trailer of a serialized archive; block data stays in the caller's buffer. */
+struct archive_index_t {
+    uint64_t raw_size = 0;
+    uint64_t checkpoint_interval = 0;
+    unsigned n_streams = 1;
+    int coder = CODER_HUFFMAN;
+    bool checksums = false;
+    bool streamed = false;
+    freq_table_t freqs{};
+    bytes_t dictionary;
+    vector<table_switch_t> tables;
+    vector<block_entry_t> entries;
+    uint64_t trailer_offset = 0;
+};
+
+struct word_decoder_t;
+
+/** Table-driven decoder built once per archive from the Huffman tree. */
+struct decoder_t {
+    const Node *root = nullptr;
+    vector<uint16_t> table;     // next DECODE_TABLE_BITS bits -> symbol | code length << 8, 0 for longer codes
+    vector<uint32_t> pairs;     // next PAIR_TABLE_BITS bits -> first | second << 8 | both lengths << 16, 0 if
+                                // they do not hold two codes; may be empty
+    int kernel = 0;             // specialized decode kernel for the code lengths (huffman-kernels.h)
+    shared_ptr<const word_decoder_t> words;  // word archives: the dictionary, and no tree
+    shared_ptr<const ans_table_t> ans;       // tANS archives: the decoding table
+    vector<decoder_t> tables;   // decoders of the table switches, for the blocks with block_entry_t::table > 0
+    shared_ptr<Node> tree;      // the tree of a table switch, owned by its decoder
+};
+
+freq_table_t to_freq_table(const unordered_map<char, unsigned> &freqs);
+
+unordered_map<char, unsigned> from_freq_table(const freq_table_t &table);
+
+bool use_pair_tables(int pair_mode, uint64_t n_symbols);
+
+code_table_t make_code_table(const unordered_map<char, code_t*> &codes, bool pairs = false);
+
+uint64_t encoded_bits(const char *data, size_t n, const code_table_t &table);
+
+uint64_t histogram_bits(const freq_table_t &freqs, const code_table_t &table);
+
+bool worth_encoding(uint64_t n_bits, uint64_t raw_len);
+
+uint64_t encode_block(const char *data, size_t n, const code_table_t &table, bytes_t &out);
+
+uint64_t encode_streams(const char *data, size_t n, const code_table_t &table, unsigned n_streams, bytes_t &out,
+                        vector<uint64_t> &stream_bits);
+
+decoder_t make_decoder(const Node *root, bool pairs = false);
+
+decoder_t make_decoder(const archive_index_t &index, const Node *root, bool pairs = false);
+
+void decode_block(const unsigned char *data, uint64_t n_bits, const decoder_t &decoder, char *out, size_t n_out,
+                  uint64_t first_bit = 0);
+
+void decode_streams(const unsigned char *data, const vector<uint64_t> &stream_bits, const decoder_t &decoder,
+                    char *out, size_t n_out);
+
+size_t block_count(uint64_t raw_size, uint64_t block_size = BLOCK_SIZE);
+
+void init_archive(archive_t &archive, uint64_t raw_size, const freq_table_t &freqs, uint64_t block_size = BLOCK_SIZE,
+                  uint64_t checkpoint_interval = 0, unsigned n_streams = 1);
+
+void use_coder(archive_t &archive, code_table_t &table, int coder);
+
+int resolve_store_policy(const archive_t &archive, const code_table_t &table, int store_mode);
+
+void encode_archive_block(archive_t &archive, size_t i, const char *data, const code_table_t &table, int policy);
+
+void count_blocks(const archive_t &archive, unsigned &n_huffman, unsigned &n_stored);
+
+void serialize_header(const archive_t &archive, bytes_t &out);
+
+void serialize_trailer(const archive_t &archive, uint64_t trailer_offset, bytes_t &out);
+
+void serialize_archive(const archive_t &archive, bytes_t &out);
+
+void write_archive(const archive_t &archive, const string &filename);
+
+archive_index_t parse_archive(const unsigned char *data, size_t size);
+
+const decoder_t &entry_decoder(const decoder_t &decoder, const block_entry_t &entry);
+
+void decode_entry(const unsigned char *archive, const block_entry_t &entry, const decoder_t &decoder, char *out);
+
+uint64_t extract_range(const unsigned char *archive, const archive_index_t &index, const decoder_t &decoder,
+                       uint64_t offset, uint64_t length, char *out);
+
+uint64_t verify_archive(const archive_t &archive, const string &seq, size_t n_threads);
+
+bool check_archive(const archive_t &archive, const string &seq, size_t n_threads);
+
+bool report_verification(uint64_t n_failed, long time_verify);
+
+archive_t compress_phases(string &seq, string &input, phase_times_t &times, const function<long()> &count,
+                          const function<void()> &build_codes, const function<archive_t()> &encode);
+
+estimate_t estimate_compression(const string &seq, const unordered_map<char, unsigned> &freqs,
+                                const run_options_t &options = run_options_t(), size_t n_threads = 1);
+
+void print_estimate(const estimate_t &estimate, const long time_read, const long time_freqs);
+
+#endif //SPM_PROJECT_HUFFMAN_FORMAT_H
@@ -0,0 +1,868 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "huffman-io.h"
+#include "huffman-ans.h"
+#include "huffman-kernels.h"
+#include "crc32c.h"
+
+using namespace std;
+
+/**
+ * Opens the input for the fused read stage.
+ * @param filename the file to read.
+ * @param direct bypass the page cache (O_DIRECT); falls back to buffered reads if the filesystem refuses it.
+ * @return the open file and its size.
+ */
+input_file_t open_input(const string &filename, bool direct)
+{
+    input_file_t file;
+#ifdef O_DIRECT
+    if (direct)
+    {
+        file.fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+        file.direct = file.fd >= 0;
+        if (!file.direct && errno == EINVAL)
+            cerr << "O_DIRECT not supported for " << filename << ", using buffered reads" << endl;
+    }
+#endif
+    if (file.fd < 0)
+        file.fd = open(filename.c_str(), O_RDONLY);
+    if (file.fd < 0)
+        throw runtime_error("Could not open file: " + filename);
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct)
+        file.direct = fcntl(file.fd, F_NOCACHE, 1) == 0;
+#endif
+
+    struct stat st{};
+    if (fstat(file.fd, &st) != 0)
+    {
+        close(file.fd);
+        throw runtime_error("Could not stat file: " + filename);
+    }
+    file.size = st.st_size;
+    return file;
+}
+
+void close_input(input_file_t &file)
+{
+    if (file.fd >= 0)
+        close(file.fd);
+    file.fd = -1;
+}
+
+/**
+ * Opens and maps an archive.
+ * @param filename the archive.
+ * @param advice the madvise() advice for the mapping.
+ * @param populate fault every page in when mapping it.
+ */
+MappedArchive::MappedArchive(const string &filename, int advice, bool populate)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Could not open file: " + filename);
+    try
+    {
+        map(fd, filename, advice, populate);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+/**
+ * Maps an archive already open; the descriptor stays with the caller.
+ */
+MappedArchive::MappedArchive(int fd, const string &filename, int advice)
+{
+    map(fd, filename, advice, false);
+}
+
+MappedArchive::~MappedArchive()
+{
+    munmap((void *)bytes, length);
+}
+
+void MappedArchive::map(int fd, const string &filename, int advice, bool populate)
+{
+    struct stat st{};
+    if (fstat(fd, &st) != 0)
+        throw runtime_error("Could not stat file: " + filename);
+    if (st.st_size == 0)
+        throw runtime_error("Not an archive: " + filename);
+    auto flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate)
+        flags |= MAP_POPULATE;
+#endif
+    auto map = mmap(nullptr, st.st_size, PROT_READ, flags, fd, 0);
+    if (map == MAP_FAILED)
+        throw runtime_error("Could not map file: " + filename);
+    madvise(map, st.st_size, advice);
+    bytes = static_cast<const unsigned char *>(map);
+    length = st.st_size;
+}
+
+/**
+ * Start of the i-th of n ranges of a file, aligned down to DIRECT_ALIGN.
+ * @return the offset of range i; read_split(size, n, n) is size.
+ */
+uint64_t read_split(uint64_t size, size_t i, size_t n)
+{
+    if (i >= n)
+        return size;
+    return (uint64_t)((__uint128_t)size * i / n) / DIRECT_ALIGN * DIRECT_ALIGN;
+}
+
+/** preads until n bytes are read or EOF, returns the bytes read. */
+static size_t pread_full(int fd, char *buf, size_t n, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        auto got = pread(fd, buf + done, n - done, (off_t)(offset + done));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            throw runtime_error(string("pread failed: ") + strerror(errno));
+        if (got == 0)
+            break;
+        done += got;
+    }
+    return done;
+}
+
+/**
+ * Reads [begin, end) of the file into dst and adds its symbols to counts, one chunk at a time.
+ * @param file the input, from open_input().
+ * @param begin first byte of the range (a multiple of DIRECT_ALIGN with direct I/O).
+ * @param end one past the last byte of the range.
+ * @param dst destination of the range, at least end - begin bytes.
+ * @param counts the caller's partial histogram.
+ */
+void read_count_range(const input_file_t &file, uint64_t begin, uint64_t end, char *dst, freq_table_t &counts)
+{
+    if (!file.direct)
+    {
+        for (auto offset = begin; offset < end; offset += READ_CHUNK)
+        {
+            auto len = min<uint64_t>(READ_CHUNK, end - offset);
+            if (pread_full(file.fd, dst + (offset - begin), len, offset) != len)
+                throw runtime_error("Unexpected end of input file");
+            count_symbols(dst + (offset - begin), len, counts);
+        }
+        return;
+    }
+
+    if (begin % DIRECT_ALIGN != 0)
+        throw runtime_error("Direct reads must start on a DIRECT_ALIGN boundary");
+
+    // O_DIRECT needs an aligned destination: read into a bounce buffer, then copy out
+    static thread_local unique_ptr<char, decltype(&free)> bounce(nullptr, &free);
+    if (!bounce)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p, DIRECT_ALIGN, READ_CHUNK) != 0)
+            throw bad_alloc();
+        bounce.reset(static_cast<char *>(p));
+    }
+
+    for (auto offset = begin; offset < end; offset += READ_CHUNK)
+    {
+        auto len = min<uint64_t>(READ_CHUNK, end - offset);
+        // lengths are rounded up to the alignment, the tail of the file comes back short
+        auto aligned_len = (len + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+        if (pread_full(file.fd, bounce.get(), aligned_len, offset) < len)
+            throw runtime_error("Unexpected end of input file");
+        memcpy(dst + (offset - begin), bounce.get(), len);
+        count_symbols(bounce.get(), len, counts);
+    }
+}
+
+/**
+ * Random-access read of an archive on disk. The file is mapped, not read: parsing touches the
+ * header and the trailer, decoding only the pages of the blocks covering the range.
+ * @param filename the archive.
+ * @param offset first byte of the range, in the uncompressed sequence.
+ * @param length the number of bytes wanted.
+ * @param out receives the bytes (fewer than length if the range goes past the end).
+ * @return the number of symbols decoded to produce them.
+ */
+uint64_t extract_file(const string &filename, uint64_t offset, uint64_t length, string &out)
+{
+    // no read-ahead: the accesses are a few scattered blocks
+    MappedArchive archive(filename, MADV_RANDOM);
+    auto index = parse_archive(archive.data(), archive.size());
+    out.resize(offset < index.raw_size ? min(length, index.raw_size - offset) : 0);
+    auto tree = generate_huffman_tree(from_freq_table(index.freqs));
+    uint64_t decoded = 0;
+    try
+    {
+        auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, out.size()));
+        decoded = extract_range(archive.data(), index, decoder, offset, length, &out[0]);
+    }
+    catch (...)
+    {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+    return decoded;
+}
+
+/**
+ * Decodes a whole archive to a file on n_threads threads. By default the blocks are split among the
+ * threads through the index; speculative decoding instead runs all the threads on one block at a time,
+ * from guessed offsets (huffman-sync.h), as for a stream with no index. Blocks it cannot split (stored, tANS,
+ * multi-stream, word blocks) are decoded as usual.
+ * @param filename the archive.
+ * @param output the file the sequence is written to, "-" for stdout.
+ * @param n_threads the number of decoding threads.
+ * @param speculative ignore block boundaries when parallelizing.
+ * @param stats filled with the cost of speculation.
+ * @return the number of bytes decoded.
+ */
+uint64_t decode_file(const string &filename, const string &output, size_t n_threads, bool speculative,
+                     sync_stats_t &stats)
+{
+    string out;
+    {
+        // unmapped before the output is written
+        MappedArchive archive(filename, MADV_SEQUENTIAL);
+        auto data = archive.data();
+        Node *tree = nullptr;
+        try
+        {
+            auto index = parse_archive(data, archive.size());
+            out.resize(index.raw_size);
+            tree = generate_huffman_tree(from_freq_table(index.freqs));
+            auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+            n_threads = max<size_t>(1, n_threads);
+
+            if (speculative)
+                for (auto &entry : index.entries)
+                {
+                    if (entry.kind == BLOCK_HUFFMAN && entry.stream_bits.empty() && !decoder.words && !decoder.ans)
+                    {
+                        decode_speculative(data + entry.comp_offset, entry.n_bits, entry_decoder(decoder, entry),
+                                           &out[entry.raw_offset], entry.raw_len, n_threads, stats);
+                        if (entry.has_crc && crc32c(&out[entry.raw_offset], entry.raw_len) != entry.crc)
+                            throw runtime_error("Corrupted archive: block checksum mismatch");
+                    }
+                    else
+                        decode_entry(data, entry, decoder, &out[entry.raw_offset]);
+                }
+            else
+            {
+                vector<thread> threads;
+                vector<exception_ptr> errors(n_threads);
+                auto n_blocks = index.entries.size();
+                for (size_t t = 0; t < n_threads; t++)
+                    threads.emplace_back([&, t]() {
+                        try
+                        {
+                            for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                                decode_entry(data, index.entries[i], decoder, &out[index.entries[i].raw_offset]);
+                        }
+                        catch (...)
+                        {
+                            errors[t] = current_exception();
+                        }
+                    });
+                for (auto &t : threads)
+                    t.join();
+                for (auto &error : errors)
+                    if (error)
+                        rethrow_exception(error);
+            }
+        }
+        catch (...)
+        {
+            free_tree(tree);
+            throw;
+        }
+        free_tree(tree);
+    }
+
+    ofstream out_file;
+    if (output != "-")
+    {
+        out_file.open(output, ios::binary);
+        if (!out_file.is_open())
+            throw runtime_error("Could not open file: " + output);
+    }
+    ostream &dst = output == "-" ? cout : out_file;
+    if (!dst.write(out.data(), (long)out.size()).flush())
+        throw runtime_error("Could not write file: " + output);
+    return out.size();
+}
+
+/**
+ * Verifies an archive on n_threads threads, without writing anything: every block is decoded into a
+ * per-thread scratch block, its CRC (ARCHIVE_FLAG_CHECKSUMS) checked and, if the original sequence is
+ * given, compared with its range of the sequence. Archives written before checksums are only checked
+ * for decoding errors, unless seq is given.
+ * @param filename the archive.
+ * @param n_threads the number of decoding threads.
+ * @param seq the original sequence, or nullptr to rely on the checksums alone.
+ * @param n_blocks set to the number of blocks in the archive.
+ * @return the number of corrupted blocks.
+ */
+uint64_t verify_file(const string &filename, size_t n_threads, const string *seq, uint64_t &n_blocks)
+{
+    MappedArchive archive(filename, MADV_SEQUENTIAL);
+    auto data = archive.data();
+    Node *tree = nullptr;
+    uint64_t n_failed = 0;
+    try
+    {
+        auto index = parse_archive(data, archive.size());
+        n_blocks = index.entries.size();
+        if (seq != nullptr && seq->size() != index.raw_size)
+            throw runtime_error("Archive size does not match the input: " + filename);
+        tree = generate_huffman_tree(from_freq_table(index.freqs));
+        auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+        n_threads = max<size_t>(1, min<size_t>(n_threads, n_blocks));
+
+        vector<uint64_t> failed(n_threads, 0);
+        vector<thread> threads;
+        for (size_t t = 0; t < n_threads; t++)
+            threads.emplace_back([&, t]() {
+                string scratch;
+                for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                {
+                    auto &entry = index.entries[i];
+                    scratch.resize(entry.raw_len);
+                    try
+                    {
+                        decode_entry(data, entry, decoder, &scratch[0]);
+                        if (seq != nullptr && memcmp(scratch.data(), seq->data() + entry.raw_offset, entry.raw_len))
+                            failed[t]++;
+                    }
+                    catch (const exception &)
+                    {
+                        failed[t]++;
+                    }
+                }
+            });
+        for (auto &t : threads)
+            t.join();
+        for (auto n : failed)
+            n_failed += n;
+    }
+    catch (...)
+    {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+    return n_failed;
+}
+
+/** pwrites all of buf at offset. */
+static void pwrite_full(int fd, const unsigned char *buf, size_t n, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        auto put = pwrite(fd, buf + done, n - done, (off_t)(offset + done));
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0)
+            throw runtime_error(string("pwrite failed: ") + strerror(errno));
+        done += put;
+    }
+}
+
+/* runs body(t) for t in [0, n_threads) on n_threads threads, then rethrows the first error */
+template <typename Body>
+static void run_parallel(size_t n_threads, Body body)
+{
+    vector<thread> threads;
+    vector<exception_ptr> errors(n_threads);
+    for (size_t t = 0; t < n_threads; t++)
+        threads.emplace_back([&, t]() {
+            try
+            {
+                body(t);
+            }
+            catch (...)
+            {
+                errors[t] = current_exception();
+            }
+        });
+    for (auto &t : threads)
+        t.join();
+    for (auto &error : errors)
+        if (error)
+            rethrow_exception(error);
+}
+
+/* the metadata of the blocks already in an archive, as serialize_trailer needs it (no block data) */
+static void load_index(const archive_index_t &index, archive_t &archive)
+{
+    archive.raw_size = index.raw_size;
+    archive.checkpoint_interval = index.checkpoint_interval;
+    archive.n_streams = index.n_streams;
+    archive.coder = index.coder;
+    archive.checksums = index.checksums;
+    archive.freqs = index.freqs;
+    archive.tables = index.tables;
+    archive.blocks.resize(index.entries.size());
+    for (size_t i = 0; i < index.entries.size(); i++)
+    {
+        auto &entry = index.entries[i];
+        auto &block = archive.blocks[i];
+        block.kind = entry.kind;
+        block.raw_len = entry.raw_len;
+        block.n_bits = entry.n_bits;
+        block.crc = entry.crc;
+        block.checkpoints = entry.checkpoints;
+        block.stream_bits = entry.stream_bits;
+    }
+}
+
+/* bits of a histogram coded with the tables built from table_freqs, with the coder of the archive */
+static uint64_t coded_bits(const freq_table_t &freqs, const freq_table_t &table_freqs, int coder)
+{
+    if (coder == CODER_ANS)
+        return ans_histogram_bits(freqs, make_ans_table(table_freqs));
+    auto tree = generate_huffman_tree(from_freq_table(table_freqs));
+    auto codes = generate_huffman_codes(tree);
+    auto table = make_code_table(codes);
+    free_codes(codes);
+    free_tree(tree);
+    return histogram_bits(freqs, table);
+}
+
+/**
+ * How much worse the new bytes code with the current table than with a table of their own, the cost of
+ * storing that table included: (current - own) / own. Infinite if the current table lacks a symbol.
+ */
+static double table_divergence(const freq_table_t &current, const freq_table_t &freqs, int coder)
+{
+    for (int c = 0; c < 256; c++)
+        if (freqs[c] > 0 && current[c] == 0)
+            return numeric_limits<double>::infinity();
+    archive_t table_only;
+    table_only.freqs = freqs;
+    bytes_t serialized;
+    serialize_trailer(table_only, 0, serialized);
+    auto own = coded_bits(freqs, freqs, coder) + 8 * serialized.size();
+    auto bits = coded_bits(freqs, current, coder);
+    return ((double)bits - (double)own) / (double)own;
+}
+
+/**
+ * Appends the bytes an input gained since it was last compressed to its archive, as new blocks: the work is
+ * proportional to the new bytes only. The archive header and trailer are the only parts of the archive read.
+ * The new bytes are coded with the last table of the archive while their table divergence stays within
+ * max_divergence, else with a table of their own, recorded as a table switch in the trailer. The settings
+ * of the archive (coder, checkpoints, sub-streams) are kept; block size, store mode and pairs come from
+ * options. The trailer is rewritten after the new blocks, then the header: an append is not atomic.
+ * @param archive_name the archive, created if missing or empty.
+ * @param input_name the input, which must start with the bytes already in the archive.
+ * @param n_threads the number of reading and encoding threads.
+ * @param max_divergence the table divergence above which the new bytes get a table of their own.
+ * @param options the run options, used for a new archive and for the new blocks.
+ * @param result filled with what was appended.
+ * @return the number of bytes appended.
+ */
+uint64_t append_file(const string &archive_name, const string &input_name, size_t n_threads, double max_divergence,
+                     const run_options_t &options, append_result_t &result)
+{
+    int fd = open(archive_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw runtime_error("Could not open file: " + archive_name);
+    n_threads = max<size_t>(1, n_threads);
+    auto input = open_input(input_name, false);
+    Node *tree = nullptr;
+    unordered_map<char, code_t *> codes;
+    try
+    {
+        // the archive so far: header, trailer and footer only, the payload pages are never touched
+        archive_t archive;
+        archive.checkpoint_interval = options.checkpoint_interval;
+        archive.n_streams = options.n_streams;
+        archive.coder = options.coder;
+        uint64_t trailer_offset = ARCHIVE_HEADER_SIZE;
+        struct stat st{};
+        if (fstat(fd, &st) != 0)
+            throw runtime_error("Could not stat file: " + archive_name);
+        if (st.st_size > 0)
+        {
+            MappedArchive map(fd, archive_name, MADV_NORMAL);
+            auto index = parse_archive(map.data(), map.size());
+            if (!index.dictionary.empty())
+                throw runtime_error("Word archives cannot be appended to");
+            load_index(index, archive);
+            trailer_offset = index.trailer_offset;
+        }
+        if (input.size < archive.raw_size)
+            throw runtime_error("Input is shorter than its archive: " + input_name);
+
+        auto new_len = input.size - archive.raw_size;
+        result = append_result_t();
+        result.new_bytes = new_len;
+        result.n_tables = archive.tables.size() + 1;
+        if (new_len == 0)
+        {
+            if (st.st_size == 0)
+            {
+                // nothing to compress yet, but the archive must be valid
+                bytes_t empty;
+                serialize_archive(archive, empty);
+                pwrite_full(fd, empty.data(), empty.size(), 0);
+            }
+            close_input(input);
+            close(fd);
+            return 0;
+        }
+
+        // read and count the new bytes
+        string seq(new_len, '\0');
+        vector<freq_table_t> partial(n_threads, freq_table_t{});
+        run_parallel(n_threads, [&](size_t t) {
+            auto begin = read_split(new_len, t, n_threads), end = read_split(new_len, t + 1, n_threads);
+            read_count_range(input, archive.raw_size + begin, archive.raw_size + end, &seq[begin], partial[t]);
+        });
+        freq_table_t freqs{};
+        for (auto &counts : partial)
+            for (int c = 0; c < 256; c++)
+                freqs[c] += counts[c];
+
+        // keep the current table, or switch to one of the new bytes
+        auto &current = archive.tables.empty() ? archive.freqs : archive.tables.back().freqs;
+        result.divergence = table_divergence(current, freqs, archive.coder);
+        auto table_freqs = current;
+        if (archive.blocks.empty())
+        {
+            archive.freqs = table_freqs = freqs;
+            result.new_table = true;
+        }
+        else if (result.divergence > max_divergence)
+        {
+            archive.tables.push_back({archive.blocks.size(), freqs});
+            table_freqs = freqs;
+            result.new_table = true;
+        }
+        result.n_tables = archive.tables.size() + 1;
+
+        archive_t tail;
+        init_archive(tail, new_len, table_freqs, options.block_size, archive.checkpoint_interval, archive.n_streams);
+        tail.checksums = archive.checksums;     // an archive has a CRC on every block or on none
+        tree = generate_huffman_tree(from_freq_table(table_freqs));
+        codes = generate_huffman_codes(tree);
+        auto table = make_code_table(codes, use_pair_tables(options.pair_mode, new_len));
+        use_coder(tail, table, archive.coder);
+        tail.freqs = freqs;     // the store policy is decided on what the new bytes cost
+        auto policy = resolve_store_policy(tail, table, options.store_mode);
+        auto n_blocks = tail.blocks.size();
+        run_parallel(n_threads, [&](size_t t) {
+            for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                encode_archive_block(tail, i, seq.data(), table, policy);
+        });
+        result.n_blocks = n_blocks;
+
+        // new blocks over the old trailer, then the new trailer, then the header with the new size and flags
+        auto offset = trailer_offset;
+        for (auto &block : tail.blocks)
+        {
+            pwrite_full(fd, block.data.data(), block.data.size(), offset);
+            offset += block.data.size();
+            block.data = bytes_t();
+            archive.blocks.push_back(std::move(block));
+        }
+        archive.raw_size += new_len;
+        bytes_t buffer;
+        serialize_trailer(archive, offset, buffer);
+        pwrite_full(fd, buffer.data(), buffer.size(), offset);
+        if (ftruncate(fd, (off_t)(offset + buffer.size())) != 0)
+            throw runtime_error(string("ftruncate failed: ") + strerror(errno));
+        buffer.clear();
+        serialize_header(archive, buffer);
+        pwrite_full(fd, buffer.data(), buffer.size(), 0);
+    }
+    catch (...)
+    {
+        free_codes(codes);
+        free_tree(tree);
+        close_input(input);
+        close(fd);
+        throw;
+    }
+    free_codes(codes);
+    free_tree(tree);
+    close_input(input);
+    if (close(fd) != 0)
+        throw runtime_error("Could not write file: " + archive_name);
+    return result.new_bytes;
+}
+
+/** reads until n bytes are read or EOF, returns the bytes read. */
+static size_t read_full(int fd, char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        auto got = read(fd, buf + done, n - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            throw runtime_error(string("read failed: ") + strerror(errno));
+        if (got == 0)
+            break;
+        done += got;
+    }
+    return done;
+}
+
+/** writes all of buf at the current position of fd. */
+static void write_full(int fd, const unsigned char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n)
+    {
+        auto put = write(fd, buf + done, n - done);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0)
+            throw runtime_error(string("write failed: ") + strerror(errno));
+        done += put;
+    }
+}
+
+/**
+ * Compresses a stream in one pass, with memory bounded by the ring of segments (see huffman-io.h): a reader
+ * thread reads and counts the input, segment by segment, while the previous segment is coded on n_threads
+ * threads and written out in block order. The first segment sets the table of the archive; every later one
+ * keeps the current table while its table divergence stays within max_divergence, else switches to its own.
+ * The archive is the same as a file compressed with the same table switches: if the output can be seeked
+ * back to, the header is rewritten at the end, else the archive is ARCHIVE_FLAG_STREAMED.
+ * @param input_name the input, "-" for stdin.
+ * @param output_name the archive, "-" for stdout.
+ * @param n_threads the number of encoding threads, the reader thread not included.
+ * @param max_divergence the table divergence above which a segment gets a table of its own.
+ * @param options the run options (block size, store mode, pairs, coder, checkpoints, sub-streams).
+ * @param result filled with what was written.
+ * @return the number of bytes compressed.
+ */
+uint64_t compress_pipe(const string &input_name, const string &output_name, size_t n_threads, double max_divergence,
+                       const run_options_t &options, pipe_result_t &result)
+{
+    int in_fd = input_name == "-" ? STDIN_FILENO : open(input_name.c_str(), O_RDONLY);
+    if (in_fd < 0)
+        throw runtime_error("Could not open file: " + input_name);
+    int out_fd = output_name == "-" ? STDOUT_FILENO : open(output_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        if (in_fd != STDIN_FILENO)
+            close(in_fd);
+        throw runtime_error("Could not open file: " + output_name);
+    }
+    n_threads = max<size_t>(1, n_threads);
+    result = pipe_result_t();
+
+    // a regular file not opened for appending can take the final header in place
+    struct stat st{};
+    auto base = lseek(out_fd, 0, SEEK_CUR);
+    auto seekable = base >= 0 && fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode) && !(fcntl(out_fd, F_GETFL) & O_APPEND);
+
+    archive_t archive;
+    archive.block_size = options.block_size;
+    archive.checkpoint_interval = options.checkpoint_interval;
+    archive.n_streams = options.n_streams;
+    archive.coder = options.coder;
+    archive.streamed = !seekable;
+
+    // the ring: the reader fills segment s into ring[s % ring.size()] once segment s - ring.size() is coded
+    struct segment_t {
+        string data;
+        uint64_t len = 0;
+        freq_table_t counts{};
+    };
+    auto segment_size = PIPE_SEGMENT_BLOCKS * options.block_size;
+    vector<segment_t> ring(PIPE_RING_SEGMENTS);
+    mutex lock;
+    condition_variable read_cv, coded_cv;
+    size_t n_read = 0, n_coded = 0;
+    bool end = false, stop = false;
+    exception_ptr error;
+    thread reader([&]() {
+        try
+        {
+            for (size_t s = 0;; s++)
+            {
+                {
+                    unique_lock<mutex> guard(lock);
+                    coded_cv.wait(guard, [&] { return stop || s - n_coded < ring.size(); });
+                    if (stop)
+                        return;
+                }
+                auto &segment = ring[s % ring.size()];
+                segment.data.resize(segment_size);
+                segment.len = 0;
+                segment.counts = freq_table_t{};
+                auto last = false;
+                while (segment.len < segment_size && !last)
+                {
+                    auto want = min<uint64_t>(READ_CHUNK, segment_size - segment.len);
+                    auto got = read_full(in_fd, &segment.data[segment.len], want);
+                    count_symbols(&segment.data[segment.len], got, segment.counts);
+                    segment.len += got;
+                    last = got < want;
+                }
+                lock_guard<mutex> guard(lock);
+                n_read = s + (segment.len > 0);
+                end = last;
+                read_cv.notify_all();
+                if (last)
+                    return;
+            }
+        }
+        catch (...)
+        {
+            lock_guard<mutex> guard(lock);
+            error = current_exception();
+            read_cv.notify_all();
+        }
+    });
+
+    Node *tree = nullptr;
+    unordered_map<char, code_t *> codes;
+    try
+    {
+        uint64_t offset;
+        {
+            bytes_t header;
+            serialize_header(archive, header);
+            write_full(out_fd, header.data(), header.size());
+            offset = header.size();
+        }
+
+        code_table_t table;
+        for (size_t s = 0;; s++)
+        {
+            {
+                unique_lock<mutex> guard(lock);
+                read_cv.wait(guard, [&] { return n_read > s || end || error; });
+                if (error)
+                    rethrow_exception(error);
+                if (n_read == s)
+                    break;
+            }
+            auto &segment = ring[s % ring.size()];
+
+            // keep the current table, or switch to one of the segment
+            auto table_freqs = archive.tables.empty() ? archive.freqs : archive.tables.back().freqs;
+            auto new_table = archive.blocks.empty();
+            if (new_table)
+                archive.freqs = table_freqs = segment.counts;
+            else if (table_divergence(table_freqs, segment.counts, archive.coder) > max_divergence)
+            {
+                archive.tables.push_back({archive.blocks.size(), segment.counts});
+                table_freqs = segment.counts;
+                new_table = true;
+            }
+
+            archive_t part;
+            init_archive(part, segment.len, table_freqs, options.block_size, archive.checkpoint_interval,
+                         archive.n_streams);
+            part.checksums = archive.checksums;
+            if (new_table)
+            {
+                free_codes(codes);
+                free_tree(tree);
+                tree = generate_huffman_tree(from_freq_table(table_freqs));
+                codes = generate_huffman_codes(tree);
+                table = make_code_table(codes, use_pair_tables(options.pair_mode, segment_size));
+                use_coder(part, table, archive.coder);
+            }
+            part.freqs = segment.counts;    // the store policy is decided on what the segment costs
+            auto policy = resolve_store_policy(part, table, options.store_mode);
+            auto n_blocks = part.blocks.size();
+            run_parallel(n_threads, [&](size_t t) {
+                for (auto i = t * n_blocks / n_threads; i < (t + 1) * n_blocks / n_threads; i++)
+                    encode_archive_block(part, i, segment.data.data(), table, policy);
+            });
+
+            // the blocks hold their own bytes: the slot goes back to the reader before they are written
+            archive.raw_size += segment.len;
+            {
+                lock_guard<mutex> guard(lock);
+                n_coded = s + 1;
+                coded_cv.notify_all();
+            }
+            for (auto &block : part.blocks)
+            {
+                write_full(out_fd, block.data.data(), block.data.size());
+                offset += block.data.size();
+                block.data = bytes_t();
+                archive.blocks.push_back(std::move(block));
+            }
+            result.n_segments++;
+            // nothing of the segment is left but metadata: free its arena memory (allocator.h)
+            arena_release();
+        }
+
+        bytes_t buffer;
+        serialize_trailer(archive, offset, buffer);
+        write_full(out_fd, buffer.data(), buffer.size());
+        result.comp_size = offset + buffer.size();
+        if (seekable)
+        {
+            buffer.clear();
+            serialize_header(archive, buffer);
+            pwrite_full(out_fd, buffer.data(), buffer.size(), base);
+        }
+    }
+    catch (...)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stop = true;
+            coded_cv.notify_all();
+        }
+        reader.join();
+        free_codes(codes);
+        free_tree(tree);
+        if (in_fd != STDIN_FILENO)
+            close(in_fd);
+        if (out_fd != STDOUT_FILENO)
+            close(out_fd);
+        throw;
+    }
+    reader.join();
+    free_codes(codes);
+    free_tree(tree);
+    if (in_fd != STDIN_FILENO)
+        close(in_fd);
+    if (out_fd != STDOUT_FILENO && close(out_fd) != 0)
+        throw runtime_error("Could not write file: " + output_name);
+
+    result.raw_size = archive.raw_size;
+    result.n_blocks = archive.blocks.size();
+    result.n_tables = archive.tables.size() + 1;
+    result.streamed = archive.streamed;
+    return result.raw_size;
+}
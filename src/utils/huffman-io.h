@@ -0,0 +1,117 @@
+#ifndef SPM_PROJECT_HUFFMAN_IO_H
+#define SPM_PROJECT_HUFFMAN_IO_H
+
+#include <cstdint>
+#include <string>
+
+#include "huffman-format.h"
+#include "huffman-sync.h"
+
+/*
+ * Fused read-and-count stage.
+ * Instead of reading the whole file on one thread and then counting it, every mapper preads its
+ * own range of the file, READ_CHUNK bytes at a time, straight into its slice of the sequence and
+ * histograms each chunk right after it lands, while it is still in cache.
+ * With direct I/O the file is opened with O_DIRECT (F_NOCACHE on macOS): chunks go through an
+ * aligned per-thread bounce buffer and ranges must start on a DIRECT_ALIGN boundary, which
+ * read_split() guarantees.
+ */
+
+#define READ_CHUNK (1UL << 20)      // bytes per pread, a multiple of DIRECT_ALIGN
+#define DIRECT_ALIGN 4096UL         // O_DIRECT alignment of offsets, lengths and buffers
+
+/*
+ * Append mode, for inputs that only grow (logs): append_file() compresses the bytes added since the last
+ * run into new blocks of the same archive, so every run costs time proportional to the new bytes only.
+ * The histogram of the new bytes decides whether they reuse the last table of the archive or get their
+ * own, stored in the trailer as a table switch (ARCHIVE_FLAG_TABLES, see huffman-format.h).
+ */
+
+#define APPEND_MAX_DIVERGENCE 0.02  // default relative size increase tolerated before switching tables
+
+/*
+ * Pipe mode, for inputs and outputs that cannot be mapped or seeked ("-" is stdin or stdout): compress_pipe()
+ * makes one pass over the input. A reader thread reads it into a ring of PIPE_RING_SEGMENTS segments of
+ * PIPE_SEGMENT_BLOCKS blocks each, counting every chunk as it lands; the encoder threads code one segment
+ * while the next one is read, and its blocks are written out in order before the slot is handed back.
+ * Memory stays bounded by the ring, whatever the size of the input. Every segment keeps the current table
+ * or gets its own, as appends do. On an output that cannot be seeked back to, the header cannot be
+ * rewritten with the size and the table switches, which go to the trailer instead (ARCHIVE_FLAG_STREAMED).
+ */
+
+#define PIPE_SEGMENT_BLOCKS 64      // blocks per segment of the ring
+#define PIPE_RING_SEGMENTS 2        // segments read ahead of the encoders, at least 2 to overlap them
+
+using namespace std;
+
+/** Input file opened for positional reads. */
+struct input_file_t {
+    int fd = -1;
+    uint64_t size = 0;
+    bool direct = false;    // O_DIRECT actually in use (the filesystem may refuse it)
+};
+
+input_file_t open_input(const string &filename, bool direct);
+
+/**
+ * An archive mapped read-only, unmapped when it goes out of scope, also when parsing or decoding it throws.
+ * advice is the madvise() of the expected accesses; populate faults every page in at once (MAP_POPULATE),
+ * for scans that read them all. Empty files are refused, they are not archives.
+ */
+class MappedArchive {
+public:
+    MappedArchive(const string &filename, int advice, bool populate = false);
+    MappedArchive(int fd, const string &filename, int advice);
+    ~MappedArchive();
+    MappedArchive(const MappedArchive &) = delete;
+    MappedArchive &operator=(const MappedArchive &) = delete;
+
+    const unsigned char *data() const { return bytes; }
+    uint64_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    uint64_t length = 0;
+
+    void map(int fd, const string &filename, int advice, bool populate);
+};
+
+void close_input(input_file_t &file);
+
+uint64_t read_split(uint64_t size, size_t i, size_t n);
+
+void read_count_range(const input_file_t &file, uint64_t begin, uint64_t end, char *dst, freq_table_t &counts);
+
+/** What one append did. */
+struct append_result_t {
+    uint64_t new_bytes = 0;
+    uint64_t n_blocks = 0;      // blocks added
+    double divergence = 0;      // table divergence of the new bytes from the last table of the archive
+    bool new_table = false;     // the new bytes got a table of their own
+    size_t n_tables = 1;        // tables in the archive, after the append
+};
+
+/** What one pipe compression did. */
+struct pipe_result_t {
+    uint64_t raw_size = 0;
+    uint64_t comp_size = 0;     // bytes written, header to footer
+    uint64_t n_blocks = 0;
+    size_t n_segments = 0;
+    size_t n_tables = 1;        // tables in the archive
+    bool streamed = false;      // the output could not be seeked back to (ARCHIVE_FLAG_STREAMED)
+};
+
+uint64_t extract_file(const string &filename, uint64_t offset, uint64_t length, string &out);
+
+uint64_t decode_file(const string &filename, const string &output, size_t n_threads, bool speculative,
+                     sync_stats_t &stats);
+
+uint64_t verify_file(const string &filename, size_t n_threads, const string *seq, uint64_t &n_blocks);
+
+uint64_t append_file(const string &archive_name, const string &input_name, size_t n_threads, double max_divergence,
+                     const run_options_t &options, append_result_t &result);
+
+uint64_t compress_pipe(const string &input_name, const string &output_name, size_t n_threads, double max_divergence,
+                       const run_options_t &options, pipe_result_t &result);
+
+#endif //SPM_PROJECT_HUFFMAN_IO_H
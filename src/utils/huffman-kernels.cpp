@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <string>
+
+#include "huffman-kernels.h"
+
+using namespace std;
+
+/**
+ * Adds the symbols of data to counts. Four interleaved sub-histograms: a run of one symbol, the
+ * common case with small alphabets, would otherwise serialize every increment on the same counter.
+ * @param data the symbols.
+ * @param n the number of symbols.
+ * @param counts the histogram the counts are added to.
+ */
+void count_symbols(const char *data, size_t n, freq_table_t &counts) {
+    uint64_t sub[4][256] = {};
+    auto p = reinterpret_cast<const unsigned char *>(data);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sub[0][p[i]]++;
+        sub[1][p[i + 1]]++;
+        sub[2][p[i + 2]]++;
+        sub[3][p[i + 3]]++;
+    }
+    for (; i < n; i++) sub[0][p[i]]++;
+    for (int c = 0; c < 256; c++) counts[c] += sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+}
+
+/**
+ * Number of slices the bins are reduced in by n_threads threads: one per thread, at most
+ * 256 / REDUCE_SLICE_BINS.
+ */
+size_t reduce_slices(size_t n_threads) {
+    return max<size_t>(1, min<size_t>(n_threads, 256 / REDUCE_SLICE_BINS));
+}
+
+/**
+ * Sums one slice of the bins of every partial histogram into counts, the rest of counts untouched:
+ * the n_slices slices can be reduced by different threads into the same table.
+ * @param partials the partial histograms.
+ * @param slice the slice, in [0, n_slices).
+ * @param n_slices the number of slices, from reduce_slices().
+ * @param counts the histogram the slice is added to.
+ */
+void reduce_counts(const vector<freq_table_t> &partials, size_t slice, size_t n_slices, freq_table_t &counts) {
+    auto begin = slice * 256 / n_slices, end = (slice + 1) * 256 / n_slices;
+    for (auto &partial: partials)
+        for (auto c = begin; c < end; c++) counts[c] += partial[c];
+}
+
+/**
+ * Picks the kernel for a code whose lengths span [min_len, max_len] (0 if there are no codes).
+ */
+int select_kernel(unsigned min_len, unsigned max_len) {
+    if (max_len == 0 || max_len > DECODE_TABLE_BITS) return KERNEL_GENERIC;
+    if (min_len == max_len && max_len <= 4) return KERNEL_FIXED1 + (int) max_len - 1;
+    if (max_len <= 4) return KERNEL_LEN4;
+    if (max_len <= 8) return KERNEL_LEN8;
+    return KERNEL_LEN11;
+}
+
+const char *kernel_name(int kernel) {
+    switch (kernel) {
+        case KERNEL_LEN4: return "len4";
+        case KERNEL_LEN8: return "len8";
+        case KERNEL_LEN11: return "len11";
+        case KERNEL_FIXED1: return "fixed1";
+        case KERNEL_FIXED2: return "fixed2";
+        case KERNEL_FIXED3: return "fixed3";
+        case KERNEL_FIXED4: return "fixed4";
+        default: return "generic";
+    }
+}
+
+/*
+ * fill < 32 on entry: K codes of at most MAX_LEN bits keep it below 64, so one flush check per group.
+ * State lives in locals to stay in registers.
+ */
+template<unsigned MAX_LEN, bool FIXED>
+static void pack_small(const char *data, size_t n, const code_table_t &table, unsigned char *&dst, uint64_t &acc,
+                       unsigned &fill) {
+    constexpr unsigned K = 32 / MAX_LEN;
+    auto p = dst;
+    auto a = acc;
+    auto f = fill;
+    auto flush = [&]() {
+        if (f >= 32) {
+            for (int k = 0; k < 4; k++) p[k] = (unsigned char) (a >> (8 * k));
+            p += 4;
+            a >>= 32;
+            f -= 32;
+        }
+    };
+
+    size_t i = 0;
+    for (; i + K <= n; i += K) {
+        for (unsigned k = 0; k < K; k++) {
+            auto &code = table[(unsigned char) data[i + k]];
+            a |= code.bits << f;
+            f += FIXED ? MAX_LEN : code.len;
+        }
+        flush();
+    }
+    for (; i < n; i++) {
+        auto &code = table[(unsigned char) data[i]];
+        a |= code.bits << f;
+        f += FIXED ? MAX_LEN : code.len;
+        flush();
+    }
+    dst = p;
+    acc = a;
+    fill = f;
+}
+
+/*
+ * K symbols per 64 bit load: a load yields at least 57 bits and K * MAX_LEN <= 56. Every index below
+ * 2^MAX_LEN starts with a complete code, so the table has no holes and there is no slow path.
+ */
+template<unsigned MAX_LEN, bool FIXED>
+static void decode_small(const unsigned char *data, uint64_t n_bytes, const decoder_t &decoder, char *out,
+                         size_t n_out, uint64_t &pos) {
+    constexpr unsigned K = 56 / MAX_LEN;
+    constexpr uint64_t MASK = (1ULL << MAX_LEN) - 1;
+    auto table = decoder.table.data();
+    auto p = pos;
+
+    size_t i = 0;
+    for (; i + K <= n_out && (p >> 3) + 8 <= n_bytes; i += K) {
+        auto bits = peek_bits(data, n_bytes, p);
+        for (unsigned k = 0; k < K; k++) {
+            auto entry = table[bits & MASK];
+            unsigned len = FIXED ? MAX_LEN : entry >> 8;
+            out[i + k] = (char) (entry & 0xff);
+            bits >>= len;
+            p += len;
+        }
+    }
+    for (; i < n_out; i++) out[i] = decode_symbol(decoder, data, n_bytes, p);
+    pos = p;
+}
+
+/**
+ * Appends the codes of n symbols to a bit accumulator with a specialized kernel.
+ * @param kernel the kernel chosen for the table, not KERNEL_GENERIC.
+ * @param dst where the next 32 bits go, advanced past the bytes written.
+ * @param acc the pending bits, fill of them; fill must be below 32, and is on return.
+ */
+void pack_kernel(int kernel, const char *data, size_t n, const code_table_t &table, unsigned char *&dst,
+                 uint64_t &acc, unsigned &fill) {
+    switch (kernel) {
+        case KERNEL_LEN4: pack_small<4, false>(data, n, table, dst, acc, fill); break;
+        case KERNEL_LEN8: pack_small<8, false>(data, n, table, dst, acc, fill); break;
+        case KERNEL_LEN11: pack_small<DECODE_TABLE_BITS, false>(data, n, table, dst, acc, fill); break;
+        case KERNEL_FIXED1: pack_small<1, true>(data, n, table, dst, acc, fill); break;
+        case KERNEL_FIXED2: pack_small<2, true>(data, n, table, dst, acc, fill); break;
+        case KERNEL_FIXED3: pack_small<3, true>(data, n, table, dst, acc, fill); break;
+        case KERNEL_FIXED4: pack_small<4, true>(data, n, table, dst, acc, fill); break;
+        default: throw runtime_error("No encode kernel " + string(kernel_name(kernel)));
+    }
+}
+
+/**
+ * Decodes n_out symbols starting at bit pos with a specialized kernel.
+ * @param kernel the kernel chosen for the decoder, not KERNEL_GENERIC.
+ * @param pos the bit position, moved past the last code decoded.
+ */
+void decode_kernel(int kernel, const unsigned char *data, uint64_t n_bytes, const decoder_t &decoder, char *out,
+                   size_t n_out, uint64_t &pos) {
+    switch (kernel) {
+        case KERNEL_LEN4: decode_small<4, false>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_LEN8: decode_small<8, false>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_LEN11: decode_small<DECODE_TABLE_BITS, false>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_FIXED1: decode_small<1, true>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_FIXED2: decode_small<2, true>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_FIXED3: decode_small<3, true>(data, n_bytes, decoder, out, n_out, pos); break;
+        case KERNEL_FIXED4: decode_small<4, true>(data, n_bytes, decoder, out, n_out, pos); break;
+        default: throw runtime_error("No decode kernel " + string(kernel_name(kernel)));
+    }
+}
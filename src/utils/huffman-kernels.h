@@ -0,0 +1,86 @@
+#ifndef SPM_PROJECT_HUFFMAN_KERNELS_H
+#define SPM_PROJECT_HUFFMAN_KERNELS_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "huffman-format.h"
+
+/*
+ * Coding kernels shared by every backend: symbol counting, and encode/decode kernels specialized at
+ * compile time for short codes. Small alphabets (DNA, hex dumps, sensor streams) have short codes, so
+ * the kernel is chosen from the code lengths when the tables are built (make_code_table, make_decoder)
+ * and the encode/decode paths of huffman-format.cpp dispatch on it:
+ *  - every code at most MAX_LEN bits: the encoder adds 32 / MAX_LEN codes between two flush checks and
+ *    the decoder takes 56 / MAX_LEN symbols out of one 64 bit load, with no tree-walk fallback and a
+ *    table of 2^MAX_LEN entries (16 for MAX_LEN 4, a single cache line);
+ *  - every code exactly W bits (2^W balanced symbols): as above with the shifts constant.
+ * The generic path handles anything else.
+ */
+
+#define KERNEL_GENERIC 0
+#define KERNEL_LEN4 1       // codes of at most 4 bits
+#define KERNEL_LEN8 2
+#define KERNEL_LEN11 3      // codes of at most DECODE_TABLE_BITS bits
+#define KERNEL_FIXED1 4     // every code 1 bit long (2 symbols)
+#define KERNEL_FIXED2 5     // 2 bits (4 balanced symbols, e.g. DNA)
+#define KERNEL_FIXED3 6
+#define KERNEL_FIXED4 7     // 4 bits (16 balanced symbols, e.g. hex)
+
+/*
+ * Column reduction of the partial histograms of n counting threads: instead of one thread adding up the n
+ * partials (256 * n additions on the critical path), each of n_slices threads sums its own slice of the
+ * 256 bins across all of them, so the merge shrinks with the thread count instead of growing with it.
+ */
+#define REDUCE_SLICE_BINS 8     // bins per slice at least: 64 bytes, neighbouring slices share at most one line
+
+using namespace std;
+
+/** The (at least 56) bits from bit pos on, LSB first; bytes past n_bytes read as zero. */
+inline uint64_t peek_bits(const unsigned char *data, uint64_t n_bytes, uint64_t pos) {
+    auto byte = pos >> 3;
+    uint64_t v = 0;
+    if (byte + 8 <= n_bytes) {
+        memcpy(&v, data + byte, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+    } else
+        for (auto i = byte; i < n_bytes; i++) v |= (uint64_t) data[i] << (8 * (i - byte));
+    return v >> (pos & 7);
+}
+
+/** Decodes the symbol at bit pos with the generic table and moves pos past its code. */
+inline char decode_symbol(const decoder_t &decoder, const unsigned char *data, uint64_t n_bytes, uint64_t &pos) {
+    auto entry = decoder.table[peek_bits(data, n_bytes, pos) & ((1UL << DECODE_TABLE_BITS) - 1)];
+    if (entry != 0) {
+        pos += entry >> 8;
+        return (char) (entry & 0xff);
+    }
+    auto node = decoder.root;
+    while (!is_leaf(node)) {
+        if (pos >= n_bytes * 8) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+        node = ((data[pos >> 3] >> (pos & 7)) & 1) ? node->right : node->left;
+        pos++;
+    }
+    return node->c;
+}
+
+void count_symbols(const char *data, size_t n, freq_table_t &counts);
+
+size_t reduce_slices(size_t n_threads);
+
+void reduce_counts(const vector<freq_table_t> &partials, size_t slice, size_t n_slices, freq_table_t &counts);
+
+int select_kernel(unsigned min_len, unsigned max_len);
+
+const char *kernel_name(int kernel);
+
+void pack_kernel(int kernel, const char *data, size_t n, const code_table_t &table, unsigned char *&dst,
+                 uint64_t &acc, unsigned &fill);
+
+void decode_kernel(int kernel, const unsigned char *data, uint64_t n_bytes, const decoder_t &decoder, char *out,
+                   size_t n_out, uint64_t &pos);
+
+#endif //SPM_PROJECT_HUFFMAN_KERNELS_H
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <sys/mman.h>
+
+#include "huffman-query.h"
+#include "huffman-io.h"
+#include "huffman-kernels.h"
+
+using namespace std;
+
+// bits compared per peek: peek_bits returns at least 57 valid bits
+#define PATTERN_CHUNK 56
+// the scan skips the whole codes in the next SCAN_TABLE_BITS bits with one lookup when none can start a match
+#define SCAN_TABLE_BITS 14
+// coded patterns at least this long cover a whole byte at any bit offset, so blocks can be filtered bytewise
+#define ANCHOR_MIN_BITS 15
+
+/** A pattern coded with one table, cut in PATTERN_CHUNK-bit chunks. */
+struct coded_pattern_t {
+    bool possible = false;      // every symbol of the pattern has a code
+    uint64_t n_bits = 0;
+    vector<uint64_t> chunks;
+    vector<uint64_t> masks;
+    vector<uint16_t> skip;      // next SCAN_TABLE_BITS bits -> bits | codes << 8 of the codes to skip, 0 to test
+    array<uint8_t, 256> anchors{};  // byte -> bit r set if it equals bits [r, r + 8) of the coded pattern
+};
+
+/** What the scan of one block found. */
+struct block_match_t {
+    uint64_t n_matches = 0;
+    vector<uint64_t> offsets;   // the first max_offsets, as offsets in the input
+    string head, tail;          // its first and last (pattern size - 1) symbols, for the matches across blocks
+    bool has_tail = true;       // false for skipped blocks, until a match across the next boundary needs it
+};
+
+/* runs body(t) on n_threads threads, the caller's included, and rethrows the first error */
+template<typename Body>
+static void run_threads(size_t n_threads, Body body) {
+    vector<thread> threads;
+    vector<exception_ptr> errors(n_threads);
+    auto guarded = [&](size_t t) {
+        try {
+            body(t);
+        } catch (...) {
+            errors[t] = current_exception();
+        }
+    };
+    for (size_t t = 1; t < n_threads; t++) threads.emplace_back(guarded, t);
+    guarded(0);
+    for (auto &t: threads) t.join();
+    for (auto &error: errors)
+        if (error) rethrow_exception(error);
+}
+
+/* whether a block can be walked code by code: single-stream Huffman, with more than one symbol */
+static bool scannable(const block_entry_t &entry, const decoder_t &decoder) {
+    return entry.kind == BLOCK_HUFFMAN && entry.stream_bits.empty() && !decoder.ans && !decoder.words &&
+           decoder.root != nullptr && !is_leaf(decoder.root);
+}
+
+/* the pattern as the bits the encoder would write for it with the tree of decoder */
+static coded_pattern_t code_pattern(const string &pattern, const decoder_t &decoder) {
+    coded_pattern_t coded;
+    if (decoder.root == nullptr || is_leaf(decoder.root)) return coded;
+    array<packed_code_t, 256> codes{};
+    auto stack = vector<tuple<const Node *, uint64_t, unsigned>>{{decoder.root, 0, 0}};
+    while (!stack.empty()) {
+        auto [node, bits, len] = stack.back();
+        stack.pop_back();
+        if (is_leaf(node)) {
+            codes[(unsigned char) node->c] = {bits, (uint8_t) len};
+            continue;
+        }
+        if (len == 64) throw runtime_error("Code too long for a search");
+        stack.emplace_back(node->left, bits, len + 1);
+        stack.emplace_back(node->right, bits | 1ULL << len, len + 1);
+    }
+
+    bytes_t packed;
+    uint64_t acc = 0;
+    unsigned fill = 0;
+    for (auto c: pattern) {
+        auto code = codes[(unsigned char) c];
+        if (code.len == 0) return coded;
+        for (unsigned k = 0; k < code.len; k++) {
+            acc |= (code.bits >> k & 1) << fill;
+            if (++fill == 8) packed.push_back((unsigned char) acc), acc = 0, fill = 0;
+        }
+        coded.n_bits += code.len;
+    }
+    if (fill > 0) packed.push_back((unsigned char) acc);
+    for (uint64_t pos = 0; pos < coded.n_bits; pos += PATTERN_CHUNK) {
+        auto len = min<uint64_t>(PATTERN_CHUNK, coded.n_bits - pos);
+        coded.masks.push_back((1ULL << len) - 1);
+        coded.chunks.push_back(peek_bits(packed.data(), packed.size(), pos) & coded.masks.back());
+    }
+    coded.possible = true;
+    if (coded.n_bits >= ANCHOR_MIN_BITS)
+        for (unsigned r = 0; r < 8; r++) coded.anchors[peek_bits(packed.data(), packed.size(), r) & 0xff] |= 1 << r;
+
+    // a window can be skipped if it holds whole codes, none of them the first symbol of the pattern followed by
+    // its second one; the code closing the window may be followed by anything, so it must not be the first
+    // symbols as int, -1 for none
+    int first = (unsigned char) pattern[0];
+    int second = pattern.size() > 1 ? (unsigned char) pattern[1] : -1;
+    coded.skip.assign(1UL << SCAN_TABLE_BITS, 0);
+    for (uint64_t x = 0; x < coded.skip.size(); x++) {
+        unsigned bits = 0, n = 0;
+        bool hit = false;
+        int prev = -1;
+        while (!hit) {
+            auto e = decoder.table[(x >> bits) & ((1UL << DECODE_TABLE_BITS) - 1)];
+            if (e == 0 || bits + (e >> 8) > SCAN_TABLE_BITS) break;
+            int c = e & 0xff;
+            hit = prev == first && (second < 0 || c == second);
+            prev = c;
+            bits += e >> 8;
+            n++;
+        }
+        if (!hit && prev != first && n > 0) coded.skip[x] = (uint16_t) (bits | n << 8);
+    }
+    return coded;
+}
+
+/* whether the coded pattern is at bit pos, a code boundary or not */
+static bool coded_at(const unsigned char *data, uint64_t n_bytes, uint64_t pos, const coded_pattern_t &pattern) {
+    for (size_t k = 0; k < pattern.chunks.size(); k++)
+        if ((peek_bits(data, n_bytes, pos + k * PATTERN_CHUNK) & pattern.masks[k]) != pattern.chunks[k]) return false;
+    return true;
+}
+
+/*
+ * Whether the coded pattern appears anywhere in a block, at any bit offset: a superset of the matches that
+ * reads every byte once. An occurrence at bit t covers the whole byte at t + r, r = -t mod 8, and that byte
+ * is bits [r, r + 8) of the coded pattern; only the bytes equal to one of those 8 values are checked.
+ */
+static bool has_candidate(const unsigned char *data, uint64_t n_bits, const coded_pattern_t &pattern) {
+    auto n_bytes = (n_bits + 7) / 8;
+    for (uint64_t j = 0; j < n_bytes; j++) {
+        auto shifts = pattern.anchors[data[j]];
+        for (unsigned r = 0; shifts != 0; r++, shifts >>= 1)
+            if ((shifts & 1) && 8 * j >= r && 8 * j - r + pattern.n_bits <= n_bits &&
+                coded_at(data, n_bytes, 8 * j - r, pattern))
+                return true;
+    }
+    return false;
+}
+
+/* the first (pattern size - 1) symbols of a block with no candidate, for the matches across blocks */
+static void decode_head(const unsigned char *archive, const block_entry_t &entry, const decoder_t &decoder,
+                        size_t keep, block_match_t &result) {
+    auto n_bytes = (entry.n_bits + 7) / 8;
+    uint64_t pos = 0;
+    for (uint64_t i = 0; i < min<uint64_t>(keep, entry.raw_len); i++)
+        result.head.push_back(decode_symbol(decoder, archive + entry.comp_offset, n_bytes, pos));
+}
+
+static void add_match(block_match_t &result, uint64_t offset, size_t max_offsets) {
+    result.n_matches++;
+    if (result.offsets.size() < max_offsets) result.offsets.push_back(offset);
+}
+
+/*
+ * The code boundaries of a block, in order, nothing written: windows of codes that cannot start a match are
+ * skipped with one lookup, the other codes are decoded one at a time and the pattern compared at each.
+ */
+static void scan_block(const unsigned char *archive, const block_entry_t &entry, const decoder_t &decoder,
+                       const coded_pattern_t &pattern, size_t keep, size_t max_offsets, block_match_t &result) {
+    auto data = archive + entry.comp_offset;
+    auto n_bytes = (entry.n_bits + 7) / 8;
+    auto table = decoder.table.data();
+    auto mask = (1UL << DECODE_TABLE_BITS) - 1;
+    auto tail_from = entry.raw_len > keep ? entry.raw_len - keep : 0;
+    auto skip = pattern.possible ? pattern.skip.data() : nullptr;
+    uint64_t pos = 0;
+    for (uint64_t i = 0; i < entry.raw_len; i++) {
+        auto bits = peek_bits(data, n_bytes, pos);
+        // the head and the tail are kept symbol by symbol, and the padding at the end must not be skipped
+        if (skip != nullptr && i >= keep) {
+            auto w = skip[bits & ((1UL << SCAN_TABLE_BITS) - 1)];
+            while (w != 0 && i + (w >> 8) <= tail_from) {
+                pos += w & 0xff;
+                i += w >> 8;
+                bits = peek_bits(data, n_bytes, pos);
+                w = skip[bits & ((1UL << SCAN_TABLE_BITS) - 1)];
+            }
+            if (i >= entry.raw_len) break;
+        }
+        if (pattern.possible && pos + pattern.n_bits <= entry.n_bits && (bits & pattern.masks[0]) == pattern.chunks[0] &&
+            coded_at(data, n_bytes, pos, pattern))
+            add_match(result, entry.raw_offset + i, max_offsets);
+        char c;
+        auto e = table[bits & mask];
+        if (e != 0) {
+            c = (char) (e & 0xff);
+            pos += e >> 8;
+        } else c = decode_symbol(decoder, data, n_bytes, pos);
+        if (i < keep) result.head.push_back(c);
+        if (i >= tail_from) result.tail.push_back(c);
+    }
+    if (pos != entry.n_bits) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+}
+
+/* the same on plain bytes: a stored block, or a block decoded to the scratch buffer */
+static void search_bytes(const char *data, const block_entry_t &entry, const string &pattern, size_t keep,
+                         size_t max_offsets, block_match_t &result) {
+    string_view bytes(data, entry.raw_len);
+    for (auto at = bytes.find(pattern); at != string_view::npos; at = bytes.find(pattern, at + 1))
+        add_match(result, entry.raw_offset + at, max_offsets);
+    result.head.assign(bytes.substr(0, keep));
+    result.tail.assign(bytes.substr(entry.raw_len > keep ? entry.raw_len - keep : 0));
+}
+
+/**
+ * The exact histogram of an archive, when its trailer holds it: always, but for word archives and appended
+ * archives, whose tables do not count every block.
+ * @return false if the blocks must be scanned instead.
+ */
+bool archive_histogram(const archive_index_t &index, freq_table_t &counts) {
+    if (!index.dictionary.empty() || !index.tables.empty()) return false;
+    // appends that reused the table added blocks it does not count
+    uint64_t total = 0;
+    for (auto f: index.freqs) total += f;
+    if (total != index.raw_size) return false;
+    counts = index.freqs;
+    return true;
+}
+
+/**
+ * Counts the symbols of an archive, in parallel over the blocks. Stored blocks are counted in place, the
+ * others decoded one at a time, with the decode kernels, into a per-thread scratch block.
+ * @param archive the archive bytes.
+ * @param index the index returned by parse_archive.
+ * @param decoder the decoder built by make_decoder from the index.
+ * @param n_threads the number of scanning threads.
+ * @return the occurrences of every byte value.
+ */
+freq_table_t count_archive(const unsigned char *archive, const archive_index_t &index, const decoder_t &decoder,
+                           size_t n_threads) {
+    n_threads = max<size_t>(1, n_threads);
+    vector<freq_table_t> partial(n_threads, freq_table_t{});
+    atomic<size_t> next(0);
+    run_threads(n_threads, [&](size_t t) {
+        auto &counts = partial[t];
+        string scratch;
+        for (size_t i; (i = next++) < index.entries.size();) {
+            auto &entry = index.entries[i];
+            if (entry.kind == BLOCK_STORED) {
+                count_symbols(reinterpret_cast<const char *>(archive + entry.comp_offset), entry.raw_len, counts);
+            } else {
+                scratch.resize(entry.raw_len);
+                decode_entry(archive, entry, decoder, &scratch[0]);
+                count_symbols(scratch.data(), scratch.size(), counts);
+            }
+        }
+    });
+    freq_table_t counts{};
+    for (auto &p: partial)
+        for (int c = 0; c < 256; c++) counts[c] += p[c];
+    return counts;
+}
+
+/**
+ * Finds every occurrence of a pattern in an archive without decoding it (see huffman-query.h).
+ * @param archive the archive bytes.
+ * @param index the index returned by parse_archive.
+ * @param decoder the decoder built by make_decoder from the index.
+ * @param pattern the bytes to look for, not empty.
+ * @param n_threads the number of scanning threads.
+ * @param max_offsets how many match offsets to report.
+ * @return the number of matches and the first offsets.
+ */
+search_result_t search_archive(const unsigned char *archive, const archive_index_t &index, const decoder_t &decoder,
+                               const string &pattern, size_t n_threads, size_t max_offsets) {
+    if (pattern.empty()) throw runtime_error("Empty search pattern");
+    n_threads = max<size_t>(1, n_threads);
+    auto keep = pattern.size() - 1;
+
+    // the pattern coded with every table
+    vector<coded_pattern_t> coded;
+    coded.push_back(code_pattern(pattern, decoder));
+    for (auto &table: decoder.tables) coded.push_back(code_pattern(pattern, table));
+
+    vector<block_match_t> blocks(index.entries.size());
+    vector<search_result_t> partial(n_threads);
+    atomic<size_t> next(0);
+    run_threads(n_threads, [&](size_t t) {
+        string scratch;
+        for (size_t i; (i = next++) < index.entries.size();) {
+            auto &entry = index.entries[i];
+            auto &block_decoder = entry_decoder(decoder, entry);
+            if (entry.kind == BLOCK_STORED) {
+                search_bytes(reinterpret_cast<const char *>(archive + entry.comp_offset), entry, pattern, keep,
+                             max_offsets, blocks[i]);
+                partial[t].n_stored++;
+            } else if (scannable(entry, block_decoder)) {
+                auto &coded_pattern = coded[entry.table];
+                if (!coded_pattern.possible || (coded_pattern.n_bits >= ANCHOR_MIN_BITS &&
+                    !has_candidate(archive + entry.comp_offset, entry.n_bits, coded_pattern))) {
+                    decode_head(archive, entry, block_decoder, keep, blocks[i]);
+                    blocks[i].has_tail = false;
+                    partial[t].n_skipped++;
+                    continue;
+                }
+                scan_block(archive, entry, block_decoder, coded_pattern, keep, max_offsets, blocks[i]);
+                partial[t].n_scanned++;
+            } else {
+                scratch.resize(entry.raw_len);
+                decode_entry(archive, entry, decoder, &scratch[0]);
+                search_bytes(scratch.data(), entry, pattern, keep, max_offsets, blocks[i]);
+                partial[t].n_decoded++;
+            }
+        }
+    });
+
+    // the tails of skipped blocks, where the next blocks start with the end of the pattern
+    auto forward = [&](size_t i) {
+        string bytes;
+        for (auto j = i + 1; j < blocks.size() && bytes.size() < keep; j++) bytes += blocks[j].head;
+        return bytes;
+    };
+    vector<size_t> need_tail;
+    for (size_t i = 0; keep > 0 && i + 1 < blocks.size(); i++) {
+        if (blocks[i].has_tail) continue;
+        auto next_bytes = forward(i);
+        for (size_t k = 1; k <= keep; k++)
+            if (next_bytes.size() >= pattern.size() - k &&
+                next_bytes.compare(0, pattern.size() - k, pattern, k, pattern.size() - k) == 0) {
+                need_tail.push_back(i);
+                break;
+            }
+    }
+    next = 0;
+    run_threads(min(n_threads, max<size_t>(1, need_tail.size())), [&](size_t) {
+        for (size_t k; (k = next++) < need_tail.size();) {
+            auto i = need_tail[k];
+            auto &entry = index.entries[i];
+            blocks[i].head.clear();
+            scan_block(archive, entry, entry_decoder(decoder, entry), coded_pattern_t(), keep, max_offsets, blocks[i]);
+            blocks[i].has_tail = true;
+        }
+    });
+
+    search_result_t result;
+    for (auto &p: partial) {
+        result.n_scanned += p.n_scanned;
+        result.n_skipped += p.n_skipped;
+        result.n_stored += p.n_stored;
+        result.n_decoded += p.n_decoded;
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        auto &block = blocks[i];
+        result.n_matches += block.n_matches;
+        for (auto offset: block.offsets)
+            if (result.offsets.size() < max_offsets) result.offsets.push_back(offset);
+
+        // matches starting in the tail of block i and ending in the next blocks
+        if (keep == 0 || !block.has_tail || block.tail.empty()) continue;
+        auto window = block.tail + forward(i);
+        auto start = index.entries[i].raw_offset + index.entries[i].raw_len - block.tail.size();
+        for (size_t s = 0; s < block.tail.size() && s + pattern.size() <= window.size(); s++)
+            if (window.compare(s, pattern.size(), pattern) == 0) {
+                result.n_matches++;
+                if (result.offsets.size() < max_offsets) result.offsets.push_back(start + s);
+            }
+    }
+    return result;
+}
+
+/**
+ * Symbol counts of an archive on disk: from its trailer when it holds them, else from a scan.
+ * @param filename the archive.
+ * @param n_threads the number of scanning threads.
+ * @param scan scan the blocks even if the trailer holds the counts.
+ * @param from_trailer set when no block was read.
+ */
+freq_table_t count_file(const string &filename, size_t n_threads, bool scan, bool &from_trailer) {
+    // every page is read by a scan: fault them in at once
+    MappedArchive archive(filename, MADV_SEQUENTIAL, true);
+    freq_table_t counts{};
+    Node *tree = nullptr;
+    try {
+        auto index = parse_archive(archive.data(), archive.size());
+        from_trailer = !scan && archive_histogram(index, counts);
+        if (!from_trailer) {
+            tree = generate_huffman_tree(from_freq_table(index.freqs));
+            auto decoder = make_decoder(index, tree);
+            counts = count_archive(archive.data(), index, decoder, n_threads);
+        }
+    } catch (...) {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+    return counts;
+}
+
+/**
+ * Searches an archive on disk for a pattern (see search_archive).
+ */
+search_result_t search_file(const string &filename, const string &pattern, size_t n_threads, size_t max_offsets) {
+    MappedArchive archive(filename, MADV_SEQUENTIAL, true);
+    search_result_t result;
+    Node *tree = nullptr;
+    try {
+        auto index = parse_archive(archive.data(), archive.size());
+        tree = generate_huffman_tree(from_freq_table(index.freqs));
+        auto decoder = make_decoder(index, tree);
+        result = search_archive(archive.data(), index, decoder, pattern, n_threads, max_offsets);
+    } catch (...) {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef SPM_PROJECT_HUFFMAN_QUERY_H
+#define SPM_PROJECT_HUFFMAN_QUERY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "huffman-format.h"
+
+/*
+ * Queries answered on an archive without decompressing it.
+ * Symbol counts come from the frequency table of the trailer, which is the histogram of the whole input
+ * unless the archive was appended to or is word-level; those are counted block by block.
+ * Pattern search encodes the pattern with the code of every table. Huffman codes are prefix-free, so the
+ * pattern occurs at a symbol iff its code starts at that symbol's code boundary. First, a bytewise filter
+ * looks for the coded pattern at any bit offset of a block: a block where it appears nowhere has no match
+ * and is skipped. The other blocks are scanned: their code boundaries are walked with a table that skips
+ * the codes that cannot start a match, nothing is written, and the next bits are compared with the coded
+ * pattern at the remaining boundaries. Stored blocks are searched in place. Blocks with no code boundaries
+ * to match on (tANS, words, sub-streams) are decoded into a per-thread scratch block and searched there.
+ * Matches that cross a block boundary are found from the last and first symbols of the blocks.
+ * Blocks are processed in parallel.
+ */
+
+#define SEARCH_MAX_OFFSETS 10   // match offsets reported by default
+
+using namespace std;
+
+/** Outcome of a search. */
+struct search_result_t {
+    uint64_t n_matches = 0;     // occurrences, overlapping ones included
+    vector<uint64_t> offsets;   // the first ones, increasing
+    uint64_t n_scanned = 0;     // Huffman blocks searched in the compressed domain
+    uint64_t n_skipped = 0;     // Huffman blocks whose bits do not contain the coded pattern anywhere
+    uint64_t n_stored = 0;      // stored blocks searched in place
+    uint64_t n_decoded = 0;     // blocks decoded to a scratch buffer first
+};
+
+bool archive_histogram(const archive_index_t &index, freq_table_t &counts);
+
+freq_table_t count_archive(const unsigned char *archive, const archive_index_t &index, const decoder_t &decoder,
+                           size_t n_threads);
+
+search_result_t search_archive(const unsigned char *archive, const archive_index_t &index, const decoder_t &decoder,
+                               const string &pattern, size_t n_threads, size_t max_offsets = SEARCH_MAX_OFFSETS);
+
+freq_table_t count_file(const string &filename, size_t n_threads, bool scan, bool &from_trailer);
+
+search_result_t search_file(const string &filename, const string &pattern, size_t n_threads,
+                            size_t max_offsets = SEARCH_MAX_OFFSETS);
+
+#endif //SPM_PROJECT_HUFFMAN_QUERY_H
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "huffman-stream.h"
+
+using namespace std;
+
+/**
+ * Opens an archive and starts decoding its first blocks.
+ * @param filename the archive.
+ * @param ahead the number of decoded blocks buffered ahead of the reader (at least 1).
+ */
+ArchiveReader::ArchiveReader(const string &filename, size_t ahead) : archive(filename, MADV_SEQUENTIAL) {
+    try {
+        index = parse_archive(archive.data(), archive.size());
+        tree = generate_huffman_tree(from_freq_table(index.freqs));
+        decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+    } catch (...) {
+        free_tree(tree);
+        throw;
+    }
+    ring.resize(max<size_t>(1, min(ahead, index.entries.size())));
+    worker = thread(&ArchiveReader::decode_ahead, this);
+}
+
+ArchiveReader::~ArchiveReader() {
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    consumed_cv.notify_all();
+    worker.join();
+    free_tree(tree);
+}
+
+/* background thread: decodes the blocks in order, waiting whenever the ring is full */
+void ArchiveReader::decode_ahead() {
+    auto page = (uint64_t) sysconf(_SC_PAGESIZE);
+    uint64_t released = 0;
+    for (size_t i = 0; i < index.entries.size(); i++) {
+        {
+            unique_lock<mutex> guard(lock);
+            consumed_cv.wait(guard, [&] { return stop || i - n_consumed < ring.size(); });
+            if (stop) return;
+        }
+        auto &entry = index.entries[i];
+        auto &slot = ring[i % ring.size()];
+        try {
+            slot.resize(entry.raw_len);
+            decode_entry(archive.data(), entry, decoder, &slot[0]);
+        } catch (...) {
+            lock_guard<mutex> guard(lock);
+            error = current_exception();
+            decoded_cv.notify_all();
+            return;
+        }
+
+        // the compressed pages before the next block are not needed anymore
+        auto next = i + 1 < index.entries.size() ? index.entries[i + 1].comp_offset : index.trailer_offset;
+        auto done = next / page * page;
+        if (done > released) {
+            madvise((void *) (archive.data() + released), done - released, MADV_DONTNEED);
+            released = done;
+        }
+
+        lock_guard<mutex> guard(lock);
+        n_decoded = i + 1;
+        decoded_cv.notify_all();
+    }
+}
+
+/**
+ * Reads the next bytes of the sequence, blocking until they are decoded.
+ * @param buf destination, at least n bytes.
+ * @param n the number of bytes wanted.
+ * @return the number of bytes read: n, or less at the end of the sequence (0 once it is reached).
+ */
+size_t ArchiveReader::read(char *buf, size_t n) {
+    size_t done = 0;
+    auto n_blocks = index.entries.size();
+    while (done < n && n_consumed < n_blocks) {
+        {
+            unique_lock<mutex> guard(lock);
+            decoded_cv.wait(guard, [&] { return n_decoded > n_consumed || error; });
+            if (n_decoded == n_consumed) rethrow_exception(error);
+        }
+        // the slot of block n_consumed is not touched by the decoder until it is released below
+        auto &slot = ring[n_consumed % ring.size()];
+        auto len = min(n - done, slot.size() - offset);
+        memcpy(buf + done, slot.data() + offset, len);
+        done += len;
+        offset += len;
+        if (offset == slot.size()) {
+            offset = 0;
+            lock_guard<mutex> guard(lock);
+            n_consumed++;
+            consumed_cv.notify_all();
+        }
+    }
+    position += done;
+    return done;
+}
+
+/**
+ * Decodes an archive to a file through an ArchiveReader, STREAM_BUFFER bytes at a time: memory stays
+ * bounded by the ring of the reader and one buffer, whatever the size of the archive.
+ * @param filename the archive.
+ * @param output the file the sequence is written to, "-" for stdout.
+ * @param ahead the number of decoded blocks buffered ahead of the writer.
+ * @return the number of bytes decoded.
+ */
+uint64_t stream_file(const string &filename, const string &output, size_t ahead) {
+    ArchiveReader reader(filename, ahead);
+    ofstream file;
+    if (output != "-") {
+        file.open(output, ios::binary);
+        if (!file.is_open()) throw runtime_error("Could not open file: " + output);
+    }
+    ostream &dst = output == "-" ? cout : file;
+    string buffer(STREAM_BUFFER, '\0');
+    for (size_t n; (n = reader.read(&buffer[0], buffer.size())) > 0;)
+        if (!dst.write(buffer.data(), (long) n)) throw runtime_error("Could not write file: " + output);
+    if (!dst.flush()) throw runtime_error("Could not write file: " + output);
+    return reader.tell();
+}
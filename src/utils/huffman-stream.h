@@ -0,0 +1,66 @@
+#ifndef SPM_PROJECT_HUFFMAN_STREAM_H
+#define SPM_PROJECT_HUFFMAN_STREAM_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "huffman-format.h"
+#include "huffman-io.h"
+
+/*
+ * Pull-based decoding: an ArchiveReader hands out the sequence of an archive in order, through read(buf, n),
+ * into buffers of the caller. The archive is memory-mapped, and a background thread decodes up to
+ * STREAM_AHEAD_BLOCKS blocks ahead of the reader into a ring of block buffers, so the first bytes are
+ * available as soon as the first block is decoded and memory stays bounded by the ring, whatever the size
+ * of the archive. Compressed pages are released once their blocks are decoded.
+ */
+
+#define STREAM_AHEAD_BLOCKS 4       // decoded blocks buffered ahead of the reader
+#define STREAM_BUFFER (1UL << 20)   // bytes per read when streaming to a file
+
+using namespace std;
+
+class ArchiveReader {
+public:
+    explicit ArchiveReader(const string &filename, size_t ahead = STREAM_AHEAD_BLOCKS);
+    ~ArchiveReader();
+    ArchiveReader(const ArchiveReader &) = delete;
+    ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+    size_t read(char *buf, size_t n);
+
+    /** Size of the whole decoded sequence. */
+    uint64_t size() const { return index.raw_size; }
+
+    /** Bytes returned so far. */
+    uint64_t tell() const { return position; }
+
+private:
+    MappedArchive archive;
+    archive_index_t index;
+    Node *tree = nullptr;
+    decoder_t decoder;
+
+    vector<string> ring;            // block i is decoded into ring[i % ring.size()]
+    mutex lock;
+    condition_variable decoded_cv, consumed_cv;
+    size_t n_decoded = 0;           // blocks ready in the ring
+    size_t n_consumed = 0;          // blocks read to their end, their slot is free again
+    bool stop = false;
+    exception_ptr error;            // what stopped the decoder, rethrown by read()
+    thread worker;
+
+    size_t offset = 0;              // bytes read from block n_consumed
+    uint64_t position = 0;
+
+    void decode_ahead();
+};
+
+uint64_t stream_file(const string &filename, const string &output, size_t ahead = STREAM_AHEAD_BLOCKS);
+
+#endif //SPM_PROJECT_HUFFMAN_STREAM_H
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "huffman-sync.h"
+#include "huffman-kernels.h"
+
+using namespace std;
+
+/** One thread's share of a block. */
+struct segment_t {
+    uint64_t start;             // guessed code boundary (true for the first segment)
+    uint64_t limit;             // start of the next segment
+    uint64_t end = 0;           // first code boundary at or past limit, as decoded from start
+    string symbols;             // decoded from start to end
+    vector<uint64_t> window;    // window[j]: the boundary after j symbols, for the first SYNC_WINDOW of them
+    bool failed = false;        // the guessed start ran off the block
+
+    // continuation past end, until it hits a boundary in the next segment's window
+    string tail;
+    uint64_t tail_end = 0;
+    bool synced = false;
+    size_t sync_index = 0;      // window index of the next segment where it synchronized
+};
+
+/* longest code a specialized decode kernel handles, 0 for the generic path */
+static unsigned kernel_max_len(int kernel)
+{
+    switch (kernel)
+    {
+    case KERNEL_LEN4: return 4;
+    case KERNEL_LEN8: return 8;
+    case KERNEL_LEN11: return DECODE_TABLE_BITS;
+    case KERNEL_FIXED1: case KERNEL_FIXED2: case KERNEL_FIXED3: case KERNEL_FIXED4:
+        return kernel - KERNEL_FIXED1 + 1;
+    default: return 0;
+    }
+}
+
+/* decodes symbols from pos until pos reaches limit, recording the first boundaries into window if given */
+static void decode_until(const unsigned char *data, uint64_t n_bytes, const decoder_t &decoder, uint64_t &pos,
+                         uint64_t limit, string &out, vector<uint64_t> *window)
+{
+    while (pos < limit && window != nullptr && window->size() < SYNC_WINDOW)
+    {
+        window->push_back(pos);
+        out.push_back(decode_symbol(decoder, data, n_bytes, pos));
+    }
+    // with a kernel, batches of symbols that cannot cross limit, then the last few one at a time
+    auto max_len = kernel_max_len(decoder.kernel);
+    while (max_len > 0 && pos < limit && (limit - pos) / max_len >= 256)
+    {
+        auto n = (limit - pos) / max_len;
+        auto old = out.size();
+        out.resize(old + n);
+        decode_kernel(decoder.kernel, data, n_bytes, decoder, &out[old], n, pos);
+    }
+    while (pos < limit)
+        out.push_back(decode_symbol(decoder, data, n_bytes, pos));
+}
+
+/* keeps decoding after seg.end until a boundary of next's window, or past it (then seg.synced stays false) */
+static void synchronize(const unsigned char *data, uint64_t n_bits, const decoder_t &decoder, segment_t &seg,
+                        const segment_t &next)
+{
+    auto n_bytes = (n_bits + 7) / 8;
+    auto pos = seg.end;
+    size_t j = 0;
+    seg.tail.clear();
+    seg.synced = false;
+    while (!next.failed)
+    {
+        while (j < next.window.size() && next.window[j] < pos)
+            j++;
+        if (j == next.window.size() || pos >= n_bits)
+            break;
+        if (next.window[j] == pos)
+        {
+            seg.synced = true;
+            seg.sync_index = j;
+            break;
+        }
+        seg.tail.push_back(decode_symbol(decoder, data, n_bytes, pos));
+    }
+    seg.tail_end = pos;
+}
+
+/**
+ * Decodes a single-stream Huffman block on n_threads threads without using any checkpoint: segments start
+ * at guessed bit offsets and are stitched at their sync points (see huffman-sync.h).
+ * @param data the encoded bytes.
+ * @param n_bits the number of meaningful bits.
+ * @param decoder the decoder built from the archive's Huffman tree.
+ * @param out destination buffer, at least n_out bytes.
+ * @param n_out the number of symbols of the block.
+ * @param n_threads the number of segments decoded at once.
+ * @param stats updated with the sync distances and the wasted work.
+ */
+void decode_speculative(const unsigned char *data, uint64_t n_bits, const decoder_t &decoder, char *out,
+                        size_t n_out, size_t n_threads, sync_stats_t &stats)
+{
+    auto n_segments = (size_t)min<uint64_t>(n_threads, n_bits / SYNC_MIN_SEGMENT);
+    if (n_segments < 2 || decoder.root == nullptr || is_leaf(decoder.root))
+    {
+        decode_block(data, n_bits, decoder, out, n_out);
+        stats.decoded_symbols += n_out;
+        return;
+    }
+
+    auto n_bytes = (n_bits + 7) / 8;
+    vector<segment_t> segments(n_segments);
+    for (size_t t = 0; t < n_segments; t++)
+    {
+        segments[t].start = t * n_bits / n_segments;
+        segments[t].limit = (t + 1) * n_bits / n_segments;
+    }
+
+    // speculative decoding: every segment from its guessed start, then the continuations, all in parallel
+    auto run_parallel = [&](auto body) {
+        vector<thread> threads;
+        for (size_t t = 1; t < n_segments; t++)
+            threads.emplace_back(body, t);
+        exception_ptr error;
+        try
+        {
+            body(0);
+        }
+        catch (...)
+        {
+            error = current_exception();
+        }
+        for (auto &th : threads)
+            th.join();
+        if (error)
+            rethrow_exception(error);
+    };
+    run_parallel([&](size_t t) {
+        auto &seg = segments[t];
+        auto pos = seg.start;
+        seg.symbols.reserve(n_out / n_segments + n_out / n_segments / 8);
+        try
+        {
+            decode_until(data, n_bytes, decoder, pos, seg.limit, seg.symbols, t > 0 ? &seg.window : nullptr);
+        }
+        catch (const runtime_error &)
+        {
+            if (t == 0)
+                throw;  // the true stream is broken
+            seg.failed = true;  // a guessed start decoded past the end of the block
+        }
+        seg.end = pos;
+    });
+    run_parallel([&](size_t t) {
+        if (t + 1 < n_segments && !segments[t].failed)
+            synchronize(data, n_bits, decoder, segments[t], segments[t + 1]);
+    });
+
+    // stitching, in order: segment t is valid from the sync point of segment t - 1 on, or is redone
+    size_t written = 0;
+    auto emit = [&](const char *symbols, size_t n) {
+        if (n > n_out - written)
+            throw runtime_error("Corrupted archive: block decoded to the wrong size");
+        memcpy(out + written, symbols, n);
+        written += n;
+    };
+    emit(segments[0].symbols.data(), segments[0].symbols.size());
+    stats.n_blocks++;
+    stats.decoded_symbols += segments[0].symbols.size();
+    for (size_t t = 1; t < n_segments; t++)
+    {
+        auto &prev = segments[t - 1];
+        auto &seg = segments[t];
+        stats.n_segments++;
+        stats.decoded_symbols += prev.tail.size() + seg.symbols.size();
+        emit(prev.tail.data(), prev.tail.size());
+        if (prev.synced)
+        {
+            auto k = prev.sync_index;
+            auto distance = seg.window[k] - seg.start;
+            stats.sync_bits += distance;
+            stats.max_sync_bits = max(stats.max_sync_bits, distance);
+            stats.wasted_symbols += k;
+            emit(seg.symbols.data() + k, seg.symbols.size() - k);
+            continue;
+        }
+
+        // no sync point: decode the segment again from the true position, and its continuation
+        stats.n_failed++;
+        stats.wasted_symbols += seg.symbols.size();
+        auto pos = prev.tail_end;
+        seg.symbols.clear();
+        seg.failed = false;
+        decode_until(data, n_bytes, decoder, pos, seg.limit, seg.symbols, nullptr);
+        seg.end = pos;
+        stats.decoded_symbols += seg.symbols.size();
+        emit(seg.symbols.data(), seg.symbols.size());
+        if (t + 1 < n_segments)
+            synchronize(data, n_bits, decoder, seg, segments[t + 1]);
+    }
+    if (written != n_out || segments.back().end != n_bits)
+        throw runtime_error("Corrupted archive: block decoded to the wrong size");
+}
@@ -0,0 +1,38 @@
+#ifndef SPM_PROJECT_HUFFMAN_SYNC_H
+#define SPM_PROJECT_HUFFMAN_SYNC_H
+
+#include <cstdint>
+
+#include "huffman-format.h"
+
+/*
+ * Speculative parallel decoding of one Huffman block, for bitstreams with no index inside them.
+ * The block is cut at arbitrary bit offsets and every thread decodes its segment as if a code started
+ * there. A wrong start yields garbage for a while, but Huffman codes self-synchronize: after a few
+ * codes the spurious boundaries fall on true ones and the decoding is correct from there on.
+ * Every thread records the first SYNC_WINDOW code boundaries of its segment; the thread before it
+ * then keeps decoding past the end of its own segment until it lands on one of them (the sync point).
+ * Stitching takes each segment from its sync point on. A segment that does not synchronize within the
+ * window is decoded again, serially, from the true position: the only work ever redone.
+ */
+
+#define SYNC_WINDOW 4096                // code boundaries a thread records for the previous one to sync on
+#define SYNC_MIN_SEGMENT (1UL << 16)    // bits per thread below which a block is decoded serially
+
+using namespace std;
+
+/** What speculation cost, summed over the blocks decoded. */
+struct sync_stats_t {
+    uint64_t n_blocks = 0;          // blocks decoded speculatively
+    uint64_t n_segments = 0;        // segments started at a guessed position
+    uint64_t n_failed = 0;          // segments that did not synchronize and were decoded again
+    uint64_t sync_bits = 0;         // sum over synchronized segments of (sync point - segment start)
+    uint64_t max_sync_bits = 0;
+    uint64_t decoded_symbols = 0;   // everything decoded, wasted work included
+    uint64_t wasted_symbols = 0;    // decoded before a sync point, or by a segment that failed
+};
+
+void decode_speculative(const unsigned char *data, uint64_t n_bits, const decoder_t &decoder, char *out,
+                        size_t n_out, size_t n_threads, sync_stats_t &stats);
+
+#endif //SPM_PROJECT_HUFFMAN_SYNC_H
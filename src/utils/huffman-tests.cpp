@@ -0,0 +1,1301 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "huffman-commons.h"
+#include "huffman-format.h"
+#include "huffman-io.h"
+#include "huffman-kernels.h"
+#include "huffman-query.h"
+#include "huffman-stream.h"
+#include "../distributed/Communicator.h"
+#include "../distributed/HuffmanDistributed.h"
+#include "../thread/HuffmanWords.h"
+#include "../thread/ThreadPool.h"
+#include "../server/protocol.h"
+
+/*
+ * Round-trip and corruption checks of the archive format and of the tools built on it, registered with CTest
+ * one group per test: spm_tests <group> [args]. Every group runs in a scratch directory of its own, removed at
+ * the end, so the files the backends write (output.bin, benchmark.csv) never land in the build tree.
+ */
+
+#define TEST_BLOCK_SIZE 16384   // small blocks, so that a few hundred KB make many of them
+
+using namespace std;
+
+static unsigned n_checks = 0, n_failed = 0;
+static vector<string> group_args;   // paths after the group name, made absolute before the chdir
+
+#define CHECK(cond, what) check((cond), (what), __LINE__)
+
+static void check(bool ok, const string &what, int line) {
+    n_checks++;
+    if (ok) return;
+    n_failed++;
+    cout << "\033[1;31mFAILED\033[0m line " << line << ": " << what << endl;
+}
+
+/* xorshift64*, so every run sees the same inputs */
+struct test_rng_t {
+    uint64_t state;
+
+    explicit test_rng_t(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    size_t below(size_t n) { return next() % n; }
+};
+
+/* words drawn from a small vocabulary with skewed weights, separated by spaces and newlines */
+static string make_text(size_t size, uint64_t seed) {
+    static const char *vocabulary[] = {"the", "archive", "of", "block", "huffman", "a", "decode", "table", "and",
+                                       "stream", "symbol", "to", "func", "return", "if", "x", "0x22", "in"};
+    const size_t n_words = sizeof(vocabulary) / sizeof(vocabulary[0]);
+    test_rng_t rng(seed);
+    string text;
+    while (text.size() < size) {
+        auto k = min(rng.below(n_words), rng.below(n_words));
+        text += vocabulary[k];
+        text += rng.below(12) == 0 ? '\n' : ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+static string make_random(size_t size, uint64_t seed) {
+    test_rng_t rng(seed);
+    string bytes(size, '\0');
+    for (auto &c: bytes) c = (char) rng.next();
+    return bytes;
+}
+
+/* long runs of a few byte values, '\0' included */
+static string make_runs(size_t size, uint64_t seed) {
+    test_rng_t rng(seed);
+    string bytes;
+    while (bytes.size() < size) bytes.append(1 + rng.below(300), "\0\1\2\377"[rng.below(4)]);
+    bytes.resize(size);
+    return bytes;
+}
+
+/* the inputs every round trip is run on, by name */
+static vector<pair<string, string>> test_inputs() {
+    return {
+            {"empty", ""},
+            {"one byte", "x"},
+            {"short", "abracadabra"},
+            {"one symbol", string(100000, 'a')},
+            {"text", make_text(300000, 1)},
+            {"runs", make_runs(200000, 2)},
+            {"random", make_random(100000, 3)},
+            {"text then random", make_text(150000, 4) + make_random(50000, 5)},
+            {"three blocks", make_text(2 * BLOCK_SIZE + 1000, 6)},
+    };
+}
+
+/* the byte-level encoder of the sequential backend, serialized */
+static bytes_t compress_bytes(const string &seq, const run_options_t &options,
+                              const function<void(archive_t &)> &edit = nullptr) {
+    freq_table_t counts{};
+    count_symbols(seq.data(), seq.size(), counts);
+    auto tree = generate_huffman_tree(from_freq_table(counts));
+    auto codes = generate_huffman_codes(tree);
+    auto table = make_code_table(codes, use_pair_tables(options.pair_mode, seq.size()));
+    free_codes(codes);
+    free_tree(tree);
+
+    archive_t archive;
+    init_archive(archive, seq.size(), counts, options.block_size, options.checkpoint_interval, options.n_streams);
+    use_coder(archive, table, options.coder);
+    auto policy = resolve_store_policy(archive, table, options.store_mode);
+    for (size_t i = 0; i < archive.blocks.size(); i++) encode_archive_block(archive, i, seq.data(), table, policy);
+    if (edit) edit(archive);
+    bytes_t bytes;
+    serialize_archive(archive, bytes);
+    return bytes;
+}
+
+/* decodes every block of a serialized archive; throws on anything parse_archive or decode_entry reject */
+static string decompress_bytes(const bytes_t &bytes) {
+    auto index = parse_archive(bytes.data(), bytes.size());
+    auto tree = generate_huffman_tree(from_freq_table(index.freqs));
+    string out(index.raw_size, '\0');
+    try {
+        auto decoder = make_decoder(index, tree, use_pair_tables(PAIRS_AUTO, index.raw_size));
+        for (auto &entry: index.entries) decode_entry(bytes.data(), entry, decoder, &out[entry.raw_offset]);
+    } catch (...) {
+        free_tree(tree);
+        throw;
+    }
+    free_tree(tree);
+    return out;
+}
+
+static void write_bytes(const string &filename, const char *data, size_t n) {
+    ofstream out(filename, ios::binary | ios::trunc);
+    out.write(data, (long) n);
+    if (!out.flush()) throw runtime_error("Could not write file: " + filename);
+}
+
+static string read_bytes(const string &filename) {
+    return read_file(filename);
+}
+
+static run_options_t test_options() {
+    run_options_t options;
+    options.block_size = TEST_BLOCK_SIZE;
+    return options;
+}
+
+/* the pool runs every task once, job after job, with more or fewer tasks than workers, and survives a throw */
+static void test_pool() {
+    ThreadPool pool(3);
+    CHECK(pool.size() == 3, "pool size");
+    for (size_t n_tasks: {0, 1, 2, 3, 7, 1000}) {
+        vector<atomic<unsigned>> runs(n_tasks);
+        for (int job = 0; job < 5; job++) pool.parallel_for(n_tasks, [&](size_t i) { runs[i]++; });
+        auto all_five = true;
+        for (auto &r: runs) all_five = all_five && r == 5;
+        CHECK(all_five, to_string(n_tasks) + " tasks run once per job");
+    }
+
+    // a job sees what the caller wrote before it, the caller what the job wrote
+    vector<uint64_t> squares(100);
+    pool.parallel_for(squares.size(), [&](size_t i) { squares[i] = i * i; });
+    auto right = true;
+    for (size_t i = 0; i < squares.size(); i++) right = right && squares[i] == i * i;
+    CHECK(right, "task results visible after parallel_for");
+
+    // a throwing task ends the job: the exception reaches the caller, the other workers survive
+    for (size_t n_tasks: {1, 3, 1000}) {
+        atomic<unsigned> n_run{0};
+        string what;
+        try {
+            pool.parallel_for(n_tasks, [&](size_t i) {
+                n_run++;
+                if (i == n_tasks / 2) throw runtime_error("task " + to_string(i));
+            });
+        } catch (const runtime_error &e) {
+            what = e.what();
+        }
+        CHECK(what == "task " + to_string(n_tasks / 2), to_string(n_tasks) + " tasks: exception rethrown");
+        CHECK(n_run <= n_tasks, to_string(n_tasks) + " tasks: none run twice");
+    }
+    vector<atomic<unsigned>> runs(100);
+    pool.parallel_for(runs.size(), [&](size_t i) { runs[i]++; });
+    auto all_once = true;
+    for (auto &r: runs) all_once = all_once && r == 1;
+    CHECK(all_once, "the pool runs the next job after a throw");
+}
+
+/* arena memory from several threads: aligned, private to its thread, counted, and gone after a release */
+static void test_alloc() {
+    alloc_stats_reset();
+    vector<vector<uint64_t, arena_allocator<uint64_t>>> filled(4);
+    vector<thread> threads;
+    for (size_t t = 0; t < filled.size(); t++)
+        threads.emplace_back([&, t]() {
+            for (uint64_t i = 0; i < 100000; i++) filled[t].push_back(t << 32 | i);
+        });
+    for (auto &t: threads) t.join();
+    auto intact = true;
+    for (uint64_t t = 0; t < filled.size(); t++)
+        for (uint64_t i = 0; i < filled[t].size(); i++) intact = intact && filled[t][i] == (t << 32 | i);
+    CHECK(intact, "vectors grown on four threads at once keep their values");
+
+    for (size_t align: {1, 8, 64, 4096}) {
+        auto p = arena_allocate(align + 3, align);
+        CHECK((uintptr_t) p % align == 0, "aligned to " + to_string(align));
+    }
+    auto big = (char *) arena_allocate(ARENA_REGION_SIZE, 64);
+    big[0] = big[ARENA_REGION_SIZE - 1] = 1;
+    auto stats = alloc_stats();
+    CHECK(stats.arena_allocs > filled.size() + 5 && stats.arena_mapped >= (filled.size() + 1) * ARENA_REGION_SIZE,
+          "arena allocations and mappings counted, one region per thread");
+
+    filled.clear();
+    arena_release();
+    CHECK(alloc_stats().arena_mapped == 0, "release unmaps every region");
+    auto p = (uint64_t *) arena_allocate(sizeof(uint64_t), alignof(uint64_t));
+    *p = 42;
+    CHECK(*p == 42 && alloc_stats().arena_mapped == ARENA_REGION_SIZE, "allocation after a release maps anew");
+    arena_release();
+
+#ifdef SPM_ALLOC_STATS
+    alloc_stats_reset();
+    auto block = new char[1 << 20];
+    block[0] = 1;
+    stats = alloc_stats();
+    delete[] block;
+    CHECK(stats.allocs >= 1 && stats.peak_bytes >= (1 << 20), "operator new counted");
+#endif
+}
+
+/* every store mode, on every input */
+static void test_format() {
+    vector<pair<string, run_options_t>> layouts;
+    layouts.emplace_back("default", test_options());
+    for (auto store_mode: {STORE_OFF, STORE_GLOBAL}) {
+        auto options = test_options();
+        options.store_mode = store_mode;
+        layouts.emplace_back(store_mode == STORE_OFF ? "never stored" : "stored globally", options);
+    }
+    auto options = test_options();
+    options.block_size = BLOCK_SIZE;
+    layouts.emplace_back("default block size", options);
+    options = test_options();
+    options.checkpoint_interval = 1000;
+    layouts.emplace_back("checkpoints", options);
+    options = test_options();
+    options.n_streams = 4;
+    layouts.emplace_back("4 streams", options);
+    options = test_options();
+    options.pair_mode = PAIRS_ON;
+    layouts.emplace_back("pair tables", options);
+
+    for (auto &input: test_inputs())
+        for (auto &layout: layouts) {
+            auto what = input.first + ", " + layout.first;
+            auto bytes = compress_bytes(input.second, layout.second);
+            string out;
+            try {
+                out = decompress_bytes(bytes);
+            } catch (const exception &e) {
+                CHECK(false, what + ": " + e.what());
+                continue;
+            }
+            CHECK(out == input.second, what + ": round trip");
+            auto index = parse_archive(bytes.data(), bytes.size());
+            CHECK(index.entries.size() == block_count(input.second.size(), layout.second.block_size),
+                  what + ": block count");
+        }
+
+    // random access, from the checkpoints or the start of the blocks, in memory and on disk
+    auto text = make_text(300000, 7);
+    for (uint64_t interval: {0, 1000}) {
+        options = test_options();
+        options.checkpoint_interval = interval;
+        auto bytes = compress_bytes(text, options);
+        auto index = parse_archive(bytes.data(), bytes.size());
+        auto tree = generate_huffman_tree(from_freq_table(index.freqs));
+        auto decoder = make_decoder(tree);
+        write_bytes("text.spm", (const char *) bytes.data(), bytes.size());
+        test_rng_t rng(7);
+        for (int k = 0; k < 50; k++) {
+            auto offset = rng.below(text.size() + 10), length = rng.below(3 * TEST_BLOCK_SIZE);
+            auto expected = offset < text.size() ? text.substr(offset, length) : string();
+            auto what = to_string(offset) + "+" + to_string(length) + ", checkpoints every " + to_string(interval);
+            string out(expected.size(), '\0');
+            extract_range(bytes.data(), index, decoder, offset, length, &out[0]);
+            CHECK(out == expected, "extract " + what);
+            string from_file;
+            extract_file("text.spm", offset, length, from_file);
+            CHECK(from_file == expected, "extract from the file " + what);
+        }
+        free_tree(tree);
+    }
+
+    // pair tables on both sides, or on either one only: the bits are the same
+    auto pairs_text = make_text(PAIR_MIN_INPUT + 1000, 15);
+    options = test_options();
+    options.pair_mode = PAIRS_OFF;
+    auto single = compress_bytes(pairs_text, options);
+    options.pair_mode = PAIRS_ON;
+    CHECK(compress_bytes(pairs_text, options) == single, "pair tables encode the same bits");
+    CHECK(decompress_bytes(single) == pairs_text, "pair tables decode single-symbol archives");
+
+    auto refused = false;
+    try {
+        archive_t archive;
+        init_archive(archive, text.size(), freq_table_t{}, TEST_BLOCK_SIZE, 1000, 4);
+    } catch (const runtime_error &) {
+        refused = true;
+    }
+    CHECK(refused, "checkpoints and streams refused together");
+
+    // incompressible input is stored, not grown; only the random blocks of a mixed input are
+    auto random = make_random(100000, 8);
+    auto bytes = compress_bytes(random, test_options());
+    CHECK(bytes.size() < random.size() + random.size() / 50, "random input stored");
+    auto mixed = make_text(5 * TEST_BLOCK_SIZE, 9) + make_random(3 * TEST_BLOCK_SIZE, 10);
+    bytes = compress_bytes(mixed, test_options());
+    auto index = parse_archive(bytes.data(), bytes.size());
+    unsigned n_stored = 0;
+    for (auto &entry: index.entries) n_stored += entry.kind == BLOCK_STORED;
+    CHECK(index.entries.size() == 8 && n_stored == 3, "only the random blocks stored");
+
+    // the in-memory phases of the backends borrow the input and hand it back, also when a phase throws
+    string seq, input = text;
+    phase_times_t times;
+    auto archive = compress_phases(seq, input, times, [&]() {
+        CHECK(seq == text && input.empty(), "input swapped in");
+        return 7L;
+    }, []() {}, [&]() {
+        archive_t encoded;
+        encoded.raw_size = seq.size();
+        return encoded;
+    });
+    CHECK(input == text && seq.empty() && archive.raw_size == text.size() && times.time_reduce == 7,
+          "input handed back, reduce time recorded");
+    auto thrown = false;
+    try {
+        compress_phases(seq, input, times, []() { return 0L; }, []() { throw runtime_error("no codes"); },
+                        []() { return archive_t(); });
+    } catch (const runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown && input == text && seq.empty(), "input handed back when a phase throws");
+}
+
+/* the tANS coder: round trips, random access, and the speculative decode falling back to whole blocks */
+static void test_ans() {
+    auto options = test_options();
+    options.coder = CODER_ANS;
+    for (auto &input: test_inputs()) {
+        auto bytes = compress_bytes(input.second, options);
+        string out;
+        try {
+            out = decompress_bytes(bytes);
+        } catch (const exception &e) {
+            CHECK(false, input.first + ", tANS: " + e.what());
+            continue;
+        }
+        CHECK(out == input.second, input.first + ", tANS: round trip");
+    }
+
+    auto text = make_text(300000, 12);
+    auto bytes = compress_bytes(text, options);
+    CHECK(parse_archive(bytes.data(), bytes.size()).coder == CODER_ANS, "tANS archive flagged");
+    write_bytes("text.spm", (const char *) bytes.data(), bytes.size());
+    test_rng_t rng(12);
+    for (int k = 0; k < 20; k++) {
+        auto offset = rng.below(text.size()), length = rng.below(3 * TEST_BLOCK_SIZE);
+        string out;
+        extract_file("text.spm", offset, length, out);
+        CHECK(out == text.substr(offset, length), "tANS extract " + to_string(offset) + "+" + to_string(length));
+    }
+    sync_stats_t stats;
+    decode_file("text.spm", "text.out", 3, true, stats);
+    CHECK(read_bytes("text.out") == text, "tANS speculative decode");
+
+    auto refused = false;
+    try {
+        options.checkpoint_interval = 1000;
+        compress_bytes(text, options);
+    } catch (const runtime_error &) {
+        refused = true;
+    }
+    CHECK(refused, "tANS with checkpoints refused");
+
+    // the dry run sizes the blocks with the tANS table, as the real run does
+    freq_table_t counts{};
+    count_symbols(text.data(), text.size(), counts);
+    options.checkpoint_interval = 0;
+    auto ans = estimate_compression(text, from_freq_table(counts), options);
+    options.coder = CODER_HUFFMAN;
+    auto huffman = estimate_compression(text, from_freq_table(counts), options);
+    CHECK(ans.coder == CODER_ANS && ans.coded_bits != huffman.coded_bits, "tANS estimate uses the tANS table");
+    options.coder = CODER_ANS;
+    bytes = compress_bytes(text, options);
+    auto off = max(ans.output_bytes, (uint64_t) bytes.size()) - min(ans.output_bytes, (uint64_t) bytes.size());
+    CHECK(off < bytes.size() / 100,
+          "tANS estimate " + to_string(ans.output_bytes) + " close to the archive " + to_string(bytes.size()));
+}
+
+/* a damaged payload byte is caught by the block checksum */
+static void test_crc() {
+    auto text = make_text(300000, 10);
+    auto bytes = compress_bytes(text, test_options());
+    auto index = parse_archive(bytes.data(), bytes.size());
+    CHECK(index.checksums, "checksums stored by default");
+    CHECK(decompress_bytes(bytes) == text, "intact archive decodes");
+    write_bytes("intact.spm", (const char *) bytes.data(), bytes.size());
+    uint64_t n_blocks;
+    CHECK(verify_file("intact.spm", 2, nullptr, n_blocks) == 0, "intact archive verifies");
+    CHECK(n_blocks == index.entries.size(), "verify counts the blocks");
+    CHECK(verify_file("intact.spm", 2, &text, n_blocks) == 0, "intact archive matches its input");
+
+    auto &entry = index.entries[index.entries.size() / 2];
+    for (uint64_t at: {entry.comp_offset, entry.comp_offset + (entry.n_bits / 8) / 2}) {
+        auto damaged = bytes;
+        damaged[at] ^= 0x10;
+        auto caught = false;
+        try {
+            caught = decompress_bytes(damaged) != text;
+        } catch (const runtime_error &) {
+            caught = true;
+        }
+        CHECK(caught, "payload byte " + to_string(at) + " flipped");
+        write_bytes("damaged.spm", (const char *) damaged.data(), damaged.size());
+        CHECK(verify_file("damaged.spm", 2, nullptr, n_blocks) == 1, "verify finds the one damaged block");
+        sync_stats_t stats;
+        caught = false;
+        try {
+            decode_file("damaged.spm", "damaged.out", 3, true, stats);
+        } catch (const runtime_error &) {
+            caught = true;
+        }
+        CHECK(caught, "speculative decode checks the block checksum");
+    }
+}
+
+/* truncated, mislabeled or bit-flipped archives are rejected, never decoded to the wrong bytes */
+static void test_corrupt() {
+    auto text = make_text(100000, 11);
+    auto bytes = compress_bytes(text, test_options());
+    auto rejected = [&](const bytes_t &damaged) {
+        try {
+            return decompress_bytes(damaged) == text ? 0 : -1;
+        } catch (const runtime_error &) {
+            return 1;
+        } catch (const length_error &) {
+            return 1;
+        } catch (const bad_alloc &) {
+            return 1;
+        }
+    };
+
+    for (size_t size = 0; size < bytes.size(); size += size < 64 || size + 64 > bytes.size() ? 1 : 997) {
+        bytes_t truncated(bytes.begin(), bytes.begin() + size);
+        CHECK(rejected(truncated) == 1, "truncated to " + to_string(size) + " bytes");
+    }
+    auto damaged = bytes;
+    damaged[0] = 'X';
+    CHECK(rejected(damaged) == 1, "bad magic");
+    damaged = bytes;
+    damaged[4]++;
+    CHECK(rejected(damaged) == 1, "unknown version");
+    damaged = bytes;
+    damaged[5] |= 0x80;
+    CHECK(rejected(damaged) == 1, "unknown flag");
+    damaged = bytes;
+    damaged[bytes.size() - 1] ^= 1;
+    CHECK(rejected(damaged) == 1, "bad footer");
+    damaged = bytes;
+    damaged[bytes.size() - ARCHIVE_FOOTER_SIZE] ^= 1;
+    CHECK(rejected(damaged) == 1, "bad trailer offset");
+
+    // every bit of the header, trailer and footer: rejected or harmless, never wrong data
+    auto index = parse_archive(bytes.data(), bytes.size());
+    vector<size_t> positions;
+    for (size_t p = 0; p < ARCHIVE_HEADER_SIZE; p++) positions.push_back(p);
+    for (size_t p = index.trailer_offset; p < bytes.size(); p++) positions.push_back(p);
+    unsigned n_wrong = 0;
+    for (auto p: positions)
+        for (int bit = 0; bit < 8; bit++) {
+            damaged = bytes;
+            damaged[p] ^= (unsigned char) (1 << bit);
+            if (rejected(damaged) < 0) n_wrong++;
+        }
+    CHECK(n_wrong == 0, to_string(n_wrong) + " single-bit flips decoded to wrong data");
+
+    CHECK(rejected(compress_bytes(text, test_options())) == 0, "the archive is deterministic");
+
+    // trailers whose table cannot have coded the blocks: empty, or counting more bytes than there are
+    vector<pair<string, run_options_t>> layouts = {{"", test_options()}, {", 4 streams", test_options()}};
+    layouts[1].second.n_streams = 4;
+    for (auto &layout: layouts) {
+        auto emptied = compress_bytes(text, layout.second, [](archive_t &a) { a.freqs = freq_table_t{}; });
+        CHECK(rejected(emptied) == 1, "empty frequency table" + layout.first);
+        auto inflated = compress_bytes(text, layout.second, [](archive_t &a) { a.freqs['e'] += 1000; });
+        CHECK(rejected(inflated) == 1, "frequency table counting more than the input" + layout.first);
+    }
+    // the same for the table of a switch, which covers the blocks from the second on
+    auto switched = compress_bytes(text, test_options(), [](archive_t &a) { a.tables.push_back({1, {}}); });
+    CHECK(rejected(switched) == 1, "empty table switch");
+    switched = compress_bytes(text, test_options(), [&](archive_t &a) {
+        a.tables.push_back({1, a.freqs});
+        a.freqs = freq_table_t{};
+        a.freqs['e'] = TEST_BLOCK_SIZE + 1;
+    });
+    CHECK(rejected(switched) == 1, "first table counting more than its block");
+    auto random = make_random(50000, 12);
+    auto options = test_options();
+    options.store_mode = STORE_ALL;
+    auto stored = compress_bytes(random, options, [](archive_t &archive) { archive.freqs = freq_table_t{}; });
+    CHECK(decompress_bytes(stored) == random, "empty table with stored blocks only: nothing to decode with it");
+
+    // every command that maps an archive refuses files that are not one, and keeps no descriptor open
+    write_bytes("empty.spm", "", 0);
+    write_bytes("text.txt", text.data(), text.size());
+    write_bytes("truncated.spm", (const char *) bytes.data(), bytes.size() / 2);
+    auto open_fds = [] {
+        return distance(filesystem::directory_iterator("/proc/self/fd"), filesystem::directory_iterator());
+    };
+    auto fds_before = open_fds();
+    vector<pair<string, function<void(const string &)>>> commands = {
+            {"extract", [](const string &f) { string out; extract_file(f, 0, 10, out); }},
+            {"decode",  [](const string &f) { sync_stats_t stats; decode_file(f, "out.txt", 2, true, stats); }},
+            {"verify",  [](const string &f) { uint64_t n; verify_file(f, 2, nullptr, n); }},
+            {"count",   [](const string &f) { bool from_trailer; count_file(f, 2, false, from_trailer); }},
+            {"search",  [](const string &f) { search_file(f, "the", 2); }},
+            {"stream",  [](const string &f) { ArchiveReader reader(f); }}};
+    for (auto &command: commands)
+        for (string file: {"missing.spm", "empty.spm", "text.txt", "truncated.spm"}) {
+            auto refused = false;
+            try {
+                command.second(file);
+            } catch (const runtime_error &) {
+                refused = true;
+            }
+            CHECK(refused, command.first + " refuses " + file);
+        }
+    CHECK(open_fds() == fds_before, "no descriptor left open");
+}
+
+/* the fused read stage: ranges split among mappers, read and counted in parallel; then the sliced reduce */
+static void test_read() {
+    for (size_t size: {(size_t) 0, (size_t) 1, (size_t) DIRECT_ALIGN - 1, 2 * READ_CHUNK + 12345}) {
+        auto text = make_text(size, 12);
+        write_bytes("input.txt", text.data(), text.size());
+        freq_table_t expected{};
+        for (auto c: text) expected[(unsigned char) c]++;
+
+        for (auto direct: {false, true})
+            for (size_t n_mappers: {1, 2, 3, 7}) {
+                auto what = to_string(size) + " bytes, " + to_string(n_mappers) + " mappers";
+                if (direct) what += ", direct";
+                auto file = open_input("input.txt", direct);
+                CHECK(file.size == size, what + ": size");
+                string seq(file.size, '\0');
+                vector<freq_table_t> partials(n_mappers, freq_table_t{});
+                vector<thread> mappers;
+                for (size_t i = 0; i < n_mappers; i++)
+                    mappers.emplace_back([&, i]() {
+                        auto begin = read_split(file.size, i, n_mappers);
+                        read_count_range(file, begin, read_split(file.size, i + 1, n_mappers), &seq[begin],
+                                         partials[i]);
+                    });
+                for (auto &t: mappers) t.join();
+                close_input(file);
+
+                freq_table_t counts{};
+                for (auto &partial: partials)
+                    for (int c = 0; c < 256; c++) counts[c] += partial[c];
+                CHECK(seq == text && counts == expected, what + ": bytes and counts");
+            }
+    }
+
+    // the partials reduced by slices of the bins, concurrently, for thread counts that do not divide 256
+    auto input = make_random(300000, 13) + make_text(300000, 14);
+    freq_table_t expected{};
+    count_symbols(input.data(), input.size(), expected);
+    for (size_t n_partials: {1, 3, 7, 33}) {
+        vector<freq_table_t> partials(n_partials, freq_table_t{});
+        for (size_t i = 0; i < n_partials; i++) {
+            auto begin = read_split(input.size(), i, n_partials), end = read_split(input.size(), i + 1, n_partials);
+            count_symbols(input.data() + begin, end - begin, partials[i]);
+        }
+        for (size_t n_threads: {1, 2, 3, 5, 7, 31, 32, 33, 100}) {
+            auto what = to_string(n_partials) + " partials, " + to_string(n_threads) + " threads";
+            auto n_slices = reduce_slices(n_threads);
+            CHECK(n_slices >= 1 && n_slices <= n_threads && 256 / n_slices >= REDUCE_SLICE_BINS, what + ": slices");
+            freq_table_t counts{};
+            vector<thread> reducers;
+            for (size_t slice = 0; slice < n_slices; slice++)
+                reducers.emplace_back([&, slice]() { reduce_counts(partials, slice, n_slices, counts); });
+            for (auto &t: reducers) t.join();
+            CHECK(counts == expected, what + ": sliced reduce equals the serial count");
+        }
+    }
+}
+
+/* uniform draws from an alphabet */
+static string make_alphabet(size_t size, const string &alphabet, uint64_t seed) {
+    test_rng_t rng(seed);
+    string bytes(size, '\0');
+    for (auto &c: bytes) c = alphabet[rng.below(alphabet.size())];
+    return bytes;
+}
+
+/* symbol i occurring fib(i) times: codes up to 20 bits, past the decode table */
+static string make_fibonacci(uint64_t seed) {
+    string bytes;
+    uint64_t a = 1, b = 1;
+    for (char c = 'a'; c < 'a' + 20; c++, b += a, a = b - a) bytes.append(a, c);
+    test_rng_t rng(seed);
+    for (size_t i = bytes.size() - 1; i > 0; i--) swap(bytes[i], bytes[rng.below(i + 1)]);
+    return bytes;
+}
+
+/* the specialized kernels are picked from the code lengths and code exactly like the generic path */
+static void test_kernels() {
+    vector<pair<string, int>> inputs = {
+            {make_alphabet(200000, "ab", 16), KERNEL_FIXED1},
+            {make_alphabet(200000, "ACGT", 17), KERNEL_FIXED2},
+            {make_alphabet(200000, "01234567", 18), KERNEL_FIXED3},
+            {make_alphabet(200000, "0123456789abcdef", 19), KERNEL_FIXED4},
+            {make_random(200000, 20), KERNEL_LEN8},
+            {make_fibonacci(21), KERNEL_GENERIC},
+            {make_text(200000, 22), -1},
+            {make_runs(200000, 23), -1},
+    };
+    set<int> seen;
+    for (auto &input: inputs) {
+        auto &seq = input.first;
+        freq_table_t counts{}, expected{};
+        count_symbols(seq.data(), seq.size(), counts);
+        for (auto c: seq) expected[(unsigned char) c]++;
+        CHECK(counts == expected, "count_symbols");
+
+        auto tree = generate_huffman_tree(from_freq_table(counts));
+        auto codes = generate_huffman_codes(tree);
+        auto table = make_code_table(codes);
+        free_codes(codes);
+        unsigned min_len = 64, max_len = 0;
+        for (int c = 0; c < 256; c++)
+            if (table[c].len > 0) {
+                min_len = min<unsigned>(min_len, table[c].len);
+                max_len = max<unsigned>(max_len, table[c].len);
+            }
+        auto decoder = make_decoder(tree);
+        auto what = string(kernel_name(table.kernel)) + " (" + to_string(min_len) + ".." + to_string(max_len) +
+                    " bits)";
+        CHECK(table.kernel == select_kernel(min_len, max_len) && decoder.kernel == table.kernel,
+              what + ": kernel chosen from the code lengths");
+        CHECK(input.second < 0 || table.kernel == input.second, what + ": expected " + kernel_name(input.second));
+        seen.insert(table.kernel);
+
+        // the bits of the kernel are the bits of the plain bit-by-bit packing
+        bytes_t packed;
+        auto n_bits = encode_block(seq.data(), seq.size(), table, packed);
+        CHECK(n_bits == encoded_bits(seq.data(), seq.size(), table), what + ": bit count");
+        auto bits_right = true;
+        uint64_t pos = 0;
+        for (auto c: seq) {
+            auto &code = table[(unsigned char) c];
+            for (unsigned k = 0; k < code.len && bits_right; k++, pos++)
+                bits_right = ((packed[pos >> 3] >> (pos & 7)) & 1) == ((code.bits >> k) & 1);
+        }
+        CHECK(bits_right, what + ": encoded bits");
+        string out(seq.size(), '\0');
+        decode_block(packed.data(), n_bits, decoder, &out[0], out.size());
+        CHECK(out == seq, what + ": round trip");
+        free_tree(tree);
+    }
+    CHECK(seen.size() >= 7, to_string(seen.size()) + " kernels exercised");
+}
+
+/* word-level archives, decoded whole and by ranges, and the byte-level fallback */
+static void test_words() {
+    auto text = make_text(300000, 24);
+    write_bytes("words.txt", text.data(), text.size());
+    auto options = test_options();
+    HuffmanWords(2, 2, "words.txt", 2, options).run();
+    auto archive = read_bytes(OUTPUT_FILE);
+    auto bytes = bytes_t(archive.begin(), archive.end());
+    auto index = parse_archive(bytes.data(), bytes.size());
+    CHECK(!index.dictionary.empty() && index.entries.size() > 1, "text coded by words, in several blocks");
+    CHECK(archive.size() < text.size() / 2, "word archive smaller than half the text");
+    CHECK(decompress_bytes(bytes) == text, "word archive round trip");
+
+    test_rng_t rng(25);
+    for (int k = 0; k < 20; k++) {
+        auto offset = rng.below(text.size()), length = rng.below(3 * TEST_BLOCK_SIZE);
+        string out;
+        extract_file(OUTPUT_FILE, offset, length, out);
+        CHECK(out == text.substr(offset, length), "extract " + to_string(offset) + "+" + to_string(length));
+    }
+
+    // no gain from words, dictionary included: byte-level blocks, never larger than the input
+    auto random = make_random(200000, 26);
+    write_bytes("words.txt", random.data(), random.size());
+    HuffmanWords(2, 2, "words.txt", 2, options).run();
+    archive = read_bytes(OUTPUT_FILE);
+    bytes = bytes_t(archive.begin(), archive.end());
+    index = parse_archive(bytes.data(), bytes.size());
+    CHECK(index.dictionary.empty(), "random bytes coded by bytes");
+    CHECK(archive.size() <= random.size() + random.size() / 50, "byte fallback not larger than the input");
+    CHECK(decompress_bytes(bytes) == random, "byte fallback round trip");
+}
+
+/* decoding from guessed offsets inside the blocks, and streamed, against the plain block-by-block decode */
+static void test_decode() {
+    auto text = make_text(400000, 26) + make_runs(100000, 27);
+    auto options = test_options();
+    options.block_size = 4 * TEST_BLOCK_SIZE;
+    auto bytes = compress_bytes(text, options);
+    write_bytes("text.spm", (const char *) bytes.data(), bytes.size());
+
+    for (size_t n_threads: {1, 3, 8})
+        for (auto speculative: {false, true}) {
+            auto what = string(speculative ? "speculative" : "plain") + " decode on " + to_string(n_threads) +
+                        " threads";
+            sync_stats_t stats;
+            decode_file("text.spm", "text.out", n_threads, speculative, stats);
+            CHECK(read_bytes("text.out") == text, what);
+            CHECK(stats.n_blocks > 0 || !speculative || n_threads == 1, what + ": blocks decoded speculatively");
+        }
+
+    // the streaming reader, read to the end in odd-sized pieces, or dropped halfway with blocks in flight
+    for (size_t ahead: {1, 2, 8}) {
+        ArchiveReader reader("text.spm", ahead);
+        CHECK(reader.size() == text.size(), "reader size");
+        string out;
+        vector<char> buf(7919);
+        for (size_t n; (n = reader.read(buf.data(), buf.size())) > 0;) out.append(buf.data(), n);
+        CHECK(out == text && reader.tell() == text.size(), to_string(ahead) + " blocks ahead: reader round trip");
+    }
+    {
+        ArchiveReader reader("text.spm", 4);
+        vector<char> buf(TEST_BLOCK_SIZE);
+        reader.read(buf.data(), buf.size());
+        CHECK(reader.tell() == buf.size(), "reader dropped after one read");
+    }
+
+    auto index = parse_archive(bytes.data(), bytes.size());
+    auto &entry = index.entries.back();
+    auto damaged = bytes;
+    damaged[entry.comp_offset] ^= 0x10;
+    write_bytes("damaged.spm", (const char *) damaged.data(), damaged.size());
+    auto caught = false;
+    try {
+        ArchiveReader reader("damaged.spm", 2);
+        vector<char> buf(7919);
+        while (reader.read(buf.data(), buf.size()) > 0);
+    } catch (const runtime_error &) {
+        caught = true;
+    }
+    CHECK(caught, "reader rethrows the error of a damaged block");
+}
+
+/* appends that keep the table, then one that switches it; random access across the switch */
+static void test_append() {
+    auto text = make_text(200000, 12);
+    auto grown = text + make_text(50000, 13);
+    auto switched = grown + make_runs(100000, 14);
+    auto options = test_options();
+    append_result_t result;
+
+    write_bytes("log.txt", text.data(), text.size());
+    append_file("log.spm", "log.txt", 2, APPEND_MAX_DIVERGENCE, options, result);
+    CHECK(result.new_bytes == text.size() && result.n_tables == 1, "first append");
+    write_bytes("log.txt", grown.data(), grown.size());
+    append_file("log.spm", "log.txt", 2, APPEND_MAX_DIVERGENCE, options, result);
+    CHECK(!result.new_table && result.n_tables == 1, "similar bytes keep the table");
+    write_bytes("log.txt", switched.data(), switched.size());
+    append_file("log.spm", "log.txt", 2, APPEND_MAX_DIVERGENCE, options, result);
+    CHECK(result.new_table && result.n_tables == 2, "different bytes switch the table");
+    CHECK(append_file("log.spm", "log.txt", 2, APPEND_MAX_DIVERGENCE, options, result) == 0, "nothing new");
+
+    for (auto speculative: {false, true}) {
+        sync_stats_t stats;
+        decode_file("log.spm", "log.out", 2, speculative, stats);
+        CHECK(read_bytes("log.out") == switched, string("appended archive round trip") +
+                                                 (speculative ? ", speculative" : ""));
+    }
+    bool from_trailer;
+    freq_table_t expected{};
+    count_symbols(switched.data(), switched.size(), expected);
+    CHECK(count_file("log.spm", 2, false, from_trailer) == expected && !from_trailer,
+          "appended archive counted block by block");
+    string out;
+    extract_file("log.spm", grown.size() - 5000, 10000, out);
+    CHECK(out == switched.substr(grown.size() - 5000, 10000), "extract across the table switch");
+
+    write_bytes("short.txt", text.data(), 1000);
+    auto refused = false;
+    try {
+        append_file("log.spm", "short.txt", 2, APPEND_MAX_DIVERGENCE, options, result);
+    } catch (const runtime_error &) {
+        refused = true;
+    }
+    CHECK(refused, "input shorter than the archive refused");
+}
+
+/* runs body with target (stdin or stdout) redirected to fd, which it closes */
+static void redirected(int target, int fd, const function<void()> &body) {
+    cout.flush();
+    int saved = dup(target);
+    dup2(fd, target);
+    close(fd);
+    try {
+        body();
+    } catch (...) {
+        dup2(saved, target);
+        close(saved);
+        throw;
+    }
+    dup2(saved, target);
+    close(saved);
+}
+
+/* one-pass compression, to a file the header is rewritten in and to an output that cannot be seeked */
+static void test_pipe() {
+    // one segment of text, one of runs (its own table), and a partial one of text again
+    auto segment = PIPE_SEGMENT_BLOCKS * TEST_BLOCK_SIZE;
+    auto input = make_text(segment, 15) + make_runs(segment, 16) + make_text(segment / 3, 17);
+    write_bytes("pipe.txt", input.data(), input.size());
+    auto options = test_options();
+    pipe_result_t result;
+
+    compress_pipe("pipe.txt", "pipe.spm", 2, APPEND_MAX_DIVERGENCE, options, result);
+    CHECK(!result.streamed && result.raw_size == input.size(), "seekable output");
+    CHECK(result.n_segments > 1 && result.n_tables > 1, "segments switch tables");
+    sync_stats_t stats;
+    decode_file("pipe.spm", "pipe.out", 2, false, stats);
+    CHECK(read_bytes("pipe.out") == input, "piped archive round trip");
+
+    // stdin as the input
+    redirected(STDIN_FILENO, open("pipe.txt", O_RDONLY), [&]() {
+        compress_pipe("-", "stdin.spm", 2, APPEND_MAX_DIVERGENCE, options, result);
+    });
+    CHECK(result.raw_size == input.size() && read_bytes("stdin.spm") == read_bytes("pipe.spm"),
+          "stdin compressed like the file");
+
+    // stdout appending to a file: writes only, the header cannot be rewritten
+    redirected(STDOUT_FILENO, open("streamed.spm", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644), [&]() {
+        compress_pipe("pipe.txt", "-", 2, APPEND_MAX_DIVERGENCE, options, result);
+    });
+    CHECK(result.streamed && result.n_tables > 1, "non-seekable output is streamed");
+    auto streamed = read_bytes("streamed.spm");
+    auto index = parse_archive((const unsigned char *) streamed.data(), streamed.size());
+    CHECK(index.streamed && index.raw_size == input.size(), "streamed archive holds its size in the trailer");
+    decode_file("streamed.spm", "streamed.out", 2, true, stats);
+    CHECK(read_bytes("streamed.out") == input, "streamed archive round trip");
+    ArchiveReader reader("streamed.spm", 2);
+    string out;
+    vector<char> buf(7919);
+    for (size_t n; (n = reader.read(buf.data(), buf.size())) > 0;) out.append(buf.data(), n);
+    CHECK(out == input, "streamed archive read through the reader");
+}
+
+static uint64_t count_matches(const string &text, const string &pattern) {
+    uint64_t n = 0;
+    for (auto p = text.find(pattern); p != string::npos; p = text.find(pattern, p + 1)) n++;
+    return n;
+}
+
+/* counts and searches on the compressed archive against the plain text, at code boundaries or decoded */
+static void test_query() {
+    // the last part has bytes past 0x7f in coded blocks, for patterns whose symbols would be negative as char
+    auto accented = make_text(100000, 21);
+    for (auto &c: accented)
+        if (c == 'e') c = '\xe9';
+    auto text = make_text(300000, 19) + make_random(20000, 20) + accented;
+    freq_table_t expected{};
+    count_symbols(text.data(), text.size(), expected);
+    vector<string> patterns = {"x", "func", "the archive", "0x22 in\n", "return return", "zzz", string(1, '\0'),
+                               "\xe9", "r\xe9t", "\xe9\xe9"};
+
+    vector<pair<string, run_options_t>> layouts;
+    layouts.emplace_back("default", test_options());
+    auto options = test_options();
+    options.n_streams = 4;
+    layouts.emplace_back("4 streams", options);
+    options = test_options();
+    options.coder = CODER_ANS;
+    layouts.emplace_back("tANS", options);
+    for (auto &layout: layouts) {
+        auto bytes = compress_bytes(text, layout.second);
+        write_bytes("query.spm", (const char *) bytes.data(), bytes.size());
+        bool from_trailer;
+        CHECK(count_file("query.spm", 2, false, from_trailer) == expected && from_trailer,
+              layout.first + ": counts from the trailer");
+        CHECK(count_file("query.spm", 3, true, from_trailer) == expected && !from_trailer,
+              layout.first + ": counts from a scan");
+
+        for (auto &pattern: patterns) {
+            auto what = layout.first + ", '" + pattern + "'";
+            auto result = search_file("query.spm", pattern, 3, 1000000);
+            auto n = count_matches(text, pattern);
+            CHECK(result.n_matches == n, what + ": " + to_string(result.n_matches) + " matches, " + to_string(n) +
+                                         " expected");
+            CHECK(result.offsets.size() == n && (n == 0 || text.compare(result.offsets.back(), pattern.size(),
+                                                                        pattern) == 0), what + " offsets");
+        }
+    }
+}
+
+/* forks n_ranks processes running rank(r); true if all of them exit with 0 */
+static bool run_ranks(size_t n_ranks, const function<bool(size_t)> &rank) {
+    cout.flush();
+    vector<pid_t> pids;
+    for (size_t r = 0; r < n_ranks; r++) {
+        auto pid = fork();
+        if (pid < 0) throw runtime_error("Could not fork");
+        if (pid == 0) {
+            auto ok = false;
+            try {
+                ok = rank(r);
+            } catch (const exception &e) {
+                cout << "rank " << r << ": " << e.what() << endl;
+            }
+            cout.flush();
+            _exit(ok ? 0 : 1);
+        }
+        pids.push_back(pid);
+    }
+    auto ok = true;
+    for (auto pid: pids) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return ok;
+}
+
+/* rounds of sums of different lengths, and all-gathers where every rank fills only its own slots */
+static bool all_reduce_rounds(Communicator &comm) {
+    auto ok = true;
+    for (uint64_t round = 0; round < 5; round++) {
+        vector<uint64_t> values(10 + 20 * round);
+        for (uint64_t i = 0; i < values.size(); i++) values[i] = comm.rank() * 1000 + i + round;
+        comm.all_reduce(values);
+        auto n = (uint64_t) comm.size();
+        for (uint64_t i = 0; i < values.size(); i++) ok = ok && values[i] == 1000 * n * (n - 1) / 2 + n * (i + round);
+
+        vector<uint64_t> gathered(comm.size());
+        gathered[comm.rank()] = comm.rank() + round;
+        comm.all_reduce(gathered);
+        for (uint64_t r = 0; r < gathered.size(); r++) ok = ok && gathered[r] == r + round;
+        comm.barrier();
+    }
+    return ok;
+}
+
+/* the histogram all-reduce over shared memory and TCP, and whole distributed runs on both */
+static void test_distributed() {
+    for (size_t n_ranks: {1, 2, 4}) {
+        size_t region_size;
+        auto region = ShmCommunicator::create_region(n_ranks, 256, region_size);
+        CHECK(run_ranks(n_ranks, [&](size_t r) {
+            ShmCommunicator comm(r, n_ranks, region, region_size);
+            return all_reduce_rounds(comm);
+        }), "shm all-reduce, " + to_string(n_ranks) + " ranks");
+        ShmCommunicator::destroy_region(region, region_size);
+
+        unsigned port = 0;
+        auto listen_fd = TcpCommunicator::listen_on("127.0.0.1", port);
+        CHECK(run_ranks(n_ranks, [&](size_t r) {
+            if (r != 0) close(listen_fd);
+            TcpCommunicator comm(r, n_ranks, "127.0.0.1", port, r == 0 ? listen_fd : -1);
+            return all_reduce_rounds(comm);
+        }), "tcp all-reduce, " + to_string(n_ranks) + " ranks");
+        close(listen_fd);
+    }
+
+    // more ranks than blocks leaves some ranks with nothing to encode
+    vector<pair<string, string>> inputs = {{"text", make_text(300000, 13)}, {"one block", make_text(1000, 14)},
+                                           {"empty", ""}};
+    for (auto &input: inputs) {
+        write_bytes("input.txt", input.second.data(), input.second.size());
+        for (string transport: {"shm", "tcp"}) {
+            auto what = input.first + ", " + transport;
+            CHECK(run_distributed_local("input.txt", 3, 2, transport, test_options()) == 0, what + ": ranks succeed");
+            auto archive = read_bytes(OUTPUT_FILE);
+            string out;
+            try {
+                out = decompress_bytes(bytes_t(archive.begin(), archive.end()));
+            } catch (const exception &e) {
+                CHECK(false, what + ": " + e.what());
+                continue;
+            }
+            CHECK(out == input.second, what + ": round trip");
+        }
+    }
+}
+
+/* the dry run predicts the archive the encoder writes, byte for byte with Huffman blocks */
+static void test_estimate() {
+    vector<run_options_t> option_sets(5);
+    for (auto &options: option_sets) options.block_size = TEST_BLOCK_SIZE;
+    option_sets[1].store_mode = STORE_GLOBAL;
+    option_sets[2].store_mode = STORE_OFF;
+    option_sets[3].checkpoint_interval = 1000;
+    option_sets[4].n_streams = 4;
+    option_sets[4].block_size = 64 * 1024;
+    for (auto &input: test_inputs()) {
+        auto &seq = input.second;
+        freq_table_t counts{};
+        for (auto c: seq) counts[(unsigned char) c]++;
+        auto estimate = estimate_compression(seq, from_freq_table(counts), option_sets[0]);
+        CHECK(estimate.n_symbols == seq.size(), input.first + ": symbols counted");
+        for (size_t o = 0; o < option_sets.size(); o++) {
+            auto sized = estimate_compression(seq, from_freq_table(counts), option_sets[o], 3);
+            auto bytes = compress_bytes(seq, option_sets[o]);
+            auto index = parse_archive(bytes.data(), bytes.size());
+            uint64_t n_stored = 0;
+            for (auto &entry: index.entries) n_stored += entry.kind == BLOCK_STORED;
+            CHECK(sized.output_bytes == bytes.size() && sized.n_blocks == index.entries.size() &&
+                  sized.n_stored == n_stored,
+                  input.first + ", options " + to_string(o) + ": " + to_string(sized.output_bytes) + " bytes and " +
+                  to_string(sized.n_stored) + " stored estimated, " + to_string(bytes.size()) + " and " +
+                  to_string(n_stored) + " written");
+        }
+
+        auto tree = generate_huffman_tree(from_freq_table(counts));
+        auto codes = generate_huffman_codes(tree);
+        auto table = make_code_table(codes);
+        free_codes(codes);
+        free_tree(tree);
+        auto bits = encoded_bits(seq.data(), seq.size(), table);
+        CHECK(estimate.coded_bits == bits || estimate.alphabet == 1,
+              input.first + ": " + to_string(estimate.coded_bits) + " bits estimated, " + to_string(bits) +
+              " encoded");
+        CHECK(input.first != "random" || estimate.n_stored == estimate.n_blocks, "random: estimated as stored");
+        CHECK(input.first != "text" || estimate.n_stored == 0, "text: estimated as coded");
+        CHECK(input.first != "text then random" || (estimate.n_stored > 0 && estimate.n_stored < estimate.n_blocks),
+              "text then random: only the random blocks estimated as stored");
+        auto avg_len = seq.empty() ? 0 : (double) estimate.coded_bits / (double) seq.size();
+        CHECK(seq.empty() || (avg_len >= estimate.entropy - 1e-9 && avg_len <= estimate.entropy + 1),
+              input.first + ": average code length within one bit of the entropy");
+    }
+}
+
+/* comma-separated fields of a line */
+static vector<string> csv_fields(const string &line) {
+    vector<string> fields(1);
+    for (auto c: line)
+        if (c == ',') fields.emplace_back();
+        else fields.back() += c;
+    return fields;
+}
+
+/* benchmark.csv rows under the current header; a file with other columns is moved aside first */
+static void test_benchmark() {
+    string old = "n_mappers,time_total\n4,1000\n";
+    write_bytes(BENCHMARK_FILE, old.data(), old.size());
+    write_benchmark(1, 2, 3, 4, 5, 2, 1, 2, "test", 3, 1, 1000, 6);
+    write_benchmark(1, 2, 3, 4, 5, 2, 1, 2, "test", 3, 1, 1000, 6);
+    CHECK(read_bytes(string(BENCHMARK_FILE) + ".1") == old, "old file moved aside");
+
+    ifstream file(BENCHMARK_FILE);
+    vector<string> lines;
+    for (string line; getline(file, line);) lines.push_back(line);
+    CHECK(lines.size() == 3 && lines[0] + "\n" == BENCHMARK_HEADER, "new file with the header and both rows");
+    if (lines.size() != 3) return;
+    auto header = csv_fields(lines[0]), row = csv_fields(lines[1]);
+    CHECK(row.size() == header.size(), to_string(row.size()) + " fields under " + to_string(header.size()) +
+                                       " columns");
+    for (size_t i = 0; i < min(row.size(), header.size()); i++) {
+        if (header[i] == "type") CHECK(row[i] == "test", "type column");
+        if (header[i] == "time_reduce") CHECK(row[i] == "6", "time_reduce column");
+        if (header[i] == "n_stored_blocks") CHECK(row[i] == "1", "n_stored_blocks column");
+        if (header[i] == "allocs" || header[i] == "peak_bytes")
+#ifdef SPM_ALLOC_STATS
+            CHECK(!row[i].empty() && row[i].find_first_not_of("0123456789") == string::npos, header[i] + " counted");
+#else
+            CHECK(row[i].empty(), header[i] + " left empty when not counted");
+#endif
+    }
+
+    write_benchmark(1, 2, 3, 4, 5, 2, 1, 2, "test");
+    CHECK(!filesystem::exists(string(BENCHMARK_FILE) + ".2"), "current header appended to");
+}
+
+/* a client connection to the server under test */
+struct test_client_t {
+    int fd = -1;
+
+    bool connect_to(const string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0) return true;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        return false;
+    }
+
+    /* sends one request; false if the server hung up */
+    bool call(uint8_t op, const string &payload, uint8_t &status, bytes_t &response) {
+        return send_message(fd, op, payload.data(), payload.size()) && recv_message(fd, status, response);
+    }
+
+    ~test_client_t() {
+        if (fd >= 0) close(fd);
+    }
+};
+
+/* a field of /proc/<pid>/status (the kB of VmSize, ...); 0 if it cannot be read */
+static uint64_t proc_status(pid_t pid, const string &field) {
+    ifstream status("/proc/" + to_string(pid) + "/status");
+    string key;
+    uint64_t value = 0;
+    while (status >> key)
+        if (key == field + ":" && status >> value) return value;
+    return 0;
+}
+
+/* thread stacks mapped by a process: the one-page PROT_NONE guards below them, from /proc */
+static unsigned thread_stacks(pid_t pid) {
+    ifstream maps("/proc/" + to_string(pid) + "/maps");
+    unsigned n = 0;
+    for (string line; getline(maps, line);) {
+        uint64_t begin, end;
+        char perms[5] = {};
+        if (sscanf(line.c_str(), "%lx-%lx %4s", &begin, &end, perms) == 3 && end - begin == 4096 &&
+            strcmp(perms, "---p") == 0)
+            n++;
+    }
+    return n;
+}
+
+/* spm_project serve, started from the binary given on the command line: round trips, errors, stats, shutdown */
+static void test_server() {
+    if (group_args.empty()) throw runtime_error("usage: spm_tests server <spm_project>");
+    const string socket_path = "server.sock";
+    auto pid = fork();
+    if (pid < 0) throw runtime_error("Could not fork");
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(group_args[0].c_str(), group_args[0].c_str(), "serve", socket_path.c_str(), "2", "2", "map",
+              (char *) nullptr);
+        _exit(127);
+    }
+
+    test_client_t client;
+    for (int attempt = 0; attempt < 500 && !client.connect_to(socket_path); attempt++) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) throw runtime_error("The server exited before listening");
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    if (client.fd < 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        throw runtime_error("Could not connect to the server");
+    }
+
+    uint8_t status;
+    bytes_t compressed, decompressed;
+    for (auto &input: test_inputs()) {
+        if (!client.call(OP_COMPRESS, input.second, status, compressed)) {
+            CHECK(false, input.first + ": server hung up on compress");
+            break;
+        }
+        CHECK(status == STATUS_OK, input.first + ": compressed");
+        string archive(compressed.begin(), compressed.end());
+        CHECK(decompress_bytes(compressed) == input.second, input.first + ": server archive decodes locally");
+        if (!client.call(OP_DECOMPRESS, archive, status, decompressed)) {
+            CHECK(false, input.first + ": server hung up on decompress");
+            break;
+        }
+        CHECK(status == STATUS_OK && string(decompressed.begin(), decompressed.end()) == input.second,
+              input.first + ": server round trip");
+    }
+
+    CHECK(client.call(OP_DECOMPRESS, "not an archive", status, decompressed) && status == STATUS_ERROR,
+          "bad archive answered with an error");
+    // a block that fails its checksum throws on a pool worker: the request fails, the daemon does not
+    auto text = make_text(200000, 29);
+    auto damaged = compress_bytes(text, test_options());
+    auto index = parse_archive(damaged.data(), damaged.size());
+    damaged[index.entries[index.entries.size() / 2].comp_offset] ^= 0x10;
+    CHECK(client.call(OP_DECOMPRESS, string(damaged.begin(), damaged.end()), status, decompressed) &&
+          status == STATUS_ERROR, "damaged block of " + to_string(index.entries.size()) + " answered with an error");
+    CHECK(client.call(OP_COMPRESS, text, status, compressed) && status == STATUS_OK &&
+          decompress_bytes(compressed) == text, "server still compresses after the damaged archive");
+    CHECK(client.call(OP_STATS, "", status, decompressed) && status == STATUS_OK &&
+          string(decompressed.begin(), decompressed.end()).find("\"errors\":2") != string::npos,
+          "stats count the errors");
+
+    // request after request, the server does not keep what it allocated for the previous ones (with the arena
+    // allocator, nothing is freed before arena_release)
+    auto big = make_text(2 << 20, 28);
+    uint64_t vm_first = 0;
+    for (int k = 0; k < 40; k++) {
+        if (!client.call(OP_COMPRESS, big, status, compressed) || status != STATUS_OK) {
+            CHECK(false, "request " + to_string(k) + " of 40");
+            break;
+        }
+        if (k == 0) vm_first = proc_status(pid, "VmSize");
+    }
+    auto vm_last = proc_status(pid, "VmSize");
+    CHECK(vm_last < vm_first + 48 * 1024, "server VmSize " + to_string(vm_first) + " kB after one request, " +
+                                          to_string(vm_last) + " kB after 40");
+
+    // connections come and go: the handlers of closed ones are joined, so their stacks are unmapped instead of
+    // piling up, one per connection ever made (a few stay cached by the thread library)
+    auto stacks_before = thread_stacks(pid);
+    for (int k = 0; k < 50; k++) {
+        test_client_t passing;
+        CHECK(passing.connect_to(socket_path) && passing.call(OP_STATS, "", status, decompressed),
+              "connection " + to_string(k));
+    }
+    test_client_t probe;
+    CHECK(probe.connect_to(socket_path) && probe.call(OP_STATS, "", status, decompressed), "probe connection");
+    auto stacks_after = thread_stacks(pid);
+    CHECK(stacks_after < stacks_before + 20, to_string(stacks_before) + " thread stacks mapped before 50 " +
+                                              "connections, " + to_string(stacks_after) + " after");
+
+    CHECK(client.call(OP_SHUTDOWN, "", status, decompressed) && status == STATUS_OK, "shutdown acknowledged");
+
+    int wstatus = 0;
+    waitpid(pid, &wstatus, 0);
+    CHECK(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0, "server exits cleanly");
+}
+
+int main(int argc, char *argv[]) {
+    const map<string, function<void()>> groups = {
+            {"pool",        test_pool},
+            {"alloc",       test_alloc},
+            {"format",      test_format},
+            {"ans",         test_ans},
+            {"crc",         test_crc},
+            {"corrupt",     test_corrupt},
+            {"read",        test_read},
+            {"kernels",     test_kernels},
+            {"words",       test_words},
+            {"decode",      test_decode},
+            {"append",      test_append},
+            {"pipe",        test_pipe},
+            {"query",       test_query},
+            {"distributed", test_distributed},
+            {"estimate",    test_estimate},
+            {"benchmark",   test_benchmark},
+            {"server",      test_server},
+    };
+    if (argc < 2 || !groups.count(argv[1])) {
+        cout << "Usage: " << argv[0] << " <group> [args], one of:";
+        for (auto &group: groups) cout << " " << group.first;
+        cout << endl;
+        return 2;
+    }
+    for (int i = 2; i < argc; i++) group_args.push_back(filesystem::absolute(argv[i]).string());
+
+    char scratch[] = "/tmp/spm-tests-XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        cout << "Could not create a scratch directory" << endl;
+        return 2;
+    }
+    auto cwd = filesystem::current_path();
+    filesystem::current_path(scratch);
+    try {
+        groups.at(argv[1])();
+    } catch (const exception &e) {
+        CHECK(false, string("uncaught exception: ") + e.what());
+    }
+    filesystem::current_path(cwd);
+    filesystem::remove_all(scratch);
+
+    cout << argv[1] << ": " << n_checks - n_failed << "/" << n_checks << " checks passed" << endl;
+    return n_failed == 0 ? 0 : 1;
+}
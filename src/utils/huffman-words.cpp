@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "huffman-words.h"
+#include "huffman-kernels.h"
+
+using namespace std;
+
+static void put_varint(bytes_t &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((unsigned char) (v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char) v);
+}
+
+static uint64_t get_varint(const unsigned char *data, size_t size, size_t &pos) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= size) throw runtime_error("Corrupted dictionary: unexpected end of data");
+        auto b = data[pos++];
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    throw runtime_error("Corrupted dictionary: bad varint");
+}
+
+/* the len low bits of code, in reverse order: canonical codes go out MSB first, packed codes LSB first */
+static uint64_t reverse_bits(uint64_t code, unsigned len) {
+    uint64_t reversed = 0;
+    for (unsigned i = 0; i < len; i++) reversed |= ((code >> i) & 1) << (len - 1 - i);
+    return reversed;
+}
+
+/**
+ * First token boundary at or after pos: the start of a run of word or non-word bytes.
+ * Ranges split there tokenize exactly as the whole input would.
+ */
+size_t token_boundary(const char *data, size_t size, size_t pos) {
+    while (pos > 0 && pos < size && is_word_byte(data[pos]) == is_word_byte(data[pos - 1])) pos++;
+    return min(pos, size);
+}
+
+/**
+ * Optimal code lengths, in place (Moffat and Katajainen, "In-place calculation of minimum-redundancy
+ * codes"): linear after the sort, with no tree and no priority queue.
+ * @param symbols sorted by increasing count; their len is set.
+ */
+void code_lengths(vector<word_symbol_t> &symbols) {
+    auto n = (long) symbols.size();
+    if (n == 0) return;
+    if (n == 1) {
+        symbols[0].len = 1;
+        return;
+    }
+
+    vector<uint64_t> a(n);
+    for (long i = 0; i < n; i++) a[i] = symbols[i].count;
+
+    // phase 1: the weights of the internal nodes, leaves consumed from the front
+    long leaf = 2, root = 0;
+    a[0] += a[1];
+    for (long next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else a[next] = a[leaf++];
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else a[next] += a[leaf++];
+    }
+
+    // phase 2: depths of the internal nodes, from the parent pointers
+    a[n - 2] = 0;
+    for (long next = n - 3; next >= 0; next--) a[next] = a[a[next]] + 1;
+
+    // phase 3: depths of the leaves
+    long avbl = 1, used = 0, depth = 0, next = n - 1;
+    root = n - 2;
+    while (avbl > 0) {
+        while (root >= 0 && (long) a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (avbl > used) {
+            a[next--] = depth;
+            avbl--;
+        }
+        avbl = 2 * used;
+        depth++;
+        used = 0;
+    }
+
+    for (long i = 0; i < n; i++) {
+        if (a[i] > 64) throw runtime_error("Word code longer than 64 bits");
+        symbols[i].len = (uint8_t) a[i];
+    }
+}
+
+/**
+ * Assigns canonical codes.
+ * @param symbols in canonical order: by code length, then by token.
+ * @param codes filled with the packed code of every symbol, by index.
+ */
+void canonical_codes(const vector<word_symbol_t> &symbols, vector<packed_code_t> &codes) {
+    codes.resize(symbols.size());
+    uint64_t code = 0;
+    unsigned len = symbols.empty() ? 0 : symbols[0].len;
+    for (size_t i = 0; i < symbols.size(); i++) {
+        // moving to longer codes appends zeros to the next free code
+        code <<= symbols[i].len - len;
+        len = symbols[i].len;
+        codes[i] = {reverse_bits(code, len), (uint8_t) len};
+        code++;
+    }
+}
+
+/**
+ * Appends the dictionary of a word archive.
+ * @param symbols in canonical order, with their code lengths.
+ */
+void serialize_dictionary(const vector<word_symbol_t> &symbols, bytes_t &out) {
+    unsigned max_len = 0;
+    for (auto &s: symbols) max_len = max<unsigned>(max_len, s.len);
+    vector<uint64_t> n_codes(max_len + 1, 0);
+    for (auto &s: symbols) n_codes[s.len]++;
+
+    put_varint(out, symbols.size());
+    out.push_back((unsigned char) max_len);
+    for (unsigned len = 1; len <= max_len; len++) put_varint(out, n_codes[len]);
+
+    string_view prev;
+    for (auto &s: symbols) {
+        size_t shared = 0;
+        while (shared < prev.size() && shared < s.token.size() && prev[shared] == s.token[shared]) shared++;
+        put_varint(out, shared);
+        put_varint(out, s.token.size() - shared);
+        out.insert(out.end(), s.token.begin() + (long) shared, s.token.end());
+        prev = s.token;
+    }
+}
+
+/**
+ * Rebuilds tokens and canonical decoding tables from a serialized dictionary.
+ */
+word_decoder_t parse_dictionary(const unsigned char *data, size_t size) {
+    word_decoder_t decoder;
+    size_t pos = 0;
+    auto n_symbols = get_varint(data, size, pos);
+    if (pos >= size) throw runtime_error("Corrupted dictionary: unexpected end of data");
+    unsigned max_len = data[pos++];
+    if (max_len > 64 || (n_symbols > 0 && max_len == 0)) throw runtime_error("Corrupted dictionary: bad code lengths");
+
+    decoder.n_codes.assign(max_len + 1, 0);
+    decoder.first_code.assign(max_len + 1, 0);
+    decoder.first_symbol.assign(max_len + 1, 0);
+    uint64_t code = 0, symbol = 0;
+    for (unsigned len = 1; len <= max_len; len++) {
+        decoder.n_codes[len] = get_varint(data, size, pos);
+        decoder.first_code[len] = code;
+        decoder.first_symbol[len] = symbol;
+        symbol += decoder.n_codes[len];
+        // more codes than a prefix code of this length can hold
+        if (len < 64 && decoder.n_codes[len] > (1ULL << len) - code)
+            throw runtime_error("Corrupted dictionary: oversubscribed code lengths");
+        code = (code + decoder.n_codes[len]) << 1;
+    }
+    if (symbol != n_symbols) throw runtime_error("Corrupted dictionary: bad symbol count");
+
+    decoder.offsets.reserve(n_symbols + 1);
+    decoder.offsets.push_back(0);
+    size_t prev = 0;
+    for (uint64_t i = 0; i < n_symbols; i++) {
+        auto shared = get_varint(data, size, pos);
+        auto suffix = get_varint(data, size, pos);
+        if (shared > decoder.text.size() - prev || suffix > size - pos || shared + suffix > MAX_TOKEN_LEN)
+            throw runtime_error("Corrupted dictionary: bad token");
+        auto start = decoder.text.size();
+        for (size_t k = 0; k < shared; k++) decoder.text.push_back(decoder.text[prev + k]);
+        decoder.text.insert(decoder.text.end(), data + pos, data + pos + suffix);
+        pos += suffix;
+        prev = start;
+        decoder.offsets.push_back((uint32_t) decoder.text.size());
+    }
+
+    // one lookup for the short codes (symbol indexes above 2^26 take the bit-serial path)
+    decoder.table.assign(1UL << WORD_TABLE_BITS, 0);
+    for (unsigned len = 1; len <= min<unsigned>(max_len, WORD_TABLE_BITS); len++)
+        for (uint64_t k = 0; k < decoder.n_codes[len]; k++) {
+            auto s = decoder.first_symbol[len] + k;
+            if (s >= 1ULL << 26) break;
+            auto bits = reverse_bits(decoder.first_code[len] + k, len);
+            for (uint64_t high = 0; high < 1ULL << (WORD_TABLE_BITS - len); high++)
+                decoder.table[bits | high << len] = (uint32_t) (s << 6 | len);
+        }
+    return decoder;
+}
+
+/**
+ * Decodes the tokens of a block until n_out bytes are produced (the last token may be cut).
+ * @param data the encoded bytes.
+ * @param n_bits the number of meaningful bits.
+ * @param decoder the dictionary of the archive.
+ * @param out destination buffer, at least n_out bytes.
+ * @param n_out the number of bytes to produce.
+ * @return the bits consumed.
+ */
+uint64_t decode_words(const unsigned char *data, uint64_t n_bits, const word_decoder_t &decoder, char *out,
+                      size_t n_out) {
+    auto n_bytes = (n_bits + 7) / 8;
+    auto max_len = decoder.n_codes.size() - 1;
+    uint64_t pos = 0;
+    size_t written = 0;
+    while (written < n_out) {
+        if (pos >= n_bits) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+        uint64_t symbol;
+        auto entry = decoder.table[peek_bits(data, n_bytes, pos) & ((1UL << WORD_TABLE_BITS) - 1)];
+        if (entry != 0) {
+            symbol = entry >> 6;
+            pos += entry & 63;
+        } else {
+            // canonical decoding, a bit at a time: codes of each length are consecutive
+            uint64_t code = 0;
+            for (size_t len = 1;; len++) {
+                if (len > max_len || pos >= n_bits) throw runtime_error("Corrupted archive: bad word code");
+                code = code << 1 | ((data[pos >> 3] >> (pos & 7)) & 1);
+                pos++;
+                if (code - decoder.first_code[len] < decoder.n_codes[len]) {
+                    symbol = decoder.first_symbol[len] + (code - decoder.first_code[len]);
+                    break;
+                }
+            }
+        }
+        auto start = decoder.offsets[symbol];
+        auto n = min<size_t>(decoder.offsets[symbol + 1] - start, n_out - written);
+        memcpy(out + written, decoder.text.data() + start, n);
+        written += n;
+    }
+    if (pos > n_bits) throw runtime_error("Corrupted archive: block decoded to the wrong size");
+    return pos;
+}
@@ -0,0 +1,76 @@
+#ifndef SPM_PROJECT_HUFFMAN_WORDS_H
+#define SPM_PROJECT_HUFFMAN_WORDS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "huffman-format.h"
+
+/*
+ * Word-level Huffman: the symbols are tokens, not bytes.
+ * A token is a maximal run of word bytes (alphanumeric or >= 0x80) or of other bytes, cut every
+ * MAX_TOKEN_LEN bytes from the start of the run; concatenating the tokens gives back the input.
+ * Tokenization only depends on where runs start, so any range starting at a run boundary
+ * (token_boundary) tokenizes the same way whoever does it: mappers and blocks split there.
+ *
+ * Alphabets have millions of symbols, so there is no tree: code lengths come from the symbols
+ * sorted by count (in place, Moffat-Katajainen) and codes are canonical, which makes the lengths
+ * and the symbol order all the decoder needs. The dictionary, in the archive trailer, is
+ *   varint n_symbols | u8 max_len | varint count of every length 1..max_len |
+ *   tokens in canonical order (by length, then bytes), front coded: varint shared prefix with the
+ *   previous token | varint suffix length | suffix bytes
+ * Canonical codes are written MSB first, so a decoder can read them a bit at a time.
+ */
+
+#define MAX_TOKEN_LEN 32
+#define WORD_TABLE_BITS 12      // codes up to this length are decoded with one lookup
+
+using namespace std;
+
+/** A token of the alphabet, its count and (once codes are assigned) its code length. */
+struct word_symbol_t {
+    string_view token;
+    uint64_t count;
+    uint8_t len;
+    uint64_t *slot;     // the caller's lookup entry, set to the symbol index once the order is canonical
+};
+
+/** Parsed dictionary plus the tables of the canonical decoder. */
+struct word_decoder_t {
+    bytes_t text;                   // the tokens, concatenated in canonical order
+    vector<uint32_t> offsets;       // token i is text[offsets[i], offsets[i + 1])
+    vector<uint64_t> first_code;    // by length: first canonical code
+    vector<uint64_t> first_symbol;  // by length: index of its symbol
+    vector<uint64_t> n_codes;       // by length: number of codes
+    vector<uint32_t> table;         // next WORD_TABLE_BITS bits -> symbol << 6 | length, 0 for longer codes
+};
+
+inline bool is_word_byte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c >= 0x80;
+}
+
+/** End of the token starting at p (a token boundary), at most end. */
+inline size_t token_end(const char *data, size_t p, size_t end) {
+    auto word = is_word_byte(data[p]);
+    auto limit = min(end, p + MAX_TOKEN_LEN);
+    auto q = p + 1;
+    while (q < limit && is_word_byte(data[q]) == word) q++;
+    return q;
+}
+
+size_t token_boundary(const char *data, size_t size, size_t pos);
+
+void code_lengths(vector<word_symbol_t> &symbols);
+
+void canonical_codes(const vector<word_symbol_t> &symbols, vector<packed_code_t> &codes);
+
+void serialize_dictionary(const vector<word_symbol_t> &symbols, bytes_t &out);
+
+word_decoder_t parse_dictionary(const unsigned char *data, size_t size);
+
+uint64_t decode_words(const unsigned char *data, uint64_t n_bits, const word_decoder_t &decoder, char *out,
+                      size_t n_out);
+
+#endif //SPM_PROJECT_HUFFMAN_WORDS_H